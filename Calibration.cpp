@@ -27,6 +27,8 @@
 #include <opencv2/calib3d/calib3d.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include "calc.hpp"
+#include "pipelineStats.h"
+#include "traceEvents.h"
 
 //
 // A class to encapsulate the inputs and outputs of a corner-finding run, and to allow for copying of the results
@@ -39,7 +41,8 @@ Calibration::CalibrationCornerFinderData::CalibrationCornerFinderData(const Cali
     videoWidth(videoWidth_in),
     videoHeight(videoHeight_in),
     cornerFoundAllFlag(0),
-    corners()
+    corners(),
+    focalLengthConstraints()
 {
     init();
 }
@@ -51,7 +54,8 @@ Calibration::CalibrationCornerFinderData::CalibrationCornerFinderData(const Cali
     videoWidth(orig.videoWidth),
     videoHeight(orig.videoHeight),
     cornerFoundAllFlag(orig.cornerFoundAllFlag),
-    corners(orig.corners)
+    corners(orig.corners),
+    focalLengthConstraints(orig.focalLengthConstraints)
 {
     init();
     copy(orig);
@@ -68,6 +72,7 @@ const Calibration::CalibrationCornerFinderData& Calibration::CalibrationCornerFi
         videoHeight = orig.videoHeight;
         cornerFoundAllFlag = orig.cornerFoundAllFlag;
         corners = orig.corners;
+        focalLengthConstraints = orig.focalLengthConstraints;
         init();
         copy(orig);
     }
@@ -103,6 +108,24 @@ void Calibration::CalibrationCornerFinderData::dealloc()
 }
 
 
+//
+// Closed-form focal length constraints.
+//
+
+Calibration::FocalLengthConstraints& Calibration::FocalLengthConstraints::operator+=(const Calibration::FocalLengthConstraints& rhs)
+{
+    aa += rhs.aa; ab += rhs.ab; bb += rhs.bb; ac += rhs.ac; bc += rhs.bc;
+    views += rhs.views;
+    return *this;
+}
+
+Calibration::FocalLengthConstraints& Calibration::FocalLengthConstraints::operator-=(const Calibration::FocalLengthConstraints& rhs)
+{
+    aa -= rhs.aa; ab -= rhs.ab; bb -= rhs.bb; ac -= rhs.ac; bc -= rhs.bc;
+    views -= rhs.views;
+    return *this;
+}
+
 //
 // User-facing calibration functions.
 //
@@ -127,7 +150,9 @@ Calibration::Calibration(const CalibrationPatternType patternType, const int cal
     m_chessboardSquareWidth(chessboardSquareWidth),
     m_videoWidth(videoWidth),
     m_videoHeight(videoHeight),
-    m_corners()
+    m_corners(),
+    m_focalLengthConstraints(),
+    m_focalLengthConstraintsSum()
 {
     // Spawn the corner finder worker thread.
     m_cornerFinderThread = threadInit(0, (void *)(&m_cornerFinderData), cornerFinder);
@@ -137,6 +162,8 @@ Calibration::Calibration(const CalibrationPatternType patternType, const int cal
 
 bool Calibration::frame(ARVideoSource *vs)
 {
+    bool gotResults = false;
+    
     //
     // Start of main calibration-related cycle.
     //
@@ -146,9 +173,20 @@ bool Calibration::frame(ARVideoSource *vs)
         threadEndWait(m_cornerFinderThread); // We know from status above that worker has already finished, so this just resets it.
         
         // Copy the results.
+        TRACE_BEGIN("wait m_cornerFinderResultLock");
         pthread_mutex_lock(&m_cornerFinderResultLock); // Results are also read by GL thread, so need to lock before modifying.
+        TRACE_END("wait m_cornerFinderResultLock");
+        TRACE_BEGIN("copyResults");
         m_cornerFinderResultData = m_cornerFinderData;
+        m_cornerFinderResultGeneration++;
+        TRACE_END("copyResults");
+        
+        // Update the live focal length estimate from the captured images plus this detection.
+        FocalLengthConstraints constraints = m_focalLengthConstraintsSum;
+        if (m_cornerFinderResultData.cornerFoundAllFlag) constraints += m_cornerFinderResultData.focalLengthConstraints;
+        m_focalLengthEstimateValid = calcFocalLengthEstimate(constraints, m_videoWidth, m_videoHeight, &m_focalLengthEstimate[0], &m_focalLengthEstimate[1]);
         pthread_mutex_unlock(&m_cornerFinderResultLock);
+        gotResults = true;
     }
     
     // If corner finder worker thread is ready and waiting, submit the new image.
@@ -158,8 +196,10 @@ bool Calibration::frame(ARVideoSource *vs)
         // the backing for calibImage.
         AR2VideoBufferT *buff = vs->checkoutFrameIfNewerThan({0,0});
         if (buff) {
+            uint64_t copyStartTime = pipelineStatsTimeNow();
             memcpy(m_cornerFinderData.videoFrame, buff->buffLuma, vs->getVideoWidth()*vs->getVideoHeight());
             vs->checkinFrame();
+            pipelineStatsRecord(PIPELINE_STAGE_COPY, copyStartTime);
             
             // Kick off a new cycle of the cornerFinder. The results will be collected on a subsequent cycle.
             threadStartSignal(m_cornerFinderThread);
@@ -169,14 +209,17 @@ bool Calibration::frame(ARVideoSource *vs)
     //
     // End of main calibration-related cycle.
     //
-    return true;
+    return gotResults;
 }
 
-bool Calibration::cornerFinderResultsLockAndFetch(int *cornerFoundAllFlag, std::vector<cv::Point2f>& corners, ARUint8** videoFrame)
+bool Calibration::cornerFinderResultsLockAndFetch(int *cornerFoundAllFlag, std::vector<cv::Point2f>& corners, ARUint8** videoFrame, uint64_t *generation)
 {
+    TRACE_BEGIN("wait m_cornerFinderResultLock");
     pthread_mutex_lock(&m_cornerFinderResultLock);
+    TRACE_END("wait m_cornerFinderResultLock");
     *cornerFoundAllFlag = m_cornerFinderResultData.cornerFoundAllFlag;
-    corners = m_cornerFinderResultData.corners;
+    if (!generation || *generation != m_cornerFinderResultGeneration) corners = m_cornerFinderResultData.corners;
+    if (generation) *generation = m_cornerFinderResultGeneration;
     *videoFrame = m_cornerFinderResultData.videoFrame;
     return true;
 }
@@ -187,6 +230,20 @@ bool Calibration::cornerFinderResultsUnlock(void)
     return true;
 }
 
+bool Calibration::focalLengthEstimate(ARdouble *fx_out, ARdouble *fy_out)
+{
+    bool ret;
+    
+    pthread_mutex_lock(&m_cornerFinderResultLock);
+    ret = m_focalLengthEstimateValid;
+    if (ret) {
+        *fx_out = m_focalLengthEstimate[0];
+        *fy_out = m_focalLengthEstimate[1];
+    }
+    pthread_mutex_unlock(&m_cornerFinderResultLock);
+    return ret;
+}
+
 // Worker thread.
 // static
 void *Calibration::cornerFinder(THREAD_HANDLE_T *threadHandle)
@@ -196,21 +253,34 @@ void *Calibration::cornerFinder(THREAD_HANDLE_T *threadHandle)
 #endif
     
     CalibrationCornerFinderData *cornerFinderDataPtr = (CalibrationCornerFinderData *)threadGetArg(threadHandle);
+    TRACE_THREAD_NAME("cornerFinder");
     
     while (threadStartWait(threadHandle) == 0) {
         
+        TRACE_BEGIN("findCorners");
+        uint64_t detectStartTime = pipelineStatsTimeNow();
         switch (cornerFinderDataPtr->patternType) {
             case CalibrationPatternType::CHESSBOARD:
                 cornerFinderDataPtr->cornerFoundAllFlag = cv::findChessboardCorners(cv::cvarrToMat(cornerFinderDataPtr->calibImage), cornerFinderDataPtr->patternSize, cornerFinderDataPtr->corners, CV_CALIB_CB_FAST_CHECK|CV_CALIB_CB_ADAPTIVE_THRESH|CV_CALIB_CB_FILTER_QUADS);
+                pipelineStatsRecord(PIPELINE_STAGE_DETECT_CHESSBOARD, detectStartTime);
                 break;
             case CalibrationPatternType::CIRCLES_GRID:
                 cornerFinderDataPtr->cornerFoundAllFlag = cv::findCirclesGrid(cv::cvarrToMat(cornerFinderDataPtr->calibImage), cornerFinderDataPtr->patternSize, cornerFinderDataPtr->corners, cv::CALIB_CB_SYMMETRIC_GRID);
+                pipelineStatsRecord(PIPELINE_STAGE_DETECT_CIRCLES_GRID, detectStartTime);
                 break;
             case CalibrationPatternType::ASYMMETRIC_CIRCLES_GRID:
                 cornerFinderDataPtr->cornerFoundAllFlag = cv::findCirclesGrid(cv::cvarrToMat(cornerFinderDataPtr->calibImage), cornerFinderDataPtr->patternSize, cornerFinderDataPtr->corners, cv::CALIB_CB_ASYMMETRIC_GRID);
+                pipelineStatsRecord(PIPELINE_STAGE_DETECT_ASYMMETRIC_CIRCLES_GRID, detectStartTime);
                 break;
         }
+        TRACE_END("findCorners");
         ARLOGd("cornerFinderDataPtr->cornerFoundAllFlag=%d.\n", cornerFinderDataPtr->cornerFoundAllFlag);
+        
+        // Homography-based focal length constraints for the live estimate.
+        cornerFinderDataPtr->focalLengthConstraints = FocalLengthConstraints();
+        if (cornerFinderDataPtr->cornerFoundAllFlag) {
+            calcFocalLengthConstraints(cornerFinderDataPtr->patternType, cornerFinderDataPtr->patternSize, cornerFinderDataPtr->corners, cornerFinderDataPtr->videoWidth, cornerFinderDataPtr->videoHeight, &cornerFinderDataPtr->focalLengthConstraints);
+        }
         threadEndSignal(threadHandle);
     }
     
@@ -226,13 +296,24 @@ bool Calibration::capture()
    
     bool saved = false;
     
+    TRACE_BEGIN("wait m_cornerFinderResultLock");
     pthread_mutex_lock(&m_cornerFinderResultLock);
+    TRACE_END("wait m_cornerFinderResultLock");
     if (m_cornerFinderResultData.cornerFoundAllFlag) {
         // Refine the corner positions.
+        uint64_t subpixelStartTime = pipelineStatsTimeNow();
         cornerSubPix(cv::cvarrToMat(m_cornerFinderResultData.calibImage), m_cornerFinderResultData.corners, cv::Size(5,5), cvSize(-1,-1), cv::TermCriteria(CV_TERMCRIT_ITER, 100, 0.1));
+        pipelineStatsRecord(PIPELINE_STAGE_SUBPIXEL, subpixelStartTime);
+        m_cornerFinderResultGeneration++; // Refinement moved the displayed corners.
         
         // Save the corners.
         m_corners.push_back(m_cornerFinderResultData.corners);
+        
+        // Constraints from the refined corners become part of the running estimate.
+        FocalLengthConstraints constraints;
+        calcFocalLengthConstraints(m_patternType, m_patternSize, m_corners.back(), m_videoWidth, m_videoHeight, &constraints);
+        m_focalLengthConstraints.push_back(constraints);
+        m_focalLengthConstraintsSum += constraints;
         saved = true;
     }
     pthread_mutex_unlock(&m_cornerFinderResultLock);
@@ -253,6 +334,10 @@ bool Calibration::uncapture(void)
 {
     if (m_corners.size() <= 0) return false;
     m_corners.pop_back();
+    pthread_mutex_lock(&m_cornerFinderResultLock);
+    m_focalLengthConstraintsSum -= m_focalLengthConstraints.back();
+    m_focalLengthConstraints.pop_back();
+    pthread_mutex_unlock(&m_cornerFinderResultLock);
     return true;
 }
 
@@ -260,12 +345,24 @@ bool Calibration::uncaptureAll(void)
 {
     if (m_corners.size() <= 0) return false;
     m_corners.clear();
+    pthread_mutex_lock(&m_cornerFinderResultLock);
+    m_focalLengthConstraints.clear();
+    m_focalLengthConstraintsSum = FocalLengthConstraints();
+    pthread_mutex_unlock(&m_cornerFinderResultLock);
     return true;
 }
 
 void Calibration::calib(ARParam *param_out, ARdouble *err_min_out, ARdouble *err_avg_out, ARdouble *err_max_out)
 {
-    calc((int)m_corners.size(), m_patternType, m_patternSize, m_chessboardSquareWidth, m_corners, m_videoWidth, m_videoHeight, param_out, err_min_out, err_avg_out, err_max_out);
+    // Use the closed-form estimate from the captured images, if any, as the starting point for the solver.
+    ARdouble fx = 0.0, fy = 0.0;
+    pthread_mutex_lock(&m_cornerFinderResultLock);
+    if (!calcFocalLengthEstimate(m_focalLengthConstraintsSum, m_videoWidth, m_videoHeight, &fx, &fy)) fx = fy = 0.0;
+    pthread_mutex_unlock(&m_cornerFinderResultLock);
+    
+    uint64_t solveStartTime = pipelineStatsTimeNow();
+    calc((int)m_corners.size(), m_patternType, m_patternSize, m_chessboardSquareWidth, m_corners, m_videoWidth, m_videoHeight, fx, fy, param_out, err_min_out, err_avg_out, err_max_out);
+    pipelineStatsRecord(PIPELINE_STAGE_SOLVE, solveStartTime);
 }
 
 Calibration::~Calibration()
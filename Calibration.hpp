@@ -45,12 +45,31 @@ public:
     static std::map<CalibrationPatternType, cv::Size> CalibrationPatternSizes;
     static std::map<CalibrationPatternType, float> CalibrationPatternSpacings;
     
+    // Closed-form (Zhang) constraints on the focal length, accumulated from the homographies of successive views of
+    // the calibration pattern. Zero skew and a principal point at the image centre are assumed, so each view
+    // contributes two linear equations in (1/fx^2, 1/fy^2), which are summed into the 2x2 normal equations. Adding or
+    // removing a view is thus O(1).
+    class FocalLengthConstraints {
+    public:
+        double aa = 0.0, ab = 0.0, bb = 0.0, ac = 0.0, bc = 0.0;
+        int views = 0;
+        FocalLengthConstraints& operator+=(const FocalLengthConstraints& rhs);
+        FocalLengthConstraints& operator-=(const FocalLengthConstraints& rhs);
+    };
+    
     Calibration(const CalibrationPatternType patternType, const int calibImageCountMax, const cv::Size patternSize, const int chessboardSquareWidth, const int videoWidth, const int videoHeight);
     int calibImageCount() const {return (int)m_corners.size(); }
     int calibImageCountMax() const {return m_calibImageCountMax; }
+    // Collect any completed corner finder results and submit a new frame. Returns true if new results were collected.
     bool frame(ARVideoSource *vs);
-    bool cornerFinderResultsLockAndFetch(int *cornerFoundAllFlag, std::vector<cv::Point2f>& corners, ARUint8** videoFrame);
+    // Lock the corner finder results and fetch them. The results generation increments whenever the corners change.
+    // If generation is non-NULL, on entry it may hold the generation the caller last fetched, in which case the
+    // corners are not copied again if unchanged; on return it holds the current generation.
+    bool cornerFinderResultsLockAndFetch(int *cornerFoundAllFlag, std::vector<cv::Point2f>& corners, ARUint8** videoFrame, uint64_t *generation = NULL);
     bool cornerFinderResultsUnlock(void);
+    // Fetch the live focal length estimate (in pixels), built from the captured images plus the most recent
+    // detection. Returns false if no estimate is available yet.
+    bool focalLengthEstimate(ARdouble *fx_out, ARdouble *fy_out);
     bool capture();
     bool uncapture();
     bool uncaptureAll();
@@ -82,6 +101,7 @@ private:
         IplImage            *calibImage;
         int                  cornerFoundAllFlag;
         std::vector<cv::Point2f> corners;
+        FocalLengthConstraints focalLengthConstraints; // Valid only if views > 0.
     private:
         void init();
         void copy(const CalibrationCornerFinderData& orig);
@@ -92,8 +112,13 @@ private:
     THREAD_HANDLE_T     *m_cornerFinderThread = NULL;
     pthread_mutex_t      m_cornerFinderResultLock;
     CalibrationCornerFinderData m_cornerFinderResultData; // Corner finder results copy, for display to user.
+    uint64_t             m_cornerFinderResultGeneration = 0; // Incremented whenever m_cornerFinderResultData.corners changes. Protected by m_cornerFinderResultLock.
     
     std::vector<std::vector<cv::Point2f> > m_corners; // Collected corner information which gets passed to the OpenCV calibration function.
+    std::vector<FocalLengthConstraints> m_focalLengthConstraints; // Per-image constraints, parallel to m_corners.
+    FocalLengthConstraints m_focalLengthConstraintsSum; // Sum of m_focalLengthConstraints. Protected by m_cornerFinderResultLock.
+    bool                 m_focalLengthEstimateValid = false;
+    ARdouble             m_focalLengthEstimate[2]; // fx, fy. Protected by m_cornerFinderResultLock.
     int                  m_calibImageCountMax;
     CalibrationPatternType m_patternType;
     cv::Size             m_patternSize;
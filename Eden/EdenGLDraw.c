@@ -0,0 +1,462 @@
+//
+//  EdenGLDraw.c
+//  The Eden Library
+//
+//  Copyright (c) 2017 Philip Lamb (PRL) phil@eden.net.nz. All rights reserved.
+//
+//	Rev		Date		Who		Changes
+//
+
+// @@BEGIN_EDEN_LICENSE_HEADER@@
+//
+//  This file is part of The Eden Library.
+//
+//  The Eden Library is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  The Eden Library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  along with The Eden Library.  If not, see <http://www.gnu.org/licenses/>.
+//
+//  As a special exception, the copyright holders of this library give you
+//  permission to link this library with independent modules to produce an
+//  executable, regardless of the license terms of these independent modules, and to
+//  copy and distribute the resulting executable under terms of your choice,
+//  provided that you also meet, for each linked independent module, the terms and
+//  conditions of the license of that module. An independent module is a module
+//  which is neither derived from nor based on this library. If you modify this
+//  library, you may extend this exception to your version of the library, but you
+//  are not obligated to do so. If you do not wish to do so, delete this exception
+//  statement from your version.
+//
+// @@END_EDEN_LICENSE_HEADER@@
+
+// ============================================================================
+//	Private includes.
+// ============================================================================
+
+#include <Eden/EdenGLDraw.h>
+
+#if EDEN_USE_GL && !defined(_WIN32)
+#  define EDEN_GL_DRAW_AVAILABLE 1
+#endif
+
+#if EDEN_GL_DRAW_AVAILABLE
+
+#include <stdio.h>
+#include <stdlib.h> // malloc(), realloc(), free()
+#include <string.h>
+#ifndef EDEN_MACOSX
+#  ifndef GL_GLEXT_PROTOTYPES
+#    define GL_GLEXT_PROTOTYPES // glCreateProgram(), glGenVertexArrays() etc.
+#  endif
+#endif
+// EdenSurfaces also does OpenGL header inclusion.
+#include <Eden/EdenSurfaces.h>
+#define USE_GL_STATE_CACHE 1
+#include <Eden/glStateCache.h>
+#ifdef EDEN_MACOSX
+#  include <OpenGL/glext.h> // GL_APPLE_vertex_array_object.
+#  define glGenVertexArrays glGenVertexArraysAPPLE
+#  define glBindVertexArray glBindVertexArrayAPPLE
+#  define glDeleteVertexArrays glDeleteVertexArraysAPPLE
+#  define VERTEX_ARRAY_OBJECT_EXTENSION "GL_APPLE_vertex_array_object"
+#else
+#  define VERTEX_ARRAY_OBJECT_EXTENSION "GL_ARB_vertex_array_object"
+#endif
+
+// ============================================================================
+//  Private types and definitions.
+// ============================================================================
+
+// Indices of program uniforms.
+enum {
+    UNIFORM_MODELVIEW_PROJECTION_MATRIX,
+    UNIFORM_COLOR,
+    UNIFORM_SHADING,
+    UNIFORM_TEXTURE0,
+    UNIFORM_COUNT
+};
+// Indices of program attributes.
+enum {
+    ATTRIBUTE_VERTEX,
+    ATTRIBUTE_TEXCOORD,
+    ATTRIBUTE_COUNT
+};
+
+// Vertices are streamed interleaved, so that the attribute pointers stay fixed and
+// successive draws differ only in their first vertex.
+typedef struct {
+    GLfloat x, y;
+    GLfloat s, t;
+} EDEN_GL_DRAW_VERTEX;
+
+#define EDEN_GL_DRAW_BUFFER_VERTICES_MIN 4096
+
+// ============================================================================
+//  Global variables.
+// ============================================================================
+
+static EDEN_BOOL gActive = FALSE;
+static EDEN_BOOL gBegun = FALSE;
+static GLuint gProgram = 0;
+static GLint gUniforms[UNIFORM_COUNT];
+static GLuint gVertexArray = 0; // 0 if vertex array objects are unavailable.
+static GLuint gBuffer = 0;
+static int gBufferVertexCapacity = 0;
+static int gBufferVertexCount = 0; // Vertices written since the buffer was last orphaned.
+static EDEN_GL_DRAW_VERTEX *gStaging = NULL; // Sized to gBufferVertexCapacity.
+
+// Uniform values last sent, so that unchanged values are not re-sent.
+static EDEN_BOOL gUniformsValid = FALSE;
+static float gUniformMVP[16];
+static float gUniformColor[4];
+static int gUniformShading;
+
+// A single shader pair for all drawing. Position and texture coordinates only; no lighting.
+static const char vertShaderString[] =
+    "#version 110\n"
+    "attribute vec2 position;\n"
+    "attribute vec2 texCoord;\n"
+    "uniform mat4 modelViewProjectionMatrix;\n"
+    "varying vec2 texCoordVarying;\n"
+    "void main()\n"
+    "{\n"
+    "gl_Position = modelViewProjectionMatrix * vec4(position, 0.0, 1.0);\n"
+    "texCoordVarying = texCoord;\n"
+    "}\n";
+static const char fragShaderString[] =
+    "#version 110\n"
+    "uniform vec4 color;\n"
+    "uniform int shading;\n"
+    "uniform sampler2D texture0;\n"
+    "varying vec2 texCoordVarying;\n"
+    "void main()\n"
+    "{\n"
+    "if (shading == 0) gl_FragColor = color;\n"
+    "else {\n"
+    "vec4 t = texture2D(texture0, texCoordVarying);\n"
+    "if (shading == 1) gl_FragColor = color * t;\n"
+    "else gl_FragColor = vec4(color.rgb, color.a * t.r);\n"
+    "}\n"
+    "}\n";
+
+// ============================================================================
+//  Private functions.
+// ============================================================================
+
+static EDEN_BOOL hasExtension(const char *name)
+{
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+    const char *p;
+    size_t len = strlen(name);
+
+    if (!extensions) return (FALSE);
+    for (p = extensions; (p = strstr(p, name)); p += len) {
+        if ((p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0')) return (TRUE);
+    }
+    return (FALSE);
+}
+
+static GLuint compileShader(const GLenum type, const char *source)
+{
+    GLuint shader;
+    GLint status;
+    char log[512];
+
+    shader = glCreateShader(type);
+    if (!shader) return (0);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (!status) {
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        EDEN_LOGe("EdenGLDraw: Error compiling %s shader: %s\n", (type == GL_VERTEX_SHADER ? "vertex" : "fragment"), log);
+        glDeleteShader(shader);
+        return (0);
+    }
+    return (shader);
+}
+
+static GLuint createProgram(void)
+{
+    GLuint program, vertShader, fragShader;
+    GLint status;
+    char log[512];
+
+    if (!(vertShader = compileShader(GL_VERTEX_SHADER, vertShaderString))) return (0);
+    if (!(fragShader = compileShader(GL_FRAGMENT_SHADER, fragShaderString))) {
+        glDeleteShader(vertShader);
+        return (0);
+    }
+    program = glCreateProgram();
+    if (program) {
+        glAttachShader(program, vertShader);
+        glAttachShader(program, fragShader);
+        glBindAttribLocation(program, ATTRIBUTE_VERTEX, "position");
+        glBindAttribLocation(program, ATTRIBUTE_TEXCOORD, "texCoord");
+        glLinkProgram(program);
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        if (!status) {
+            glGetProgramInfoLog(program, sizeof(log), NULL, log);
+            EDEN_LOGe("EdenGLDraw: Error linking shader program: %s\n", log);
+            glDeleteProgram(program);
+            program = 0;
+        }
+    }
+    glDeleteShader(vertShader); // After linking (or failure), shader objects can be deleted.
+    glDeleteShader(fragShader);
+    return (program);
+}
+
+// Point the attributes at the streaming buffer, which must be bound.
+static void setupAttributes(void)
+{
+    glVertexAttribPointer(ATTRIBUTE_VERTEX, 2, GL_FLOAT, GL_FALSE, sizeof(EDEN_GL_DRAW_VERTEX), (const GLvoid *)0);
+    glEnableVertexAttribArray(ATTRIBUTE_VERTEX);
+    glVertexAttribPointer(ATTRIBUTE_TEXCOORD, 2, GL_FLOAT, GL_FALSE, sizeof(EDEN_GL_DRAW_VERTEX), (const GLvoid *)(2*sizeof(GLfloat)));
+    glEnableVertexAttribArray(ATTRIBUTE_TEXCOORD);
+}
+
+static void setUniforms(const float mvp[16], const float colorRGBA[4], const int shading)
+{
+    if (!gUniformsValid || memcmp(mvp, gUniformMVP, sizeof(gUniformMVP)) != 0) {
+        glUniformMatrix4fv(gUniforms[UNIFORM_MODELVIEW_PROJECTION_MATRIX], 1, GL_FALSE, mvp);
+        memcpy(gUniformMVP, mvp, sizeof(gUniformMVP));
+    }
+    if (!gUniformsValid || memcmp(colorRGBA, gUniformColor, sizeof(gUniformColor)) != 0) {
+        glUniform4fv(gUniforms[UNIFORM_COLOR], 1, colorRGBA);
+        memcpy(gUniformColor, colorRGBA, sizeof(gUniformColor));
+    }
+    if (!gUniformsValid || shading != gUniformShading) {
+        glUniform1i(gUniforms[UNIFORM_SHADING], shading);
+        gUniformShading = shading;
+    }
+    gUniformsValid = TRUE;
+}
+
+// Bind the streaming buffer and make room in it for count more vertices. The buffer is bound here, rather than
+// assumed to still be bound from EdenGLDrawBegin(), since callers may bind other buffers between Begin and End.
+// When the buffer is full, it is orphaned rather than overwritten, so that drawing never waits for the GPU to
+// finish with earlier vertices.
+static EDEN_BOOL bufferReserve(const int count)
+{
+    int capacity;
+    EDEN_GL_DRAW_VERTEX *staging;
+
+    glBindBuffer(GL_ARRAY_BUFFER, gBuffer);
+    if (gBufferVertexCount + count <= gBufferVertexCapacity) return (TRUE);
+
+    capacity = gBufferVertexCapacity;
+    while (capacity < count) capacity *= 2;
+    if (capacity != gBufferVertexCapacity) {
+        if (!(staging = (EDEN_GL_DRAW_VERTEX *)realloc(gStaging, capacity*sizeof(EDEN_GL_DRAW_VERTEX)))) {
+            EDEN_LOGe("Out of memory!\n");
+            return (FALSE);
+        }
+        gStaging = staging;
+        gBufferVertexCapacity = capacity;
+    }
+    glBufferData(GL_ARRAY_BUFFER, gBufferVertexCapacity*sizeof(EDEN_GL_DRAW_VERTEX), NULL, GL_STREAM_DRAW);
+    gBufferVertexCount = 0;
+    return (TRUE);
+}
+
+// ============================================================================
+//  Public functions.
+// ============================================================================
+
+EDEN_BOOL EdenGLDrawInit(void)
+{
+    const char *version;
+    int major = 0, minor = 0;
+
+    if (gActive) return (TRUE);
+
+    version = (const char *)glGetString(GL_VERSION);
+    if (!version) return (FALSE);
+    sscanf(version, "%d.%d", &major, &minor);
+    if (major < 2) {
+        EDEN_LOG("EdenGLDraw: OpenGL %s does not support shaders. Using fixed-function drawing.\n", version);
+        return (FALSE);
+    }
+
+    if (!(gProgram = createProgram())) return (FALSE);
+    gUniforms[UNIFORM_MODELVIEW_PROJECTION_MATRIX] = glGetUniformLocation(gProgram, "modelViewProjectionMatrix");
+    gUniforms[UNIFORM_COLOR] = glGetUniformLocation(gProgram, "color");
+    gUniforms[UNIFORM_SHADING] = glGetUniformLocation(gProgram, "shading");
+    gUniforms[UNIFORM_TEXTURE0] = glGetUniformLocation(gProgram, "texture0");
+    glUseProgram(gProgram);
+    glUniform1i(gUniforms[UNIFORM_TEXTURE0], 0);
+    glUseProgram(0);
+    gUniformsValid = FALSE;
+
+    gBufferVertexCapacity = EDEN_GL_DRAW_BUFFER_VERTICES_MIN;
+    if (!(gStaging = (EDEN_GL_DRAW_VERTEX *)malloc(gBufferVertexCapacity*sizeof(EDEN_GL_DRAW_VERTEX)))) {
+        EDEN_LOGe("Out of memory!\n");
+        glDeleteProgram(gProgram);
+        gProgram = 0;
+        return (FALSE);
+    }
+    glGenBuffers(1, &gBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, gBuffer);
+    glBufferData(GL_ARRAY_BUFFER, gBufferVertexCapacity*sizeof(EDEN_GL_DRAW_VERTEX), NULL, GL_STREAM_DRAW);
+    gBufferVertexCount = 0;
+
+    // With a vertex array object, the attribute setup is done once here rather than at every EdenGLDrawBegin().
+#ifdef EDEN_MACOSX
+    if (hasExtension(VERTEX_ARRAY_OBJECT_EXTENSION)) {
+#else
+    if (major >= 3 || hasExtension(VERTEX_ARRAY_OBJECT_EXTENSION)) {
+#endif
+        glGenVertexArrays(1, &gVertexArray);
+        glBindVertexArray(gVertexArray);
+        setupAttributes();
+        glBindVertexArray(0);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    gActive = TRUE;
+    return (TRUE);
+}
+
+EDEN_BOOL EdenGLDrawFinal(void)
+{
+    if (!gActive) return (FALSE);
+
+    EdenGLDrawEnd();
+    if (gVertexArray) {
+        glDeleteVertexArrays(1, &gVertexArray);
+        gVertexArray = 0;
+    }
+    glDeleteBuffers(1, &gBuffer);
+    gBuffer = 0;
+    glDeleteProgram(gProgram);
+    gProgram = 0;
+    free(gStaging);
+    gStaging = NULL;
+    gBufferVertexCapacity = gBufferVertexCount = 0;
+    gUniformsValid = FALSE;
+    gActive = FALSE;
+    return (TRUE);
+}
+
+EDEN_BOOL EdenGLDrawIsActive(void)
+{
+    return (gActive);
+}
+
+void EdenGLDrawBegin(void)
+{
+    if (!gActive || gBegun) return;
+
+    glUseProgram(gProgram);
+    glBindBuffer(GL_ARRAY_BUFFER, gBuffer);
+    if (gVertexArray) glBindVertexArray(gVertexArray);
+    else setupAttributes();
+    glStateCacheDisableDepthTest();
+    glStateCacheBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glStateCacheEnableBlend();
+    gBegun = TRUE;
+}
+
+void EdenGLDrawEnd(void)
+{
+    if (!gBegun) return;
+
+    if (gVertexArray) glBindVertexArray(0);
+    else {
+        // Generic attribute 0 aliases the fixed-function vertex array, so must not be left enabled.
+        glDisableVertexAttribArray(ATTRIBUTE_VERTEX);
+        glDisableVertexAttribArray(ATTRIBUTE_TEXCOORD);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glUseProgram(0);
+    glStateCacheDisableBlend();
+    gBegun = FALSE;
+}
+
+void EdenGLDrawArrays(const float mvp[16], const float colorRGBA[4], const EDEN_GL_DRAW_SHADING shading, const unsigned int mode, const float *vertices, const float *texcoords, const int count)
+{
+    int i;
+    EDEN_GL_DRAW_VERTEX *v;
+
+    if (!gActive || !mvp || !colorRGBA || !vertices || count <= 0) return;
+    if (shading != EDEN_GL_DRAW_SHADING_COLOR && !texcoords) return;
+
+    EdenGLDrawBegin();
+    if (!bufferReserve(count)) return; // Binds gBuffer.
+
+    v = gStaging;
+    for (i = 0; i < count; i++) {
+        v[i].x = vertices[i*2];
+        v[i].y = vertices[i*2 + 1];
+        if (texcoords) {
+            v[i].s = texcoords[i*2];
+            v[i].t = texcoords[i*2 + 1];
+        } else {
+            v[i].s = v[i].t = 0.0f;
+        }
+    }
+    glBufferSubData(GL_ARRAY_BUFFER, gBufferVertexCount*sizeof(EDEN_GL_DRAW_VERTEX), count*sizeof(EDEN_GL_DRAW_VERTEX), gStaging);
+    setUniforms(mvp, colorRGBA, (int)shading);
+    glDrawArrays((GLenum)mode, gBufferVertexCount, count);
+    gBufferVertexCount += count;
+}
+
+void EdenGLDrawBufferArrays(const float mvp[16], const float colorRGBA[4], const unsigned int mode, const unsigned int buffer, const int first, const int count)
+{
+    if (!gActive || !mvp || !colorRGBA || !buffer || count <= 0) return;
+
+    EdenGLDrawBegin();
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glVertexAttribPointer(ATTRIBUTE_VERTEX, 2, GL_FLOAT, GL_FALSE, 0, (const GLvoid *)0);
+    glDisableVertexAttribArray(ATTRIBUTE_TEXCOORD);
+    setUniforms(mvp, colorRGBA, EDEN_GL_DRAW_SHADING_COLOR);
+    glDrawArrays((GLenum)mode, first, count);
+
+    // Restore the streaming buffer's attributes.
+    glBindBuffer(GL_ARRAY_BUFFER, gBuffer);
+    setupAttributes();
+}
+
+#else // !EDEN_GL_DRAW_AVAILABLE
+
+EDEN_BOOL EdenGLDrawInit(void)
+{
+    return (FALSE);
+}
+
+EDEN_BOOL EdenGLDrawFinal(void)
+{
+    return (FALSE);
+}
+
+EDEN_BOOL EdenGLDrawIsActive(void)
+{
+    return (FALSE);
+}
+
+void EdenGLDrawBegin(void)
+{
+}
+
+void EdenGLDrawEnd(void)
+{
+}
+
+void EdenGLDrawArrays(const float mvp[16], const float colorRGBA[4], const EDEN_GL_DRAW_SHADING shading, const unsigned int mode, const float *vertices, const float *texcoords, const int count)
+{
+}
+
+void EdenGLDrawBufferArrays(const float mvp[16], const float colorRGBA[4], const unsigned int mode, const unsigned int buffer, const int first, const int count)
+{
+}
+
+#endif // EDEN_GL_DRAW_AVAILABLE
@@ -0,0 +1,180 @@
+//
+//  EdenGLDraw.h
+//  The Eden Library
+//
+//  Copyright (c) 2017 Philip Lamb (PRL) phil@eden.net.nz. All rights reserved.
+//
+//	Rev		Date		Who		Changes
+//
+
+// @@BEGIN_EDEN_LICENSE_HEADER@@
+//
+//  This file is part of The Eden Library.
+//
+//  The Eden Library is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  The Eden Library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  along with The Eden Library.  If not, see <http://www.gnu.org/licenses/>.
+//
+//  As a special exception, the copyright holders of this library give you
+//  permission to link this library with independent modules to produce an
+//  executable, regardless of the license terms of these independent modules, and to
+//  copy and distribute the resulting executable under terms of your choice,
+//  provided that you also meet, for each linked independent module, the terms and
+//  conditions of the license of that module. An independent module is a module
+//  which is neither derived from nor based on this library. If you modify this
+//  library, you may extend this exception to your version of the library, but you
+//  are not obligated to do so. If you do not wish to do so, delete this exception
+//  statement from your version.
+//
+// @@END_EDEN_LICENSE_HEADER@@
+
+// HeaderDoc documentation included. See http://developer.apple.com/darwin/projects/headerdoc/
+
+/*!
+    @header EdenGLDraw
+    @abstract Shader-based 2D drawing shared by Eden's overlay drawing.
+    @version 1.0.0
+    @updated 2017-06-01
+    @discussion
+        Draws flat-coloured and textured 2D geometry under desktop OpenGL using a single
+        small shader program, a streaming vertex buffer, and (where available) a vertex
+        array object. Transforms and colour are passed as uniforms rather than via the
+        fixed-function matrix stacks and glColor(), and uniforms are only re-sent when
+        their values change.
+
+        All drawing between EdenGLDrawBegin() and EdenGLDrawEnd() shares the same program,
+        vertex array and blend state, so the per-draw cost is a buffer update and a draw
+        call. Between these calls, blending is enabled with
+        (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA) and depth testing is disabled.
+
+        Requires OpenGL 2.0. The context need not be a core profile context, so this may be
+        used alongside other code (e.g. video display) which uses the fixed-function
+        pipeline, provided that code is not called between EdenGLDrawBegin() and
+        EdenGLDrawEnd(). Where OpenGL 2.0 is unavailable, EdenGLDrawInit() returns FALSE and
+        callers should use their fixed-function paths.
+
+        Under OpenGL ES 2.0, Eden modules use their own shader paths and this module is not
+        used.
+    @copyright 2017 Philip Lamb
+ */
+
+#ifndef __EdenGLDraw_h__
+#define __EdenGLDraw_h__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ============================================================================
+//	Includes.
+// ============================================================================
+#ifndef __Eden_h__
+#  include <Eden/Eden.h>
+#endif
+
+// ============================================================================
+//  Defines and types.
+// ============================================================================
+
+typedef enum {
+    EDEN_GL_DRAW_SHADING_COLOR,             // Flat colour.
+    EDEN_GL_DRAW_SHADING_TEXTURE,           // Texture on unit 0, modulated by colour.
+    EDEN_GL_DRAW_SHADING_TEXTURE_COVERAGE   // Colour, with coverage taken from the luminance of the texture on unit 0 (e.g. bitmap fonts).
+} EDEN_GL_DRAW_SHADING;
+
+// ============================================================================
+//  Functions.
+// ============================================================================
+
+/*!
+    @function
+    @abstract   Initialise shader-based drawing in the current OpenGL context.
+    @discussion
+        Compiles the shader program and creates the vertex buffer and vertex array.
+        Must be called with the OpenGL context current.
+    @result     TRUE if shader-based drawing is available, FALSE if not (in which case
+        EdenGLDrawIsActive() will return FALSE).
+*/
+EDEN_BOOL EdenGLDrawInit(void);
+
+/*!
+    @function
+    @abstract   Finalise shader-based drawing.
+    @discussion
+        Deletes the OpenGL objects created by EdenGLDrawInit(). Must be called with the
+        same OpenGL context current.
+    @result     TRUE if succcessful, FALSE in case of error.
+*/
+EDEN_BOOL EdenGLDrawFinal(void);
+
+/*!
+    @function
+    @abstract   Find out whether shader-based drawing is available.
+    @result     TRUE if EdenGLDrawInit() has succeeded.
+*/
+EDEN_BOOL EdenGLDrawIsActive(void);
+
+/*!
+    @function
+    @abstract   Begin a sequence of shader-based drawing.
+    @discussion
+        Binds the program and vertex array and sets blend and depth state. Called
+        implicitly by the drawing functions if required, but calling it explicitly
+        makes clear where fixed-function drawing must stop.
+*/
+void EdenGLDrawBegin(void);
+
+/*!
+    @function
+    @abstract   End a sequence of shader-based drawing.
+    @discussion
+        Unbinds the program, vertex array and vertex buffer, so that fixed-function
+        drawing may resume. Blending is left disabled.
+*/
+void EdenGLDrawEnd(void);
+
+/*!
+    @function
+    @abstract   Draw 2D geometry supplied in client memory.
+    @discussion
+        The vertices are copied into the streaming vertex buffer and drawn in a single call.
+    @param      mvp Model-view-projection matrix (column-major, as used by OpenGL).
+    @param      colorRGBA Colour.
+    @param      shading How to shade the geometry. For textured shading, the texture must
+        be bound to texture unit 0.
+    @param      mode OpenGL primitive type, e.g. GL_TRIANGLES or GL_LINES.
+    @param      vertices count (x, y) pairs.
+    @param      texcoords count (s, t) pairs, or NULL if shading is EDEN_GL_DRAW_SHADING_COLOR.
+    @param      count Number of vertices.
+*/
+void EdenGLDrawArrays(const float mvp[16], const float colorRGBA[4], const EDEN_GL_DRAW_SHADING shading, const unsigned int mode, const float *vertices, const float *texcoords, const int count);
+
+/*!
+    @function
+    @abstract   Draw flat-coloured 2D geometry already held in a vertex buffer.
+    @discussion
+        For geometry which changes rarely and so is better kept in its own buffer
+        object rather than streamed.
+    @param      mvp Model-view-projection matrix (column-major, as used by OpenGL).
+    @param      colorRGBA Colour.
+    @param      mode OpenGL primitive type, e.g. GL_LINES.
+    @param      buffer Name of an OpenGL vertex buffer holding tightly-packed (x, y) pairs of floats.
+    @param      first Index of first vertex to draw.
+    @param      count Number of vertices.
+*/
+void EdenGLDrawBufferArrays(const float mvp[16], const float colorRGBA[4], const unsigned int mode, const unsigned int buffer, const int first, const int count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !__EdenGLDraw_h__
@@ -46,18 +46,20 @@
 
 #include <stdlib.h> // calloc()
 #include <string.h>
+#include <math.h> // cosf(), sinf()
 
 // EdenSurfaces also does OpenGL header inclusion.
 #include <Eden/EdenSurfaces.h>	// TEXTURE_INFO_t, TEXTURE_INDEX_t, SurfacesTextureLoad(), SurfacesTextureSet(), SurfacesTextureUnload()
 #include <Eden/gluttext.h>
 #if EDEN_USE_GL
-#  define USE_GL_STATE_CACHE 0
+#  define USE_GL_STATE_CACHE 1
 #  include <Eden/glStateCache.h>
+#  include <Eden/EdenGLDraw.h>
 #elif EDEN_USE_GLES2
 #  include <AR6/ARG/glStateCache2.h>
 #  include <AR6/ARG/arg_shader_gl.h>
-#  include <AR6/ARG/arg_mtx.h>
 #endif
+#include <AR6/ARG/arg_mtx.h>
 
 // ============================================================================
 //  Private types and definitions.
@@ -126,6 +128,23 @@ typedef struct _EDEN_GL_FONT_FONT_SETTINGS {
     float colorRGBA[4];
 } EDEN_GL_FONT_FONT_SETTINGS;
 
+// Laid-out geometry of a line or block of text, so that it can be drawn in a single call. Stroke fonts give GL_LINES,
+// and texture fonts GL_TRIANGLES with texture coordinates into the font texture. Geometry is in font units, i.e.
+// independent of font size and position, so a string drawn at several sizes or places shares one mesh.
+typedef struct _EDEN_GL_FONT_MESH {
+    EDEN_GL_FONT_INFO_t *font; // NULL if this cache entry is unused.
+    EDEN_GL_FONT_FORMATTING_SETTINGS formatting;
+    unsigned int hash;
+    unsigned char *key; // The lines, each including its null terminator.
+    size_t keyLength;
+    GLfloat *vertices; // 2 per vertex.
+    GLfloat *texcoords; // 2 per vertex. NULL for stroke fonts.
+    GLsizei vertexCount;
+    unsigned long lastUsed;
+} EDEN_GL_FONT_MESH;
+
+#define EDEN_GL_FONT_MESH_CACHE_SIZE 32 // Enough for all text typically on screen at once.
+
 // ============================================================================
 //  Globals
 // ============================================================================
@@ -191,10 +210,15 @@ static EDEN_GL_FONT_FONT_SETTINGS gFontSettings = {
     {1.0f, 1.0f, 1.0f, 1.0f}
 };
 
+static EDEN_GL_FONT_MESH gMeshCache[EDEN_GL_FONT_MESH_CACHE_SIZE]; // Least recently used entries are replaced.
+static unsigned long gMeshCacheClock = 0;
+
 // ============================================================================
 //  Private functions
 // ============================================================================
 
+static void meshCacheFlush(const EDEN_GL_FONT_INFO_t *font);
+
 // ============================================================================
 //  Public functions
 // ============================================================================
@@ -219,6 +243,7 @@ EDEN_BOOL EdenGLFontFinal(void)
 	// Sanity check
 	if (!gInited) return (FALSE);
     
+    meshCacheFlush(NULL);
     gContextsActiveCount = 0;
 	gInited = FALSE;
     
@@ -256,6 +281,7 @@ void EdenGLFontDeleteTextureFont(EDEN_GL_FONT_INFO_t **fontInfo_p)
         *fontInfo_p == &roman ||
         *fontInfo_p == &monoroman) return;
     
+    meshCacheFlush(*fontInfo_p);
     free((*fontInfo_p)->fontName);
     free((*fontInfo_p)->fontDataPathname);
     free(*fontInfo_p);
@@ -618,90 +644,244 @@ EDEN_BOOL EdenGLFontCleanupFontForContext(const int contextIndex, EDEN_GL_FONT_I
     return (TRUE);
 }
 
-struct _VTs {
-    GLfloat vertices[4][2];
-    GLfloat texcoords[4][2];
-};
+// ============================================================================
+//  String mesh cache
+// ============================================================================
 
-static void drawSetup(const int contextIndex, struct _VTs *VTs)
+static void meshFree(EDEN_GL_FONT_MESH *mesh)
 {
-	EDEN_GL_FONT_TEXTURE_INFO *fontTextureInfo;
+    free(mesh->key);
+    free(mesh->vertices);
+    free(mesh->texcoords);
+    memset(mesh, 0, sizeof(EDEN_GL_FONT_MESH));
+}
+
+// Discard cached meshes for the given font, or all meshes if font is NULL.
+static void meshCacheFlush(const EDEN_GL_FONT_INFO_t *font)
+{
+    int i;
+    
+    for (i = 0; i < EDEN_GL_FONT_MESH_CACHE_SIZE; i++) {
+        if (gMeshCache[i].font && (!font || gMeshCache[i].font == font)) meshFree(&gMeshCache[i]);
+    }
+}
 
-    VTs->vertices[0][0] = 0.0f; VTs->vertices[0][1] = 0.0f;
-    VTs->vertices[1][0] = gFontSettings.font->naturalWidthIfMonospaced; VTs->vertices[1][1] = 0.0f;
-    VTs->vertices[2][0] = gFontSettings.font->naturalWidthIfMonospaced; VTs->vertices[2][1] = gFontSettings.font->naturalHeight;
-    VTs->vertices[3][0] = 0.0f; VTs->vertices[3][1] = gFontSettings.font->naturalHeight;
-    VTs->texcoords[0][0] = 0.0f; VTs->texcoords[0][1] = 0.0f;
-    VTs->texcoords[1][0] = 0.0625f; VTs->texcoords[1][1] = 0.0f;
-    VTs->texcoords[2][0] = 0.0625f; VTs->texcoords[2][1] = 0.0625f;
-    VTs->texcoords[3][0] = 0.0f; VTs->texcoords[3][1] = 0.0625f;
+// The key of a mesh is its lines, each with its null terminator. A NULL line lays out the same as an empty one.
+static unsigned int meshKeyHash(const unsigned char **lines, const unsigned int lineCount, size_t *keyLength_p)
+{
+    unsigned int i;
+    const unsigned char *line;
+    unsigned int hash = 2166136261u; // FNV-1a.
+    size_t keyLength = 0;
     
-    fontTextureInfo = (EDEN_GL_FONT_TEXTURE_INFO *)gFontSettings.font->tsi;
+    for (i = 0; i < lineCount; i++) {
+        line = (lines[i] ? lines[i] : (const unsigned char *)"");
+        do {
+            hash = (hash ^ *line) * 16777619u;
+            keyLength++;
+        } while (*line++);
+    }
+    *keyLength_p = keyLength;
+    return (hash);
+}
+
+static EDEN_BOOL meshKeyMatches(const EDEN_GL_FONT_MESH *mesh, const unsigned char **lines, const unsigned int lineCount)
+{
+    unsigned int i;
+    size_t len;
+    const unsigned char *key = mesh->key;
     
-    // Set up for texture drawing.
-#if EDEN_USE_GL
-    EdenSurfacesTextureSet(contextIndex, fontTextureInfo->textureIndexPerContext[contextIndex]); // Select font texture.
-    glStateCacheBlendFunc(GL_SRC_COLOR, GL_ONE_MINUS_SRC_COLOR); // Blend by luminance.
-    glStateCacheEnableBlend();
-    glVertexPointer(2, GL_FLOAT, 0, VTs->vertices);
-    glStateCacheEnableClientStateVertexArray();
-    glStateCacheDisableClientStateNormalArray();
-    glStateCacheClientActiveTexture(GL_TEXTURE0);
-    glTexCoordPointer(2, GL_FLOAT, 0, VTs->texcoords);
-    glStateCacheEnableClientStateTexCoordArray();
-    glStateCacheEnableTex2D();
-#endif
+    for (i = 0; i < lineCount; i++) {
+        len = (lines[i] ? strlen((const char *)lines[i]) : 0) + 1;
+        if (memcmp(key, (lines[i] ? lines[i] : (const unsigned char *)""), len) != 0) return (FALSE);
+        key += len;
+    }
+    return (TRUE);
 }
 
-static void drawOneLine(const unsigned char *line, int contextIndex, const float viewProjection[16])
+// Lay out one line in a stroke font, as GL_LINES in font units with the baseline at height y.
+// If vertices is NULL, just counts. Returns the number of vertices.
+static int strokeLineSegments(const unsigned char *line, const float y, GLfloat *vertices)
+{
+    int i = 0, j;
+    int count = 0, n;
+    unsigned char c;
+    float penX = 0.0f, advance;
+    
+    while ((c = line[i++])) {
+        if (c < ' ') continue;
+        n = glutStrokeCharacterSegments(gFontSettings.font->fontDataPathname, c, penX, (vertices ? vertices + count*2 : NULL), &advance);
+        if (vertices && y != 0.0f) {
+            for (j = count; j < count + n; j++) vertices[j*2 + 1] += y;
+        }
+        count += n;
+        penX += advance;
+        if (!gFontSettings.font->monospaced && c == ' ' && gFormattingSettings.wordExtraSpacing) penX += glutStrokeWidth(gFontSettings.font->fontDataPathname, ' ') * gFormattingSettings.wordExtraSpacing;
+        penX += gFontSettings.font->naturalHeight * gFormattingSettings.characterSpacing;
+    }
+    return (count);
+}
+
+// Lay out one line in a texture font, as GL_TRIANGLES in font units with the baseline at height y, and texture
+// coordinates into the font's 16 x 16 character texture. If vertices is NULL, just counts. Returns the number of vertices.
+static int textureLineQuads(const unsigned char *line, const float y, GLfloat *vertices, GLfloat *texcoords)
 {
     int i = 0;
+    int count = 0;
     unsigned char c;
+    float penX = 0.0f;
+    const float w = gFontSettings.font->naturalWidthIfMonospaced;
+    const float h = gFontSettings.font->naturalHeight;
+    
+    while ((c = line[i++])) {
+        if (c < ' ') continue;
+        if (vertices) {
+            float s = (float)(c%16)*0.0625f;
+            float t = 1.0f - (float)(c/16 + 1)*0.0625f;
+            GLfloat quadVertices[6][2] = {{penX, y}, {penX + w, y}, {penX + w, y + h}, {penX, y}, {penX + w, y + h}, {penX, y + h}};
+            GLfloat quadTexcoords[6][2] = {{s, t}, {s + 0.0625f, t}, {s + 0.0625f, t + 0.0625f}, {s, t}, {s + 0.0625f, t + 0.0625f}, {s, t + 0.0625f}};
+            memcpy(vertices + count*2, quadVertices, sizeof(quadVertices));
+            memcpy(texcoords + count*2, quadTexcoords, sizeof(quadTexcoords));
+        }
+        count += 6;
+        penX += w + h*gFormattingSettings.characterSpacing; // Move to the right.
+    }
+    return (count);
+}
 
-    if (gFontSettings.font->type == EDEN_GL_FONT_TYPE_GLUT_STROKE) {
+static int layoutBlock(const unsigned char **lines, const unsigned int lineCount, GLfloat *vertices, GLfloat *texcoords)
+{
+    unsigned int i;
+    int count = 0;
+    float y;
+    
+    for (i = 0; i < lineCount; i++) {
+        if (!lines[i]) continue;
+        y = ((lineCount - 1) - i)*gFontSettings.font->naturalHeight*gFormattingSettings.lineSpacing; // Baseline for this line.
+        if (gFontSettings.font->type == EDEN_GL_FONT_TYPE_GLUT_STROKE) {
+            count += strokeLineSegments(lines[i], y, (vertices ? vertices + count*2 : NULL));
+        } else {
+            count += textureLineQuads(lines[i], y, (vertices ? vertices + count*2 : NULL), (texcoords ? texcoords + count*2 : NULL));
+        }
+    }
+    return (count);
+}
+
+// Find the mesh for the lines in the current font and formatting settings, laying it out if not already cached.
+static EDEN_GL_FONT_MESH *meshGet(const unsigned char **lines, const unsigned int lineCount)
+{
+    int i;
+    unsigned int hash;
+    size_t keyLength;
+    EDEN_GL_FONT_MESH *mesh, *victim = NULL;
+    unsigned char *key;
+    
+    hash = meshKeyHash(lines, lineCount, &keyLength);
+    for (i = 0; i < EDEN_GL_FONT_MESH_CACHE_SIZE; i++) {
+        mesh = &gMeshCache[i];
+        if (!mesh->font) {
+            victim = mesh;
+            continue;
+        }
+        if (mesh->font == gFontSettings.font && mesh->hash == hash && mesh->keyLength == keyLength &&
+            mesh->formatting.characterSpacing == gFormattingSettings.characterSpacing &&
+            mesh->formatting.lineSpacing == gFormattingSettings.lineSpacing &&
+            mesh->formatting.wordExtraSpacing == gFormattingSettings.wordExtraSpacing &&
+            meshKeyMatches(mesh, lines, lineCount)) {
+            mesh->lastUsed = ++gMeshCacheClock;
+            return (mesh);
+        }
+        if (!victim || (victim->font && mesh->lastUsed < victim->lastUsed)) victim = mesh; // Least recently used.
+    }
+    
+    // Not cached, so lay out into the free or least recently used entry.
+    mesh = victim;
+    meshFree(mesh);
+    mesh->vertexCount = layoutBlock(lines, lineCount, NULL, NULL);
+    mesh->key = (unsigned char *)malloc(keyLength);
+    if (mesh->vertexCount) {
+        mesh->vertices = (GLfloat *)malloc(mesh->vertexCount * 2 * sizeof(GLfloat));
+        if (gFontSettings.font->type == EDEN_GL_FONT_TYPE_TEXTURE) mesh->texcoords = (GLfloat *)malloc(mesh->vertexCount * 2 * sizeof(GLfloat));
+    }
+    if (!mesh->key || (mesh->vertexCount && (!mesh->vertices || (gFontSettings.font->type == EDEN_GL_FONT_TYPE_TEXTURE && !mesh->texcoords)))) {
+        EDEN_LOGe("Out of memory!");
+        meshFree(mesh);
+        return (NULL);
+    }
+    layoutBlock(lines, lineCount, mesh->vertices, mesh->texcoords);
+    key = mesh->key;
+    for (i = 0; i < lineCount; i++) {
+        size_t len = (lines[i] ? strlen((const char *)lines[i]) : 0) + 1;
+        memcpy(key, (lines[i] ? lines[i] : (const unsigned char *)""), len);
+        key += len;
+    }
+    mesh->font = gFontSettings.font;
+    mesh->formatting = gFormattingSettings;
+    mesh->hash = hash;
+    mesh->keyLength = keyLength;
+    mesh->lastUsed = ++gMeshCacheClock;
+    return (mesh);
+}
+
+// Draw a mesh in a single call. mvp is the model-view-projection matrix. On desktop OpenGL, if mvp is NULL, the
+// mesh is drawn with the fixed-function pipeline using the current matrices, otherwise via EdenGLDraw.
+static void drawMesh(const EDEN_GL_FONT_MESH *mesh, const int contextIndex, const float mvp[16])
+{
+    if (!mesh->vertexCount) return;
+    
+    if (mesh->font->type == EDEN_GL_FONT_TYPE_GLUT_STROKE) {
 #if EDEN_USE_GL
-        glColor4f(gFontSettings.colorRGBA[0], gFontSettings.colorRGBA[1], gFontSettings.colorRGBA[2], gFontSettings.colorRGBA[3]);
-        while ((c = line[i++])) {
-            if (c < ' ') continue;
-            glutStrokeCharacter(gFontSettings.font->fontDataPathname, c);
-            if (!gFontSettings.font->monospaced && c == ' ' && gFormattingSettings.wordExtraSpacing) glTranslatef(glutStrokeWidth(gFontSettings.font->fontDataPathname, ' ') * gFormattingSettings.wordExtraSpacing, 0.0f, 0.0f);
-            glTranslatef(gFontSettings.font->naturalHeight * gFormattingSettings.characterSpacing, 0.0f, 0.0f);
+        if (mvp) {
+            EdenGLDrawArrays(mvp, gFontSettings.colorRGBA, EDEN_GL_DRAW_SHADING_COLOR, GL_LINES, mesh->vertices, NULL, mesh->vertexCount);
+            return;
         }
+        glStateCacheColor4fv(gFontSettings.colorRGBA);
+        glVertexPointer(2, GL_FLOAT, 0, mesh->vertices);
+        glStateCacheEnableClientStateVertexArray();
+        glStateCacheClientActiveTexture(GL_TEXTURE0);
+        glStateCacheDisableClientStateTexCoordArray();
+        glStateCacheDisableClientStateNormalArray();
+        glDrawArrays(GL_LINES, 0, mesh->vertexCount);
 #elif EDEN_USE_GLES2
-        EDEN_GL_FONT_GLUT_STROKE_INFO *gsi = (EDEN_GL_FONT_GLUT_STROKE_INFO *)gFontSettings.font->tsi;
+        EDEN_GL_FONT_GLUT_STROKE_INFO *gsi = (EDEN_GL_FONT_GLUT_STROKE_INFO *)mesh->font->tsi;
         glUseProgram(gsi->programs[contextIndex]);
         glUniform4fv(gsi->uniforms[contextIndex*UNIFORM_COUNT + UNIFORM_COLOR], 1, gFontSettings.colorRGBA);
-        float mvp[16];
-        mtxLoadMatrixf(mvp, viewProjection);
-        while ((c = line[i++])) {
-            if (c < ' ') continue;
-            glUniformMatrix4fv(gsi->uniforms[contextIndex*UNIFORM_COUNT + UNIFORM_MODELVIEW_PROJECTION_MATRIX], 1, GL_FALSE, mvp);
-            float translateX;
-            glutStrokeCharacter(gFontSettings.font->fontDataPathname, c, ATTRIBUTE_VERTEX, &translateX);
-            if (!gFontSettings.font->monospaced && c == ' ' && gFormattingSettings.wordExtraSpacing) mtxTranslatef(mvp, glutStrokeWidth(gFontSettings.font->fontDataPathname, ' ') * gFormattingSettings.wordExtraSpacing, 0.0f, 0.0f);
-            mtxTranslatef(mvp, translateX + gFontSettings.font->naturalHeight * gFormattingSettings.characterSpacing, 0.0f, 0.0f);
-        }
+        glUniformMatrix4fv(gsi->uniforms[contextIndex*UNIFORM_COUNT + UNIFORM_MODELVIEW_PROJECTION_MATRIX], 1, GL_FALSE, mvp);
+        glVertexAttribPointer(ATTRIBUTE_VERTEX, 2, GL_FLOAT, GL_FALSE, 0, mesh->vertices);
+        glEnableVertexAttribArray(ATTRIBUTE_VERTEX);
+        glDrawArrays(GL_LINES, 0, mesh->vertexCount);
 #endif
-    } else if (gFontSettings.font->type == EDEN_GL_FONT_TYPE_TEXTURE) {
-        while ((c = line[i++])) {
-            if (c < ' ') continue;
+    } else if (mesh->font->type == EDEN_GL_FONT_TYPE_TEXTURE) {
 #if EDEN_USE_GL
-            glMatrixMode(GL_TEXTURE);
-            glLoadIdentity();
-            glTranslatef((float)(c%16)*0.0625f, 1.0f - (float)(c/16 + 1)*0.0625f, 0.0f); // Select the appropriate bit of font texture.
-            glMatrixMode(GL_MODELVIEW);
-            glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-            glTranslatef(gFontSettings.font->naturalWidthIfMonospaced + (gFontSettings.font->naturalHeight * gFormattingSettings.characterSpacing), 0.0f, 0.0f); // Move to the right.
-#endif
+        EDEN_GL_FONT_TEXTURE_INFO *fontTextureInfo = (EDEN_GL_FONT_TEXTURE_INFO *)mesh->font->tsi;
+        EdenSurfacesTextureSet(contextIndex, fontTextureInfo->textureIndexPerContext[contextIndex]); // Select font texture.
+        if (mvp) {
+            EdenGLDrawArrays(mvp, gFontSettings.colorRGBA, EDEN_GL_DRAW_SHADING_TEXTURE_COVERAGE, GL_TRIANGLES, mesh->vertices, mesh->texcoords, mesh->vertexCount);
+            return;
         }
+        glStateCacheBlendFunc(GL_SRC_COLOR, GL_ONE_MINUS_SRC_COLOR); // Blend by luminance.
+        glStateCacheEnableBlend();
+        glVertexPointer(2, GL_FLOAT, 0, mesh->vertices);
+        glStateCacheEnableClientStateVertexArray();
+        glStateCacheDisableClientStateNormalArray();
+        glStateCacheClientActiveTexture(GL_TEXTURE0);
+        glTexCoordPointer(2, GL_FLOAT, 0, mesh->texcoords);
+        glStateCacheEnableClientStateTexCoordArray();
+        glStateCacheEnableTex2D();
+        glDrawArrays(GL_TRIANGLES, 0, mesh->vertexCount);
+#endif
     }
 }
 
+// ============================================================================
+//  Drawing
+// ============================================================================
+
 void EdenGLFontDrawLine(const int contextIndex, const float viewProjection[16], const unsigned char *line, const float hOffset, const float vOffset, H_OFFSET_TYPE hOffsetType, V_OFFSET_TYPE vOffsetType)
 {
     GLfloat x, y;
     GLfloat fontScalef;
-    struct _VTs VTs;
+    EDEN_GL_FONT_MESH *mesh;
     
     if (!line) return;
     
@@ -718,29 +898,55 @@ void EdenGLFontDrawLine(const int contextIndex, const float viewProjection[16],
     	else /* V_OFFSET_VIEW_CENTER_TO_TEXT_CENTER */ y = (gViewSettings.height - textHeight)/2.0f + hOffset;
     }
     
-    if (gFontSettings.font->type == EDEN_GL_FONT_TYPE_TEXTURE) drawSetup(contextIndex, &VTs);
+    if (!(mesh = meshGet(&line, 1))) return;
     fontScalef = gFontSettings.size/72.0f * gViewSettings.pixelsPerInch / gFontSettings.font->naturalHeight;
 #if EDEN_USE_GL
-    glPushMatrix();
-    glTranslatef(x, y, 0.0f);
-    glScalef(fontScalef, fontScalef, fontScalef);
-    drawOneLine(line, 0 , NULL);
-    glPopMatrix();
-#elif EDEN_USE_GLES2
+    if (!viewProjection || !EdenGLDrawIsActive()) {
+        glPushMatrix();
+        glTranslatef(x, y, 0.0f);
+        glScalef(fontScalef, fontScalef, fontScalef);
+        drawMesh(mesh, contextIndex, NULL);
+        glPopMatrix();
+        return;
+    }
+#endif
     float mvp[16];
     mtxLoadMatrixf(mvp, viewProjection);
     mtxTranslatef(mvp, x, y, 0.0f);
     mtxScalef(mvp, fontScalef, fontScalef, fontScalef);
-    drawOneLine(line, contextIndex, mvp);
-#endif
+    drawMesh(mesh, contextIndex, mvp);
+}
+
+int EdenGLFontGetLineSegments(const unsigned char *line, const float x, const float y, const float angle, float *vertices)
+{
+    int j;
+    int count;
+    float fontScalef, cosA, sinA, vx, vy;
+    
+    if (!line) return (0);
+    if (gFontSettings.font->type != EDEN_GL_FONT_TYPE_GLUT_STROKE) return (0);
+    
+    count = strokeLineSegments(line, 0.0f, vertices);
+    if (vertices) {
+        // Scale, rotate about the baseline origin, and translate into place.
+        fontScalef = gFontSettings.size/72.0f * gViewSettings.pixelsPerInch / gFontSettings.font->naturalHeight;
+        cosA = cosf(angle * (float)M_PI / 180.0f);
+        sinA = sinf(angle * (float)M_PI / 180.0f);
+        for (j = 0; j < count; j++) {
+            vx = vertices[j*2] * fontScalef;
+            vy = vertices[j*2 + 1] * fontScalef;
+            vertices[j*2    ] = x + vx*cosA - vy*sinA;
+            vertices[j*2 + 1] = y + vx*sinA + vy*cosA;
+        }
+    }
+    return (count);
 }
 
 void EdenGLFontDrawBlock(const int contextIndex, const float viewProjection[16], const unsigned char **lines, const unsigned int lineCount, const float hOffset, const float vOffset, H_OFFSET_TYPE hOffsetType, V_OFFSET_TYPE vOffsetType)
 {
-    int i;
     GLfloat x, y;
     GLfloat fontScalef;
-    struct _VTs VTs;
+    EDEN_GL_FONT_MESH *mesh;
     
     if (!lines) return;
     
@@ -758,31 +964,22 @@ void EdenGLFontDrawBlock(const int contextIndex, const float viewProjection[16],
     	else /* V_OFFSET_VIEW_CENTER_TO_TEXT_CENTER */ y = (gViewSettings.height - textHeight)/2.0f + hOffset;
     }
     
-    if (gFontSettings.font->type == EDEN_GL_FONT_TYPE_TEXTURE) drawSetup(contextIndex, &VTs);
+    // All lines are laid out into one mesh, at their baselines, so the block is drawn in a single call.
+    if (!(mesh = meshGet(lines, lineCount))) return;
     fontScalef = gFontSettings.size/72.0f * gViewSettings.pixelsPerInch / gFontSettings.font->naturalHeight;
 #if EDEN_USE_GL
-    glPushMatrix();
-    for (i = 0; i < lineCount; i++) {
-        if (lines[i]) {
-            glPopMatrix();
-            glPushMatrix();
-            glTranslatef(x, y, 0.0f);
-            glScalef(fontScalef, fontScalef, fontScalef);
-            glTranslatef(0.0f, ((lineCount - 1) - i)*gFontSettings.font->naturalHeight*gFormattingSettings.lineSpacing, 0.0f); // Translate to baseline for this line.
-            drawOneLine(lines[i], 0, NULL);
-        }
-    }
-    glPopMatrix();
-#elif EDEN_USE_GLES2
-    for (i = 0; i < lineCount; i++) {
-        if (lines[i]) {
-            float mvp[16];
-            mtxLoadMatrixf(mvp, viewProjection);
-            mtxTranslatef(mvp, x, y, 0.0f);
-            mtxScalef(mvp, fontScalef, fontScalef, fontScalef);
-            mtxTranslatef(mvp, 0.0f, ((lineCount - 1) - i)*gFontSettings.font->naturalHeight*gFormattingSettings.lineSpacing, 0.0f); // Translate to baseline for this line.
-            drawOneLine(lines[i], contextIndex, mvp);
-        }
+    if (!viewProjection || !EdenGLDrawIsActive()) {
+        glPushMatrix();
+        glTranslatef(x, y, 0.0f);
+        glScalef(fontScalef, fontScalef, fontScalef);
+        drawMesh(mesh, contextIndex, NULL);
+        glPopMatrix();
+        return;
     }
 #endif
+    float mvp[16];
+    mtxLoadMatrixf(mvp, viewProjection);
+    mtxTranslatef(mvp, x, y, 0.0f);
+    mtxScalef(mvp, fontScalef, fontScalef, fontScalef);
+    drawMesh(mesh, contextIndex, mvp);
 }
@@ -383,8 +383,15 @@ EDEN_BOOL EdenGLFontCleanupFontForContext(const int contextIndex, EDEN_GL_FONT_I
 
         Texture font use modifies blend settings, texturing enable settings,
         and vertex, texture coordinate pointers, and enabled client state of vertex, texture
-        and normal arrays. It also leaves texture matrix indeterminate on return.
+        and normal arrays.
+
+        The laid-out geometry of the most recently drawn strings is cached (keyed by string,
+        font and formatting settings, but not size or position), so redrawing unchanged text
+        requires no layout, and each call makes a single draw call.
     @param      contextIndex (description)
+    @param      viewProjection Under desktop OpenGL, NULL to draw using the current fixed-function
+        matrices, or a view-projection matrix to draw via EdenGLDraw, if EdenGLDrawIsActive().
+        Under OpenGL ES 2.0, the view-projection matrix (required).
     @param      line null-terminated string of characters to draw.
 	@param      hOffset Horizontal offset (in OpenGL coordinates) between the reference points
         specified in hOffsetType.
@@ -401,6 +408,27 @@ EDEN_BOOL EdenGLFontCleanupFontForContext(const int contextIndex, EDEN_GL_FONT_I
 */
 void EdenGLFontDrawLine(const int contextIndex, const float viewProjection[16], const unsigned char *line, const float hOffset, const float vOffset, H_OFFSET_TYPE hOffsetType, V_OFFSET_TYPE vOffsetType);
 
+/*!
+    @function
+    @abstract Get a line of text as line-segment geometry, for batched drawing.
+    @discussion
+        Lays out the line in the current font, size and formatting settings, exactly as
+        EdenGLFontDrawLine would draw it, but instead of drawing it writes each stroke out as
+        independent line segments. The result can be combined with other line geometry (e.g.
+        in a vertex buffer) and drawn with a single glDrawArrays(GL_LINES, ...) call, rather
+        than one draw call per stroke.
+
+        Only stroke fonts have line geometry. For texture fonts, 0 is returned.
+    @param line A null-terminated (C string) of the characters to lay out.
+    @param x Position (in OpenGL coordinates) of the left end of the text baseline.
+    @param y Position (in OpenGL coordinates) of the left end of the text baseline.
+    @param angle Rotation (in degrees, anticlockwise) of the text about (x, y).
+    @param vertices If non-NULL, the segment endpoints are written here as pairs of
+        vertices, 2 floats per vertex. Call first with NULL to find the size required.
+    @result Number of vertices (2 per segment).
+ */
+int EdenGLFontGetLineSegments(const unsigned char *line, const float x, const float y, const float angle, float *vertices);
+
 /*!
     @function 
     @abstract   Draw a block of multiple lines of text into the framebuffer.
@@ -422,8 +450,15 @@ void EdenGLFontDrawLine(const int contextIndex, const float viewProjection[16],
 
         Texture font use modifies blend settings, texturing enable settings,
         and vertex, texture coordinate pointers, and enabled client state of vertex, texture
-        and normal arrays. It also leaves texture matrix indeterminate on return.
+        and normal arrays.
+
+        The laid-out geometry of the most recently drawn strings is cached (keyed by string,
+        font and formatting settings, but not size or position), so redrawing unchanged text
+        requires no layout, and each call makes a single draw call.
 	@param      contextIndex (description)
+    @param      viewProjection Under desktop OpenGL, NULL to draw using the current fixed-function
+        matrices, or a view-projection matrix to draw via EdenGLDraw, if EdenGLDrawIsActive().
+        Under OpenGL ES 2.0, the view-projection matrix (required).
     @param      lines Array of null-terminated string of characters to draw.
     @param      lineCount Number of strings in array 'lines'.
     @param      hOffset Horizontal offset (in OpenGL coordinates) between the reference points
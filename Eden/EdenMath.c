@@ -0,0 +1,536 @@
+//
+//  EdenMath.c
+//  The Eden Library
+//
+//  Copyright (c) 2001-2017 Philip Lamb (PRL) phil@eden.net.nz. All rights reserved.
+//
+//	Rev		Date		Who		Changes
+//	1.0.0	2001-07-28	PRL		Initial version.
+//
+
+// @@BEGIN_EDEN_LICENSE_HEADER@@
+//
+//  This file is part of The Eden Library.
+//
+//  The Eden Library is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  The Eden Library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  along with The Eden Library.  If not, see <http://www.gnu.org/licenses/>.
+//
+//  As a special exception, the copyright holders of this library give you
+//  permission to link this library with independent modules to produce an
+//  executable, regardless of the license terms of these independent modules, and to
+//  copy and distribute the resulting executable under terms of your choice,
+//  provided that you also meet, for each linked independent module, the terms and
+//  conditions of the license of that module. An independent module is a module
+//  which is neither derived from nor based on this library. If you modify this
+//  library, you may extend this exception to your version of the library, but you
+//  are not obligated to do so. If you do not wish to do so, delete this exception
+//  statement from your version.
+//
+// @@END_EDEN_LICENSE_HEADER@@
+
+// ============================================================================
+//	Includes
+// ============================================================================
+#include <Eden/EdenMath.h>
+#include <string.h>						// memcpy()
+
+// SSE2 is always available on x86-64, and NEON on arm64, so these are compile-time choices.
+// AVX is chosen at runtime, where the compiler can target it per-function.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define EDEN_MATH_SSE2
+#  include <emmintrin.h>
+#  if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#    define EDEN_MATH_AVX
+#    include <immintrin.h>
+#    define EDEN_MATH_TARGET_AVX __attribute__((target("avx")))
+#  endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  define EDEN_MATH_NEON
+#  include <arm_neon.h>
+#endif
+
+// ============================================================================
+//	Private types and globals
+// ============================================================================
+
+typedef void (*MULT_MATRIX_FUNC)(float C[16], const float B[16], const float A[16]);
+typedef void (*MULT_MATRIXD_FUNC)(double C[16], const double B[16], const double A[16]);
+typedef void (*MULT_MATRIX_BY_VECTORS_FUNC)(float *q, const float A[16], const float *p, const int count);
+typedef void (*MULT_MATRIX_BY_VECTORSD_FUNC)(double *q, const double A[16], const double *p, const int count);
+
+static void multMatrixDispatch(float C[16], const float B[16], const float A[16]);
+static void multMatrixdDispatch(double C[16], const double B[16], const double A[16]);
+static void multMatrixByVectorsDispatch(float *q, const float A[16], const float *p, const int count);
+static void multMatrixByVectorsdDispatch(double *q, const double A[16], const double *p, const int count);
+
+// Resolved on first use. Threads racing to resolve them will all store the same values.
+static MULT_MATRIX_FUNC gMultMatrix = multMatrixDispatch;
+static MULT_MATRIXD_FUNC gMultMatrixd = multMatrixdDispatch;
+static MULT_MATRIX_BY_VECTORS_FUNC gMultMatrixByVectors = multMatrixByVectorsDispatch;
+static MULT_MATRIX_BY_VECTORSD_FUNC gMultMatrixByVectorsd = multMatrixByVectorsdDispatch;
+static const char *gImplementation = NULL;
+
+// ============================================================================
+//	Scalar implementations
+// ============================================================================
+
+// C = A.B. C may alias A or B.
+static void multMatrixScalar(float C[16], const float B[16], const float A[16])
+{
+    float T[16];
+    int i, j;
+
+    for (j = 0; j < 4; j++) {
+        for (i = 0; i < 4; i++) {
+            T[j*4 + i] = A[i]*B[j*4] + A[4 + i]*B[j*4 + 1] + A[8 + i]*B[j*4 + 2] + A[12 + i]*B[j*4 + 3];
+        }
+    }
+    memcpy(C, T, sizeof(T));
+}
+
+static void multMatrixdScalar(double C[16], const double B[16], const double A[16])
+{
+    double T[16];
+    int i, j;
+
+    for (j = 0; j < 4; j++) {
+        for (i = 0; i < 4; i++) {
+            T[j*4 + i] = A[i]*B[j*4] + A[4 + i]*B[j*4 + 1] + A[8 + i]*B[j*4 + 2] + A[12 + i]*B[j*4 + 3];
+        }
+    }
+    memcpy(C, T, sizeof(T));
+}
+
+// q[n] = A.p[n] for count 4-vectors. q may alias p.
+static void multMatrixByVectorsScalar(float *q, const float A[16], const float *p, const int count)
+{
+    float x, y, z, w;
+    int n;
+
+    for (n = 0; n < count; n++, p += 4, q += 4) {
+        x = p[0]; y = p[1]; z = p[2]; w = p[3];
+        q[0] = A[0]*x + A[4]*y + A[8]*z  + A[12]*w;
+        q[1] = A[1]*x + A[5]*y + A[9]*z  + A[13]*w;
+        q[2] = A[2]*x + A[6]*y + A[10]*z + A[14]*w;
+        q[3] = A[3]*x + A[7]*y + A[11]*z + A[15]*w;
+    }
+}
+
+static void multMatrixByVectorsdScalar(double *q, const double A[16], const double *p, const int count)
+{
+    double x, y, z, w;
+    int n;
+
+    for (n = 0; n < count; n++, p += 4, q += 4) {
+        x = p[0]; y = p[1]; z = p[2]; w = p[3];
+        q[0] = A[0]*x + A[4]*y + A[8]*z  + A[12]*w;
+        q[1] = A[1]*x + A[5]*y + A[9]*z  + A[13]*w;
+        q[2] = A[2]*x + A[6]*y + A[10]*z + A[14]*w;
+        q[3] = A[3]*x + A[7]*y + A[11]*z + A[15]*w;
+    }
+}
+
+// ============================================================================
+//	SSE2 implementations
+// ============================================================================
+#ifdef EDEN_MATH_SSE2
+
+static void multMatrixSSE2(float C[16], const float B[16], const float A[16])
+{
+    const __m128 a0 = _mm_loadu_ps(A), a1 = _mm_loadu_ps(A + 4), a2 = _mm_loadu_ps(A + 8), a3 = _mm_loadu_ps(A + 12);
+    __m128 c[4];
+    int j;
+
+    // Column j of C is column j of B transformed by A.
+    for (j = 0; j < 4; j++) {
+        c[j] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a0, _mm_set1_ps(B[j*4])),     _mm_mul_ps(a1, _mm_set1_ps(B[j*4 + 1]))),
+                          _mm_add_ps(_mm_mul_ps(a2, _mm_set1_ps(B[j*4 + 2])), _mm_mul_ps(a3, _mm_set1_ps(B[j*4 + 3]))));
+    }
+    for (j = 0; j < 4; j++) _mm_storeu_ps(C + j*4, c[j]);
+}
+
+static void multMatrixdSSE2(double C[16], const double B[16], const double A[16])
+{
+    __m128d a[8], c[8], b;
+    int i, j;
+
+    for (i = 0; i < 8; i++) a[i] = _mm_loadu_pd(A + i*2);
+    for (j = 0; j < 4; j++) {
+        b = _mm_set1_pd(B[j*4]);
+        c[j*2]     = _mm_mul_pd(a[0], b);
+        c[j*2 + 1] = _mm_mul_pd(a[1], b);
+        for (i = 1; i < 4; i++) {
+            b = _mm_set1_pd(B[j*4 + i]);
+            c[j*2]     = _mm_add_pd(c[j*2],     _mm_mul_pd(a[i*2], b));
+            c[j*2 + 1] = _mm_add_pd(c[j*2 + 1], _mm_mul_pd(a[i*2 + 1], b));
+        }
+    }
+    for (i = 0; i < 8; i++) _mm_storeu_pd(C + i*2, c[i]);
+}
+
+static void multMatrixByVectorsSSE2(float *q, const float A[16], const float *p, const int count)
+{
+    const __m128 a0 = _mm_loadu_ps(A), a1 = _mm_loadu_ps(A + 4), a2 = _mm_loadu_ps(A + 8), a3 = _mm_loadu_ps(A + 12);
+    __m128 v;
+    int n;
+
+    for (n = 0; n < count; n++, p += 4, q += 4) {
+        v = _mm_loadu_ps(p);
+        v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a0, _mm_shuffle_ps(v, v, 0x00)), _mm_mul_ps(a1, _mm_shuffle_ps(v, v, 0x55))),
+                       _mm_add_ps(_mm_mul_ps(a2, _mm_shuffle_ps(v, v, 0xAA)), _mm_mul_ps(a3, _mm_shuffle_ps(v, v, 0xFF))));
+        _mm_storeu_ps(q, v);
+    }
+}
+
+static void multMatrixByVectorsdSSE2(double *q, const double A[16], const double *p, const int count)
+{
+    __m128d a[8], lo, hi, b;
+    int i, n;
+
+    for (i = 0; i < 8; i++) a[i] = _mm_loadu_pd(A + i*2);
+    for (n = 0; n < count; n++, p += 4, q += 4) {
+        b = _mm_set1_pd(p[0]);
+        lo = _mm_mul_pd(a[0], b);
+        hi = _mm_mul_pd(a[1], b);
+        for (i = 1; i < 4; i++) {
+            b = _mm_set1_pd(p[i]);
+            lo = _mm_add_pd(lo, _mm_mul_pd(a[i*2], b));
+            hi = _mm_add_pd(hi, _mm_mul_pd(a[i*2 + 1], b));
+        }
+        _mm_storeu_pd(q, lo);
+        _mm_storeu_pd(q + 2, hi);
+    }
+}
+
+#endif // EDEN_MATH_SSE2
+
+// ============================================================================
+//	AVX implementations
+// ============================================================================
+#ifdef EDEN_MATH_AVX
+
+// Two columns at a time: each 128-bit lane holds one column, and in-lane shuffles broadcast its elements.
+EDEN_MATH_TARGET_AVX static void multMatrixAVX(float C[16], const float B[16], const float A[16])
+{
+    const __m256 a0 = _mm256_broadcast_ps((const __m128 *)A), a1 = _mm256_broadcast_ps((const __m128 *)(A + 4));
+    const __m256 a2 = _mm256_broadcast_ps((const __m128 *)(A + 8)), a3 = _mm256_broadcast_ps((const __m128 *)(A + 12));
+    const __m256 b01 = _mm256_loadu_ps(B), b23 = _mm256_loadu_ps(B + 8);
+    __m256 c01, c23;
+
+    c01 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a0, _mm256_shuffle_ps(b01, b01, 0x00)), _mm256_mul_ps(a1, _mm256_shuffle_ps(b01, b01, 0x55))),
+                        _mm256_add_ps(_mm256_mul_ps(a2, _mm256_shuffle_ps(b01, b01, 0xAA)), _mm256_mul_ps(a3, _mm256_shuffle_ps(b01, b01, 0xFF))));
+    c23 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a0, _mm256_shuffle_ps(b23, b23, 0x00)), _mm256_mul_ps(a1, _mm256_shuffle_ps(b23, b23, 0x55))),
+                        _mm256_add_ps(_mm256_mul_ps(a2, _mm256_shuffle_ps(b23, b23, 0xAA)), _mm256_mul_ps(a3, _mm256_shuffle_ps(b23, b23, 0xFF))));
+    _mm256_storeu_ps(C, c01);
+    _mm256_storeu_ps(C + 8, c23);
+}
+
+// One column per register.
+EDEN_MATH_TARGET_AVX static void multMatrixdAVX(double C[16], const double B[16], const double A[16])
+{
+    const __m256d a0 = _mm256_loadu_pd(A), a1 = _mm256_loadu_pd(A + 4), a2 = _mm256_loadu_pd(A + 8), a3 = _mm256_loadu_pd(A + 12);
+    __m256d c[4];
+    int j;
+
+    for (j = 0; j < 4; j++) {
+        c[j] = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(a0, _mm256_broadcast_sd(B + j*4)),     _mm256_mul_pd(a1, _mm256_broadcast_sd(B + j*4 + 1))),
+                             _mm256_add_pd(_mm256_mul_pd(a2, _mm256_broadcast_sd(B + j*4 + 2)), _mm256_mul_pd(a3, _mm256_broadcast_sd(B + j*4 + 3))));
+    }
+    for (j = 0; j < 4; j++) _mm256_storeu_pd(C + j*4, c[j]);
+}
+
+// Two vectors at a time, as for multMatrixAVX().
+EDEN_MATH_TARGET_AVX static void multMatrixByVectorsAVX(float *q, const float A[16], const float *p, const int count)
+{
+    const __m256 a0 = _mm256_broadcast_ps((const __m128 *)A), a1 = _mm256_broadcast_ps((const __m128 *)(A + 4));
+    const __m256 a2 = _mm256_broadcast_ps((const __m128 *)(A + 8)), a3 = _mm256_broadcast_ps((const __m128 *)(A + 12));
+    __m256 v;
+    int n;
+
+    for (n = 0; n + 2 <= count; n += 2, p += 8, q += 8) {
+        v = _mm256_loadu_ps(p);
+        v = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a0, _mm256_shuffle_ps(v, v, 0x00)), _mm256_mul_ps(a1, _mm256_shuffle_ps(v, v, 0x55))),
+                          _mm256_add_ps(_mm256_mul_ps(a2, _mm256_shuffle_ps(v, v, 0xAA)), _mm256_mul_ps(a3, _mm256_shuffle_ps(v, v, 0xFF))));
+        _mm256_storeu_ps(q, v);
+    }
+    if (n < count) multMatrixByVectorsSSE2(q, A, p, count - n);
+}
+
+EDEN_MATH_TARGET_AVX static void multMatrixByVectorsdAVX(double *q, const double A[16], const double *p, const int count)
+{
+    const __m256d a0 = _mm256_loadu_pd(A), a1 = _mm256_loadu_pd(A + 4), a2 = _mm256_loadu_pd(A + 8), a3 = _mm256_loadu_pd(A + 12);
+    __m256d v;
+    int n;
+
+    for (n = 0; n < count; n++, p += 4, q += 4) {
+        v = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(a0, _mm256_broadcast_sd(p)),     _mm256_mul_pd(a1, _mm256_broadcast_sd(p + 1))),
+                          _mm256_add_pd(_mm256_mul_pd(a2, _mm256_broadcast_sd(p + 2)), _mm256_mul_pd(a3, _mm256_broadcast_sd(p + 3))));
+        _mm256_storeu_pd(q, v);
+    }
+}
+
+#endif // EDEN_MATH_AVX
+
+// ============================================================================
+//	NEON implementations
+// ============================================================================
+#ifdef EDEN_MATH_NEON
+
+static void multMatrixNEON(float C[16], const float B[16], const float A[16])
+{
+    const float32x4_t a0 = vld1q_f32(A), a1 = vld1q_f32(A + 4), a2 = vld1q_f32(A + 8), a3 = vld1q_f32(A + 12);
+    float32x4_t c[4], b;
+    int j;
+
+    for (j = 0; j < 4; j++) {
+        b = vld1q_f32(B + j*4);
+        c[j] = vmulq_lane_f32(a0, vget_low_f32(b), 0);
+        c[j] = vmlaq_lane_f32(c[j], a1, vget_low_f32(b), 1);
+        c[j] = vmlaq_lane_f32(c[j], a2, vget_high_f32(b), 0);
+        c[j] = vmlaq_lane_f32(c[j], a3, vget_high_f32(b), 1);
+    }
+    for (j = 0; j < 4; j++) vst1q_f32(C + j*4, c[j]);
+}
+
+static void multMatrixByVectorsNEON(float *q, const float A[16], const float *p, const int count)
+{
+    const float32x4_t a0 = vld1q_f32(A), a1 = vld1q_f32(A + 4), a2 = vld1q_f32(A + 8), a3 = vld1q_f32(A + 12);
+    float32x4_t v, r;
+    int n;
+
+    for (n = 0; n < count; n++, p += 4, q += 4) {
+        v = vld1q_f32(p);
+        r = vmulq_lane_f32(a0, vget_low_f32(v), 0);
+        r = vmlaq_lane_f32(r, a1, vget_low_f32(v), 1);
+        r = vmlaq_lane_f32(r, a2, vget_high_f32(v), 0);
+        r = vmlaq_lane_f32(r, a3, vget_high_f32(v), 1);
+        vst1q_f32(q, r);
+    }
+}
+
+#endif // EDEN_MATH_NEON
+
+// ============================================================================
+//	Dispatch
+// ============================================================================
+
+static void resolve(void)
+{
+    MULT_MATRIX_FUNC multMatrix = multMatrixScalar;
+    MULT_MATRIXD_FUNC multMatrixd = multMatrixdScalar;
+    MULT_MATRIX_BY_VECTORS_FUNC multMatrixByVectors = multMatrixByVectorsScalar;
+    MULT_MATRIX_BY_VECTORSD_FUNC multMatrixByVectorsd = multMatrixByVectorsdScalar;
+    const char *implementation = "scalar";
+
+#if defined(EDEN_MATH_SSE2)
+    multMatrix = multMatrixSSE2;
+    multMatrixd = multMatrixdSSE2;
+    multMatrixByVectors = multMatrixByVectorsSSE2;
+    multMatrixByVectorsd = multMatrixByVectorsdSSE2;
+    implementation = "SSE2";
+#  if defined(EDEN_MATH_AVX)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx")) {
+        multMatrix = multMatrixAVX;
+        multMatrixd = multMatrixdAVX;
+        multMatrixByVectors = multMatrixByVectorsAVX;
+        multMatrixByVectorsd = multMatrixByVectorsdAVX;
+        implementation = "AVX";
+    }
+#  endif
+#elif defined(EDEN_MATH_NEON)
+    multMatrix = multMatrixNEON;
+    multMatrixByVectors = multMatrixByVectorsNEON;
+    implementation = "NEON";
+#endif
+
+    gMultMatrix = multMatrix;
+    gMultMatrixd = multMatrixd;
+    gMultMatrixByVectors = multMatrixByVectors;
+    gMultMatrixByVectorsd = multMatrixByVectorsd;
+    gImplementation = implementation;
+}
+
+static void multMatrixDispatch(float C[16], const float B[16], const float A[16])
+{
+    resolve();
+    (*gMultMatrix)(C, B, A);
+}
+
+static void multMatrixdDispatch(double C[16], const double B[16], const double A[16])
+{
+    resolve();
+    (*gMultMatrixd)(C, B, A);
+}
+
+static void multMatrixByVectorsDispatch(float *q, const float A[16], const float *p, const int count)
+{
+    resolve();
+    (*gMultMatrixByVectors)(q, A, p, count);
+}
+
+static void multMatrixByVectorsdDispatch(double *q, const double A[16], const double *p, const int count)
+{
+    resolve();
+    (*gMultMatrixByVectorsd)(q, A, p, count);
+}
+
+// ============================================================================
+//	Public functions
+// ============================================================================
+
+const char *EdenMathImplementation(void)
+{
+    if (!gImplementation) resolve();
+    return (gImplementation);
+}
+
+void EdenMathIdentityMatrix(float mtx16[16])
+{
+    static const float identity[16] = {1.0f, 0.0f, 0.0f, 0.0f,  0.0f, 1.0f, 0.0f, 0.0f,  0.0f, 0.0f, 1.0f, 0.0f,  0.0f, 0.0f, 0.0f, 1.0f};
+    memcpy(mtx16, identity, sizeof(identity));
+}
+
+void EdenMathMultMatrix(float C[16], const float B[16], const float A[16])
+{
+    (*gMultMatrix)(C, B, A);
+}
+
+void EdenMathMultMatrixd(double C[16], const double B[16], const double A[16])
+{
+    (*gMultMatrixd)(C, B, A);
+}
+
+void EdenMathMultMatrixByVector(float q[4], const float A[16], const float p[4])
+{
+    (*gMultMatrixByVectors)(q, A, p, 1);
+}
+
+void EdenMathMultMatrixByVectord(double q[4], const double A[16], const double p[4])
+{
+    (*gMultMatrixByVectorsd)(q, A, p, 1);
+}
+
+void EdenMathMultMatrixByVectors(float *q, const float A[16], const float *p, const int count)
+{
+    if (count <= 0) return;
+    (*gMultMatrixByVectors)(q, A, p, count);
+}
+
+void EdenMathMultMatrixByVectorsd(double *q, const double A[16], const double *p, const int count)
+{
+    if (count <= 0) return;
+    (*gMultMatrixByVectorsd)(q, A, p, count);
+}
+
+// Points are widened to 4-vectors with w = 1, a batch at a time, so that the 4-vector kernels can be used.
+#define TRANSFORM_POINTS_BATCH 64
+
+void EdenMathTransformPoints(float *q, const float A[16], const float *p, const int count)
+{
+    float buf[TRANSFORM_POINTS_BATCH*4];
+    int n, i, batch;
+
+    for (n = 0; n < count; n += batch, p += batch*3, q += batch*3) {
+        batch = MIN(count - n, TRANSFORM_POINTS_BATCH);
+        for (i = 0; i < batch; i++) {
+            buf[i*4] = p[i*3]; buf[i*4 + 1] = p[i*3 + 1]; buf[i*4 + 2] = p[i*3 + 2]; buf[i*4 + 3] = 1.0f;
+        }
+        (*gMultMatrixByVectors)(buf, A, buf, batch);
+        for (i = 0; i < batch; i++) {
+            q[i*3] = buf[i*4]; q[i*3 + 1] = buf[i*4 + 1]; q[i*3 + 2] = buf[i*4 + 2];
+        }
+    }
+}
+
+void EdenMathTransformPointsd(double *q, const double A[16], const double *p, const int count)
+{
+    double buf[TRANSFORM_POINTS_BATCH*4];
+    int n, i, batch;
+
+    for (n = 0; n < count; n += batch, p += batch*3, q += batch*3) {
+        batch = MIN(count - n, TRANSFORM_POINTS_BATCH);
+        for (i = 0; i < batch; i++) {
+            buf[i*4] = p[i*3]; buf[i*4 + 1] = p[i*3 + 1]; buf[i*4 + 2] = p[i*3 + 2]; buf[i*4 + 3] = 1.0;
+        }
+        (*gMultMatrixByVectorsd)(buf, A, buf, batch);
+        for (i = 0; i < batch; i++) {
+            q[i*3] = buf[i*4]; q[i*3 + 1] = buf[i*4 + 1]; q[i*3 + 2] = buf[i*4 + 2];
+        }
+    }
+}
+
+// Gauss-Jordan elimination with partial pivoting. Kept scalar, as it is dominated by pivot
+// selection and row exchanges rather than arithmetic.
+EDEN_BOOL EdenMathInvertMatrixd(double out[16], const double m[16])
+{
+    double wtmp[4][8];
+    double *r[4];
+    double mx, t;
+    int i, j, k, p;
+
+    // Augment [m | I], working in rows (i.e. on the transpose of the column-major input).
+    for (i = 0; i < 4; i++) {
+        r[i] = wtmp[i];
+        for (j = 0; j < 4; j++) {
+            r[i][j] = m[j*4 + i];
+            r[i][j + 4] = (i == j ? 1.0 : 0.0);
+        }
+    }
+
+    for (k = 0; k < 4; k++) {
+        // Choose pivot.
+        p = k;
+        mx = fabs(r[k][k]);
+        for (i = k + 1; i < 4; i++) {
+            if (fabs(r[i][k]) > mx) {
+                mx = fabs(r[i][k]);
+                p = i;
+            }
+        }
+        if (mx == 0.0) return (FALSE);
+        if (p != k) {
+            double *s = r[p];
+            r[p] = r[k];
+            r[k] = s;
+        }
+
+        // Normalise pivot row, then eliminate column k from other rows.
+        t = 1.0 / r[k][k];
+        for (j = k; j < 8; j++) r[k][j] *= t;
+        for (i = 0; i < 4; i++) {
+            if (i == k) continue;
+            t = r[i][k];
+            if (t == 0.0) continue;
+            for (j = k; j < 8; j++) r[i][j] -= t * r[k][j];
+        }
+    }
+
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < 4; j++) {
+            out[j*4 + i] = r[i][j + 4];
+        }
+    }
+    return (TRUE);
+}
+
+EDEN_BOOL EdenMathInvertMatrix(float out[16], const float m[16])
+{
+    double md[16], outd[16];
+    int i;
+
+    for (i = 0; i < 16; i++) md[i] = m[i];
+    if (!EdenMathInvertMatrixd(outd, md)) return (FALSE);
+    for (i = 0; i < 16; i++) out[i] = (float)outd[i];
+    return (TRUE);
+}
@@ -404,6 +404,65 @@ void EdenMathMultMatrixByVector(float q[4], const float A[16], const float p[4])
 */
 void EdenMathMultMatrixByVectord(double q[4], const double A[16], const double p[4]);
 
+/*!
+    @function
+    @abstract   Multiplies 4x4 matrix A into each of an array of column vectors.
+    @discussion
+        A is in column-major form. The vectors are packed 4 floats apiece. q may be the same
+        array as p.
+    @param      q Array of count 4-vectors which will receive the results.
+    @param      A 4x4 matrix in column-major form.
+    @param      p Array of count 4-vectors.
+    @param      count Number of vectors.
+*/
+void EdenMathMultMatrixByVectors(float *q, const float A[16], const float *p, const int count);
+
+/*!
+    @function
+    @abstract   Multiplies 4x4 matrix A into each of an array of column vectors.
+    @discussion
+        A is in column-major form. The vectors are packed 4 doubles apiece. q may be the same
+        array as p.
+    @param      q Array of count 4-vectors which will receive the results.
+    @param      A 4x4 matrix in column-major form.
+    @param      p Array of count 4-vectors.
+    @param      count Number of vectors.
+*/
+void EdenMathMultMatrixByVectorsd(double *q, const double A[16], const double *p, const int count);
+
+/*!
+    @function
+    @abstract   Transforms an array of 3D points by 4x4 matrix A.
+    @discussion
+        Each point (x, y, z) is treated as the column vector (x, y, z, 1), and the x, y and z
+        components of the result are stored. No perspective division is done. q may be the same
+        array as p.
+    @param      q Array of count points (3 floats apiece) which will receive the results.
+    @param      A 4x4 matrix in column-major form.
+    @param      p Array of count points (3 floats apiece).
+    @param      count Number of points.
+*/
+void EdenMathTransformPoints(float *q, const float A[16], const float *p, const int count);
+
+/*!
+    @function
+    @abstract   Transforms an array of 3D points by 4x4 matrix A.
+    @discussion
+        As for EdenMathTransformPoints(), but in double precision.
+*/
+void EdenMathTransformPointsd(double *q, const double A[16], const double *p, const int count);
+
+/*!
+    @function
+    @abstract   Find out which implementation of the matrix functions is in use.
+    @discussion
+        The matrix multiplication and vector transformation functions use SSE2 or NEON
+        where the compiler targets them, and AVX where the CPU supports it, chosen on
+        first use.
+    @result     A string naming the implementation, e.g. "AVX", "SSE2", "NEON" or "scalar".
+*/
+const char *EdenMathImplementation(void);
+
 /*!
     @function 
     @abstract   Creates a matrix which represents translation by a vector.
@@ -64,8 +64,9 @@ typedef unsigned char bool;
 #include <Eden/EdenSurfaces.h>	// TEXTURE_INFO_t, TEXTURE_INDEX_t, SurfacesTextureLoad(), SurfacesTextureSet(), SurfacesTextureUnload()
 #include <Eden/EdenGLFont.h>
 #if EDEN_USE_GL
-#  define USE_GL_STATE_CACHE 0
+#  define USE_GL_STATE_CACHE 1
 #  include <Eden/glStateCache.h>
+#  include <Eden/EdenGLDraw.h>
 #elif EDEN_USE_GLES2
 #  include <AR6/ARG/glStateCache2.h>
 #  include <AR6/ARG/arg_shader_gl.h>
@@ -79,6 +80,12 @@ typedef unsigned char bool;
 #define BOX_LINES_MAX 80
 #define BOX_LINE_LENGTH_MAX 1023
 
+// Font metrics used in text layout, so that layout needn't query the font per character.
+typedef struct _boxFontMetrics {
+    float advances[256];            // Width in pixels of each character, as from EdenGLFontGetCharacterWidth().
+    float interCharSpacingWidth;    // Width in pixels of the space between adjacent characters.
+} boxFontMetrics_t;
+
 typedef struct _boxSettings {
     pthread_mutex_t lock;
 	float boxWidth;				// Pixel width of box.
@@ -90,6 +97,12 @@ typedef struct _boxSettings {
     unsigned char *text;
 	unsigned char *lines[BOX_LINES_MAX];
 	int lineCount;
+    // Inputs to the current layout of 'lines'. Layout is redone only if one of these, or 'text', changes.
+    EDEN_BOOL layoutValid;
+    float layoutBoxWidth;
+    float layoutPaddingH;
+    float layoutSoftwrapRatio;
+    boxFontMetrics_t layoutMetrics;
 } boxSettings_t;
 
 //#define DEBUG_MESSAGE					// Uncomment to show extra debugging info.
@@ -153,9 +166,19 @@ EDEN_BOOL gEdenMessageKeyboardRequired = FALSE;		// EdenMessageInputKeyboard sho
 // Private functions.
 //
 
+static void boxFontMetricsGet(boxFontMetrics_t *metrics)
+{
+    int i;
+    
+    for (i = 0; i < 256; i++) metrics->advances[i] = EdenGLFontGetCharacterWidth((unsigned char)i);
+    metrics->interCharSpacingWidth = EdenGLFontGetLineWidth((const unsigned char *)"--") - 2.0f*metrics->advances['-'];
+}
+
 // Can pass NULL for parameter 'text' in which case previous text is reused.
-// Depends on settings 'text', 'boxWidth', 'boxPaddingH'.
+// Depends on settings 'text', 'boxWidth', 'boxPaddingH', 'softwrapRatio', and the current font.
 // Sets settings 'text', 'lines', 'lineCount', 'boxHeight'.
+// Lines are reflowed only if the text or one of its dependencies has changed. Line widths are kept as running
+// sums of per-character advances, so layout is linear in the length of the text.
 static void boxSetText(boxSettings_t *settings, const unsigned char *text)
 {
 	int i;
@@ -164,7 +187,7 @@ static void boxSetText(boxSettings_t *settings, const unsigned char *text)
  	float boxTextWidth;
 	float boxTextWidthSoftwrap;
 	float hyphenWidth;
-    float interCharSpacingWidth;
+    boxFontMetrics_t metrics;
     
 	unsigned char c = '\0', c0, c1; // current, previous, next char.
 	int lineLength = 0;
@@ -173,11 +196,21 @@ static void boxSetText(boxSettings_t *settings, const unsigned char *text)
    
 	if (!settings) return;
     
+    boxFontMetricsGet(&metrics);
+    
     pthread_mutex_lock(&settings->lock);
     
-    if (text) {
+    if (text && !(settings->text && strcmp((const char *)text, (const char *)settings->text) == 0)) {
         free(settings->text);
         settings->text = (unsigned char *)strdup((char *)text);
+        settings->layoutValid = FALSE;
+    }
+    if (settings->layoutValid &&
+        settings->layoutBoxWidth == settings->boxWidth &&
+        settings->layoutPaddingH == settings->boxPaddingH &&
+        settings->layoutSoftwrapRatio == settings->softwrapRatio &&
+        memcmp(&settings->layoutMetrics, &metrics, sizeof(boxFontMetrics_t)) == 0) {
+        goto layoutDone; // Existing layout is still valid.
     }
     
 	// Free old lines.
@@ -191,8 +224,7 @@ static void boxSetText(boxSettings_t *settings, const unsigned char *text)
     
 	boxTextWidth = settings->boxWidth - 2*settings->boxPaddingH;
 	boxTextWidthSoftwrap = boxTextWidth*settings->softwrapRatio;
-	hyphenWidth = EdenGLFontGetCharacterWidth('-');
-    interCharSpacingWidth = EdenGLFontGetLineWidth((const unsigned char *)"--") - 2.0f*hyphenWidth;
+	hyphenWidth = metrics.advances['-'];
     
     if (settings->text) {
         // Split text into lines, softwrapping on whitespace if possible.
@@ -215,7 +247,8 @@ static void boxSetText(boxSettings_t *settings, const unsigned char *text)
             } else {
                 bool addChar = false;
                 // Is there still room for a hyphen after this character?
-                float predictedLineWidth = lineWidth + interCharSpacingWidth + EdenGLFontGetCharacterWidth(settings->text[textIndex]);
+                float charWidth = (lineLength ? metrics.interCharSpacingWidth : 0.0f) + metrics.advances[c];
+                float predictedLineWidth = lineWidth + metrics.interCharSpacingWidth + metrics.advances[c];
                 if (predictedLineWidth < (boxTextWidth - hyphenWidth)) {
                     addChar = true;
                 } else {
@@ -240,7 +273,7 @@ static void boxSetText(boxSettings_t *settings, const unsigned char *text)
                 if (addChar) {
                     lineBuf[lineLength++] = c;
                     lineBuf[lineLength] = '\0';
-                    lineWidth = EdenGLFontGetLineWidth(lineBuf);
+                    lineWidth += charWidth;
                     if (lineLength == BOX_LINE_LENGTH_MAX) newline = true; // Next char would overflow buffer, so break now.
                     textIndex++;
                 }
@@ -258,6 +291,13 @@ static void boxSetText(boxSettings_t *settings, const unsigned char *text)
         } while (!done);
     }
     
+    settings->layoutValid = TRUE;
+    settings->layoutBoxWidth = settings->boxWidth;
+    settings->layoutPaddingH = settings->boxPaddingH;
+    settings->layoutSoftwrapRatio = settings->softwrapRatio;
+    settings->layoutMetrics = metrics;
+    
+layoutDone:
     settings->boxHeight = EdenGLFontGetBlockHeight((const unsigned char **)settings->lines, settings->lineCount) + 2.0f*settings->boxPaddingV;
 
     pthread_mutex_unlock(&settings->lock);
@@ -649,20 +689,27 @@ void EdenMessageDraw(const int contextIndex, const float viewProjection[16])
 	if (gBoxSettings->lineCount) {
         // Draw the semi-transparent black shaded box and white outline.
 #if EDEN_USE_GL
-        glStateCacheBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-        glStateCacheEnableBlend();
-        glVertexPointer(2, GL_FLOAT, 0, boxVertices);
-        glStateCacheEnableClientStateVertexArray();
-        glStateCacheDisableClientStateNormalArray();
-        glStateCacheClientActiveTexture(GL_TEXTURE0);
-        glStateCacheDisableClientStateTexCoordArray();
-        glColor4f(0.0f, 0.0f, 0.0f, 0.5f);	// 50% transparent black.
-        glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-        glStateCacheDisableBlend();
-        glColor4f(1.0f, 1.0f, 1.0f, 1.0f); // Opaque white.
-        glDrawArrays(GL_LINE_LOOP, 0, 4);
+        if (viewProjection && EdenGLDrawIsActive()) {
+            const float boxColor[4] = {0.0f, 0.0f, 0.0f, 0.5f};	// 50% transparent black.
+            const float outlineColor[4] = {1.0f, 1.0f, 1.0f, 1.0f}; // Opaque white.
+            EdenGLDrawArrays(viewProjection, boxColor, EDEN_GL_DRAW_SHADING_COLOR, GL_TRIANGLE_FAN, &boxVertices[0][0], NULL, 4);
+            EdenGLDrawArrays(viewProjection, outlineColor, EDEN_GL_DRAW_SHADING_COLOR, GL_LINE_LOOP, &boxVertices[0][0], NULL, 4);
+        } else {
+            glStateCacheBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            glStateCacheEnableBlend();
+            glVertexPointer(2, GL_FLOAT, 0, boxVertices);
+            glStateCacheEnableClientStateVertexArray();
+            glStateCacheDisableClientStateNormalArray();
+            glStateCacheClientActiveTexture(GL_TEXTURE0);
+            glStateCacheDisableClientStateTexCoordArray();
+            glStateCacheColor4f(0.0f, 0.0f, 0.0f, 0.5f);	// 50% transparent black.
+            glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+            glStateCacheDisableBlend();
+            glStateCacheColor4f(1.0f, 1.0f, 1.0f, 1.0f); // Opaque white.
+            glDrawArrays(GL_LINE_LOOP, 0, 4);
+        }
         
-        EdenGLFontDrawBlock(contextIndex, NULL, (const unsigned char **)gBoxSettings->lines, gBoxSettings->lineCount, 0.0f, 0.0f, H_OFFSET_VIEW_CENTER_TO_TEXT_CENTER, V_OFFSET_VIEW_CENTER_TO_TEXT_CENTER);
+        EdenGLFontDrawBlock(contextIndex, viewProjection, (const unsigned char **)gBoxSettings->lines, gBoxSettings->lineCount, 0.0f, 0.0f, H_OFFSET_VIEW_CENTER_TO_TEXT_CENTER, V_OFFSET_VIEW_CENTER_TO_TEXT_CENTER);
 #elif EDEN_USE_GLES2
         glUseProgram(program);
         glUniformMatrix4fv(uniforms[UNIFORM_MODELVIEW_PROJECTION_MATRIX], 1, GL_FALSE, viewProjection);
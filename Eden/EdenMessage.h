@@ -258,6 +258,9 @@ void EdenMessageSetBoxParams(const float width, const float padding);
 		This drawing call is required in order to see the output of the
 		message routines, in both single- and multi-threaded applications.
 	@param      contextIndex (description)
+    @param      viewProjection Under desktop OpenGL, NULL to draw using the current fixed-function
+        matrices, or a 2D orthographic view-projection matrix to draw via EdenGLDraw, if
+        EdenGLDrawIsActive(). Under OpenGL ES 2.0, the view-projection matrix (required).
 */
 void EdenMessageDraw(const int contextIndex, const float viewProjection[16]);
 
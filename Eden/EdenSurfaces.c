@@ -47,9 +47,15 @@
 #include <stdio.h>
 #include <string.h>				// strcmp()
 #include <stdlib.h>				// malloc(), calloc(), free()
-#include <Eden/readtex.h>			// ReadTex()
+#include <stdint.h>				// uint32_t
+#include <Eden/readtex.h>			// ReadTexScaled(), ReadTexCacheSetLimit()
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
+#endif
 #if EDEN_USE_GL
-#  define USE_GL_STATE_CACHE 0
+#  define USE_GL_STATE_CACHE 1
 #  include <Eden/glStateCache.h>
 #elif EDEN_USE_GLES2
 #  include <AR6/ARG/glStateCache2.h>
@@ -65,6 +71,10 @@
 // ============================================================================
 //#define SURFACES_DEBUG			// Uncomment to build version that outputs debug info to stderr.
 
+// Decoded images are cached while surfaces are in use, since the same file is loaded once into each
+// active context, and again whenever a context's textures are unloaded and reloaded.
+#define SURFACES_READTEX_CACHE_LIMIT (8*1024*1024)
+
 typedef struct {
 	GLuint		name;
 	GLint		env_mode;
@@ -84,6 +94,231 @@ static unsigned int gTextureIndexMax = 0;
 static int gSurfacesContextsActiveCount = 0;
 
 
+// ============================================================================
+//	Private functions
+// ============================================================================
+
+//
+// Image flipping and format conversion.
+//
+// Flips are done by swapping whole rows (vertical) and by walking pixels inwards from both ends
+// (horizontal). Both touch each byte once, and the common cases are done 16 bytes at a time with
+// SSE2 or NEON where the compiler targets them. Expanding 1- and 3-channel images to RGBA is done
+// in the same pass as the flip, into a new buffer.
+//
+
+// Swap n bytes between a and b, which must not overlap.
+static void rowSwap(unsigned char *a, unsigned char *b, size_t n)
+{
+#if defined(__SSE2__)
+    for (; n >= 16; n -= 16, a += 16, b += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)a);
+        __m128i vb = _mm_loadu_si128((const __m128i *)b);
+        _mm_storeu_si128((__m128i *)a, vb);
+        _mm_storeu_si128((__m128i *)b, va);
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    for (; n >= 16; n -= 16, a += 16, b += 16) {
+        uint8x16_t va = vld1q_u8(a);
+        uint8x16_t vb = vld1q_u8(b);
+        vst1q_u8(a, vb);
+        vst1q_u8(b, va);
+    }
+#else
+    unsigned char t[64];
+    for (; n >= sizeof(t); n -= sizeof(t), a += sizeof(t), b += sizeof(t)) {
+        memcpy(t, a, sizeof(t));
+        memcpy(a, b, sizeof(t));
+        memcpy(b, t, sizeof(t));
+    }
+#endif
+    for (; n; n--, a++, b++) {
+        unsigned char t = *a;
+        *a = *b;
+        *b = t;
+    }
+}
+
+#if defined(__SSE2__)
+// Reverse the order of the 16 bytes in v.
+static inline __m128i reverse8x16(__m128i v)
+{
+    v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    return (_mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+static inline uint8x16_t reverse8x16(uint8x16_t v)
+{
+    v = vrev64q_u8(v);
+    return (vcombine_u8(vget_high_u8(v), vget_low_u8(v)));
+}
+#endif
+
+// Swap count pixels of nc bytes each, walking p0 forwards and p1 backwards, i.e. p0[i] <-> p1[-i].
+// p1 points to the last pixel of its run. If the runs are in the same row, count must be no more
+// than half the row width.
+static void pixelsReverseSwap(unsigned char *p0, unsigned char *p1, int count, const int nc)
+{
+    int c;
+
+    if (nc == 4) {
+#if defined(__SSE2__)
+        for (; count >= 4; count -= 4, p0 += 16, p1 -= 16) {
+            __m128i v0 = _mm_loadu_si128((const __m128i *)p0);
+            __m128i v1 = _mm_loadu_si128((const __m128i *)(p1 - 12));
+            _mm_storeu_si128((__m128i *)p0, _mm_shuffle_epi32(v1, _MM_SHUFFLE(0, 1, 2, 3)));
+            _mm_storeu_si128((__m128i *)(p1 - 12), _mm_shuffle_epi32(v0, _MM_SHUFFLE(0, 1, 2, 3)));
+        }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+        for (; count >= 4; count -= 4, p0 += 16, p1 -= 16) {
+            uint32x4_t v0 = vreinterpretq_u32_u8(vld1q_u8(p0));
+            uint32x4_t v1 = vreinterpretq_u32_u8(vld1q_u8(p1 - 12));
+            v0 = vrev64q_u32(v0); v0 = vcombine_u32(vget_high_u32(v0), vget_low_u32(v0));
+            v1 = vrev64q_u32(v1); v1 = vcombine_u32(vget_high_u32(v1), vget_low_u32(v1));
+            vst1q_u8(p0, vreinterpretq_u8_u32(v1));
+            vst1q_u8(p1 - 12, vreinterpretq_u8_u32(v0));
+        }
+#endif
+        for (; count; count--, p0 += 4, p1 -= 4) {
+            uint32_t t0, t1;
+            memcpy(&t0, p0, 4);
+            memcpy(&t1, p1, 4);
+            memcpy(p0, &t1, 4);
+            memcpy(p1, &t0, 4);
+        }
+    } else if (nc == 1) {
+#if defined(__SSE2__) || defined(__ARM_NEON) || defined(__ARM_NEON__)
+        for (; count >= 16; count -= 16, p0 += 16, p1 -= 16) {
+#  if defined(__SSE2__)
+            __m128i v0 = _mm_loadu_si128((const __m128i *)p0);
+            __m128i v1 = _mm_loadu_si128((const __m128i *)(p1 - 15));
+            _mm_storeu_si128((__m128i *)p0, reverse8x16(v1));
+            _mm_storeu_si128((__m128i *)(p1 - 15), reverse8x16(v0));
+#  else
+            uint8x16_t v0 = vld1q_u8(p0);
+            uint8x16_t v1 = vld1q_u8(p1 - 15);
+            vst1q_u8(p0, reverse8x16(v1));
+            vst1q_u8(p1 - 15, reverse8x16(v0));
+#  endif
+        }
+#endif
+        for (; count; count--, p0++, p1--) {
+            unsigned char t = *p0;
+            *p0 = *p1;
+            *p1 = t;
+        }
+    } else {
+        for (; count; count--, p0 += nc, p1 -= nc) {
+            for (c = 0; c < nc; c++) {
+                unsigned char t = p0[c];
+                p0[c] = p1[c];
+                p1[c] = t;
+            }
+        }
+    }
+}
+
+// Flip a tightly-packed image in place.
+static void imageFlip(unsigned char *data, const int sizeX, const int sizeY, const int nc, const EDEN_BOOL flipH, const EDEN_BOOL flipV)
+{
+    const size_t rowBytes = (size_t)sizeX * nc;
+    unsigned char *top, *bottom;
+    int y;
+
+    if (flipV) {
+        for (y = 0; y < sizeY/2; y++) {
+            top = data + rowBytes*y;
+            bottom = data + rowBytes*(sizeY - 1 - y);
+            // Flipping both ways is a rotation by 180 degrees, i.e. the top row becomes the reversed bottom row.
+            if (flipH) pixelsReverseSwap(top, bottom + rowBytes - nc, sizeX, nc);
+            else rowSwap(top, bottom, rowBytes);
+        }
+        if (flipH && (sizeY & 1)) {
+            top = data + rowBytes*(sizeY/2);
+            pixelsReverseSwap(top, top + rowBytes - nc, sizeX/2, nc);
+        }
+    } else if (flipH) {
+        for (y = 0; y < sizeY; y++) {
+            top = data + rowBytes*y;
+            pixelsReverseSwap(top, top + rowBytes - nc, sizeX/2, nc);
+        }
+    }
+}
+
+// Expand a tightly-packed 1- or 3-channel image to RGBA, flipping as it goes. Returns a new buffer,
+// which must be free()d, or NULL if out of memory.
+static unsigned char *imageFlipToRGBA(const unsigned char *data, const int sizeX, const int sizeY, const int nc, const EDEN_BOOL flipH, const EDEN_BOOL flipV)
+{
+    const size_t rowBytes = (size_t)sizeX * nc;
+    unsigned char *out, *o;
+    const unsigned char *in;
+    int x, y;
+
+    out = (unsigned char *)malloc((size_t)sizeX * sizeY * 4);
+    if (!out) return (NULL);
+
+    o = out;
+    for (y = 0; y < sizeY; y++) {
+        in = data + rowBytes*(flipV ? sizeY - 1 - y : y);
+        x = 0;
+        if (nc == 1) {
+#if defined(__SSE2__)
+            const __m128i alpha = _mm_set1_epi8((char)0xFF);
+            for (; x + 16 <= sizeX; x += 16, o += 64) {
+                __m128i g = _mm_loadu_si128((const __m128i *)(flipH ? in + sizeX - 16 - x : in + x));
+                __m128i gg, ga;
+                if (flipH) g = reverse8x16(g);
+                gg = _mm_unpacklo_epi8(g, g);
+                ga = _mm_unpacklo_epi8(g, alpha);
+                _mm_storeu_si128((__m128i *)o,        _mm_unpacklo_epi16(gg, ga));
+                _mm_storeu_si128((__m128i *)(o + 16), _mm_unpackhi_epi16(gg, ga));
+                gg = _mm_unpackhi_epi8(g, g);
+                ga = _mm_unpackhi_epi8(g, alpha);
+                _mm_storeu_si128((__m128i *)(o + 32), _mm_unpacklo_epi16(gg, ga));
+                _mm_storeu_si128((__m128i *)(o + 48), _mm_unpackhi_epi16(gg, ga));
+            }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+            uint8x16x4_t v;
+            v.val[3] = vdupq_n_u8(0xFF);
+            for (; x + 16 <= sizeX; x += 16, o += 64) {
+                uint8x16_t g = vld1q_u8(flipH ? in + sizeX - 16 - x : in + x);
+                if (flipH) g = reverse8x16(g);
+                v.val[0] = v.val[1] = v.val[2] = g;
+                vst4q_u8(o, v);
+            }
+#endif
+            for (; x < sizeX; x++, o += 4) {
+                o[0] = o[1] = o[2] = in[flipH ? sizeX - 1 - x : x];
+                o[3] = 0xFF;
+            }
+        } else /* nc == 3 */ {
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+            if (!flipH) {
+                uint8x16x4_t v;
+                v.val[3] = vdupq_n_u8(0xFF);
+                for (; x + 16 <= sizeX; x += 16, o += 64) {
+                    uint8x16x3_t rgb = vld3q_u8(in + x*3);
+                    v.val[0] = rgb.val[0];
+                    v.val[1] = rgb.val[1];
+                    v.val[2] = rgb.val[2];
+                    vst4q_u8(o, v);
+                }
+            }
+#endif
+            for (; x < sizeX; x++, o += 4) {
+                const unsigned char *p = in + (flipH ? sizeX - 1 - x : x)*3;
+                o[0] = p[0];
+                o[1] = p[1];
+                o[2] = p[2];
+                o[3] = 0xFF;
+            }
+        }
+    }
+    return (out);
+}
+
 // ============================================================================
 //	Public functions
 // ============================================================================
@@ -98,6 +333,8 @@ EDEN_BOOL EdenSurfacesInit(const int contextsActiveCount, const int textureIndex
 
 	gSurfacesContextsActiveCount = contextsActiveCount;
 
+    ReadTexCacheSetLimit(SURFACES_READTEX_CACHE_LIMIT);
+    
 	return (TRUE);
 }
 
@@ -105,6 +342,8 @@ EDEN_BOOL EdenSurfacesFinal(void)
 {
     if (!gSurfacesContextsActiveCount) return (FALSE);
     
+    ReadTexCacheSetLimit(0);
+    
 	gTextureIndexMax = 0;
 	free(gTextureIndexPtr); gTextureIndexPtr = NULL;
 	free(gTextures); gTextures = NULL;
@@ -192,7 +431,7 @@ EDEN_BOOL EdenSurfacesTextureLoad2(const int contextIndex, const int numTextures
 #ifdef SURFACES_DEBUG
 		EDEN_LOGe("EdenSurfacesTextureLoad(): loading file '%s'\n", textureInfo[i].pathname);
 #endif
-		if (!(data = ReadTex(textureInfo[i].pathname, &sizeX, &sizeY, &nc))) {	// Load image.
+		if (!(data = ReadTexScaled(textureInfo[i].pathname, textureInfo[i].widthTarget, textureInfo[i].heightTarget, &sizeX, &sizeY, &nc))) {	// Load image.
 			EDEN_LOGe("EdenSurfacesTextureLoad(): Unable to read file '%s'.\n", textureInfo[i].pathname);
 			ok = FALSE;
             continue;
@@ -201,52 +440,20 @@ EDEN_BOOL EdenSurfacesTextureLoad2(const int contextIndex, const int numTextures
 #ifdef SURFACES_DEBUG
             EDEN_LOGe("EdenSurfacesTextureLoad(): image is %dx%d (%d-channel)\n", sizeX, sizeY, nc);
 #endif
-            // Do an in-place image flip if requested.
-            if (flipH || flipV) {
-                
-                unsigned char *p0, *p1;
-                int c, x, y;
-                
-                // Work out pointers.
-                p0 = p1 = data;
-                if (flipV) p1 += (sizeY - 1)*sizeX*nc; // Move to last row.
-                if (flipH) p1 += (sizeX - 1)*nc; // Move to last column.
-
-                if (flipV && flipH) {
-                    while (p0 < p1) {
-                        for (c = 0; c < nc; c++) {
-                            unsigned char t = p0[c];
-                            p0[c] = p1[c];
-                            p1[c] = t;
-                        }
-                        p0 += nc;
-                        p1 -= nc;
-                    }
-                } else if (flipV) {
-                    while (p0 < p1) {
-                        for (x = 0; x < sizeX; x++) {
-                            for (c = 0; c < nc; c++) {
-                                unsigned char t = p0[x*nc + c];
-                                p0[x*nc + c] = p1[x*nc + c];
-                                p1[x*nc + c] = t;
-                            }
-                        }
-                        p0 += sizeX*nc;
-                        p1 -= sizeX*nc;
-                    }
-                } else /* flipH */ {
-                    while (p0 < p1) {
-                        for (y = 0; y < sizeY; y++) {
-                            for (c = 0; c < nc; c++) {
-                                unsigned char t = p0[y*sizeX*nc + c];
-                                p0[y*sizeX*nc + c] = p1[y*sizeX*nc + c];
-                                p1[y*sizeX*nc + c] = t;
-                            }
-                        }
-                        p0 += nc;
-                        p1 -= nc;
-                    }
+            // Flip if requested. If RGBA was requested for a 1- or 3-channel image, expand it in the same pass.
+            if (textureInfo[i].internalformat == GL_RGBA && (nc == 1 || nc == 3)) {
+                unsigned char *rgba = imageFlipToRGBA(data, sizeX, sizeY, nc, flipH, flipV);
+                if (!rgba) {
+                    EDEN_LOGe("EdenSurfacesTextureLoad(): Out of memory.\n");
+                    free(data);
+                    ok = FALSE;
+                    continue;
                 }
+                free(data);
+                data = rgba;
+                nc = 4;
+            } else if (flipH || flipV) {
+                imageFlip(data, sizeX, sizeY, nc, flipH, flipV);
             }
             
             if (nc == 3) {
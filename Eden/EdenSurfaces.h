@@ -149,13 +149,19 @@ typedef unsigned int TEXTURE_INDEX_t;
         be drawn scaled to sizes smaller than unity), FALSE otherwise.
     @field internalformat OpenGL internal texture format to use.
         E.g. this allows a single-channel texture to be loaded as GL_ALPHA rather
-        than GL_LUMINANCE. Typically GL_RGB or GL_RGBA.
+        than GL_LUMINANCE. Typically GL_RGB or GL_RGBA. If GL_RGBA is requested for a
+        1- or 3-channel image, the image is expanded to RGBA (with opaque alpha) as it is
+        loaded.
     @field min_filter
     @field mag_filter
     @field wrap_s
     @field wrap_t
     @field priority
     @field env_mode
+    @field widthTarget The width at which the texture will be displayed, or 0 if not known.
+        If non-zero, JPEG images are decoded at the smallest reduced size which is at least
+        this wide (see ReadTexScaled()).
+    @field heightTarget The height at which the texture will be displayed, or 0 if not known.
 */
 typedef struct {
 	const char *pathname;
@@ -168,6 +174,8 @@ typedef struct {
 	GLclampf	priority;
 	GLint		env_mode;
 	//GLfloat	env_color[4];
+	int			widthTarget;
+	int			heightTarget;
 } TEXTURE_INFO_t;
 
 /* ============================================================================ *
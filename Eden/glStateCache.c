@@ -6,6 +6,10 @@
  *
  */
 
+#include <Eden/Eden.h>
+#if EDEN_USE_GL
+#  define USE_GL_STATE_CACHE 1
+#endif
 #include <Eden/glStateCache.h>
 
 #if USE_GL_STATE_CACHE
@@ -51,6 +55,13 @@ static GLfloat materialShininess = FLT_MAX;
 
 static GLint statePixelStoreUnpackAlignment = UINT_MAX;
 
+static GLfloat stateColor[4] = {FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX};
+static GLfloat stateLineWidth = FLT_MAX;
+static GLenum stateMatrixMode = UINT_MAX;
+static GLint stateViewport[4] = {INT_MAX, INT_MAX, INT_MAX, INT_MAX};
+
+static unsigned long stateAvoidedCallCount = 0;
+
 void glStateCacheFlush()
 {
     int i;
@@ -93,6 +104,11 @@ void glStateCacheFlush()
     stateDepthMask = UCHAR_MAX;
     
     statePixelStoreUnpackAlignment = UINT_MAX;
+    
+    stateColor[0] = stateColor[1] = stateColor[2] = stateColor[3] = FLT_MAX;
+    stateLineWidth = FLT_MAX;
+    stateMatrixMode = UINT_MAX;
+    stateViewport[0] = stateViewport[1] = stateViewport[2] = stateViewport[3] = INT_MAX;
 }
 
 void glStateCacheEnableDepthTest()
@@ -100,7 +116,7 @@ void glStateCacheEnableDepthTest()
     if (stateEnableDepthTest != 1) {
         glEnable(GL_DEPTH_TEST);
         stateEnableDepthTest = 1;
-    }
+    } else stateAvoidedCallCount++;
 }
 
 void glStateCacheDisableDepthTest()
@@ -108,7 +124,7 @@ void glStateCacheDisableDepthTest()
     if (stateEnableDepthTest != 0) {
         glDisable(GL_DEPTH_TEST);
         stateEnableDepthTest = 0;
-    }
+    } else stateAvoidedCallCount++;
 }
 
 void glStateCacheEnableClientStateVertexArray()
@@ -116,7 +132,7 @@ void glStateCacheEnableClientStateVertexArray()
     if (stateEnableVertexArray != 1) {
         glEnableClientState(GL_VERTEX_ARRAY);
         stateEnableVertexArray = 1;
-    }
+    } else stateAvoidedCallCount++;
 }
 
 void glStateCacheDisableClientStateVertexArray()
@@ -124,7 +140,7 @@ void glStateCacheDisableClientStateVertexArray()
     if (stateEnableVertexArray != 0) {
         glDisableClientState(GL_VERTEX_ARRAY);
         stateEnableVertexArray = 0;
-    }
+    } else stateAvoidedCallCount++;
 }
 
 void glStateCacheEnableClientStateNormalArray()
@@ -132,7 +148,7 @@ void glStateCacheEnableClientStateNormalArray()
     if (stateEnableNormalArray != 1) {
         glEnableClientState(GL_NORMAL_ARRAY);
         stateEnableNormalArray = 1;
-    }
+    } else stateAvoidedCallCount++;
 }
 
 void glStateCacheDisableClientStateNormalArray()
@@ -140,7 +156,7 @@ void glStateCacheDisableClientStateNormalArray()
     if (stateEnableNormalArray != 0) {
         glDisableClientState(GL_NORMAL_ARRAY);
         stateEnableNormalArray = 0;
-    }
+    } else stateAvoidedCallCount++;
 }
 
 void glStateCacheClientActiveTexture(GLenum texture)
@@ -148,7 +164,7 @@ void glStateCacheClientActiveTexture(GLenum texture)
     if (stateClientActiveTexture != texture) {
         glClientActiveTexture(texture);
         stateClientActiveTexture = texture;
-    }
+    } else stateAvoidedCallCount++;
 }
 
 void glStateCacheEnableClientStateTexCoordArray()
@@ -157,7 +173,7 @@ void glStateCacheEnableClientStateTexCoordArray()
     if (stateEnableTexCoordArray[stateClientActiveTexture - GL_TEXTURE0] != 1) {
         glEnableClientState(GL_TEXTURE_COORD_ARRAY);
         stateEnableTexCoordArray[stateClientActiveTexture - GL_TEXTURE0] = 1;
-    }
+    } else stateAvoidedCallCount++;
 }
 
 void glStateCacheDisableClientStateTexCoordArray()
@@ -166,7 +182,7 @@ void glStateCacheDisableClientStateTexCoordArray()
     if (stateEnableTexCoordArray[stateClientActiveTexture - GL_TEXTURE0] != 0) {
         glDisableClientState(GL_TEXTURE_COORD_ARRAY);
         stateEnableTexCoordArray[stateClientActiveTexture - GL_TEXTURE0] = 0;
-    }
+    } else stateAvoidedCallCount++;
 }
 
 void glStateCacheActiveTexture(GLuint texture)
@@ -174,7 +190,7 @@ void glStateCacheActiveTexture(GLuint texture)
     if (stateActiveTex != texture) {
         glActiveTexture(texture);
         stateActiveTex = texture;
-    }
+    } else stateAvoidedCallCount++;
 }
 
 void glStateCacheEnableTex2D()
@@ -183,7 +199,7 @@ void glStateCacheEnableTex2D()
     if (stateEnableTex2D[stateActiveTex - GL_TEXTURE0] != 1) {
         glEnable(GL_TEXTURE_2D);
         stateEnableTex2D[stateActiveTex - GL_TEXTURE0] = 1;
-    }
+    } else stateAvoidedCallCount++;
 }
 
 void glStateCacheDisableTex2D()
@@ -192,7 +208,7 @@ void glStateCacheDisableTex2D()
     if (stateEnableTex2D[stateActiveTex - GL_TEXTURE0] != 0) {
         glDisable(GL_TEXTURE_2D);
         stateEnableTex2D[stateActiveTex - GL_TEXTURE0] = 0;
-    }
+    } else stateAvoidedCallCount++;
 }
 
 void glStateCacheBindTexture2D(GLuint name)
@@ -201,7 +217,7 @@ void glStateCacheBindTexture2D(GLuint name)
     if (stateTexName[stateActiveTex - GL_TEXTURE0] != name) {
         glBindTexture(GL_TEXTURE_2D, name);
         stateTexName[stateActiveTex - GL_TEXTURE0] = name;
-    }
+    } else stateAvoidedCallCount++;
 }
 
 void glStateCacheTexEnvMode(GLint mode)
@@ -210,7 +226,7 @@ void glStateCacheTexEnvMode(GLint mode)
     if (stateTexEnvMode[stateActiveTex - GL_TEXTURE0] != mode) {
         glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, mode);
         stateTexEnvMode[stateActiveTex - GL_TEXTURE0] = mode;
-    }
+    } else stateAvoidedCallCount++;
 }
 
 void glStateCacheTexEnvSrc0(GLint source)
@@ -219,7 +235,7 @@ void glStateCacheTexEnvSrc0(GLint source)
     if (stateTexEnvSrc0[stateActiveTex - GL_TEXTURE0] != source) {
         glTexEnvi(GL_TEXTURE_ENV, GL_SRC0_RGB, source);
         stateTexEnvSrc0[stateActiveTex - GL_TEXTURE0] = source;
-    }
+    } else stateAvoidedCallCount++;
 }
 
 void glStateCacheTexEnvSrc1(GLint source)
@@ -228,7 +244,7 @@ void glStateCacheTexEnvSrc1(GLint source)
     if (stateTexEnvSrc1[stateActiveTex - GL_TEXTURE0] != source) {
         glTexEnvi(GL_TEXTURE_ENV, GL_SRC1_RGB, source);
         stateTexEnvSrc1[stateActiveTex - GL_TEXTURE0] = source;
-    }
+    } else stateAvoidedCallCount++;
 }
 
 void glStateCacheTexEnvCombine(GLint combine)
@@ -237,7 +253,7 @@ void glStateCacheTexEnvCombine(GLint combine)
     if (stateTexEnvCombine[stateActiveTex - GL_TEXTURE0] != combine) {
         glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_RGB, combine);
         stateTexEnvCombine[stateActiveTex - GL_TEXTURE0] = combine;
-    }
+    } else stateAvoidedCallCount++;
 }
 
 void glStateCacheEnableLighting()
@@ -245,7 +261,7 @@ void glStateCacheEnableLighting()
     if (stateEnableLighting != 1) {
         glEnable(GL_LIGHTING);
         stateEnableLighting = 1;
-    }
+    } else stateAvoidedCallCount++;
 }
 
 void glStateCacheDisableLighting()
@@ -253,31 +269,46 @@ void glStateCacheDisableLighting()
     if (stateEnableLighting != 0) {
         glDisable(GL_LIGHTING);
         stateEnableLighting = 0;
-    }
+    } else stateAvoidedCallCount++;
 }
 
 void glStateCacheMaterialv(GLenum pname, GLfloat *param)
 {
     switch (pname) {
         case GL_AMBIENT:
-            if (param[0] == materialAmbient[0] && param[1] == materialAmbient[1] && param[2] == materialAmbient[2] && param[3] == materialAmbient[3]) return;
+            if (param[0] == materialAmbient[0] && param[1] == materialAmbient[1] && param[2] == materialAmbient[2] && param[3] == materialAmbient[3]) {
+                stateAvoidedCallCount++;
+                return;
+            }
             memcpy(materialAmbient, param, 4*sizeof(GLfloat));
             break;
         case GL_DIFFUSE:
-            if (param[0] == materialDiffuse[0] && param[1] == materialDiffuse[1] && param[2] == materialDiffuse[2] && param[3] == materialDiffuse[3]) return;
+            if (param[0] == materialDiffuse[0] && param[1] == materialDiffuse[1] && param[2] == materialDiffuse[2] && param[3] == materialDiffuse[3]) {
+                stateAvoidedCallCount++;
+                return;
+            }
             memcpy(materialDiffuse, param, 4*sizeof(GLfloat));
             break;
         case GL_AMBIENT_AND_DIFFUSE:
-            if (param[0] == materialAmbient[0] && param[0] == materialDiffuse[0] && param[1] == materialAmbient[1] && param[1] == materialDiffuse[1] && param[2] == materialAmbient[2] && param[2] == materialDiffuse[2] && param[3] == materialAmbient[3] && param[3] == materialDiffuse[3]) return;
+            if (param[0] == materialAmbient[0] && param[0] == materialDiffuse[0] && param[1] == materialAmbient[1] && param[1] == materialDiffuse[1] && param[2] == materialAmbient[2] && param[2] == materialDiffuse[2] && param[3] == materialAmbient[3] && param[3] == materialDiffuse[3]) {
+                stateAvoidedCallCount++;
+                return;
+            }
             memcpy(materialAmbient, param, 4*sizeof(GLfloat));
             memcpy(materialDiffuse, param, 4*sizeof(GLfloat));
             break;
         case GL_SPECULAR:
-            if (param[0] == materialSpecular[0] && param[1] == materialSpecular[1] && param[2] == materialSpecular[2] && param[3] == materialSpecular[3]) return;
+            if (param[0] == materialSpecular[0] && param[1] == materialSpecular[1] && param[2] == materialSpecular[2] && param[3] == materialSpecular[3]) {
+                stateAvoidedCallCount++;
+                return;
+            }
             memcpy(materialSpecular, param, 4*sizeof(GLfloat));
             break;
         case GL_EMISSION:
-            if (param[0] == materialEmission[0] && param[1] == materialEmission[1] && param[2] == materialEmission[2] && param[3] == materialEmission[3]) return;
+            if (param[0] == materialEmission[0] && param[1] == materialEmission[1] && param[2] == materialEmission[2] && param[3] == materialEmission[3]) {
+                stateAvoidedCallCount++;
+                return;
+            }
             memcpy(materialEmission, param, 4*sizeof(GLfloat));
             break;
         default:
@@ -290,7 +321,10 @@ void glStateCacheMaterial(GLenum pname, GLfloat param)
 {
     switch (pname) {
         case GL_SHININESS:
-            if (param == materialShininess) return;
+            if (param == materialShininess) {
+                stateAvoidedCallCount++;
+                return;
+            }
             materialShininess = param;
             break;
         default:
@@ -304,7 +338,7 @@ void glStateCacheEnableBlend()
     if (stateEnableBlend != 1) {
         glEnable(GL_BLEND);
         stateEnableBlend = 1;
-    }
+    } else stateAvoidedCallCount++;
 }
 
 void glStateCacheDisableBlend()
@@ -312,7 +346,7 @@ void glStateCacheDisableBlend()
     if (stateEnableBlend != 0) {
         glDisable(GL_BLEND);
         stateEnableBlend = 0;
-    }
+    } else stateAvoidedCallCount++;
 }
 
 void glStateCacheBlendFunc(GLenum sfactor, GLenum dfactor)
@@ -321,7 +355,7 @@ void glStateCacheBlendFunc(GLenum sfactor, GLenum dfactor)
         glBlendFunc(sfactor, dfactor);
         stateBlendFunc_sfactor = sfactor;
         stateBlendFunc_dfactor = dfactor;
-    }
+    } else stateAvoidedCallCount++;
 }
 
 void glStateCacheColorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha)
@@ -332,7 +366,7 @@ void glStateCacheColorMask(GLboolean red, GLboolean green, GLboolean blue, GLboo
         stateColorMaskGreen = green;
         stateColorMaskBlue = blue;
         stateColorMaskAlpha = alpha;
-    }
+    } else stateAvoidedCallCount++;
 }
 
 void glStateCacheDepthMask(GLboolean flag)
@@ -340,7 +374,7 @@ void glStateCacheDepthMask(GLboolean flag)
     if (stateDepthMask != flag) {
         glDepthMask(flag);
         stateDepthMask = flag;
-    }
+    } else stateAvoidedCallCount++;
 }
 
 void glStateCachePixelStoreUnpackAlignment(GLint param)
@@ -348,7 +382,65 @@ void glStateCachePixelStoreUnpackAlignment(GLint param)
     if (statePixelStoreUnpackAlignment != param) {
         glPixelStorei(GL_UNPACK_ALIGNMENT, param);
         statePixelStoreUnpackAlignment = param;
-    }
+    } else stateAvoidedCallCount++;
+}
+
+void glStateCacheColor4f(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha)
+{
+    if (stateColor[0] != red || stateColor[1] != green || stateColor[2] != blue || stateColor[3] != alpha) {
+        glColor4f(red, green, blue, alpha);
+        stateColor[0] = red;
+        stateColor[1] = green;
+        stateColor[2] = blue;
+        stateColor[3] = alpha;
+    } else stateAvoidedCallCount++;
+}
+
+void glStateCacheColor4fv(const GLfloat *v)
+{
+    glStateCacheColor4f(v[0], v[1], v[2], v[3]);
+}
+
+void glStateCacheColor4ub(GLubyte red, GLubyte green, GLubyte blue, GLubyte alpha)
+{
+    glStateCacheColor4f((GLfloat)red/255.0f, (GLfloat)green/255.0f, (GLfloat)blue/255.0f, (GLfloat)alpha/255.0f);
+}
+
+void glStateCacheLineWidth(GLfloat width)
+{
+    if (stateLineWidth != width) {
+        glLineWidth(width);
+        stateLineWidth = width;
+    } else stateAvoidedCallCount++;
+}
+
+void glStateCacheMatrixMode(GLenum mode)
+{
+    if (stateMatrixMode != mode) {
+        glMatrixMode(mode);
+        stateMatrixMode = mode;
+    } else stateAvoidedCallCount++;
+}
+
+void glStateCacheViewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    if (stateViewport[0] != x || stateViewport[1] != y || stateViewport[2] != width || stateViewport[3] != height) {
+        glViewport(x, y, width, height);
+        stateViewport[0] = x;
+        stateViewport[1] = y;
+        stateViewport[2] = width;
+        stateViewport[3] = height;
+    } else stateAvoidedCallCount++;
+}
+
+unsigned long glStateCacheAvoidedCallCount(void)
+{
+    return (stateAvoidedCallCount);
+}
+
+void glStateCacheAvoidedCallCountReset(void)
+{
+    stateAvoidedCallCount = 0;
 }
 
 #endif // !DISABLE_GL_STATE_CACHE
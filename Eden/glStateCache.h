@@ -6,7 +6,7 @@
  *
  */
 
-// glStateCache optimises OpenGL ES on implementations where
+// glStateCache optimises OpenGL and OpenGL ES on implementations where
 // changes in GL state are expensive, by eliminating redundant
 // changes to state.
 
@@ -17,7 +17,13 @@
 
 #if USE_GL_STATE_CACHE
 
-#if defined ANDROID
+#if EDEN_USE_GL
+#  ifdef EDEN_MACOSX
+#    include <OpenGL/gl.h>
+#  else
+#    include <GL/gl.h>
+#  endif
+#elif defined ANDROID
 #  include <GLES/gl.h>
 #  include <GLES/glext.h>
 #else
@@ -169,6 +175,46 @@ void glStateCacheDepthMask(GLboolean flag);
 void glStateCachePixelStoreUnpackAlignment(GLint param);
 #endif
 
+// Current colour.
+// The cached colour is invalidated by drawing with a colour array enabled, so code which does so should
+// call glStateCacheFlush() afterwards.
+#if !USE_GL_STATE_CACHE
+#define glStateCacheColor4f(red, green, blue, alpha) glColor4f(red, green, blue, alpha)
+#define glStateCacheColor4fv(v) glColor4fv(v)
+#define glStateCacheColor4ub(red, green, blue, alpha) glColor4ub(red, green, blue, alpha)
+#else
+void glStateCacheColor4f(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha);
+void glStateCacheColor4fv(const GLfloat *v);
+void glStateCacheColor4ub(GLubyte red, GLubyte green, GLubyte blue, GLubyte alpha);
+#endif
+
+// Rasterisation.
+#if !USE_GL_STATE_CACHE
+#define glStateCacheLineWidth(width) glLineWidth(width)
+#else
+void glStateCacheLineWidth(GLfloat width);
+#endif
+
+// Transformation state.
+// Only the matrix mode is cached, not the contents of the matrix stacks.
+#if !USE_GL_STATE_CACHE
+#define glStateCacheMatrixMode(mode) glMatrixMode(mode)
+#define glStateCacheViewport(x, y, width, height) glViewport(x, y, width, height)
+#else
+void glStateCacheMatrixMode(GLenum mode);
+void glStateCacheViewport(GLint x, GLint y, GLsizei width, GLsizei height);
+#endif
+
+// Redundant-call accounting.
+// The state cache counts the GL calls it has avoided, so that its effectiveness can be measured, e.g. per frame.
+#if !USE_GL_STATE_CACHE
+#define glStateCacheAvoidedCallCount() 0ul
+#define glStateCacheAvoidedCallCountReset()
+#else
+unsigned long glStateCacheAvoidedCallCount(void);
+void glStateCacheAvoidedCallCountReset(void);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
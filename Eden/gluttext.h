@@ -55,6 +55,7 @@ extern void glutStrokeCharacter(void *font, int character);
 #elif EDEN_USE_GLES2
 extern void glutStrokeCharacter(void *font, int character, uint32_t vertexAttribIndex, float *translateX);
 #endif
+extern int glutStrokeCharacterSegments(void *font, int character, float originX, float *vertices, float *advance); // Independent line segments (2 vertices each, 2 floats per vertex), or just the vertex count if vertices is NULL.
 extern int glutStrokeWidth(void *font, int character);
 extern int glutStrokeLength(void *font, const unsigned char *string);
 #endif // GLUTTEXT_STROKE_ENABLE
@@ -1,7 +1,7 @@
 #include <Eden/gluttext.h>
 #if GLUTTEXT_STROKE_ENABLE
 #if EDEN_USE_GL
-#  define USE_GL_STATE_CACHE 0
+#  define USE_GL_STATE_CACHE 1
 #  include <Eden/glStateCache.h>
 #elif EDEN_USE_GLES2
 #  include <stdlib.h>
@@ -60,4 +60,35 @@ void glutStrokeCharacter(GLUTstrokeFont font, int c, uint32_t vertexAttribIndex,
     }
 }
 
+int glutStrokeCharacterSegments(GLUTstrokeFont font, int c, float originX, float *vertices, float *advance)
+{
+    const StrokeCharRec *ch;
+    const StrokeRec *stroke;
+    StrokeFontPtr fontinfo;
+    int i, j;
+    int count = 0;
+    
+    fontinfo = (StrokeFontPtr) font;
+    
+    if (advance) *advance = 0.0f;
+    if (c < 0 || c >= fontinfo->num_chars)
+        return 0;
+    ch = &(fontinfo->ch[c]);
+    if (advance) *advance = ch->right;
+    for (i = ch->num_strokes, stroke = ch->stroke;
+         i > 0; i--, stroke++) {
+        // Each line strip of n coords becomes n - 1 independent segments.
+        for (j = 1; j < stroke->num_coords; j++) {
+            if (vertices) {
+                *vertices++ = originX + stroke->coord[j - 1].x;
+                *vertices++ = stroke->coord[j - 1].y;
+                *vertices++ = originX + stroke->coord[j].x;
+                *vertices++ = stroke->coord[j].y;
+            }
+            count += 2;
+        }
+    }
+    return count;
+}
+
 #endif
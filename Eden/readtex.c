@@ -64,10 +64,15 @@
 #include <string.h>
 #include <stdint.h>
 
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
 #include <Eden/EdenUtil.h> // EdenGetFileExtensionFromPath()
 
 #ifdef EDEN_HAVE_LIBJPEG
 #  include <jpeglib.h>
+#  include <setjmp.h>
 #endif
 
 // Core in OpenGL 1.4.
@@ -91,6 +96,33 @@ typedef struct {
     uint32_t colorMap;              // Filled in with bytes 104-107 of file. Colormap ID.
 } rawImageHeader;
 
+// An entry in the cache of decoded images. The list is kept in most-recently-used order.
+typedef struct _READTEX_CACHE_ENTRY {
+    char *pathname;
+    int widthTarget;
+    int heightTarget;
+    time_t mtime;       // Modification time and size of the file when decoded, so that changes to the file are noticed.
+    long long fileSize;
+    int w, h, nc;
+    unsigned char *data;
+    size_t dataSize;
+    struct _READTEX_CACHE_ENTRY *next;
+} READTEX_CACHE_ENTRY;
+
+// The contents of a file, read into memory. The file is read rather than mapped, since a
+// mapped file which is truncated while being decoded raises SIGBUS.
+typedef struct {
+    unsigned char *bytes;
+    size_t length;
+} READTEX_FILE_BUFFER;
+
+/******************************************************************************/
+
+static pthread_mutex_t gCacheLock = PTHREAD_MUTEX_INITIALIZER; // Protects the following.
+static READTEX_CACHE_ENTRY *gCache = NULL;
+static size_t gCacheSize = 0;
+static size_t gCacheLimit = 0;
+
 /******************************************************************************/
 
 static void ConvertShort(uint16_t *array, size_t length)
@@ -133,13 +165,13 @@ static unsigned char *RawImageRead(const char *imageFile, int *w, int *h, int *n
     uint32_t tableLength;
     uint32_t *rowOffsetsTable = NULL;
     uint32_t *rowLengthsTable = NULL;
-    unsigned char **rows = NULL;
     unsigned char *data = NULL;
-    unsigned char *dataPtr = NULL;
     unsigned char *oPtr = NULL;
+    unsigned char *oEnd = NULL;
     unsigned char *iPtr = NULL;
+    unsigned char *fileEnd = NULL;
+    size_t rowBytes;
     unsigned char pixel;
-    int outCount;
     
     if ((fp = fopen(imageFile, "rb")) == NULL) {
         EDEN_LOGe("RawImageRead(): Can't open file '%s' for reading.\n", imageFile);
@@ -216,83 +248,194 @@ static unsigned char *RawImageRead(const char *imageFile, int *w, int *h, int *n
         goto bail;
     }
     
-    // Set up structures used to unpack the data.
-    rows = (unsigned char **)calloc(header->sizeZ, sizeof(unsigned char *));
-    for (j = 0; j < header->sizeZ; j++) {
-        if (!(rows[j] = (unsigned char *)malloc(header->sizeX))) {
-            EDEN_LOGe("Out of memory!\n");
-            goto bailRows;
-        }
-    }
-    
-    // Now unpack.
-    dataPtr = data;
+    // Unpack each plane of each row directly into its place in the interleaved output.
+    rowBytes = (size_t)header->sizeX * header->sizeZ;
+    fileEnd = fileContents + fileLen;
     for (i = 0; i < header->sizeY; i++) {
-        // Unpack all planes for a row.
         for (j = 0; j < header->sizeZ; j++) {
+            oPtr = data + rowBytes*i + j;
             if (header->storage == 1) {
                 // Unpack RLE-encoded pixels.
                 iPtr = fileContents + rowOffsetsTable[i + j*header->sizeY];
-                oPtr = rows[j];
-                outCount = 0;
-                for (;;) {
-                    if (outCount == header->sizeX) break;
+                oEnd = oPtr + rowBytes;
+                while (oPtr < oEnd && iPtr < fileEnd) {
                     pixel = *(iPtr++);
                     count = (int)(pixel & 0x7F);
                     if (!count) break; // End of line.
                     if (pixel & 0x80) {
-                        while (outCount < header->sizeX && count--) {
-                            *(oPtr++) = *(iPtr++);
-                            outCount++;
+                        while (oPtr < oEnd && iPtr < fileEnd && count--) {
+                            *oPtr = *(iPtr++);
+                            oPtr += header->sizeZ;
                         }
                     } else {
+                        if (iPtr >= fileEnd) break;
                         pixel = *(iPtr++);
-                        while (outCount < header->sizeX && count--) {
-                            *(oPtr++) = pixel;
-                            outCount++;
+                        while (oPtr < oEnd && count--) {
+                            *oPtr = pixel;
+                            oPtr += header->sizeZ;
                         }
                     }
                 }
             } else {
                 // Read pixels directly.
-                memcpy(rows[j], fileContents + 512 + header->sizeX * (i + j*header->sizeY), header->sizeX);
-            }
-        }
-        // Copy the row, interleaving.
-        for (k = 0; k < header->sizeX; k++) {
-            for (j = 0; j < header->sizeZ; j++) {
-                *(dataPtr++) = rows[j][k];
+                iPtr = fileContents + 512 + (size_t)header->sizeX * (i + j*header->sizeY);
+                if (iPtr + header->sizeX > fileEnd) {
+                    EDEN_LOGe("Image file is truncated.\n");
+                    free(data);
+                    goto bail;
+                }
+                if (header->sizeZ == 1) {
+                    memcpy(oPtr, iPtr, header->sizeX);
+                } else {
+                    for (k = 0; k < header->sizeX; k++) {
+                        *oPtr = *(iPtr++);
+                        oPtr += header->sizeZ;
+                    }
+                }
             }
         }
     }
     
-    // Clean up work structures.
-    for (j = 0; j < header->sizeZ; j++) if (rows[j]) free(rows[j]);
-    free(rows);
     free(fileContents);
     
     return (data);
 	
 	// When bailing out, do the correct free()s.
-bailRows:
-    for (j = 0; j < header->sizeZ; j++) if (rows[j]) free(rows[j]);
-    free(rows);
-    free(data);
 bail:
     free(fileContents);
     return (NULL);
 }
 
+static EDEN_BOOL FileRead(const char *path, READTEX_FILE_BUFFER *buf)
+{
+    FILE *fp;
+    long fileLen;
+    
+    buf->bytes = NULL;
+    buf->length = 0;
+    
+    if ((fp = fopen(path, "rb")) == NULL) {
+        EDEN_LOGe("Can't open file '%s' for reading.\n", path);
+        EDEN_LOGperror(NULL);
+        return (FALSE);
+    }
+    if (fseek(fp, 0L, SEEK_END) != 0 || (fileLen = ftell(fp)) <= 0) {
+        EDEN_LOGe("Error finding length of file '%s'.\n", path);
+        fclose(fp);
+        return (FALSE);
+    }
+    rewind(fp);
+    if (!(buf->bytes = (unsigned char *)malloc(fileLen))) {
+        EDEN_LOGe("Unable to allocate memory to read %ld byte image file.\n", fileLen);
+        fclose(fp);
+        return (FALSE);
+    }
+    if (fread(buf->bytes, fileLen, 1, fp) < 1) {
+        EDEN_LOGe("Error reading file '%s'.\n", path);
+        free(buf->bytes);
+        buf->bytes = NULL;
+        fclose(fp);
+        return (FALSE);
+    }
+    fclose(fp);
+    buf->length = (size_t)fileLen;
+    return (TRUE);
+}
+
+static void FileBufferFree(READTEX_FILE_BUFFER *buf)
+{
+    free(buf->bytes);
+    buf->bytes = NULL;
+    buf->length = 0;
+}
+
 #ifdef EDEN_HAVE_LIBJPEG
 #define BUFFER_HEIGHT 5
 
-unsigned char *jpgread (FILE *fp, int *w, int *h, int *nc, float *dpi)
+// libjpeg's default error handler exits the process. Instead, return to jpgDecode().
+typedef struct {
+    struct jpeg_error_mgr pub;
+    jmp_buf jmp;
+} JPG_ERROR_MGR;
+
+static void jpgErrorExit(j_common_ptr cinfo)
+{
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(((JPG_ERROR_MGR *)cinfo->err)->jmp, 1);
+}
+
+// A source manager reading from a buffer in memory (e.g. a whole file read in one go), so that the
+// compressed data is never copied.
+static void jpgMemInitSource(j_decompress_ptr cinfo)
+{
+}
+
+static boolean jpgMemFillInputBuffer(j_decompress_ptr cinfo)
+{
+    // Only called if the data ends prematurely. Insert a fake EOI marker, as libjpeg's stdio source does.
+    static const JOCTET eoi[2] = {0xFF, JPEG_EOI};
+    cinfo->src->next_input_byte = eoi;
+    cinfo->src->bytes_in_buffer = 2;
+    return (TRUE);
+}
+
+static void jpgMemSkipInputData(j_decompress_ptr cinfo, long num_bytes)
+{
+    if (num_bytes <= 0) return;
+    if ((size_t)num_bytes > cinfo->src->bytes_in_buffer) {
+        (void)(*cinfo->src->fill_input_buffer)(cinfo);
+    } else {
+        cinfo->src->next_input_byte += num_bytes;
+        cinfo->src->bytes_in_buffer -= num_bytes;
+    }
+}
+
+static void jpgMemTermSource(j_decompress_ptr cinfo)
+{
+}
+
+static void jpgMemSrc(j_decompress_ptr cinfo, const unsigned char *buf, const size_t len)
+{
+    if (!cinfo->src) {
+        cinfo->src = (struct jpeg_source_mgr *)(*cinfo->mem->alloc_small)((j_common_ptr)cinfo, JPOOL_PERMANENT, sizeof(struct jpeg_source_mgr));
+    }
+    cinfo->src->init_source = jpgMemInitSource;
+    cinfo->src->fill_input_buffer = jpgMemFillInputBuffer;
+    cinfo->src->skip_input_data = jpgMemSkipInputData;
+    cinfo->src->resync_to_restart = jpeg_resync_to_restart;
+    cinfo->src->term_source = jpgMemTermSource;
+    cinfo->src->next_input_byte = (const JOCTET *)buf;
+    cinfo->src->bytes_in_buffer = len;
+}
+
+// Choose the smallest DCT scaling which gives an image at least widthTarget x heightTarget.
+// A target of 0 places no constraint on that dimension.
+static void jpgChooseScale(j_decompress_ptr cinfo, const int widthTarget, const int heightTarget)
+{
+    unsigned int num;
+    
+    for (num = 1; num < 8;) {
+        // libjpeg rounds scaled dimensions up.
+        if ((widthTarget <= 0 || (cinfo->image_width*num + 7)/8 >= (unsigned int)widthTarget) &&
+            (heightTarget <= 0 || (cinfo->image_height*num + 7)/8 >= (unsigned int)heightTarget)) break;
+#if JPEG_LIB_VERSION >= 70
+        num++; // Any scale n/8 supported.
+#else
+        num <<= 1; // Only 1/8, 1/4, 1/2 and 1/1 supported.
+#endif
+    }
+    cinfo->scale_num = num;
+    cinfo->scale_denom = 8;
+}
+
+// Decode from either fp or buf.
+static unsigned char *jpgDecode(FILE *fp, const unsigned char *buf, const size_t len, const int widthTarget, const int heightTarget, int *w, int *h, int *nc, float *dpi)
 {
     struct jpeg_decompress_struct    cinfo;
-    struct jpeg_error_mgr            jerr;
-    unsigned char                    *pixels;
+    JPG_ERROR_MGR                    jerr;
+    unsigned char * volatile         pixels = NULL;
     unsigned char                    *buffer[BUFFER_HEIGHT];
-    int                              bytes_per_line;
+    size_t                           bytes_per_line;
     int                              row;
     int                              i;
     
@@ -300,45 +443,53 @@ unsigned char *jpgread (FILE *fp, int *w, int *h, int *nc, float *dpi)
     memset(&cinfo, 0, sizeof(cinfo));
     
     /* We set up the normal JPEG error routines, then override error_exit. */
-    cinfo.err = jpeg_std_error(&jerr);
-    /* jerr.pub.error_exit = my_error_exit; */
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = jpgErrorExit;
+    if (setjmp(jerr.jmp)) {
+        jpeg_destroy_decompress(&cinfo);
+        free(pixels);
+        return (NULL);
+    }
     
     jpeg_create_decompress(&cinfo);
     
     /* Specify data source for decompression */
-    jpeg_stdio_src(&cinfo, fp);
+    if (fp) jpeg_stdio_src(&cinfo, fp);
+    else jpgMemSrc(&cinfo, buf, len);
     
     /* Read file header, set default decompression parameters */
     (void) jpeg_read_header(&cinfo, TRUE);
     
+    /* Decode directly at reduced size if the full size isn't needed. */
+    if (widthTarget > 0 || heightTarget > 0) jpgChooseScale(&cinfo, widthTarget, heightTarget);
+    
     /* Start decompressor */
     (void) jpeg_start_decompress(&cinfo);
     
     /* Allocate image buffer */
-    bytes_per_line = cinfo.num_components * cinfo.image_width;
-    pixels = (unsigned char *)malloc(bytes_per_line  * cinfo.image_height);
-    if (!pixels) return 0;
+    bytes_per_line = (size_t)cinfo.output_components * cinfo.output_width;
+    pixels = (unsigned char *)malloc(bytes_per_line * cinfo.output_height);
+    if (!pixels) {
+        EDEN_LOGe("Out of memory!\n");
+        jpeg_destroy_decompress(&cinfo);
+        return (NULL);
+    }
     
     row = 0;
     
     /* Process data */
     while (cinfo.output_scanline < cinfo.output_height) {
-        for (i=0; i<BUFFER_HEIGHT; ++i) {
-            /* read in "upside down" because opengl says the
-             * texture origin is lower left 
-             */
-            //int rrow = cinfo.output_height - row - 1;
-            //buffer[i] = &pixels[bytes_per_line * (rrow - i)];
-            buffer[i] = &pixels[bytes_per_line * (row + i)];
+        for (i = 0; i < BUFFER_HEIGHT; ++i) {
+            buffer[i] = &pixels[bytes_per_line * (row + i < (int)cinfo.output_height ? row + i : row)];
         }
         row += jpeg_read_scanlines(&cinfo, buffer, BUFFER_HEIGHT);
     }
     
     (void) jpeg_finish_decompress(&cinfo);
     
-    if (w) *w = cinfo.image_width;
-    if (h) *h = cinfo.image_height;
-    if (nc) *nc = cinfo.num_components;
+    if (w) *w = cinfo.output_width;
+    if (h) *h = cinfo.output_height;
+    if (nc) *nc = cinfo.output_components;
     if (dpi) {
         if( cinfo.density_unit == 1 && cinfo.X_density == cinfo.Y_density ) {
             *dpi = cinfo.X_density;
@@ -353,20 +504,144 @@ unsigned char *jpgread (FILE *fp, int *w, int *h, int *nc, float *dpi)
 
     return pixels;
 }
+
+unsigned char *jpgread (FILE *fp, int *w, int *h, int *nc, float *dpi)
+{
+    return (jpgDecode(fp, NULL, 0, 0, 0, w, h, nc, dpi));
+}
+
+unsigned char *jpgreadScaled(const char *imageFile, const int widthTarget, const int heightTarget, int *w, int *h, int *nc, float *dpi)
+{
+    READTEX_FILE_BUFFER buf;
+    unsigned char *pixels;
+    
+    if (!FileRead(imageFile, &buf)) return (NULL);
+    pixels = jpgDecode(NULL, buf.bytes, buf.length, widthTarget, heightTarget, w, h, nc, dpi);
+    FileBufferFree(&buf);
+    return (pixels);
+}
 #endif // EDEN_HAVE_LIBJPEG
 
+// Cache functions. Must be called with gCacheLock held.
+
+static void CacheEntryFree(READTEX_CACHE_ENTRY *entry)
+{
+    gCacheSize -= entry->dataSize;
+    free(entry->pathname);
+    free(entry->data);
+    free(entry);
+}
+
+static void CacheTrim(const size_t limit)
+{
+    READTEX_CACHE_ENTRY **entry_p;
+    
+    // Evict least-recently-used entries, i.e. from the end of the list, until under the limit.
+    while (gCacheSize > limit) {
+        entry_p = &gCache;
+        while ((*entry_p)->next) entry_p = &((*entry_p)->next);
+        CacheEntryFree(*entry_p);
+        *entry_p = NULL;
+    }
+}
+
+// Returns a copy of the cached image, or NULL if not cached.
+static unsigned char *CacheGet(const char *imageFile, const int widthTarget, const int heightTarget, const struct stat *st, int *w, int *h, int *nc)
+{
+    READTEX_CACHE_ENTRY **entry_p, *entry;
+    unsigned char *data;
+    
+    for (entry_p = &gCache; *entry_p; entry_p = &((*entry_p)->next)) {
+        entry = *entry_p;
+        if (entry->widthTarget != widthTarget || entry->heightTarget != heightTarget || strcmp(entry->pathname, imageFile) != 0) continue;
+        if (entry->mtime != st->st_mtime || entry->fileSize != (long long)st->st_size) {
+            // File has changed since it was cached.
+            *entry_p = entry->next;
+            CacheEntryFree(entry);
+            return (NULL);
+        }
+        if (!(data = (unsigned char *)malloc(entry->dataSize))) return (NULL);
+        memcpy(data, entry->data, entry->dataSize);
+        if (w) *w = entry->w;
+        if (h) *h = entry->h;
+        if (nc) *nc = entry->nc;
+        // Move to front.
+        *entry_p = entry->next;
+        entry->next = gCache;
+        gCache = entry;
+        return (data);
+    }
+    return (NULL);
+}
+
+static void CachePut(const char *imageFile, const int widthTarget, const int heightTarget, const struct stat *st, const unsigned char *data, const int w, const int h, const int nc)
+{
+    READTEX_CACHE_ENTRY *entry;
+    size_t dataSize = (size_t)w * h * nc;
+    
+    if (dataSize > gCacheLimit) return;
+    
+    if (!(entry = (READTEX_CACHE_ENTRY *)calloc(1, sizeof(READTEX_CACHE_ENTRY)))) return;
+    if (!(entry->pathname = strdup(imageFile)) || !(entry->data = (unsigned char *)malloc(dataSize))) {
+        free(entry->pathname);
+        free(entry);
+        return;
+    }
+    memcpy(entry->data, data, dataSize);
+    entry->dataSize = dataSize;
+    entry->widthTarget = widthTarget;
+    entry->heightTarget = heightTarget;
+    entry->mtime = st->st_mtime;
+    entry->fileSize = (long long)st->st_size;
+    entry->w = w;
+    entry->h = h;
+    entry->nc = nc;
+    
+    CacheTrim(gCacheLimit - dataSize);
+    entry->next = gCache;
+    gCache = entry;
+    gCacheSize += dataSize;
+}
+
+void ReadTexCacheSetLimit(const size_t bytes)
+{
+    pthread_mutex_lock(&gCacheLock);
+    gCacheLimit = bytes;
+    CacheTrim(gCacheLimit);
+    pthread_mutex_unlock(&gCacheLock);
+}
+
+void ReadTexCacheFlush(void)
+{
+    pthread_mutex_lock(&gCacheLock);
+    CacheTrim(0);
+    pthread_mutex_unlock(&gCacheLock);
+}
+
 unsigned char *ReadTex(const char *imageFile, int *w, int *h, int *nc)
 {
-#ifdef EDEN_HAVE_LIBJPEG
-    FILE *infile;
-#endif
+    return (ReadTexScaled(imageFile, 0, 0, w, h, nc));
+}
+
+unsigned char *ReadTexScaled(const char *imageFile, const int widthTarget, const int heightTarget, int *w, int *h, int *nc)
+{
     unsigned char *ret;
+    int w0, h0, nc0;
+    struct stat st;
+    EDEN_BOOL cacheable;
+    
+    // Check the cache first.
+    pthread_mutex_lock(&gCacheLock);
+    cacheable = (gCacheLimit > 0 && stat(imageFile, &st) == 0);
+    ret = (cacheable ? CacheGet(imageFile, widthTarget, heightTarget, &st, w, h, nc) : NULL);
+    pthread_mutex_unlock(&gCacheLock);
+    if (ret) return (ret);
     
     // Check the filename extension.
     char *imageFileExtension = EdenGetFileExtensionFromPath(imageFile, TRUE);
     if (strcmp(imageFileExtension, "sgi") == 0 || strcmp(imageFileExtension, "rgb") == 0 || strcmp(imageFileExtension, "rgba") == 0 || strcmp(imageFileExtension, "bw") == 0) {
         
-        ret = RawImageRead(imageFile, w, h, nc);
+        ret = RawImageRead(imageFile, &w0, &h0, &nc0);
         if (!ret) {
             EDEN_LOGe("ReadTex(): Can't read data from file '%s'.\n", imageFile);
             free(imageFileExtension);
@@ -376,15 +651,7 @@ unsigned char *ReadTex(const char *imageFile, int *w, int *h, int *nc)
     } else if (strncmp(imageFileExtension, "jpg", 3) == 0 || strncmp(imageFileExtension, "jpeg", 4) == 0) {
         
 #ifdef EDEN_HAVE_LIBJPEG        
-        if ((infile = fopen(imageFile, "rb")) == NULL) {
-            EDEN_LOGe("ReadTex(): Can't open file '%s' for reading.\n", imageFile);
-            EDEN_LOGperror(NULL);
-            free(imageFileExtension);
-            return (NULL);
-        }
-        ret = jpgread(infile, w, h, nc, NULL);
-        fclose(infile);
-        
+        ret = jpgreadScaled(imageFile, widthTarget, heightTarget, &w0, &h0, &nc0, NULL);
         if (!ret) {
             EDEN_LOGe("ReadTex(): Can't read data from file '%s'.\n", imageFile);
             free(imageFileExtension);
@@ -402,5 +669,15 @@ unsigned char *ReadTex(const char *imageFile, int *w, int *h, int *nc)
     }
     
     free(imageFileExtension);
+    
+    if (cacheable) {
+        pthread_mutex_lock(&gCacheLock);
+        CachePut(imageFile, widthTarget, heightTarget, &st, ret, w0, h0, nc0);
+        pthread_mutex_unlock(&gCacheLock);
+    }
+    
+    if (w) *w = w0;
+    if (h) *h = h0;
+    if (nc) *nc = nc0;
     return (ret);
 }
@@ -75,6 +75,34 @@ extern "C" {
         This buffer must be free()d when finished with.
  */
 unsigned char *jpgread (FILE *fp, int *w, int *h, int *nc, float *dpi);
+
+/*!
+    @function
+    @abstract Read a JPEG file, decoding it at reduced size if possible.
+    @discussion
+        The file is read into memory in one go and decoded from there, rather than decoded
+        through stdio.
+        If a target size is supplied, the image is scaled down in the DCT domain during
+        decoding to the smallest size supported by libjpeg (n/8 of full size, or with older
+        versions of libjpeg, 1/8, 1/4 or 1/2) which is at least the target size. This is much
+        faster than decoding at full size and scaling afterwards.
+ 
+        May be called from any thread.
+    @param imageFile Pathname of the JPEG file.
+    @param widthTarget Minimum width required, or 0 if no constraint on width.
+    @param heightTarget Minimum height required, or 0 if no constraint on height.
+    @param w Pointer to location which will be filled with the width of the decoded image in pixels,
+        or NULL if this is not required.
+    @param h Pointer to location which will be filled with the height of the decoded image in pixels,
+        or NULL if this is not required.
+    @param nc Pointer to location which will be filled with the number of components in
+        the decoded image, or NULL if this is not required.
+    @param dpi Pointer to location which will be filled with the resolution of the jpeg in
+        dots-per-inch, or NULL if this is not required.
+    @result A raw buffer holding the image data, as for jpgread(), or NULL in case of error.
+        This buffer must be free()d when finished with.
+ */
+unsigned char *jpgreadScaled(const char *imageFile, const int widthTarget, const int heightTarget, int *w, int *h, int *nc, float *dpi);
 #endif // EDEN_HAVE_LIBJPEG
     
 /*!
@@ -95,6 +123,52 @@ unsigned char *jpgread (FILE *fp, int *w, int *h, int *nc, float *dpi);
  */
 extern unsigned char *ReadTex(const char *imageFile, int *w, int *h, int *nc);
 
+/*!
+    @function
+    @abstract Read an image file at no less than a target size and return it as a raw buffer.
+    @discussion
+        As for ReadTex(), but JPEG images are decoded at the smallest scale which is at least
+        the target size (see jpgreadScaled()). Other formats are always read at full size.
+ 
+        If the decoded image cache is enabled (see ReadTexCacheSetLimit()), images are looked up
+        in the cache by pathname and target size, and the file's modification time and length
+        are checked so that a changed file is re-read.
+ 
+        May be called from any thread.
+    @param imageFile name of image to read.
+    @param widthTarget Minimum width required, or 0 if no constraint on width.
+    @param heightTarget Minimum height required, or 0 if no constraint on height.
+    @param w Pointer to location which will be filled with the width of the image in pixels,
+        or NULL if this is not required.
+    @param h Pointer to location which will be filled with the height of the image in pixels,
+        or NULL if this is not required.
+    @param nc Pointer to location which will be filled with the number of components in
+        the image, or NULL if this is not required.
+    @result A raw buffer holding the image data, as for ReadTex(), or NULL in case of error.
+        This buffer must be free()d when finished with.
+ */
+extern unsigned char *ReadTexScaled(const char *imageFile, const int widthTarget, const int heightTarget, int *w, int *h, int *nc);
+
+/*!
+    @function
+    @abstract Set the size of the cache of decoded images.
+    @discussion
+        Images read by ReadTex() and ReadTexScaled() are kept in a cache so that repeated loads
+        of the same file cost only a copy. Least-recently-used images are evicted once the
+        total size of cached image data exceeds the limit. The cache is disabled by default.
+    @param bytes Maximum total size of cached image data, or 0 to disable the cache and
+        free all cached images.
+ */
+extern void ReadTexCacheSetLimit(const size_t bytes);
+
+/*!
+    @function
+    @abstract Free all images in the cache of decoded images.
+    @discussion
+        The cache remains enabled if it was enabled.
+ */
+extern void ReadTexCacheFlush(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,193 @@
+/*
+ *  LumaTextureUploader.cpp
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "LumaTextureUploader.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <AR6/AR/ar.h>
+#include "Eden/EdenGLDraw.h"
+#define USE_GL_STATE_CACHE 1
+#include "Eden/glStateCache.h"
+
+static bool hasExtension(const char *name)
+{
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+    size_t len = strlen(name);
+    
+    if (!extensions) return false;
+    for (const char *p = extensions; (p = strstr(p, name)); p += len) {
+        if ((p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0')) return true;
+    }
+    return false;
+}
+
+// PBOs are used only if supported, and only on hardware renderers, where the transfer can actually proceed
+// asynchronously.
+static bool pboUsable(void)
+{
+    const char *version = (const char *)glGetString(GL_VERSION);
+    const char *renderer = (const char *)glGetString(GL_RENDERER);
+    int major = 0, minor = 0;
+    
+    if (!version || !renderer) return false;
+    if (strstr(renderer, "llvmpipe") || strstr(renderer, "softpipe") || strstr(renderer, "Software Rasterizer") || strstr(renderer, "Software Renderer")) {
+        ARLOGi("Software renderer '%s'; not using pixel buffer objects.\n", renderer);
+        return false;
+    }
+    sscanf(version, "%d.%d", &major, &minor);
+    if (major > 2 || (major == 2 && minor >= 1)) return true;
+    if (hasExtension("GL_ARB_pixel_buffer_object")) return true;
+    ARLOGi("Pixel buffer objects not supported by OpenGL %s.\n", version);
+    return false;
+}
+
+LumaTextureUploader::LumaTextureUploader(const int width, const int height, const int pboCount) :
+    m_width(width),
+    m_height(height),
+    m_textureWidth(1),
+    m_textureHeight(1),
+    m_pbos()
+{
+    if (width <= 0 || height <= 0) return;
+    
+    // Non-power-of-two textures need OpenGL 2.0, so allocate the next power of two up and use a portion of it.
+    while (m_textureWidth < width) m_textureWidth <<= 1;
+    while (m_textureHeight < height) m_textureHeight <<= 1;
+    
+    glGenTextures(1, &m_texture);
+    glStateCacheActiveTexture(GL_TEXTURE0);
+    glStateCacheBindTexture2D(m_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, m_textureWidth, m_textureHeight, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, NULL);
+    glStateCacheBindTexture2D(0);
+    if (glGetError() != GL_NO_ERROR) {
+        ARLOGe("Error creating %dx%d luma texture.\n", m_textureWidth, m_textureHeight);
+        glDeleteTextures(1, &m_texture);
+        m_texture = 0;
+        return;
+    }
+    
+    if (pboCount > 0 && pboUsable()) {
+        m_pbos.resize(pboCount);
+        glGenBuffers(pboCount, m_pbos.data());
+        for (int i = 0; i < pboCount; i++) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbos[i]);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)width*height, NULL, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (glGetError() != GL_NO_ERROR) {
+            ARLOGe("Error creating pixel buffer objects.\n");
+            deletePBOs();
+        }
+    }
+    ARLOGi("Streaming %dx%d luma texture uploads %s.\n", width, height, (usingPBOs() ? "via pixel buffer objects" : "directly"));
+}
+
+LumaTextureUploader::~LumaTextureUploader()
+{
+    deletePBOs();
+    if (m_texture) {
+        // Deleting a bound texture unbinds it behind glStateCache's back, so unbind it through the cache first.
+        glStateCacheActiveTexture(GL_TEXTURE0);
+        glStateCacheBindTexture2D(0);
+        glDeleteTextures(1, &m_texture);
+    }
+}
+
+void LumaTextureUploader::deletePBOs()
+{
+    if (m_pbos.empty()) return;
+    glDeleteBuffers((GLsizei)m_pbos.size(), m_pbos.data());
+    m_pbos.clear();
+    m_pboIndex = 0;
+}
+
+void LumaTextureUploader::upload(const uint8_t *frame)
+{
+    if (!m_texture || !frame) return;
+    
+    glStateCacheActiveTexture(GL_TEXTURE0);
+    glStateCacheBindTexture2D(m_texture);
+    glStateCachePixelStoreUnpackAlignment(1); // Rows are tightly packed.
+    
+    if (!m_pbos.empty()) {
+        GLsizeiptr size = (GLsizeiptr)m_width*m_height;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbos[m_pboIndex]);
+        m_pboIndex = (m_pboIndex + 1) % (int)m_pbos.size();
+        // The ring means this buffer's last transfer was issued pboCount - 1 frames ago, so mapping it doesn't wait.
+        void *buf = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+        if (buf) {
+            memcpy(buf, frame, size);
+            if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) {
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_LUMINANCE, GL_UNSIGNED_BYTE, NULL); // NULL is offset 0 in the bound PBO.
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                glStateCacheBindTexture2D(0);
+                return;
+            }
+        }
+        // If the buffer can't be mapped (or its contents were lost) fall back to direct upload from now on.
+        ARLOGe("Error mapping pixel buffer object; falling back to direct texture upload.\n");
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        deletePBOs();
+    }
+    
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_LUMINANCE, GL_UNSIGNED_BYTE, frame);
+    glStateCacheBindTexture2D(0);
+}
+
+void LumaTextureUploader::draw(const float *mvp)
+{
+    if (!m_texture) return;
+    
+    GLfloat s = (GLfloat)m_width/(GLfloat)m_textureWidth;
+    GLfloat t = (GLfloat)m_height/(GLfloat)m_textureHeight;
+    const GLfloat vertices[4][2] = { {0.0f, 0.0f}, {(GLfloat)m_width, 0.0f}, {(GLfloat)m_width, (GLfloat)m_height}, {0.0f, (GLfloat)m_height} };
+    const GLfloat texcoords[4][2] = { {0.0f, t}, {s, t}, {s, 0.0f}, {0.0f, 0.0f} }; // First row of frame is at t = 0.
+    
+    glStateCacheActiveTexture(GL_TEXTURE0);
+    glStateCacheBindTexture2D(m_texture);
+    if (mvp && EdenGLDrawIsActive()) {
+        const float white[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+        EdenGLDrawArrays(mvp, white, EDEN_GL_DRAW_SHADING_TEXTURE, GL_TRIANGLE_FAN, &vertices[0][0], &texcoords[0][0], 4);
+        glStateCacheBindTexture2D(0);
+        return;
+    }
+    glStateCacheTexEnvMode(GL_REPLACE);
+    glStateCacheEnableTex2D();
+    glStateCacheDisableBlend();
+    glVertexPointer(2, GL_FLOAT, 0, vertices);
+    glStateCacheEnableClientStateVertexArray();
+    glStateCacheDisableClientStateNormalArray();
+    glStateCacheClientActiveTexture(GL_TEXTURE0);
+    glTexCoordPointer(2, GL_FLOAT, 0, texcoords);
+    glStateCacheEnableClientStateTexCoordArray();
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    glStateCacheDisableClientStateTexCoordArray();
+    glStateCacheDisableTex2D();
+    glStateCacheBindTexture2D(0);
+}
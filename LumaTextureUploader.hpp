@@ -0,0 +1,79 @@
+/*
+ *  LumaTextureUploader.hpp
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+
+#ifndef LUMATEXTUREUPLOADER_H
+#define LUMATEXTUREUPLOADER_H
+
+#include <stdint.h>
+#include <vector>
+#ifdef __APPLE__
+#  include <OpenGL/gl.h>
+#elif defined(__linux)
+#  ifndef GL_GLEXT_PROTOTYPES
+#    define GL_GLEXT_PROTOTYPES // glGenBuffers(), glMapBuffer() etc.
+#  endif
+#  include <GL/gl.h>
+#endif
+
+//
+// Streams 8-bit luma frames into an OpenGL texture, and draws it.
+//
+// Where pixel buffer objects are available (OpenGL 2.1 or GL_ARB_pixel_buffer_object) on a hardware renderer, each
+// frame is written into the next of a ring of PBOs and the texture is sourced from that PBO. glTexSubImage2D() then
+// returns without copying the frame or waiting for the GPU, and the driver transfers it asynchronously, while the ring
+// means that a buffer still being read is not written again until it has come round. Otherwise (including on Mesa's
+// software renderers, where PBOs bring no benefit) frames are uploaded directly from client memory.
+//
+// All methods must be called with the same OpenGL context current.
+//
+class LumaTextureUploader {
+public:
+    LumaTextureUploader(const int width, const int height, const int pboCount = 3);
+    ~LumaTextureUploader();
+    bool isValid() const { return m_texture != 0; }
+    bool usingPBOs() const { return !m_pbos.empty(); }
+    // Upload a frame of width x height bytes.
+    void upload(const uint8_t *frame);
+    // Draw the most recently uploaded frame, covering (0, 0) to (width, height) in the current coordinate system,
+    // with the first row of the frame at the top (y = height). If mvp is non-NULL and EdenGLDraw is active, it is
+    // drawn via EdenGLDraw with mvp as the model-view-projection matrix, otherwise with the fixed-function pipeline.
+    void draw(const float *mvp = nullptr);
+    
+private:
+    LumaTextureUploader(const LumaTextureUploader&) = delete; // No copy construction.
+    LumaTextureUploader& operator=(const LumaTextureUploader&) = delete; // No copy assignment.
+    
+    void deletePBOs();
+    
+    int                  m_width;
+    int                  m_height;
+    int                  m_textureWidth; // Power-of-two size of m_texture.
+    int                  m_textureHeight;
+    GLuint               m_texture = 0;
+    std::vector<GLuint>  m_pbos;
+    int                  m_pboIndex = 0; // Next PBO in the ring to be written.
+};
+
+#endif // !LUMATEXTUREUPLOADER_H
@@ -0,0 +1,314 @@
+/*
+ *  edenmath_bench.c
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+//
+// Checks each of the EdenMath matrix kernels built for this target against the scalar reference,
+// and times them. Exits with status 0 if all results agree, 1 otherwise.
+//
+// The implementation is included directly, rather than linked, so that every kernel can be reached,
+// not just the one chosen at runtime.
+//
+
+#include "../Eden/EdenMath.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_MATRICES 64
+#define BENCH_MATRIX_REPS 20000
+#define BENCH_VECTORS 1024
+#define BENCH_VECTOR_REPS 1000
+#define TOLERANCE_F 1e-5
+#define TOLERANCE_D 1e-12
+
+typedef struct {
+    const char *name;
+    int available;
+    MULT_MATRIX_FUNC multMatrix;
+    MULT_MATRIXD_FUNC multMatrixd;                      // NULL if this instruction set has no double kernel.
+    MULT_MATRIX_BY_VECTORS_FUNC multMatrixByVectors;
+    MULT_MATRIX_BY_VECTORSD_FUNC multMatrixByVectorsd;  // NULL if this instruction set has no double kernel.
+} KERNELS_t;
+
+static KERNELS_t gKernels[] = {
+    {"scalar", 1, multMatrixScalar, multMatrixdScalar, multMatrixByVectorsScalar, multMatrixByVectorsdScalar},
+#ifdef EDEN_MATH_SSE2
+    {"SSE2", 1, multMatrixSSE2, multMatrixdSSE2, multMatrixByVectorsSSE2, multMatrixByVectorsdSSE2},
+#endif
+#ifdef EDEN_MATH_AVX
+    {"AVX", 0, multMatrixAVX, multMatrixdAVX, multMatrixByVectorsAVX, multMatrixByVectorsdAVX},
+#endif
+#ifdef EDEN_MATH_NEON
+    {"NEON", 1, multMatrixNEON, NULL, multMatrixByVectorsNEON, NULL},
+#endif
+};
+#define KERNELS_COUNT (sizeof(gKernels)/sizeof(gKernels[0]))
+
+static int gFailures = 0;
+
+static double timeNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double)ts.tv_sec + (double)ts.tv_nsec * 1e-9);
+}
+
+static double randomUnit(void)
+{
+    return ((double)rand() / (double)RAND_MAX * 2.0 - 1.0);
+}
+
+// Largest difference between a and b, relative to the largest magnitude in b (or 1, if larger).
+static double maxErrord(const double *a, const double *b, const int n)
+{
+    double err = 0.0, scale = 1.0;
+    int i;
+
+    for (i = 0; i < n; i++) if (fabs(b[i]) > scale) scale = fabs(b[i]);
+    for (i = 0; i < n; i++) if (fabs(a[i] - b[i]) > err) err = fabs(a[i] - b[i]);
+    return (err / scale);
+}
+
+static double maxErrorf(const float *a, const float *b, const int n)
+{
+    double err = 0.0, scale = 1.0;
+    int i;
+
+    for (i = 0; i < n; i++) if (fabs(b[i]) > scale) scale = fabs(b[i]);
+    for (i = 0; i < n; i++) if (fabs((double)a[i] - (double)b[i]) > err) err = fabs((double)a[i] - (double)b[i]);
+    return (err / scale);
+}
+
+static void check(const char *kernel, const char *what, const double err, const double tolerance)
+{
+    if (err > tolerance) {
+        printf("FAIL: %s %s: relative error %g exceeds %g.\n", kernel, what, err, tolerance);
+        gFailures++;
+    }
+}
+
+static void checkKernels(const KERNELS_t *k, const float *Af, const float *Bf, const double *Ad, const double *Bd, const float *pf, const double *pd)
+{
+    float Cf[16], Rf[16], qf[BENCH_VECTORS*4], rf[BENCH_VECTORS*4];
+    double Cd[16], Rd[16], qd[BENCH_VECTORS*4], rd[BENCH_VECTORS*4];
+    int m;
+
+    for (m = 0; m < BENCH_MATRICES; m++) {
+        multMatrixScalar(Rf, Bf + m*16, Af + m*16);
+        (*k->multMatrix)(Cf, Bf + m*16, Af + m*16);
+        check(k->name, "multMatrix", maxErrorf(Cf, Rf, 16), TOLERANCE_F);
+        // Result aliasing each input.
+        memcpy(Cf, Af + m*16, sizeof(Cf));
+        (*k->multMatrix)(Cf, Bf + m*16, Cf);
+        check(k->name, "multMatrix (C == A)", maxErrorf(Cf, Rf, 16), TOLERANCE_F);
+        memcpy(Cf, Bf + m*16, sizeof(Cf));
+        (*k->multMatrix)(Cf, Cf, Af + m*16);
+        check(k->name, "multMatrix (C == B)", maxErrorf(Cf, Rf, 16), TOLERANCE_F);
+
+        if (k->multMatrixd) {
+            multMatrixdScalar(Rd, Bd + m*16, Ad + m*16);
+            (*k->multMatrixd)(Cd, Bd + m*16, Ad + m*16);
+            check(k->name, "multMatrixd", maxErrord(Cd, Rd, 16), TOLERANCE_D);
+            memcpy(Cd, Ad + m*16, sizeof(Cd));
+            (*k->multMatrixd)(Cd, Bd + m*16, Cd);
+            check(k->name, "multMatrixd (C == A)", maxErrord(Cd, Rd, 16), TOLERANCE_D);
+            memcpy(Cd, Bd + m*16, sizeof(Cd));
+            (*k->multMatrixd)(Cd, Cd, Ad + m*16);
+            check(k->name, "multMatrixd (C == B)", maxErrord(Cd, Rd, 16), TOLERANCE_D);
+        }
+    }
+
+    // Odd count, so that any unrolled kernel's tail is exercised, then in place.
+    multMatrixByVectorsScalar(rf, Af, pf, BENCH_VECTORS - 1);
+    (*k->multMatrixByVectors)(qf, Af, pf, BENCH_VECTORS - 1);
+    check(k->name, "multMatrixByVectors", maxErrorf(qf, rf, (BENCH_VECTORS - 1)*4), TOLERANCE_F);
+    memcpy(qf, pf, sizeof(float)*(BENCH_VECTORS - 1)*4);
+    (*k->multMatrixByVectors)(qf, Af, qf, BENCH_VECTORS - 1);
+    check(k->name, "multMatrixByVectors (q == p)", maxErrorf(qf, rf, (BENCH_VECTORS - 1)*4), TOLERANCE_F);
+
+    if (k->multMatrixByVectorsd) {
+        multMatrixByVectorsdScalar(rd, Ad, pd, BENCH_VECTORS - 1);
+        (*k->multMatrixByVectorsd)(qd, Ad, pd, BENCH_VECTORS - 1);
+        check(k->name, "multMatrixByVectorsd", maxErrord(qd, rd, (BENCH_VECTORS - 1)*4), TOLERANCE_D);
+        memcpy(qd, pd, sizeof(double)*(BENCH_VECTORS - 1)*4);
+        (*k->multMatrixByVectorsd)(qd, Ad, qd, BENCH_VECTORS - 1);
+        check(k->name, "multMatrixByVectorsd (q == p)", maxErrord(qd, rd, (BENCH_VECTORS - 1)*4), TOLERANCE_D);
+    }
+}
+
+// Checks the public functions, which go through the runtime dispatch, including the batching in EdenMathTransformPoints().
+static void checkPublic(const float *Af, const double *Ad, const float *pf, const double *pd)
+{
+    static const int counts[] = {1, TRANSFORM_POINTS_BATCH - 1, TRANSFORM_POINTS_BATCH, TRANSFORM_POINTS_BATCH + 1, BENCH_VECTORS};
+    float p3f[BENCH_VECTORS*3], q3f[BENCH_VECTORS*3], r3f[BENCH_VECTORS*3], r4f[4];
+    double p3d[BENCH_VECTORS*3], q3d[BENCH_VECTORS*3], r3d[BENCH_VECTORS*3], r4d[4];
+    unsigned int c;
+    int n;
+
+    for (n = 0; n < BENCH_VECTORS; n++) {
+        p3f[n*3] = pf[n*4]; p3f[n*3 + 1] = pf[n*4 + 1]; p3f[n*3 + 2] = pf[n*4 + 2];
+        p3d[n*3] = pd[n*4]; p3d[n*3 + 1] = pd[n*4 + 1]; p3d[n*3 + 2] = pd[n*4 + 2];
+    }
+    for (n = 0; n < BENCH_VECTORS; n++) {
+        const float vf[4] = {p3f[n*3], p3f[n*3 + 1], p3f[n*3 + 2], 1.0f};
+        const double vd[4] = {p3d[n*3], p3d[n*3 + 1], p3d[n*3 + 2], 1.0};
+        multMatrixByVectorsScalar(r4f, Af, vf, 1);
+        r3f[n*3] = r4f[0]; r3f[n*3 + 1] = r4f[1]; r3f[n*3 + 2] = r4f[2];
+        multMatrixByVectorsdScalar(r4d, Ad, vd, 1);
+        r3d[n*3] = r4d[0]; r3d[n*3 + 1] = r4d[1]; r3d[n*3 + 2] = r4d[2];
+    }
+    for (c = 0; c < sizeof(counts)/sizeof(counts[0]); c++) {
+        EdenMathTransformPoints(q3f, Af, p3f, counts[c]);
+        check(EdenMathImplementation(), "EdenMathTransformPoints", maxErrorf(q3f, r3f, counts[c]*3), TOLERANCE_F);
+        EdenMathTransformPointsd(q3d, Ad, p3d, counts[c]);
+        check(EdenMathImplementation(), "EdenMathTransformPointsd", maxErrord(q3d, r3d, counts[c]*3), TOLERANCE_D);
+    }
+    EdenMathMultMatrixByVector(r4f, Af, pf);
+    multMatrixByVectorsScalar(q3f, Af, pf, 1);
+    check(EdenMathImplementation(), "EdenMathMultMatrixByVector", maxErrorf(r4f, q3f, 4), TOLERANCE_F);
+}
+
+// Each timing function returns nanoseconds per call. Every result is read into a volatile sink, so that
+// the calls can't be hoisted out of the loop or elided.
+
+static volatile double gSink;
+
+static double timeMultMatrix(MULT_MATRIX_FUNC f, const float *A, const float *B)
+{
+    float C[16];
+    double t0;
+    int r, m;
+
+    t0 = timeNow();
+    for (r = 0; r < BENCH_MATRIX_REPS; r++) for (m = 0; m < BENCH_MATRICES; m++) {
+        (*f)(C, B + m*16, A + m*16);
+        gSink = C[0];
+    }
+    return ((timeNow() - t0) * 1e9 / ((double)BENCH_MATRIX_REPS * BENCH_MATRICES));
+}
+
+static double timeMultMatrixd(MULT_MATRIXD_FUNC f, const double *A, const double *B)
+{
+    double C[16];
+    double t0;
+    int r, m;
+
+    t0 = timeNow();
+    for (r = 0; r < BENCH_MATRIX_REPS; r++) for (m = 0; m < BENCH_MATRICES; m++) {
+        (*f)(C, B + m*16, A + m*16);
+        gSink = C[0];
+    }
+    return ((timeNow() - t0) * 1e9 / ((double)BENCH_MATRIX_REPS * BENCH_MATRICES));
+}
+
+static double timeMultMatrixByVectors(MULT_MATRIX_BY_VECTORS_FUNC f, const float *A, const float *p)
+{
+    static float q[BENCH_VECTORS*4];
+    double t0;
+    int r;
+
+    t0 = timeNow();
+    for (r = 0; r < BENCH_VECTOR_REPS; r++) {
+        (*f)(q, A, p, BENCH_VECTORS);
+        gSink = q[r % (BENCH_VECTORS*4)];
+    }
+    return ((timeNow() - t0) * 1e9 / BENCH_VECTOR_REPS);
+}
+
+static double timeMultMatrixByVectorsd(MULT_MATRIX_BY_VECTORSD_FUNC f, const double *A, const double *p)
+{
+    static double q[BENCH_VECTORS*4];
+    double t0;
+    int r;
+
+    t0 = timeNow();
+    for (r = 0; r < BENCH_VECTOR_REPS; r++) {
+        (*f)(q, A, p, BENCH_VECTORS);
+        gSink = q[r % (BENCH_VECTORS*4)];
+    }
+    return ((timeNow() - t0) * 1e9 / BENCH_VECTOR_REPS);
+}
+
+static void report(const char *kernel, const char *what, const double ns, const double nsScalar)
+{
+    printf("%-8s %-26s %10.1f ns %8.2fx\n", kernel, what, ns, nsScalar / ns);
+}
+
+int main(void)
+{
+    static float Af[BENCH_MATRICES*16], Bf[BENCH_MATRICES*16], pf[BENCH_VECTORS*4];
+    static double Ad[BENCH_MATRICES*16], Bd[BENCH_MATRICES*16], pd[BENCH_VECTORS*4];
+    double scalar[4];
+    unsigned int k;
+    int i;
+
+    srand(1);
+    for (i = 0; i < BENCH_MATRICES*16; i++) {
+        Ad[i] = randomUnit(); Af[i] = (float)Ad[i];
+        Bd[i] = randomUnit(); Bf[i] = (float)Bd[i];
+    }
+    for (i = 0; i < BENCH_VECTORS*4; i++) {
+        pd[i] = randomUnit() * 100.0; pf[i] = (float)pd[i];
+    }
+
+#ifdef EDEN_MATH_AVX
+    __builtin_cpu_init();
+    for (k = 0; k < KERNELS_COUNT; k++) {
+        if (strcmp(gKernels[k].name, "AVX") == 0) gKernels[k].available = __builtin_cpu_supports("avx");
+    }
+#endif
+
+    printf("EdenMath implementation in use: %s\n\n", EdenMathImplementation());
+
+    for (k = 0; k < KERNELS_COUNT; k++) {
+        if (!gKernels[k].available) {
+            printf("%s: not supported by this CPU, skipped.\n", gKernels[k].name);
+            continue;
+        }
+        checkKernels(&gKernels[k], Af, Bf, Ad, Bd, pf, pd);
+    }
+    checkPublic(Af, Ad, pf, pd);
+
+    printf("%-8s %-26s %13s %9s\n", "kernel", "function", "time/call", "speedup");
+    scalar[0] = timeMultMatrix(gKernels[0].multMatrix, Af, Bf);
+    scalar[1] = timeMultMatrixd(gKernels[0].multMatrixd, Ad, Bd);
+    scalar[2] = timeMultMatrixByVectors(gKernels[0].multMatrixByVectors, Af, pf);
+    scalar[3] = timeMultMatrixByVectorsd(gKernels[0].multMatrixByVectorsd, Ad, pd);
+    for (k = 0; k < KERNELS_COUNT; k++) {
+        const KERNELS_t *kn = &gKernels[k];
+        if (!kn->available) continue;
+        report(kn->name, "multMatrix", timeMultMatrix(kn->multMatrix, Af, Bf), scalar[0]);
+        if (kn->multMatrixd) report(kn->name, "multMatrixd", timeMultMatrixd(kn->multMatrixd, Ad, Bd), scalar[1]);
+        report(kn->name, "multMatrixByVectors x1024", timeMultMatrixByVectors(kn->multMatrixByVectors, Af, pf), scalar[2]);
+        if (kn->multMatrixByVectorsd) report(kn->name, "multMatrixByVectorsd x1024", timeMultMatrixByVectorsd(kn->multMatrixByVectorsd, Ad, pd), scalar[3]);
+    }
+
+    if (gFailures) {
+        printf("\n%d check(s) FAILED.\n", gFailures);
+        return (1);
+    }
+    printf("\nAll kernels agree with the scalar reference.\n");
+    return (0);
+}
@@ -61,6 +61,8 @@ void calc(const int capturedImageNum,
 		  const std::vector<std::vector<cv::Point2f> >& cornerSet,
 		  const int width,
 		  const int height,
+		  const ARdouble fxGuess,
+		  const ARdouble fyGuess,
 		  ARParam *param_out,
 		  ARdouble *err_min_out,
 		  ARdouble *err_avg_out,
@@ -71,7 +73,7 @@ void calc(const int capturedImageNum,
     // Options.
     int flags = 0;
     double aspectRatio = 1.0;
-    //flags |= cv::CALIB_USE_INTRINSIC_GUESS;
+    if (fxGuess > 0.0 && fyGuess > 0.0) flags |= cv::CALIB_USE_INTRINSIC_GUESS;
     //flags |= cv::CALIB_FIX_ASPECT_RATIO;
     //flags |= cv::CALIB_FIX_PRINCIPAL_POINT;
     //flags |= cv::CALIB_ZERO_TANGENT_DIST;
@@ -82,6 +84,13 @@ void calc(const int capturedImageNum,
     objectPoints.resize(capturedImageNum, objectPoints[0]);
         
     cv::Mat intrinsics = cv::Mat::eye(3, 3, CV_64F);
+    if (flags & cv::CALIB_USE_INTRINSIC_GUESS) {
+        ARLOGi("Using closed-form estimate fx=%.1f, fy=%.1f as initial guess.\n", fxGuess, fyGuess);
+        intrinsics.at<double>(0,0) = fxGuess;
+        intrinsics.at<double>(1,1) = fyGuess;
+        intrinsics.at<double>(0,2) = (width - 1)*0.5;
+        intrinsics.at<double>(1,2) = (height - 1)*0.5;
+    }
     if (flags & cv::CALIB_FIX_ASPECT_RATIO)
        intrinsics.at<double>(0,0) = aspectRatio;
     
@@ -174,6 +183,76 @@ void calc(const int capturedImageNum,
     cvReleaseMat(&rotationMatrix);
 }
 
+bool calcFocalLengthConstraints(const Calibration::CalibrationPatternType patternType,
+                                const cv::Size patternSize,
+                                const std::vector<cv::Point2f>& corners,
+                                const int width,
+                                const int height,
+                                Calibration::FocalLengthConstraints *constraints_out)
+{
+    int i;
+    
+    if ((int)corners.size() != patternSize.width*patternSize.height) return false;
+    
+    // The constraints are invariant to the scale of the object points, so unit spacing is used.
+    // Image points are centred on the assumed principal point and scaled so the solution is well-conditioned.
+    std::vector<cv::Point3f> objectPoints;
+    calcChessboardCorners(patternType, patternSize, 1.0f, objectPoints);
+    std::vector<cv::Point2f> objectPoints2D(objectPoints.size());
+    std::vector<cv::Point2f> imagePoints(corners.size());
+    const float scale = 1.0f/(float)width;
+    for (i = 0; i < (int)corners.size(); i++) {
+        objectPoints2D[i] = cv::Point2f(objectPoints[i].x, objectPoints[i].y);
+        imagePoints[i] = cv::Point2f((corners[i].x - (width - 1)*0.5f)*scale, (corners[i].y - (height - 1)*0.5f)*scale);
+    }
+    
+    cv::Mat H = cv::findHomography(objectPoints2D, imagePoints, 0);
+    if (H.empty()) return false;
+    
+    // With B = K^-T K^-1 = diag(a, b, c), the orthonormality of r1 and r2 gives h1'Bh2 = 0 and h1'Bh1 = h2'Bh2.
+    // Fixing c = 1 leaves two equations in (a, b), which are normalised and accumulated as normal equations.
+    double h1[3], h2[3], v[2][3];
+    for (i = 0; i < 3; i++) {
+        h1[i] = H.at<double>(i, 0);
+        h2[i] = H.at<double>(i, 1);
+        v[0][i] = h1[i]*h2[i];
+        v[1][i] = h1[i]*h1[i] - h2[i]*h2[i];
+    }
+    Calibration::FocalLengthConstraints constraints;
+    for (i = 0; i < 2; i++) {
+        double norm = sqrt(v[i][0]*v[i][0] + v[i][1]*v[i][1] + v[i][2]*v[i][2]);
+        if (norm < 1e-12) continue;
+        double va = v[i][0]/norm, vb = v[i][1]/norm, vc = v[i][2]/norm;
+        constraints.aa += va*va;
+        constraints.ab += va*vb;
+        constraints.bb += vb*vb;
+        constraints.ac += va*vc;
+        constraints.bc += vb*vc;
+    }
+    constraints.views = 1;
+    *constraints_out = constraints;
+    return true;
+}
+
+bool calcFocalLengthEstimate(const Calibration::FocalLengthConstraints& constraints,
+                             const int width,
+                             const int height,
+                             ARdouble *fx_out,
+                             ARdouble *fy_out)
+{
+    if (constraints.views <= 0) return false;
+    
+    double det = constraints.aa*constraints.bb - constraints.ab*constraints.ab;
+    if (fabs(det) <= 1e-9*constraints.aa*constraints.bb) return false;
+    double a = (constraints.ab*constraints.bc - constraints.ac*constraints.bb)/det; // 1/fx^2, in scaled units.
+    double b = (constraints.ab*constraints.ac - constraints.aa*constraints.bc)/det; // 1/fy^2, in scaled units.
+    if (a <= 0.0 || b <= 0.0) return false;
+    
+    *fx_out = (ARdouble)(width/sqrt(a));
+    *fy_out = (ARdouble)(width/sqrt(b));
+    return true;
+}
+
 void convParam(float intr[3][4], float dist[4], int xsize, int ysize, ARParam *param)
 {
     double   s;
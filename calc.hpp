@@ -34,7 +34,26 @@ void calc(const int capturedImageNum,
           const std::vector<std::vector<cv::Point2f> >& cornerSet,
 		  const int width,
 		  const int height,
+		  const ARdouble fxGuess,
+		  const ARdouble fyGuess,
 		  ARParam *param_out,
 		  ARdouble *err_min_out,
 		  ARdouble *err_avg_out,
 		  ARdouble *err_max_out);
+
+// Compute the homography of the pattern in a single view, and from it the two closed-form (Zhang) constraints on
+// the focal length. Returns false if no usable constraints could be derived from this view.
+bool calcFocalLengthConstraints(const Calibration::CalibrationPatternType patternType,
+                                const cv::Size patternSize,
+                                const std::vector<cv::Point2f>& corners,
+                                const int width,
+                                const int height,
+                                Calibration::FocalLengthConstraints *constraints_out);
+
+// Solve accumulated constraints for the focal length in pixels. Returns false if the views seen so far do not
+// determine it (e.g. no views, or only fronto-parallel ones).
+bool calcFocalLengthEstimate(const Calibration::FocalLengthConstraints& constraints,
+                             const int width,
+                             const int height,
+                             ARdouble *fx_out,
+                             ARdouble *fy_out);
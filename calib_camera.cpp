@@ -31,6 +31,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <atomic>
 #ifdef _WIN32
 #  include <windows.h>
 #  define MAXPATHLEN MAX_PATH
@@ -41,7 +44,10 @@
 #endif
 #ifdef __APPLE__
 #  include <OpenGL/gl.h>
-#elif defined(__linux) || defined(_WIN32)
+#elif defined(__linux)
+#  define GL_GLEXT_PROTOTYPES // glGenBuffers() etc.
+#  include <GL/gl.h>
+#elif defined(_WIN32)
 #  include <GL/gl.h>
 #endif
 #include <AR6/AR/ar.h>
@@ -53,12 +59,20 @@
 #include <AR6/ARUtil/time.h>
 #include <AR6/ARUtil/file_utils.h>
 #include <AR6/ARG/arg.h>
+#include <AR6/ARG/arg_mtx.h>
 
 #include "fileUploader.h"
+#include "persistWorker.h"
+#include "pipelineStats.h"
+#include "traceEvents.h"
+#include "LumaTextureUploader.hpp"
 #include "Calibration.hpp"
 #include "flow.hpp"
 #include "Eden/EdenMessage.h"
 #include "Eden/EdenGLFont.h"
+#include "Eden/EdenGLDraw.h"
+#define USE_GL_STATE_CACHE 1
+#include "Eden/glStateCache.h"
 
 #include "prefs.hpp"
 
@@ -108,6 +122,37 @@ unsigned char *MD5(const unsigned char *d, size_t n, unsigned char *md);
 
 #define FONT_SIZE 18.0f
 #define UPLOAD_STATUS_HIDE_AFTER_SECONDS 9.0f
+#define UPLOAD_BATCH_SIZE 16 // Calibrations sent per upload request, where the server accepts batches.
+#define PERSIST_QUEUE_MAX 8 // Calibrations waiting to be saved before the flow thread waits.
+#define PERSIST_SYNC_BATCH_MAX 8 // Saves whose directory syncs are made together.
+
+// Main loop wait times. New frames and results are signalled by the capture thread. Animations (busy indicator,
+// input cursor) need periodic redraw. Otherwise the loop sleeps until an event arrives, sampling state that isn't
+// signalled explicitly at a low rate.
+#define MAIN_LOOP_ANIMATION_INTERVAL_MS 40
+#define MAIN_LOOP_IDLE_INTERVAL_MS 100
+
+// The video source has no frame-arrival notification, so the capture thread polls it. Rather than at a short fixed
+// interval, it sleeps until just before the next frame is due (from the measured interval between frames), and
+// only then polls, at a fraction of the frame period, until the frame arrives.
+#define CAPTURE_FRAME_PERIOD_INITIAL_US 33333 // Until measured; 30 fps.
+#define CAPTURE_POLL_DIVISOR 8 // Once a frame is due, poll at this fraction of the frame period.
+#define CAPTURE_POLL_MAX_MS 50 // Longest single sleep, so that stop requests and camera restarts are seen promptly.
+
+// Pipeline statistics are written to this file in the cache directory on 's' keypress, SIGUSR1, and at exit.
+#define PIPELINE_STATS_FILE "pipeline-stats.json"
+
+// If this environment variable is set, tracing is enabled and the trace is written to the path it names
+// on 't' keypress and at exit.
+#define TRACE_FILE_ENVIRONMENT_VARIABLE "CALIB_CAMERA_TRACE_FILE"
+#define TRACE_BUFFER_EVENTS (1 << 18)
+
+// If this environment variable is set to a non-zero value, the corner finder image is uploaded by
+// LumaTextureUploader (streaming through pixel buffer objects where usable) rather than by argl.
+#define STREAMING_UPLOAD_ENVIRONMENT_VARIABLE "CALIB_CAMERA_STREAMING_UPLOAD"
+
+// If this environment variable is set, calibration uploads are limited to the number of bytes per second it gives.
+#define UPLOAD_MAX_SEND_SPEED_ENVIRONMENT_VARIABLE "CALIB_CAMERA_UPLOAD_MAX_BYTES_PER_SEC"
 
 // ============================================================================
 //	Global variables.
@@ -116,6 +161,8 @@ unsigned char *MD5(const unsigned char *d, size_t n, unsigned char *md);
 // Prefs.
 static void *gPreferences = NULL;
 Uint32 gSDLEventPreferencesChanged = 0;
+Uint32 gSDLEventRedrawRequired = 0;
+static std::atomic<bool> gRedrawRequestPending(false);
 static char *gPreferenceCameraOpenToken = NULL;
 static char *gPreferenceCameraResolutionToken = NULL;
 static bool gCalibrationSave = false;
@@ -139,13 +186,30 @@ static Calibration *gCalibration = nullptr;
 
 static char *gFileUploadQueuePath = NULL;
 FILE_UPLOAD_HANDLE_t *fileUploadHandle = NULL;
+static pthread_mutex_t gFileUploadHandleLock = PTHREAD_MUTEX_INITIALIZER; // Held while the uploader is replaced, and by saves while queueing to it.
+static long gUploadMaxSendSpeed = 0; // Bytes per second, or 0 for no limit.
+
+// Saving of results, off the flow thread.
+static PERSIST_WORKER_t *gPersistWorker = NULL;
+// Outcome of the last save made on the flow thread, when there is no persistence worker. Shown as the worker's status would be.
+static pthread_mutex_t gSaveStatusLock = PTHREAD_MUTEX_INITIALIZER;
+static char gSaveStatus[PERSIST_STATUS_BUFFER_LEN] = "";
+static struct timeval gSaveStatusHideAtTime = {0, 0};
 
 // Video acquisition and rendering.
 static ARVideoSource *vs = nullptr;
 static ARView *vv = nullptr;
-static bool gPostVideoSetupDone = false;
+static std::atomic<bool> gPostVideoSetupDone(false);
 static bool gCameraIsFrontFacing = false;
-static long gFrameCount = 0;
+
+// Capture thread. Owns polling of the video source and feeding of the corner finder, so that acquisition runs at
+// camera rate rather than being throttled by vsync on the main (rendering) thread.
+static pthread_t gCaptureThread;
+static bool gCaptureThreadRunning = false;
+static std::atomic<bool> gCaptureThreadStop(false);
+static std::atomic<long> gCaptureFrameCount(0); // Frames captured since video was started.
+static long gCaptureFrameCountDisplayed = 0; // Main thread only.
+static long gDroppedFrameCount = 0; // Frames captured but never displayed. Main thread only.
 
 // Window and GL context.
 static SDL_GLContext gSDLContext = NULL;
@@ -156,12 +220,31 @@ static SDL_Window* gSDLWindow = NULL;
 static int32_t gViewport[4] = {0, 0, 0, 0}; // {x, y, width, height}
 static int gDisplayOrientation = 1; // range [0-3]. 1=landscape.
 static float gDisplayDPI = 72.0f;
+#ifdef DEBUG
+static unsigned long gGLStateCacheAvoidedCallCountLast = 0;
+#endif
 
 // Main state.
 static struct timeval gStartTime;
+static volatile sig_atomic_t gPipelineStatsWriteRequested = 0;
+static const char *gTraceFile = NULL;
 
 // Corner finder results copy, for display to user.
 static ARGL_CONTEXT_SETTINGS_REF gArglSettingsCornerFinderImage = NULL;
+static LumaTextureUploader *gCornerFinderImageUploader = nullptr; // Used instead of argl if streaming upload was requested.
+static uint64_t gCornerFinderImageGeneration = 0; // Results generation of the image last uploaded. 0 if none.
+
+// Corner overlay. The crosses and index labels for the corner finder results are laid out as GL_LINES into a
+// single vertex buffer, which is rebuilt only when the results (or the parameters of the layout) change.
+static std::vector<cv::Point2f> gCornerOverlayCorners; // Last fetched results. Main thread only.
+static uint64_t gCornerFinderResultsGeneration = 0; // Generation of gCornerOverlayCorners, as last fetched.
+static GLuint gCornerOverlayBuffer = 0;
+static GLsizeiptr gCornerOverlayBufferSize = 0; // Allocated size of gCornerOverlayBuffer, in bytes.
+static GLsizei gCornerOverlayVertexCount = 0;
+static bool gCornerOverlayValid = false;
+static uint64_t gCornerOverlayGeneration = 0; // Generation of the results in gCornerOverlayBuffer.
+static float gCornerOverlayFontSize = 0.0f;
+static int gCornerOverlayDisplayOrientation = 0;
 
 // ============================================================================
 //	Function prototypes
@@ -169,11 +252,103 @@ static ARGL_CONTEXT_SETTINGS_REF gArglSettingsCornerFinderImage = NULL;
 
 static void quit(int rc);
 static void reshape(int w, int h);
+static void cornerOverlayFinal(void);
 static void drawView(void);
 
 //static void          init(int argc, char *argv[]);
 //static void          usage(char *com);
 static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg, ARdouble err_max, void *userdata);
+static int saveStatusGet(char statusBuf[PERSIST_STATUS_BUFFER_LEN], struct timeval *currentTime_p);
+
+// How long the capture thread should sleep before polling for a frame again. Times are in nanoseconds.
+static int captureSleepMS(const uint64_t now, const uint64_t lastFrameTime, const uint64_t framePeriod)
+{
+    uint64_t due = lastFrameTime + framePeriod - framePeriod/CAPTURE_POLL_DIVISOR;
+    uint64_t sleep = (lastFrameTime && now < due ? due - now : framePeriod/CAPTURE_POLL_DIVISOR);
+    return ((int)MIN(MAX(sleep/1000000ull, 1ull), (uint64_t)CAPTURE_POLL_MAX_MS));
+}
+
+static void *captureThread(void *arg)
+{
+    ARLOGi("Start capture thread.\n");
+    TRACE_THREAD_NAME("captureThread");
+    
+    uint64_t lastFrameTime = 0;
+    uint64_t framePeriod = CAPTURE_FRAME_PERIOD_INITIAL_US*1000ull;
+    while (!gCaptureThreadStop) {
+        
+        uint64_t captureStartTime = pipelineStatsTimeNow();
+        if (!vs->captureFrame()) {
+            arUtilSleep(captureSleepMS(captureStartTime, lastFrameTime, framePeriod));
+            continue;
+        }
+        pipelineStatsRecord(PIPELINE_STAGE_CAPTURE, captureStartTime);
+        // Track the frame period as a moving average, ignoring gaps such as while the camera was starting.
+        if (lastFrameTime && captureStartTime - lastFrameTime < 1000000000ull) framePeriod = (framePeriod*7 + (captureStartTime - lastFrameTime))/8;
+        lastFrameTime = captureStartTime;
+        TRACE_INSTANT("frame");
+        gCaptureFrameCount++;
+        
+        // Setup on the first frame requires the OpenGL context, so is done by the main thread.
+        if (!gPostVideoSetupDone) {
+            requestRedraw();
+            continue;
+        }
+        
+        FLOW_STATE state = flowStateGet();
+        if (state == FLOW_STATE_WELCOME || state == FLOW_STATE_DONE || state == FLOW_STATE_CALIBRATING) {
+            
+            // Live video is displayed, so every frame changes the display.
+            requestRedraw();
+            
+        } else if (state == FLOW_STATE_CAPTURING) {
+            
+            // While capturing, the corner finder image is displayed, so only new results change the display.
+            TRACE_SCOPE("Calibration::frame");
+            if (gCalibration->frame(vs)) requestRedraw();
+        }
+    }
+    
+    ARLOGi("End capture thread.\n");
+    return (NULL);
+}
+
+static void startCaptureThread(void)
+{
+    gCaptureFrameCount = 0;
+    gCaptureFrameCountDisplayed = 0;
+    gDroppedFrameCount = 0;
+    gCaptureThreadStop = false;
+    if (pthread_create(&gCaptureThread, NULL, captureThread, NULL) != 0) {
+        ARLOGe("Error: Unable to start capture thread.\n");
+        return;
+    }
+    gCaptureThreadRunning = true;
+}
+
+static void stopCaptureThread(void)
+{
+    if (!gCaptureThreadRunning) return;
+    gCaptureThreadStop = true;
+    pthread_join(gCaptureThread, NULL);
+    gCaptureThreadRunning = false;
+    ARLOGi("Captured %ld frames, %ld not displayed.\n", gCaptureFrameCount.load(), gDroppedFrameCount);
+}
+
+static void writePipelineStats(void)
+{
+    char *path;
+    asprintf(&path, "%s/%s", arUtilGetResourcesDirectoryPath(AR_UTIL_RESOURCES_DIRECTORY_BEHAVIOR_USE_APP_CACHE_DIR), PIPELINE_STATS_FILE);
+    pipelineStatsWrite(path);
+    free(path);
+}
+
+#ifndef _WIN32
+static void pipelineStatsSignalHandler(int signum)
+{
+    gPipelineStatsWriteRequested = 1; // Written from the main loop, which is woken at least every MAIN_LOOP_IDLE_INTERVAL_MS.
+}
+#endif
 
 static void startVideo(void)
 {
@@ -192,10 +367,15 @@ static void startVideo(void)
         }
     }
     gPostVideoSetupDone = false;
+    if (vs && vs->isOpen()) startCaptureThread();
 }
 
 static void stopVideo(void)
 {
+    // Stop acquisition before tearing down anything it feeds.
+    stopCaptureThread();
+    
+
     // Stop calibration flow.
     flowStopAndFinal();
     
@@ -208,6 +388,10 @@ static void stopVideo(void)
         arglCleanup(gArglSettingsCornerFinderImage); // Clean up any left-over ARGL data.
         gArglSettingsCornerFinderImage = NULL;
     }
+    delete gCornerFinderImageUploader;
+    gCornerFinderImageUploader = nullptr;
+    gCornerFinderImageGeneration = 0;
+    cornerOverlayFinal();
     
     delete vv;
     vv = nullptr;
@@ -232,13 +416,19 @@ static void rereadPreferences(void)
     } else {
         free(gCalibrationServerUploadURL);
         gCalibrationServerUploadURL = csuu;
+        // Saves on the persistence worker may be queueing to the current uploader at any time, so replace it under the lock.
+        pthread_mutex_lock(&gFileUploadHandleLock);
         fileUploaderFinal(&fileUploadHandle);
         if (csuu) {
             fileUploadHandle = fileUploaderInit(gFileUploadQueuePath, QUEUE_INDEX_FILE_EXTENSION, gCalibrationServerUploadURL, UPLOAD_STATUS_HIDE_AFTER_SECONDS);
             if (!fileUploadHandle) {
                 ARLOGe("Error: Could not initialise fileUploadHandle.\n");
+            } else {
+                fileUploaderSetBatchSize(fileUploadHandle, UPLOAD_BATCH_SIZE);
+                fileUploaderSetMaxSendSpeed(fileUploadHandle, gUploadMaxSendSpeed);
             }
         }
+        pthread_mutex_unlock(&gFileUploadHandleLock);
     }
     char *csat = getPreferenceCalibrationServerAuthenticationToken(gPreferences);
     if (csat && gCalibrationServerAuthenticationToken && strcmp(gCalibrationServerAuthenticationToken, csat) == 0) {
@@ -307,6 +497,7 @@ int main(int argc, char *argv[])
     gCalibrationPatternSpacing = getPreferencesCalibrationPatternSpacing(gPreferences);
     
     gSDLEventPreferencesChanged = SDL_RegisterEvents(1);
+    gSDLEventRedrawRequired = SDL_RegisterEvents(1);
     
     // Create a window.
     gSDLWindow = SDL_CreateWindow("ARToolKit6 Camera Calibration Utility",
@@ -341,14 +532,24 @@ int main(int argc, char *argv[])
         exit(-1);
     }
     
+    const char *uploadMaxSendSpeed = getenv(UPLOAD_MAX_SEND_SPEED_ENVIRONMENT_VARIABLE);
+    if (uploadMaxSendSpeed) gUploadMaxSendSpeed = MAX(atol(uploadMaxSendSpeed), 0L);
     if (gCalibrationServerUploadURL) {
         fileUploadHandle = fileUploaderInit(gFileUploadQueuePath, QUEUE_INDEX_FILE_EXTENSION, gCalibrationServerUploadURL, UPLOAD_STATUS_HIDE_AFTER_SECONDS);
         if (!fileUploadHandle) {
             ARLOGe("Error: Could not initialise fileUploadHandle.\n");
+        } else {
+            fileUploaderSetBatchSize(fileUploadHandle, UPLOAD_BATCH_SIZE);
+            fileUploaderSetMaxSendSpeed(fileUploadHandle, gUploadMaxSendSpeed);
         }
         fileUploaderTickle(fileUploadHandle);
     }
     
+    gPersistWorker = persistWorkerInit(PERSIST_QUEUE_MAX, PERSIST_SYNC_BATCH_MAX, UPLOAD_STATUS_HIDE_AFTER_SECONDS);
+    if (!gPersistWorker) {
+        ARLOGe("Error: Could not initialise persistence worker. Results will be saved on the flow thread.\n");
+    }
+    
     // Calibration prefs.
     ARLOGi("Calbration pattern size X = %d\n", gCalibrationPatternSize.width);
     ARLOGi("Calbration pattern size Y = %d\n", gCalibrationPatternSize.height);
@@ -361,18 +562,46 @@ int main(int argc, char *argv[])
     EdenGLFontInit(contextsActiveCount);
     EdenGLFontSetFont(EDEN_GL_FONT_ID_Stroke_Roman);
     EdenGLFontSetSize(FONT_SIZE);
+    // Overlays are drawn with shaders where OpenGL 2.0 is available, otherwise with the fixed-function pipeline.
+    EdenGLDrawInit();
     
     // Get start time.
     gettimeofday(&gStartTime, NULL);
     
+#ifndef _WIN32
+    signal(SIGUSR1, pipelineStatsSignalHandler);
+#endif
+    
+    gTraceFile = getenv(TRACE_FILE_ENVIRONMENT_VARIABLE);
+    if (gTraceFile && *gTraceFile) {
+        if (traceStart(TRACE_BUFFER_EVENTS)) TRACE_THREAD_NAME("main");
+        else gTraceFile = NULL;
+    }
+    
     startVideo();
     
     // Main loop.
     bool done = false;
+    bool redrawRequired = true;
+    FLOW_STATE lastState = FLOW_STATE_NOT_INITED;
+    EDEN_BOOL lastEdenMessageDrawRequired = FALSE;
+    int lastUploadStatus = 0;
+    int lastPersistStatus = 0;
+    long drawCount = 0;
+    long lastFPSFrameCount = 0;
     while (!done) {
         
+        // Work out how long we can sleep for, then block until an event arrives or that time elapses.
+        int waitMS;
+        if (lastUploadStatus == 1 || lastPersistStatus == 1 || gEdenMessageKeyboardRequired) waitMS = MAIN_LOOP_ANIMATION_INTERVAL_MS;
+        else waitMS = MAIN_LOOP_IDLE_INTERVAL_MS;
+        
         SDL_Event ev;
-        while (SDL_PollEvent(&ev)) {
+        TRACE_BEGIN("SDL_WaitEventTimeout");
+        int gotEvent = SDL_WaitEventTimeout(&ev, waitMS);
+        TRACE_END("SDL_WaitEventTimeout");
+        TRACE_BEGIN("handleEvents");
+        while (gotEvent) {
             if (ev.type == SDL_QUIT /*|| (ev.type == SDL_KEYDOWN && ev.key.keysym.sym == SDLK_ESCAPE)*/) {
                 done = true;
                 break;
@@ -385,6 +614,7 @@ int main(int argc, char *argv[])
                     SDL_GL_GetDrawableSize(gSDLWindow, &w, &h);
                     reshape(w, h);
                 }
+                redrawRequired = true;
             } else if (ev.type == SDL_KEYDOWN) {
                 if (gEdenMessageKeyboardRequired) {
                     EdenMessageInputKeyboard(ev.key.keysym.sym);
@@ -394,22 +624,27 @@ int main(int argc, char *argv[])
                     flowHandleEvent(EVENT_TOUCH);
                 } else if ((ev.key.keysym.sym == SDLK_COMMA && (ev.key.keysym.mod & KMOD_LGUI)) || ev.key.keysym.sym == SDLK_p) {
                     showPreferences(gPreferences);
+                } else if (ev.key.keysym.sym == SDLK_s) {
+                    gPipelineStatsWriteRequested = 1;
+                } else if (ev.key.keysym.sym == SDLK_t) {
+                    if (gTraceFile) traceWrite(gTraceFile);
                 }
+                redrawRequired = true;
             } else if (gSDLEventPreferencesChanged != 0 && ev.type == gSDLEventPreferencesChanged) {
                 rereadPreferences();
+                redrawRequired = true;
+            } else if (gSDLEventRedrawRequired != 0 && ev.type == gSDLEventRedrawRequired) {
+                gRedrawRequestPending = false;
+                redrawRequired = true;
             }
+            gotEvent = SDL_PollEvent(&ev);
         }
+        TRACE_END("handleEvents");
+        if (done) break;
         
         if (vs->isOpen()) {
-            if (vs->captureFrame()) {
-                gFrameCount++; // Increment ARToolKit FPS counter.
-#ifdef DEBUG
-                if (gFrameCount % 150 == 0) {
-                    ARLOGi("*** Camera - %f (frame/sec)\n", (double)gFrameCount/arUtilTimer());
-                    gFrameCount = 0;
-                    arUtilTimerReset();
-                }
-#endif
+            // The capture thread has signalled at least one frame.
+            if (gCaptureFrameCount > 0) {
                 if (!gPostVideoSetupDone) {
                     
                     gCameraIsFrontFacing = false;
@@ -468,6 +703,14 @@ int main(int argc, char *argv[])
                     arglSetRotate90(gArglSettingsCornerFinderImage, contentRotate90);
                     arglSetFlipV(gArglSettingsCornerFinderImage, contentFlipV);
                     arglSetFlipH(gArglSettingsCornerFinderImage, contentFlipH);
+                    const char *streamingUpload = getenv(STREAMING_UPLOAD_ENVIRONMENT_VARIABLE);
+                    if (streamingUpload && atoi(streamingUpload)) {
+                        gCornerFinderImageUploader = new LumaTextureUploader(vs->getVideoWidth(), vs->getVideoHeight());
+                        if (!gCornerFinderImageUploader->isValid()) {
+                            delete gCornerFinderImageUploader;
+                            gCornerFinderImageUploader = nullptr;
+                        }
+                    }
                     
                     //
                     // Calibration init.
@@ -484,9 +727,22 @@ int main(int argc, char *argv[])
                         quit(-1);
                     }
                     
+                    // Describe the camera and pattern in the pipeline statistics.
+                    char *device_id = NULL;
+                    if (ar2VideoGetParams(vs->getAR2VideoParam(), AR_VIDEO_PARAM_DEVICEID, &device_id) >= 0 && device_id) {
+                        pipelineStatsSetInfo("device_id", device_id);
+                        free(device_id);
+                    }
+                    char info[64];
+                    snprintf(info, sizeof(info), "%dx%d", vs->getVideoWidth(), vs->getVideoHeight());
+                    pipelineStatsSetInfo("video_size", info);
+                    snprintf(info, sizeof(info), "%s %dx%d", (gCalibrationPatternType == Calibration::CalibrationPatternType::CHESSBOARD ? "chessboard" : (gCalibrationPatternType == Calibration::CalibrationPatternType::CIRCLES_GRID ? "circles_grid" : "asymmetric_circles_grid")), gCalibrationPatternSize.width, gCalibrationPatternSize.height);
+                    pipelineStatsSetInfo("pattern", info);
+                    
                     // For FPS statistics.
                     arUtilTimerReset();
-                    gFrameCount = 0;
+                    lastFPSFrameCount = gCaptureFrameCount;
+                    drawCount = 0;
                     
                     gPostVideoSetupDone = true;
                 } // !gPostVideoSetupDone
@@ -496,26 +752,67 @@ int main(int argc, char *argv[])
                     vv->getViewport(gViewport);
                 }
                 
-                FLOW_STATE state = flowStateGet();
-                if (state == FLOW_STATE_WELCOME || state == FLOW_STATE_DONE || state == FLOW_STATE_CALIBRATING) {
-                    
-                    // Upload the frame to OpenGL.
-                    // Now done as part of the draw call.
-                    
-                } else if (state == FLOW_STATE_CAPTURING) {
-                    
-                    gCalibration->frame(vs);
-
-                }
-                
+                // Frames and corner finder results are consumed as part of the draw call.
             }
             
         } // vs->isOpen()
         
-        // The display has changed.
-        drawView();
-                
-        arUtilSleep(1); // 1 millisecond.
+        if (gPipelineStatsWriteRequested) {
+            gPipelineStatsWriteRequested = 0;
+            writePipelineStats();
+        }
+        
+        // Sample state which is not explicitly signalled.
+        FLOW_STATE state = flowStateGet();
+        if (state != lastState) {
+            lastState = state;
+            redrawRequired = true;
+        }
+        if (gEdenMessageDrawRequired != lastEdenMessageDrawRequired) {
+            lastEdenMessageDrawRequired = gEdenMessageDrawRequired;
+            redrawRequired = true;
+        }
+        if (gEdenMessageKeyboardRequired) redrawRequired = true; // Input cursor blinks.
+        if (fileUploadHandle) {
+            struct timeval time;
+            char uploadStatus[UPLOAD_STATUS_BUFFER_LEN];
+            gettimeofday(&time, NULL);
+            int status = fileUploaderStatusGet(fileUploadHandle, uploadStatus, &time);
+            if (status != lastUploadStatus || status == 1) redrawRequired = true; // Busy indicator is animated.
+            lastUploadStatus = status;
+        } else {
+            lastUploadStatus = 0;
+        }
+        {
+            struct timeval time;
+            char persistStatus[PERSIST_STATUS_BUFFER_LEN];
+            gettimeofday(&time, NULL);
+            int status = saveStatusGet(persistStatus, &time);
+            if (status != lastPersistStatus || status == 1) redrawRequired = true;
+            lastPersistStatus = status;
+        }
+        
+        // Redraw only if the display has changed. Swap is paced to vsync.
+        if (redrawRequired) {
+            drawView();
+            drawCount++;
+            redrawRequired = false;
+            
+            // When live video is displayed, count frames which arrived since the last draw but were never shown.
+            if (gPostVideoSetupDone) {
+                long captured = gCaptureFrameCount;
+                if (state != FLOW_STATE_CAPTURING && captured - gCaptureFrameCountDisplayed > 1) gDroppedFrameCount += captured - gCaptureFrameCountDisplayed - 1;
+                gCaptureFrameCountDisplayed = captured;
+#ifdef DEBUG
+                if (captured - lastFPSFrameCount >= 150) {
+                    ARLOGi("*** Camera - %f (frame/sec), display - %f (frame/sec), %ld frames not displayed\n", (double)(captured - lastFPSFrameCount)/arUtilTimer(), (double)drawCount/arUtilTimer(), gDroppedFrameCount);
+                    lastFPSFrameCount = captured;
+                    drawCount = 0;
+                    arUtilTimerReset();
+                }
+#endif
+            }
+        }
     }
     
     stopVideo();
@@ -531,10 +828,30 @@ void reshape(int w, int h)
     contextWasUpdated = true;
 }
 
+void requestRedraw(void)
+{
+    // Requests are coalesced, so at most one redraw event is queued at a time.
+    if (gSDLEventRedrawRequired == 0 || gRedrawRequestPending.exchange(true)) return;
+    
+    SDL_Event event;
+    SDL_zero(event);
+    event.type = gSDLEventRedrawRequired;
+    event.user.code = (Sint32)0;
+    event.user.data1 = NULL;
+    event.user.data2 = NULL;
+    SDL_PushEvent(&event);
+}
+
 static void quit(int rc)
 {
+    persistWorkerFinal(&gPersistWorker);
     fileUploaderFinal(&fileUploadHandle);
     
+    writePipelineStats();
+    // After the worker threads have finished, so that their last events are included.
+    if (gTraceFile) traceWrite(gTraceFile);
+    
+    EdenGLDrawFinal();
     SDL_Quit();
     
     free(gPreferenceCameraOpenToken);
@@ -626,7 +943,7 @@ static void init(int argc, char *argv[])
     
 */
 
-static void drawBackground(const float width, const float height, const float x, const float y, const bool drawBorder)
+static void drawBackground(const float width, const float height, const float x, const float y, const bool drawBorder, const float viewProjection[16])
 {
     GLfloat vertices[4][2];
     
@@ -635,91 +952,229 @@ static void drawBackground(const float width, const float height, const float x,
     vertices[2][0] = width + x; vertices[2][1] = height + y;
     vertices[3][0] = x; vertices[3][1] = height + y;
     
+    if (EdenGLDrawIsActive()) {
+        const float backgroundColor[4] = {0.0f, 0.0f, 0.0f, 0.5f}; // 50% transparent black.
+        const float borderColor[4] = {1.0f, 1.0f, 1.0f, 1.0f}; // Opaque white.
+        EdenGLDrawArrays(viewProjection, backgroundColor, EDEN_GL_DRAW_SHADING_COLOR, GL_TRIANGLE_FAN, &vertices[0][0], NULL, 4);
+        if (drawBorder) {
+            glStateCacheLineWidth(1.0f);
+            EdenGLDrawArrays(viewProjection, borderColor, EDEN_GL_DRAW_SHADING_COLOR, GL_LINE_LOOP, &vertices[0][0], NULL, 4);
+        }
+        return;
+    }
+    
     glLoadIdentity();
-    glDisable(GL_DEPTH_TEST);
-    glDisable(GL_LIGHTING);
-    glDisable(GL_TEXTURE_2D);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glEnable(GL_BLEND);
+    glStateCacheDisableDepthTest();
+    glStateCacheDisableLighting();
+    glStateCacheActiveTexture(GL_TEXTURE0);
+    glStateCacheDisableTex2D();
+    glStateCacheBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glStateCacheEnableBlend();
     glVertexPointer(2, GL_FLOAT, 0, vertices);
-    glEnableClientState(GL_VERTEX_ARRAY);
-    glDisableClientState(GL_NORMAL_ARRAY);
-    glClientActiveTexture(GL_TEXTURE0);
-    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-    glColor4f(0.0f, 0.0f, 0.0f, 0.5f);	// 50% transparent black.
+    glStateCacheEnableClientStateVertexArray();
+    glStateCacheDisableClientStateNormalArray();
+    glStateCacheClientActiveTexture(GL_TEXTURE0);
+    glStateCacheDisableClientStateTexCoordArray();
+    glStateCacheColor4f(0.0f, 0.0f, 0.0f, 0.5f);	// 50% transparent black.
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
     if (drawBorder) {
-        glColor4f(1.0f, 1.0f, 1.0f, 1.0f); // Opaque white.
-        glLineWidth(1.0f);
+        glStateCacheColor4f(1.0f, 1.0f, 1.0f, 1.0f); // Opaque white.
+        glStateCacheLineWidth(1.0f);
         glDrawArrays(GL_LINE_LOOP, 0, 4);
     }
 }
 
 // An animation while we're waiting.
 // Designed to be drawn on background of at least 3xsquareSize wide and tall.
-static void drawBusyIndicator(int positionX, int positionY, int squareSize, struct timeval *tp)
+static void drawBusyIndicator(int positionX, int positionY, int squareSize, struct timeval *tp, const float viewProjection[16])
 {
     const GLfloat square_vertices [4][2] = { {0.5f, 0.5f}, {squareSize - 0.5f, 0.5f}, {squareSize - 0.5f, squareSize - 0.5f}, {0.5f, squareSize - 0.5f} };
-    int i;
+    int i, j;
     
     int hundredthSeconds = (int)tp->tv_usec / 1E4;
+    int litSquare = hundredthSeconds / 25;
+    unsigned char r, g, b;
+    int secDiv255 = (int)tp->tv_usec / 3921;
+    int secMod6 = tp->tv_sec % 6;
+    if (secMod6 == 0) {
+        r = 255; g = secDiv255; b = 0;
+    } else if (secMod6 == 1) {
+        r = secDiv255; g = 255; b = 0;
+    } else if (secMod6 == 2) {
+        r = 0; g = 255; b = secDiv255;
+    } else if (secMod6 == 3) {
+        r = 0; g = secDiv255; b = 255;
+    } else if (secMod6 == 4) {
+        r = secDiv255; g = 0; b = 255;
+    } else {
+        r = 255; g = 0; b = secDiv255;
+    }
+    
+    if (EdenGLDrawIsActive()) {
+        // The lit square, then all four outlines as one set of lines, in two draw calls.
+        GLfloat fill[4][2];
+        GLfloat outlines[4*4*2][2];
+        for (i = 0; i < 4; i++) {
+            float dx = (float)(positionX + ((i + 1)/2 != 1 ? -squareSize : 0.0f)); // Order: UL, UR, LR, LL.
+            float dy = (float)(positionY + (i / 2 == 0 ? 0.0f : -squareSize));
+            for (j = 0; j < 4; j++) {
+                outlines[i*8 + j*2][0] = square_vertices[j][0] + dx;
+                outlines[i*8 + j*2][1] = square_vertices[j][1] + dy;
+                outlines[i*8 + j*2 + 1][0] = square_vertices[(j + 1) % 4][0] + dx;
+                outlines[i*8 + j*2 + 1][1] = square_vertices[(j + 1) % 4][1] + dy;
+                if (i == litSquare) {
+                    fill[j][0] = square_vertices[j][0] + dx;
+                    fill[j][1] = square_vertices[j][1] + dy;
+                }
+            }
+        }
+        const float litColor[4] = {r/255.0f, g/255.0f, b/255.0f, 1.0f};
+        const float outlineColor[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+        if (litSquare < 4) EdenGLDrawArrays(viewProjection, litColor, EDEN_GL_DRAW_SHADING_COLOR, GL_TRIANGLE_FAN, &fill[0][0], NULL, 4);
+        EdenGLDrawArrays(viewProjection, outlineColor, EDEN_GL_DRAW_SHADING_COLOR, GL_LINES, &outlines[0][0], NULL, 4*4*2);
+        return;
+    }
     
     // Set up drawing.
     glPushMatrix();
     glLoadIdentity();
-    glDisable(GL_DEPTH_TEST);
-    glDisable(GL_LIGHTING);
-    glDisable(GL_TEXTURE_2D);
-    glDisable(GL_BLEND);
+    glStateCacheDisableDepthTest();
+    glStateCacheDisableLighting();
+    glStateCacheActiveTexture(GL_TEXTURE0);
+    glStateCacheDisableTex2D();
+    glStateCacheDisableBlend();
     glVertexPointer(2, GL_FLOAT, 0, square_vertices);
-    glEnableClientState(GL_VERTEX_ARRAY);
-    glDisableClientState(GL_NORMAL_ARRAY);
-    glClientActiveTexture(GL_TEXTURE0);
-    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glStateCacheEnableClientStateVertexArray();
+    glStateCacheDisableClientStateNormalArray();
+    glStateCacheClientActiveTexture(GL_TEXTURE0);
+    glStateCacheDisableClientStateTexCoordArray();
     
     for (i = 0; i < 4; i++) {
         glLoadIdentity();
         glTranslatef((float)(positionX + ((i + 1)/2 != 1 ? -squareSize : 0.0f)), (float)(positionY + (i / 2 == 0 ? 0.0f : -squareSize)), 0.0f); // Order: UL, UR, LR, LL.
-        if (i == hundredthSeconds / 25) {
-            unsigned char r, g, b;
-            int secDiv255 = (int)tp->tv_usec / 3921;
-            int secMod6 = tp->tv_sec % 6;
-            if (secMod6 == 0) {
-                r = 255; g = secDiv255; b = 0;
-            } else if (secMod6 == 1) {
-                r = secDiv255; g = 255; b = 0;
-            } else if (secMod6 == 2) {
-                r = 0; g = 255; b = secDiv255;
-            } else if (secMod6 == 3) {
-                r = 0; g = secDiv255; b = 255;
-            } else if (secMod6 == 4) {
-                r = secDiv255; g = 0; b = 255;
-            } else {
-                r = 255; g = 0; b = secDiv255;
-            }
-            glColor4ub(r, g, b, 255);
+        if (i == litSquare) {
+            glStateCacheColor4ub(r, g, b, 255);
             glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
         }
-        glColor4ub(255, 255, 255, 255);
+        glStateCacheColor4ub(255, 255, 255, 255);
         glDrawArrays(GL_LINE_LOOP, 0, 4);
     }
     
     glPopMatrix();
 }
 
+// A status box for a background task, with busy indicator while status == 1, right-aligned at height y.
+// Returns the height of the box.
+static float drawStatusBox(const char *text, const int status, const float right, const float y, struct timeval *tp, const float viewProjection[16])
+{
+    const int squareSize = (int)(16.0f * (float)gDisplayDPI / 160.f) ;
+    float x, w, h;
+    float textWidth = EdenGLFontGetLineWidth((unsigned char *)text);
+    w = textWidth + 3*squareSize + 2*4.0f /*text margin*/ + 2*4.0f /* box margin */;
+    h = MAX(FONT_SIZE, 3*squareSize) + 2*4.0f /* box margin */;
+    x = right - (w + 2.0f);
+    drawBackground(w, h, x, y, true, viewProjection);
+    if (status == 1) drawBusyIndicator((int)(x + 4.0f + 1.5f*squareSize), (int)(y + 4.0f + 1.5f*squareSize), squareSize, tp, viewProjection);
+    EdenGLFontDrawLine(0, viewProjection, (unsigned char *)text, x + 4.0f + 3*squareSize, y + (h - FONT_SIZE)/2.0f, H_OFFSET_VIEW_LEFT_EDGE_TO_TEXT_LEFT_EDGE, V_OFFSET_VIEW_BOTTOM_TO_TEXT_BASELINE);
+    return (h);
+}
+
+// Lay out the crosses and labels for the given corners into the corner overlay buffer, if anything they depend on has
+// changed since the last layout.
+static void cornerOverlayUpdate(const std::vector<cv::Point2f>& corners, const uint64_t generation, const float videoHeight, const float fontSize)
+{
+    size_t i;
+    
+    if (gCornerOverlayValid && generation == gCornerOverlayGeneration && fontSize == gCornerOverlayFontSize && gDisplayOrientation == gCornerOverlayDisplayOrientation) return;
+    
+    TRACE_SCOPE("cornerOverlayUpdate");
+    std::vector<GLfloat> vertices;
+    vertices.reserve(corners.size()*(8 + 64)); // Cross, plus a typical label.
+    float labelAngle = (float)(gDisplayOrientation - 1) * -90.0f; // Orient the text to the user.
+    EdenGLFontSetSize(fontSize);
+    for (i = 0; i < corners.size(); i++) {
+        float x = corners[i].x;
+        float y = videoHeight - corners[i].y;
+        GLfloat cross[8] = {x - 5.0f, y - 5.0f, x + 5.0f, y + 5.0f, x - 5.0f, y + 5.0f, x + 5.0f, y - 5.0f};
+        vertices.insert(vertices.end(), cross, cross + 8);
+        
+        unsigned char buf[12]; // 10 digits in INT32_MAX, plus sign, plus null.
+        sprintf((char *)buf, "%d", (int)i);
+        int labelVertexCount = EdenGLFontGetLineSegments(buf, x, y, labelAngle, NULL);
+        size_t offset = vertices.size();
+        vertices.resize(offset + labelVertexCount*2);
+        EdenGLFontGetLineSegments(buf, x, y, labelAngle, &vertices[offset]);
+    }
+    EdenGLFontSetSize(FONT_SIZE);
+    
+    if (!gCornerOverlayBuffer) glGenBuffers(1, &gCornerOverlayBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, gCornerOverlayBuffer);
+    GLsizeiptr size = (GLsizeiptr)(vertices.size()*sizeof(GLfloat));
+    if (size > gCornerOverlayBufferSize) {
+        glBufferData(GL_ARRAY_BUFFER, size, vertices.data(), GL_DYNAMIC_DRAW);
+        gCornerOverlayBufferSize = size;
+    } else if (size > 0) {
+        glBufferSubData(GL_ARRAY_BUFFER, 0, size, vertices.data());
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    
+    gCornerOverlayVertexCount = (GLsizei)(vertices.size()/2);
+    gCornerOverlayGeneration = generation;
+    gCornerOverlayFontSize = fontSize;
+    gCornerOverlayDisplayOrientation = gDisplayOrientation;
+    gCornerOverlayValid = true;
+}
+
+static void cornerOverlayDraw(const float colorRGBA[4], const float viewProjection[16])
+{
+    if (!gCornerOverlayValid || gCornerOverlayVertexCount == 0) return;
+    
+    glStateCacheLineWidth(2.0f);
+    if (EdenGLDrawIsActive()) {
+        EdenGLDrawBufferArrays(viewProjection, colorRGBA, GL_LINES, gCornerOverlayBuffer, 0, gCornerOverlayVertexCount);
+        return;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, gCornerOverlayBuffer);
+    glVertexPointer(2, GL_FLOAT, 0, NULL);
+    glStateCacheEnableClientStateVertexArray();
+    glStateCacheDisableClientStateNormalArray();
+    glStateCacheClientActiveTexture(GL_TEXTURE0);
+    glStateCacheDisableClientStateTexCoordArray();
+    glStateCacheColor4fv(colorRGBA);
+    glDrawArrays(GL_LINES, 0, gCornerOverlayVertexCount);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static void cornerOverlayFinal(void)
+{
+    if (gCornerOverlayBuffer) {
+        glDeleteBuffers(1, &gCornerOverlayBuffer);
+        gCornerOverlayBuffer = 0;
+    }
+    gCornerOverlayBufferSize = 0;
+    gCornerOverlayVertexCount = 0;
+    gCornerOverlayValid = false;
+    gCornerOverlayCorners.clear();
+    gCornerFinderResultsGeneration = 0;
+}
+
 void drawView(void)
 {
-    int i;
     struct timeval time;
     float left, right, bottom, top;
-    GLfloat *vertices = NULL;
-    GLint vertexCount;
+    float viewProjection[16];
     
     // Get frame time.
     gettimeofday(&time, NULL);
+    uint64_t drawStartTime = pipelineStatsTimeNow();
+    TRACE_BEGIN("drawView");
     
     SDL_GL_MakeCurrent(gSDLWindow, gSDLContext);
     
+    // GL state may have been changed by code not using the state cache (e.g. video setup) since the last frame.
+    glStateCacheFlush();
+    glStateCacheAvoidedCallCountReset();
+    
     // Clean the OpenGL context.
     glClearColor(0.0, 0.0, 0.0, 1.0);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -727,32 +1182,46 @@ void drawView(void)
     //
     // Setup for drawing video frame.
     //
-    glViewport(gViewport[0], gViewport[1], gViewport[2], gViewport[3]);
+    glStateCacheViewport(gViewport[0], gViewport[1], gViewport[2], gViewport[3]);
     
     FLOW_STATE state = flowStateGet();
     if (state == FLOW_STATE_WELCOME || state == FLOW_STATE_DONE || state == FLOW_STATE_CALIBRATING) {
         
         // Display the current frame
         vv->draw(vs);
+        glStateCacheFlush(); // ARView doesn't use the state cache.
         
     } else if (state == FLOW_STATE_CAPTURING) {
         
         // Grab a lock while we're using the data to prevent it being changed underneath us.
         int cornerFoundAllFlag;
-        std::vector<cv::Point2f> corners;
         ARUint8 *videoFrame;
-        gCalibration->cornerFinderResultsLockAndFetch(&cornerFoundAllFlag, corners, &videoFrame);
+        gCalibration->cornerFinderResultsLockAndFetch(&cornerFoundAllFlag, gCornerOverlayCorners, &videoFrame, &gCornerFinderResultsGeneration);
         
-        // Display the current frame.
-        if (videoFrame) arglPixelBufferDataUpload(gArglSettingsCornerFinderImage, videoFrame);
-        arglDispImage(gArglSettingsCornerFinderImage, NULL);
+        // Display the current frame. It only needs uploading if the results have changed since the last upload.
+        if (videoFrame && gCornerFinderResultsGeneration != gCornerFinderImageGeneration) {
+            uint64_t uploadStartTime = pipelineStatsTimeNow();
+            if (gCornerFinderImageUploader) gCornerFinderImageUploader->upload(videoFrame);
+            else arglPixelBufferDataUpload(gArglSettingsCornerFinderImage, videoFrame);
+            pipelineStatsRecord(PIPELINE_STAGE_TEXTURE_UPLOAD, uploadStartTime);
+            gCornerFinderImageGeneration = gCornerFinderResultsGeneration;
+        }
+        if (!gCornerFinderImageUploader) arglDispImage(gArglSettingsCornerFinderImage, NULL);
+        
+        gCalibration->cornerFinderResultsUnlock();
+        glStateCacheFlush(); // argl doesn't use the state cache.
+        
+        // Regenerate the corner overlay if the corners have changed. This binds its own buffer, so must be done
+        // before EdenGLDrawBegin() binds the draw buffer.
+        float fontSizeScaled = FONT_SIZE * (float)vs->getVideoHeight()/(float)(gViewport[(gDisplayOrientation % 2) == 1 ? 3 : 2]);
+        cornerOverlayUpdate(gCornerOverlayCorners, gCornerFinderResultsGeneration, (float)vs->getVideoHeight(), fontSizeScaled);
         
         //
         // Setup for drawing on top of video frame, in video pixel coordinates.
         //
-        glMatrixMode(GL_PROJECTION);
-        glLoadIdentity();
-        if (vv->rotate90()) glRotatef(90.0f, 0.0f, 0.0f, -1.0f);
+        EdenGLDrawBegin(); // No more fixed-function drawing from here on, if shaders are available.
+        mtxLoadIdentityf(viewProjection);
+        if (vv->rotate90()) mtxRotatef(viewProjection, 90.0f, 0.0f, 0.0f, -1.0f);
         if (vv->flipV()) {
             bottom = (float)vs->getVideoHeight();
             top = 0.0f;
@@ -767,63 +1236,25 @@ void drawView(void)
             left = 0.0f;
             right = (float)vs->getVideoWidth();
         }
-        glOrtho(left, right, bottom, top, -1.0f, 1.0f);
-        glMatrixMode(GL_MODELVIEW);
-        glLoadIdentity();
-        glDisable(GL_DEPTH_TEST);
-        glDisable(GL_LIGHTING);
-        glDisable(GL_BLEND);
-        glActiveTexture(GL_TEXTURE0);
-        glDisable(GL_TEXTURE_2D);
-        
-        
-        // Draw the crosses marking the corner positions.
-        vertexCount = (GLint)corners.size()*4;
-        if (vertexCount > 0) {
-            float fontSizeScaled = FONT_SIZE * (float)vs->getVideoHeight()/(float)(gViewport[(gDisplayOrientation % 2) == 1 ? 3 : 2]);
-            float colorRed[4] = {1.0f, 0.0f, 0.0f, 1.0f};
-            float colorGreen[4] = {0.0f, 1.0f, 0.0f, 1.0f};
-            glColor4fv(cornerFoundAllFlag ? colorRed : colorGreen);
-            EdenGLFontSetSize(fontSizeScaled);
-            EdenGLFontSetColor(cornerFoundAllFlag ? colorRed : colorGreen);
-            arMalloc(vertices, GLfloat, vertexCount*2); // 2 coords per vertex.
-            for (i = 0; i < corners.size(); i++) {
-                vertices[i*8    ] = corners[i].x - 5.0f;
-                vertices[i*8 + 1] = vs->getVideoHeight() - corners[i].y - 5.0f;
-                vertices[i*8 + 2] = corners[i].x + 5.0f;
-                vertices[i*8 + 3] = vs->getVideoHeight() - corners[i].y + 5.0f;
-                vertices[i*8 + 4] = corners[i].x - 5.0f;
-                vertices[i*8 + 5] = vs->getVideoHeight() - corners[i].y + 5.0f;
-                vertices[i*8 + 6] = corners[i].x + 5.0f;
-                vertices[i*8 + 7] = vs->getVideoHeight() - corners[i].y - 5.0f;
-                
-                unsigned char buf[12]; // 10 digits in INT32_MAX, plus sign, plus null.
-                sprintf((char *)buf, "%d\n", i);
-                
-                glPushMatrix();
-                glLoadIdentity();
-                glTranslatef(corners[i].x, vs->getVideoHeight() - corners[i].y, 0.0f);
-                glRotatef((float)(gDisplayOrientation - 1) * -90.0f, 0.0f, 0.0f, 1.0f); // Orient the text to the user.
-                EdenGLFontDrawLine(0, NULL, buf, 0.0f, 0.0f, H_OFFSET_VIEW_LEFT_EDGE_TO_TEXT_LEFT_EDGE, V_OFFSET_VIEW_BOTTOM_TO_TEXT_BASELINE); // These alignment modes don't require setting of EdenGLFontSetViewSize().
-                glPopMatrix();
-            }
-            EdenGLFontSetSize(FONT_SIZE);
-            float colorWhite[4] = {1.0f, 1.0f, 1.0f, 1.0f};;
-            EdenGLFontSetColor(colorWhite);
+        mtxOrthof(viewProjection, left, right, bottom, top, -1.0f, 1.0f);
+        if (!EdenGLDrawIsActive()) {
+            glStateCacheMatrixMode(GL_PROJECTION);
+            glLoadMatrixf(viewProjection);
+            glStateCacheMatrixMode(GL_MODELVIEW);
+            glLoadIdentity();
+            glStateCacheDisableDepthTest();
+            glStateCacheDisableLighting();
+            glStateCacheDisableBlend();
+            glStateCacheActiveTexture(GL_TEXTURE0);
+            glStateCacheDisableTex2D();
         }
         
-        gCalibration->cornerFinderResultsUnlock();
+        if (gCornerFinderImageUploader) gCornerFinderImageUploader->draw(viewProjection); // Drawn in video pixel coordinates, as is the overlay.
         
-        if (vertexCount > 0) {
-            glVertexPointer(2, GL_FLOAT, 0, vertices);
-            glEnableClientState(GL_VERTEX_ARRAY);
-            glDisableClientState(GL_NORMAL_ARRAY);
-            glClientActiveTexture(GL_TEXTURE0);
-            glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-            glLineWidth(2.0f);
-            glDrawArrays(GL_LINES, 0, vertexCount);
-            free(vertices);
-        }
+        // Draw the crosses marking the corner positions, and their index labels, in a single draw call.
+        float colorRed[4] = {1.0f, 0.0f, 0.0f, 1.0f};
+        float colorGreen[4] = {0.0f, 1.0f, 0.0f, 1.0f};
+        cornerOverlayDraw(cornerFoundAllFlag ? colorRed : colorGreen, viewProjection);
     }
     
     //
@@ -847,16 +1278,20 @@ void drawView(void)
     //
     // Setup for drawing on screen, with correct orientation for user.
     //
-    glViewport(0, 0, contextWidth, contextHeight);
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
+    glStateCacheViewport(0, 0, contextWidth, contextHeight);
+    EdenGLDrawBegin();
     bottom = 0.0f;
     top = (float)contextHeight;
     left = 0.0f;
     right = (float)contextWidth;
-    glOrtho(left, right, bottom, top, -1.0f, 1.0f);
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
+    mtxLoadIdentityf(viewProjection);
+    mtxOrthof(viewProjection, left, right, bottom, top, -1.0f, 1.0f);
+    if (!EdenGLDrawIsActive()) {
+        glStateCacheMatrixMode(GL_PROJECTION);
+        glLoadMatrixf(viewProjection);
+        glStateCacheMatrixMode(GL_MODELVIEW);
+        glLoadIdentity();
+    }
     
     EdenGLFontSetViewSize(right, top);
     EdenMessageSetViewSize(right, top);
@@ -865,279 +1300,470 @@ void drawView(void)
     
     // Draw status bar with centred status message.
     if (statusBarMessage[0]) {
-        drawBackground(right, statusBarHeight, 0.0f, 0.0f, false);
-        glDisable(GL_BLEND);
-        EdenGLFontDrawLine(0, NULL, statusBarMessage, 0.0f, 2.0f, H_OFFSET_VIEW_CENTER_TO_TEXT_CENTER, V_OFFSET_VIEW_BOTTOM_TO_TEXT_BASELINE);
+        // While capturing, append the live closed-form focal length estimate.
+        unsigned char statusBarMessageWithEstimate[192];
+        unsigned char *message = statusBarMessage;
+        ARdouble fx, fy;
+        if (state == FLOW_STATE_CAPTURING && gCalibration->focalLengthEstimate(&fx, &fy)) {
+            snprintf((char *)statusBarMessageWithEstimate, sizeof(statusBarMessageWithEstimate), "%s (est. focal length %.0f, %.0f px)", (char *)statusBarMessage, fx, fy);
+            message = statusBarMessageWithEstimate;
+        }
+        drawBackground(right, statusBarHeight, 0.0f, 0.0f, false, viewProjection);
+        if (!EdenGLDrawIsActive()) glStateCacheDisableBlend();
+        EdenGLFontDrawLine(0, viewProjection, message, 0.0f, 2.0f, H_OFFSET_VIEW_CENTER_TO_TEXT_CENTER, V_OFFSET_VIEW_BOTTOM_TO_TEXT_BASELINE);
     }
     
-    // If background tasks are proceeding, draw a status box.
+    // If background tasks are proceeding, draw a status box for each, stacked upwards.
+    float statusBoxY = statusBarHeight + 2.0f;
+    {
+        char persistStatus[PERSIST_STATUS_BUFFER_LEN];
+        int status = saveStatusGet(persistStatus, &time);
+        if (status > 0) statusBoxY += drawStatusBox(persistStatus, status, right, statusBoxY, &time, viewProjection) + 2.0f;
+    }
     if (fileUploadHandle) {
-        char uploadStatus[UPLOAD_STATUS_BUFFER_LEN];
+        char uploadStatus[UPLOAD_STATUS_BUFFER_LEN + 32];
         int status = fileUploaderStatusGet(fileUploadHandle, uploadStatus, &time);
         if (status > 0) {
-            const int squareSize = (int)(16.0f * (float)gDisplayDPI / 160.f) ;
-            float x, y, w, h;
-            float textWidth = EdenGLFontGetLineWidth((unsigned char *)uploadStatus);
-            w = textWidth + 3*squareSize + 2*4.0f /*text margin*/ + 2*4.0f /* box margin */;
-            h = MAX(FONT_SIZE, 3*squareSize) + 2*4.0f /* box margin */;
-            x = right - (w + 2.0f);
-            y = statusBarHeight + 2.0f;
-            drawBackground(w, h, x, y, true);
-            if (status == 1) drawBusyIndicator((int)(x + 4.0f + 1.5f*squareSize), (int)(y + 4.0f + 1.5f*squareSize), squareSize, &time);
-            EdenGLFontDrawLine(0, NULL, (unsigned char *)uploadStatus, x + 4.0f + 3*squareSize, y + (h - FONT_SIZE)/2.0f, H_OFFSET_VIEW_LEFT_EDGE_TO_TEXT_LEFT_EDGE, V_OFFSET_VIEW_BOTTOM_TO_TEXT_BASELINE);
+            // Show how many calibrations are still to go.
+            FILE_UPLOAD_STATS_t uploadStats;
+            if (fileUploaderStatsGet(fileUploadHandle, &uploadStats) && uploadStats.queueDepth > 0) {
+                size_t len = strlen(uploadStatus);
+                snprintf(uploadStatus + len, sizeof(uploadStatus) - len, " (%d queued)", uploadStats.queueDepth);
+            }
+            drawStatusBox(uploadStatus, status, right, statusBoxY, &time, viewProjection);
         }
     }
     
     // If a message should be onscreen, draw it.
-    if (gEdenMessageDrawRequired) EdenMessageDraw(0, NULL);
+    if (gEdenMessageDrawRequired) EdenMessageDraw(0, viewProjection);
+    
+    EdenGLDrawEnd();
+    
+#ifdef DEBUG
+    // Report how many GL calls the state cache saved, whenever the number changes.
+    unsigned long avoidedCallCount = glStateCacheAvoidedCallCount();
+    if (avoidedCallCount != gGLStateCacheAvoidedCallCountLast) {
+        ARLOGd("glStateCache avoided %lu redundant GL calls this frame.\n", avoidedCallCount);
+        gGLStateCacheAvoidedCallCountLast = avoidedCallCount;
+    }
+#endif
     
+    pipelineStatsRecord(PIPELINE_STAGE_DRAW, drawStartTime);
+    TRACE_END("drawView");
+    
+    uint64_t swapStartTime = pipelineStatsTimeNow();
+    TRACE_BEGIN("SDL_GL_SwapWindow");
     SDL_GL_SwapWindow(gSDLWindow);
+    TRACE_END("SDL_GL_SwapWindow");
+    pipelineStatsRecord(PIPELINE_STAGE_SWAP, swapStartTime);
 }
 
 
-// Save parameters file and index file with info about it, then signal thread that it's ready for upload.
-static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg, ARdouble err_max, void *userdata)
+// Calibration IDs are the UTC date and time to the microsecond, e.g. "20171231-235959-123456", so that they sort
+// in order and do not repeat from one day to the next. Should two calibrations fall in the same microsecond, or
+// the clock step backwards, the later is moved on to keep IDs increasing. Flow thread only.
+#define CALIBRATION_ID_LEN 24
+static uint64_t gCalibrationIDLastUsecs = 0;
+
+static bool calibrationIDNew(struct timeval *time_p, char id[CALIBRATION_ID_LEN])
+{
+    struct tm timeinfo;
+    
+    if (gettimeofday(time_p, NULL) < 0) {
+        ARLOGe("Error reading time and date.\n");
+        return (false);
+    }
+    uint64_t usecs = (uint64_t)time_p->tv_sec*1000000ull + (uint64_t)time_p->tv_usec;
+    if (usecs <= gCalibrationIDLastUsecs) usecs = gCalibrationIDLastUsecs + 1;
+    gCalibrationIDLastUsecs = usecs;
+    time_p->tv_sec = (time_t)(usecs / 1000000ull);
+    time_p->tv_usec = (suseconds_t)(usecs % 1000000ull);
+    
+    if (!gmtime_r(&time_p->tv_sec, &timeinfo)) {
+        ARLOGe("Error converting time and date to UTC.\n");
+        return (false);
+    }
+    size_t len = strftime(id, CALIBRATION_ID_LEN, "%Y%m%d-%H%M%S", &timeinfo);
+    if (!len) return (false);
+    snprintf(id + len, CALIBRATION_ID_LEN - len, "-%06d", (int)time_p->tv_usec);
+    return (true);
+}
+
+// Everything needed to save a calibration, captured on the flow thread so that the save can proceed on the
+// persistence worker.
+typedef struct {
+    ARParam param;
+    ARdouble err_min;
+    ARdouble err_avg;
+    ARdouble err_max;
+    char id[CALIBRATION_ID_LEN]; // Names the files for this calibration.
+    time_t clock;
+    char *device_id;
+    char *focal_length;
+    int camera_width;
+    int camera_height;
+    bool camera_front_facing;
+    char *save_dir; // NULL if the calibration is not to be saved.
+    char *token; // NULL if the calibration is not to be uploaded.
+} SAVE_PARAM_JOB_t;
+
+static void saveParamJobFree(SAVE_PARAM_JOB_t *job)
 {
+    free(job->device_id);
+    free(job->focal_length);
+    free(job->save_dir);
+    free(job->token);
+    free(job);
+}
+
+// Save parameters file, then queue the parameters with info about them for upload. Runs on the persistence worker.
+static bool saveParamJob(PERSIST_WORKER_t *worker, void *arg, char *message, const size_t messageLen)
+{
+    SAVE_PARAM_JOB_t *job = (SAVE_PARAM_JOB_t *)arg;
     int i;
 #define SAVEPARAM_PATHNAME_LEN MAXPATHLEN
-    char indexPathname[SAVEPARAM_PATHNAME_LEN];
     char paramPathname[SAVEPARAM_PATHNAME_LEN];
-    char indexUploadPathname[SAVEPARAM_PATHNAME_LEN];
+    char calibrationSaveTempPathname[SAVEPARAM_PATHNAME_LEN];
+    bool saved = false;
+    bool queued = false;
     
-    // Get the current time. It will be used for file IDs, plus a timestamp for the parameters file.
-    time_t ourClock = time(NULL);
-    if (ourClock == (time_t)-1) {
-        ARLOGe("Error reading time and date.\n");
-        return;
-    }
-    //struct tm *timeptr = localtime(&ourClock);
-    struct tm *timeptr = gmtime(&ourClock);
+    //struct tm *timeptr = localtime(&job->clock);
+    struct tm timeinfo;
+    struct tm *timeptr = gmtime_r(&job->clock, &timeinfo);
     if (!timeptr) {
         ARLOGe("Error converting time and date to UTC.\n");
-        return;
+        snprintf(message, messageLen, "Error saving calibration.");
+        saveParamJobFree(job);
+        return (false);
     }
-    int ID = timeptr->tm_hour*10000 + timeptr->tm_min*100 + timeptr->tm_sec;
     
-    // Save the parameter file.
-    snprintf(paramPathname, SAVEPARAM_PATHNAME_LEN, "%s/%s/%06d-camera_para.dat", arUtilGetResourcesDirectoryPath(AR_UTIL_RESOURCES_DIRECTORY_BEHAVIOR_USE_APP_CACHE_DIR), QUEUE_DIR, ID);
+    // Save the parameter file. This is temporary; its contents are copied to the save directory and read back for upload.
+    snprintf(paramPathname, SAVEPARAM_PATHNAME_LEN, "%s/%s/%s-camera_para.dat", arUtilGetResourcesDirectoryPath(AR_UTIL_RESOURCES_DIRECTORY_BEHAVIOR_USE_APP_CACHE_DIR), QUEUE_DIR, job->id);
     
     //if (arParamSave(strcat(strcat(docsPath,"/"),paramPathname), 1, param) < 0) {
-    if (arParamSave(paramPathname, 1, param) < 0) {
+    if (arParamSave(paramPathname, 1, &job->param) < 0) {
         
         ARLOGe("Error writing camera_para.dat file.\n");
         
     } else {
         
         bool goodWrite = true;
-
-        // Get main device identifier and focal length from video module.
-        char *device_id = NULL;
-        char *focal_length = NULL;
         
-        AR2VideoParamT *vid = vs->getAR2VideoParam();
-        if (ar2VideoGetParams(vid, AR_VIDEO_PARAM_DEVICEID, &device_id) < 0 || !device_id) {
-            ARLOGe("Error fetching camera device identification.\n");
-            goodWrite = false;
-        }
-        
-        if (goodWrite) {
-            if (vid->module == AR_VIDEO_MODULE_AVFOUNDATION) {
-                int focalPreset;
-                ar2VideoGetParami(vid, AR_VIDEO_PARAM_AVFOUNDATION_FOCUS_PRESET, &focalPreset);
-                switch (focalPreset) {
-                    case AR_VIDEO_AVFOUNDATION_FOCUS_MACRO:
-                        focal_length = strdup("0.01");
-                        break;
-                    case AR_VIDEO_AVFOUNDATION_FOCUS_0_3M:
-                        focal_length = strdup("0.3");
-                        break;
-                    case AR_VIDEO_AVFOUNDATION_FOCUS_1_0M:
-                        focal_length = strdup("1.0");
-                        break;
-                    case AR_VIDEO_AVFOUNDATION_FOCUS_INF:
-                        focal_length = strdup("1000000.0");
-                        break;
-                    default:
-                        break;
-                }
-            }
-            if (!focal_length) {
-                // Not known at present, so just send 0.000.
-                focal_length = strdup("0.000");
-            }
-        }
-        
-        if (goodWrite && gCalibrationSave) {
+        if (job->save_dir) {
             
             // Assemble the filename.
             char calibrationSavePathname[SAVEPARAM_PATHNAME_LEN];
-            snprintf(calibrationSavePathname, SAVEPARAM_PATHNAME_LEN, "%s/camera_para-", gCalibrationSaveDir);
+            snprintf(calibrationSavePathname, SAVEPARAM_PATHNAME_LEN, "%s/camera_para-", job->save_dir);
             size_t len = strlen(calibrationSavePathname);
             int i = 0;
-            while (device_id[i] && (len + i + 2 < SAVEPARAM_PATHNAME_LEN)) {
-                calibrationSavePathname[len + i] = (device_id[i] == '/' || device_id[i] == '\\' ? '_' : device_id[i]);
+            while (job->device_id[i] && (len + i + 2 < SAVEPARAM_PATHNAME_LEN)) {
+                calibrationSavePathname[len + i] = (job->device_id[i] == '/' || job->device_id[i] == '\\' ? '_' : job->device_id[i]);
                 i++;
             }
             calibrationSavePathname[len + i] = '\0';
             len = strlen(calibrationSavePathname);
-            snprintf(&calibrationSavePathname[len], SAVEPARAM_PATHNAME_LEN - len, "-0-%dx%d", vs->getVideoWidth(), vs->getVideoHeight()); // camera_index is always 0 for desktop platforms.
+            snprintf(&calibrationSavePathname[len], SAVEPARAM_PATHNAME_LEN - len, "-0-%dx%d", job->camera_width, job->camera_height); // camera_index is always 0 for desktop platforms.
             len = strlen(calibrationSavePathname);
-            if (strcmp(focal_length, "0.000") != 0) {
-                snprintf(&calibrationSavePathname[len], SAVEPARAM_PATHNAME_LEN - len, "-%s", focal_length);
+            if (strcmp(job->focal_length, "0.000") != 0) {
+                snprintf(&calibrationSavePathname[len], SAVEPARAM_PATHNAME_LEN - len, "-%s", job->focal_length);
                 len = strlen(calibrationSavePathname);
             }
             snprintf(&calibrationSavePathname[len], SAVEPARAM_PATHNAME_LEN - len, ".dat");
             
-            if (cp_f(paramPathname, calibrationSavePathname) != 0) {
-                ARLOGe("Error saving calibration to '%s'", calibrationSavePathname);
+            // Copy beside the destination, then replace it in one step, so that an earlier calibration saved under
+            // the same name is never left half-overwritten.
+            snprintf(calibrationSaveTempPathname, SAVEPARAM_PATHNAME_LEN, "%s.%s.tmp", calibrationSavePathname, job->id);
+            if (cp_f(paramPathname, calibrationSaveTempPathname) != 0) {
+                ARLOGe("Error saving calibration to '%s'", calibrationSaveTempPathname);
                 ARLOGperror(NULL);
+                remove(calibrationSaveTempPathname);
+            } else if (!persistWorkerCommit(worker, calibrationSaveTempPathname, calibrationSavePathname)) {
+                ARLOGe("Error saving calibration to '%s'", calibrationSavePathname);
+                remove(calibrationSaveTempPathname);
             } else {
                 ARLOGi("Saved calibration to '%s'.\n", calibrationSavePathname);
+                saved = true;
             }
         }
 
         // Check for early exit.
-        if (!goodWrite || !gCalibrationServerUploadURL) {
+        if (!job->token) {
             if (remove(paramPathname) < 0) {
                 ARLOGe("Error removing temporary file '%s'.\n", paramPathname);
                 ARLOGperror(NULL);
             }
-            free(device_id);
-            free(focal_length);
-            return;
+            snprintf(message, messageLen, (saved ? "Calibration saved." : "Error saving calibration."));
+            saveParamJobFree(job);
+            return (saved);
         };
 
-        //
-        // Write an upload index file with the data for the server database entry.
-        //
-        
-        // Open the file.
-        snprintf(indexPathname, SAVEPARAM_PATHNAME_LEN, "%s/%s/%06d-index", arUtilGetResourcesDirectoryPath(AR_UTIL_RESOURCES_DIRECTORY_BEHAVIOR_USE_APP_CACHE_DIR), QUEUE_DIR, ID);
+        // Read back the parameters, then discard the file.
+        unsigned char *paramData = NULL;
+        long paramDataLen = 0;
         FILE *fp;
-        if (!(fp = fopen(indexPathname, "wb"))) {
-            ARLOGe("Error opening upload index file '%s'.\n", indexPathname);
+        if (!(fp = fopen(paramPathname, "rb"))) {
+            ARLOGe("Error opening temporary file '%s'.\n", paramPathname);
             goodWrite = false;
+        } else {
+            if (fseek(fp, 0, SEEK_END) != 0 || (paramDataLen = ftell(fp)) <= 0 || fseek(fp, 0, SEEK_SET) != 0 ||
+                !(paramData = (unsigned char *)malloc(paramDataLen)) || fread(paramData, paramDataLen, 1, fp) != 1) {
+                ARLOGe("Error reading temporary file '%s'.\n", paramPathname);
+                goodWrite = false;
+            }
+            fclose(fp);
         }
-        
-        // File name.
-        if (goodWrite) fprintf(fp, "file,%s\n", paramPathname);
+        if (remove(paramPathname) < 0) {
+            ARLOGe("Error removing temporary file '%s'.\n", paramPathname);
+            ARLOGperror(NULL);
+        }
+
+        //
+        // Assemble the form fields with the data for the server database entry.
+        //
+        FILE_UPLOAD_FIELD_t fields[16];
+        int fieldCount = 0;
+#define SAVEPARAM_ADD_FIELD(n, v) do { fields[fieldCount].name = n; fields[fieldCount].filename = NULL; fields[fieldCount].data = v; fields[fieldCount].dataLen = strlen(v); fieldCount++; } while (0)
+
+        // Parameters, as a file.
+        char paramFilename[CALIBRATION_ID_LEN + 16];
+        snprintf(paramFilename, sizeof(paramFilename), "%s-camera_para.dat", job->id);
+        fields[fieldCount].name = "file";
+        fields[fieldCount].filename = paramFilename;
+        fields[fieldCount].data = paramData;
+        fields[fieldCount].dataLen = (size_t)paramDataLen;
+        fieldCount++;
         
         // UTC date and time, in format "1999-12-31 23:59:59 UTC".
+        char timestamp[26+8] = "";
         if (goodWrite) {
-            char timestamp[26+8] = "";
             if (!strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S +0000", timeptr)) { // Use explicit "+0000" rather than %z because %z is undefined either UTC or local time zone when timestamp is created with gmtime().
                 ARLOGe("Error formatting time and date.\n");
                 goodWrite = false;
             } else {
-                fprintf(fp, "timestamp,%s\n", timestamp);
+                SAVEPARAM_ADD_FIELD("timestamp", timestamp);
             }
         }
         
         // OS: name/arch/version.
-        if (goodWrite) {
-            char *os_name = arUtilGetOSName();
-            char *os_arch = arUtilGetCPUName();
-            char *os_version = arUtilGetOSVersion();
-            fprintf(fp, "os_name,%s\nos_arch,%s\nos_version,%s\n", os_name, os_arch, os_version);
-            free(os_name);
-            free(os_arch);
-            free(os_version);
-        }
+        char *os_name = arUtilGetOSName();
+        char *os_arch = arUtilGetCPUName();
+        char *os_version = arUtilGetOSVersion();
+        SAVEPARAM_ADD_FIELD("os_name", os_name);
+        SAVEPARAM_ADD_FIELD("os_arch", os_arch);
+        SAVEPARAM_ADD_FIELD("os_version", os_version);
         
         // Camera identifier.
-        if (goodWrite) {
-            fprintf(fp, "device_id,%s\n", device_id);
-        }
+        SAVEPARAM_ADD_FIELD("device_id", job->device_id);
         
         // Focal length in metres.
-        if (goodWrite) {
-            fprintf(fp, "focal_length,%s\n", focal_length);
-        }
+        SAVEPARAM_ADD_FIELD("focal_length", job->focal_length);
         
         // Camera index.
-        if (goodWrite) {
-            char camera_index[12]; // 10 digits in INT32_MAX, plus sign, plus null.
-            snprintf(camera_index, 12, "%d", 0); // Always zero for desktop platforms.
-            fprintf(fp, "camera_index,%s\n", camera_index);
-        }
+        char camera_index[12]; // 10 digits in INT32_MAX, plus sign, plus null.
+        snprintf(camera_index, 12, "%d", 0); // Always zero for desktop platforms.
+        SAVEPARAM_ADD_FIELD("camera_index", camera_index);
         
         // Front or rear facing.
-        if (goodWrite) {
-            char camera_face[6]; // "front" or "rear", plus null.
-            snprintf(camera_face, 6, "%s", (gCameraIsFrontFacing ? "front" : "rear"));
-            fprintf(fp, "camera_face,%s\n", camera_face);
-        }
+        char camera_face[6]; // "front" or "rear", plus null.
+        snprintf(camera_face, 6, "%s", (job->camera_front_facing ? "front" : "rear"));
+        SAVEPARAM_ADD_FIELD("camera_face", camera_face);
         
         // Camera dimensions.
-        if (goodWrite) {
-            char camera_width[12]; // 10 digits in INT32_MAX, plus sign, plus null.
-            char camera_height[12]; // 10 digits in INT32_MAX, plus sign, plus null.
-            snprintf(camera_width, 12, "%d", vs->getVideoWidth());
-            snprintf(camera_height, 12, "%d", vs->getVideoHeight());
-            fprintf(fp, "camera_width,%s\n", camera_width);
-            fprintf(fp, "camera_height,%s\n", camera_height);
-        }
+        char camera_width[12]; // 10 digits in INT32_MAX, plus sign, plus null.
+        char camera_height[12]; // 10 digits in INT32_MAX, plus sign, plus null.
+        snprintf(camera_width, 12, "%d", job->camera_width);
+        snprintf(camera_height, 12, "%d", job->camera_height);
+        SAVEPARAM_ADD_FIELD("camera_width", camera_width);
+        SAVEPARAM_ADD_FIELD("camera_height", camera_height);
         
         // Calibration error.
-        if (goodWrite) {
-            char err_min_ascii[12];
-            char err_avg_ascii[12];
-            char err_max_ascii[12];
-            snprintf(err_min_ascii, 12, "%f", err_min);
-            snprintf(err_avg_ascii, 12, "%f", err_avg);
-            snprintf(err_max_ascii, 12, "%f", err_max);
-            fprintf(fp, "err_min,%s\n", err_min_ascii);
-            fprintf(fp, "err_avg,%s\n", err_avg_ascii);
-            fprintf(fp, "err_max,%s\n", err_max_ascii);
-        }
+        char err_min_ascii[12];
+        char err_avg_ascii[12];
+        char err_max_ascii[12];
+        snprintf(err_min_ascii, 12, "%f", job->err_min);
+        snprintf(err_avg_ascii, 12, "%f", job->err_avg);
+        snprintf(err_max_ascii, 12, "%f", job->err_max);
+        SAVEPARAM_ADD_FIELD("err_min", err_min_ascii);
+        SAVEPARAM_ADD_FIELD("err_avg", err_avg_ascii);
+        SAVEPARAM_ADD_FIELD("err_max", err_max_ascii);
         
         // IP address will be derived from connect.
         
         // Hash the shared secret.
+        char ss_ascii[MD5_DIGEST_LENGTH*2 + 1]; // space for null terminator.
         if (goodWrite) {
             unsigned char ss_md5[MD5_DIGEST_LENGTH];
-            char ss_ascii[MD5_DIGEST_LENGTH*2 + 1]; // space for null terminator.
-            if (!MD5((unsigned char *)gCalibrationServerAuthenticationToken, (MD5_COUNT_t)strlen(gCalibrationServerAuthenticationToken), ss_md5)) {
+            if (!MD5((unsigned char *)job->token, (MD5_COUNT_t)strlen(job->token), ss_md5)) {
                 ARLOGe("Error calculating md5.\n");
                 goodWrite = false;
             } else {
                 for (i = 0; i < MD5_DIGEST_LENGTH; i++) snprintf(&(ss_ascii[i*2]), 3, "%.2hhx", ss_md5[i]);
-                fprintf(fp, "ss,%s\n", ss_ascii);
+                SAVEPARAM_ADD_FIELD("ss", ss_ascii);
             }
         }
-        
-        // Done writing index file.
-        fclose(fp);
-        
+#undef SAVEPARAM_ADD_FIELD
+
+        // Identify the calibration by its parameters, camera and resolution, so that repeats are recognised.
+        char content_hash_ascii[MD5_DIGEST_LENGTH*2 + 1];
         if (goodWrite) {
-            // Rename the file with QUEUE_INDEX_FILE_EXTENSION file extension so it's picked up in uploader.
-            snprintf(indexUploadPathname, SAVEPARAM_PATHNAME_LEN, "%s." QUEUE_INDEX_FILE_EXTENSION, indexPathname);
-            if (rename(indexPathname, indexUploadPathname) < 0) {
-                ARLOGe("Error renaming temporary file '%s'.\n", indexPathname);
+            char *content_text = NULL;
+            unsigned char *content = NULL;
+            int content_text_len = asprintf(&content_text, "\n%s\n%sx%s", job->device_id, camera_width, camera_height);
+            if (content_text_len >= 0) content = (unsigned char *)malloc(paramDataLen + content_text_len);
+            if (!content) {
+                ARLOGe("Out of memory!\n");
                 goodWrite = false;
             } else {
-                // Kick off an upload handling cycle.
-                fileUploaderTickle(fileUploadHandle);
+                unsigned char content_md5[MD5_DIGEST_LENGTH];
+                memcpy(content, paramData, paramDataLen);
+                memcpy(content + paramDataLen, content_text, content_text_len);
+                if (!MD5(content, (MD5_COUNT_t)(paramDataLen + content_text_len), content_md5)) {
+                    ARLOGe("Error calculating md5.\n");
+                    goodWrite = false;
+                } else {
+                    for (i = 0; i < MD5_DIGEST_LENGTH; i++) snprintf(&(content_hash_ascii[i*2]), 3, "%.2hhx", content_md5[i]);
+                }
             }
+            if (content_text_len >= 0) free(content_text);
+            free(content);
         }
-        
-        if (!goodWrite) {
-            // If something went wrong, delete the index and param files.
-            if (indexPathname[0]) {
-                if (remove(indexPathname) < 0) {
-                    ARLOGe("Error removing temporary file '%s'.\n", indexPathname);
-                    ARLOGperror(NULL);
+
+        // Add the fields to the upload queue as a single record, and kick off an upload handling cycle.
+        // The uploader may be replaced by the main thread when preferences change, so hold it while queueing.
+        if (goodWrite) {
+            pthread_mutex_lock(&gFileUploadHandleLock);
+            if (fileUploadHandle) {
+                char recordName[CALIBRATION_ID_LEN + 8];
+                snprintf(recordName, sizeof(recordName), "%s-index", job->id);
+                if (!fileUploaderEnqueueRecord(fileUploadHandle, recordName, fields, fieldCount, content_hash_ascii)) {
+                    ARLOGe("Error queueing calibration for upload.\n");
+                } else {
+                    queued = true;
                 }
             }
-            if (remove(paramPathname) < 0) {
-                ARLOGe("Error removing temporary file '%s'.\n", paramPathname);
-                ARLOGperror(NULL);
-            }
+            pthread_mutex_unlock(&gFileUploadHandleLock);
         }
 
+        free(os_name);
+        free(os_arch);
+        free(os_version);
+        free(paramData);
+    }
+    
+    bool ok = (queued && (saved || !job->save_dir));
+    if (ok) snprintf(message, messageLen, (saved ? "Calibration saved and queued for upload." : "Calibration queued for upload."));
+    else if (queued) snprintf(message, messageLen, "Error saving calibration; queued for upload.");
+    else if (saved) snprintf(message, messageLen, "Calibration saved; error queueing for upload.");
+    else snprintf(message, messageLen, "Error saving calibration.");
+    saveParamJobFree(job);
+    return (ok);
+}
+
+// Called on the flow thread when a calibration completes. Captures what is needed to save it, and hands the
+// save to the persistence worker.
+static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg, ARdouble err_max, void *userdata)
+{
+    // Get the current time. It will be used for file IDs, plus a timestamp for the parameters file.
+    struct timeval ourClock;
+    char id[CALIBRATION_ID_LEN];
+    if (!calibrationIDNew(&ourClock, id)) return;
+    
+    // Get main device identifier and focal length from video module.
+    char *device_id = NULL;
+    char *focal_length = NULL;
+    
+    AR2VideoParamT *vid = vs->getAR2VideoParam();
+    if (ar2VideoGetParams(vid, AR_VIDEO_PARAM_DEVICEID, &device_id) < 0 || !device_id) {
+        ARLOGe("Error fetching camera device identification.\n");
+        free(device_id);
+        return;
+    }
+    
+    if (vid->module == AR_VIDEO_MODULE_AVFOUNDATION) {
+        int focalPreset;
+        ar2VideoGetParami(vid, AR_VIDEO_PARAM_AVFOUNDATION_FOCUS_PRESET, &focalPreset);
+        switch (focalPreset) {
+            case AR_VIDEO_AVFOUNDATION_FOCUS_MACRO:
+                focal_length = strdup("0.01");
+                break;
+            case AR_VIDEO_AVFOUNDATION_FOCUS_0_3M:
+                focal_length = strdup("0.3");
+                break;
+            case AR_VIDEO_AVFOUNDATION_FOCUS_1_0M:
+                focal_length = strdup("1.0");
+                break;
+            case AR_VIDEO_AVFOUNDATION_FOCUS_INF:
+                focal_length = strdup("1000000.0");
+                break;
+            default:
+                break;
+        }
+    }
+    if (!focal_length) {
+        // Not known at present, so just send 0.000.
+        focal_length = strdup("0.000");
+    }
+    
+    SAVE_PARAM_JOB_t *job = (SAVE_PARAM_JOB_t *)calloc(1, sizeof(SAVE_PARAM_JOB_t));
+    if (!job) {
+        ARLOGe("Out of memory!\n");
         free(device_id);
         free(focal_length);
+        return;
+    }
+    job->param = *param;
+    job->err_min = err_min;
+    job->err_avg = err_avg;
+    job->err_max = err_max;
+    strncpy(job->id, id, CALIBRATION_ID_LEN);
+    job->clock = ourClock.tv_sec;
+    job->device_id = device_id;
+    job->focal_length = focal_length;
+    job->camera_width = vs->getVideoWidth();
+    job->camera_height = vs->getVideoHeight();
+    job->camera_front_facing = gCameraIsFrontFacing;
+    if (gCalibrationSave && gCalibrationSaveDir) job->save_dir = strdup(gCalibrationSaveDir);
+    if (gCalibrationServerUploadURL && gCalibrationServerAuthenticationToken) job->token = strdup(gCalibrationServerAuthenticationToken);
+    if (!job->save_dir && !job->token) {
+        saveParamJobFree(job); // Nothing to do.
+        return;
+    }
+    
+    if (!persistWorkerSubmit(gPersistWorker, saveParamJob, job)) {
+        // No worker, so save here, and post the outcome for display.
+        char message[PERSIST_STATUS_BUFFER_LEN];
+        struct timeval time;
+        saveParamJob(NULL, job, message, sizeof(message));
+        gettimeofday(&time, NULL);
+        pthread_mutex_lock(&gSaveStatusLock);
+        strncpy(gSaveStatus, message, PERSIST_STATUS_BUFFER_LEN);
+        gSaveStatus[PERSIST_STATUS_BUFFER_LEN - 1] = '\0';
+        time.tv_sec += (time_t)UPLOAD_STATUS_HIDE_AFTER_SECONDS;
+        gSaveStatusHideAtTime = time;
+        pthread_mutex_unlock(&gSaveStatusLock);
+        requestRedraw();
+    }
+}
+
+// Status of saving, as for persistWorkerStatusGet(): from the persistence worker, or if there is none, of the
+// last save made on the flow thread.
+static int saveStatusGet(char statusBuf[PERSIST_STATUS_BUFFER_LEN], struct timeval *currentTime_p)
+{
+    int status = 0;
+    
+    if (gPersistWorker) return (persistWorkerStatusGet(gPersistWorker, statusBuf, currentTime_p));
+    
+    pthread_mutex_lock(&gSaveStatusLock);
+    if (gSaveStatus[0]) {
+        if (timercmp(currentTime_p, &gSaveStatusHideAtTime, >)) {
+            gSaveStatus[0] = '\0';
+        } else {
+            strncpy(statusBuf, gSaveStatus, PERSIST_STATUS_BUFFER_LEN);
+            status = 2;
+        }
     }
+    pthread_mutex_unlock(&gSaveStatusLock);
+    return (status);
 }
 
 
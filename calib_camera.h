@@ -34,6 +34,10 @@ extern "C" {
 #endif
 
 extern Uint32 gSDLEventPreferencesChanged;
+extern Uint32 gSDLEventRedrawRequired;
+
+// Ask the main loop to redraw the display. May be called from any thread.
+void requestRedraw(void);
 
 #ifdef __cplusplus
 }
@@ -26,30 +26,152 @@
 #include "fileUploader.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h> // strcasecmp()
 #include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
 #include <curl/curl.h>
 #include <dirent.h> // opendir(), readdir(), closedir()
 #include <sys/param.h> // MAXPATHLEN
 #include <sys/stat.h> // struct stat, stat()
 #include <pthread.h>
+#include <zlib.h>
+#include <unistd.h> // fsync(), close()
+#include <fcntl.h> // open()
+#ifdef __linux__
+#  include <sys/inotify.h>
+#  define HAVE_INOTIFY 1
+#endif
 
 #include <AR6/AR/ar.h>
 #include <AR6/ARUtil/thread_sub.h>
 #include <AR6/ARUtil/file_utils.h> // mkdir_p()
 
+#include "pipelineStats.h"
+#include "traceEvents.h"
+#include "uploadJournal.h"
+
+
+#define UPLOAD_CONCURRENCY_DEFAULT 4
+#define UPLOAD_RETRY_DELAY_MIN_DEFAULT 5.0f // Seconds before the first retry of a failed upload.
+#define UPLOAD_RETRY_DELAY_MAX_DEFAULT 3600.0f // Cap on the delay between retries, in seconds.
+#define UPLOAD_RETRY_FILE_EXTENSION "retry" // Retry state for an index file is kept alongside it, in a file with this extension appended.
+#define UPLOAD_RECORD_MAGIC "ARUPREC1" // First bytes of a packed queue record (as opposed to a text index file).
+#define UPLOAD_RECORD_MAGIC_LEN 8
+#define UPLOAD_RECORD_NAME_LEN_MAX 255
+#define UPLOAD_JOURNAL_FILENAME "queue.journal"
+#define UPLOAD_BATCH_MAGIC "ARUPBAT1" // First bytes of a batch request body, before compression.
+#define UPLOAD_BATCH_MAGIC_LEN 8
+#define UPLOAD_BATCH_CONTENT_TYPE "application/x-artoolkit-upload-batch"
+#define UPLOAD_BATCH_HEADER "X-Upload-Batch-Max:" // Response header by which the server advertises batch support.
+#define UPLOAD_RESPONSE_LEN_MAX 65536 // Response bodies are kept up to this length, for per-item acknowledgements.
+#define UPLOAD_CONTENT_HASH_FIELD "content_hash" // Record field holding the content hash passed to fileUploaderEnqueueRecord().
+#define UPLOAD_CONTENT_HASH_LEN_MAX 64
+#define UPLOAD_UPLOADED_HASHES_FILENAME "uploaded.hashes"
+#define UPLOAD_UPLOADED_HASHES_MAX 256 // Content hashes of this many recent uploads are remembered.
+#define UPLOAD_PACING_BURST_SECS 10.0 // With a send speed limit, up to this many seconds' worth of data may be sent at full speed after the link has been idle.
 
 static void *fileUploader(THREAD_HANDLE_T *threadHandle);
 
+// An item waiting in the queue: either a file in the queue directory, or an item in the journal.
+typedef struct {
+    char                *pathname; // NULL for a journal item.
+    uint64_t             journalID; // 0 for a file.
+    time_t               mtime;
+    long                 mtimeNsec;
+    bool                 inFlight;
+    int                  attempts; // Failed upload attempts so far.
+    double               retryTime; // Not to be uploaded before this time (seconds since the epoch), or 0.
+    bool                 retryOnConnect; // Last failure was for want of a connection, so retry as soon as another upload succeeds.
+    char                 contentHash[UPLOAD_CONTENT_HASH_LEN_MAX + 1]; // Empty if none, or not known.
+} UPLOAD_QUEUE_ENTRY_t;
+
+// A queued item being uploaded.
+typedef struct {
+    char                 indexPathname[MAXPATHLEN]; // Empty for a journal item.
+    uint64_t             journalID; // 0 for a file.
+    char                 filePathname[MAXPATHLEN]; // The file named by an index file, if any.
+    char                 contentHash[UPLOAD_CONTENT_HASH_LEN_MAX + 1]; // Empty if none.
+} UPLOAD_TRANSFER_ITEM_t;
+
+// One in-flight upload, of a single item as a form, or of a batch of items. Easy handles are kept
+// across uploads so that connections can be reused.
+typedef struct {
+    CURL                *curlHandle;
+    curl_mime           *mime;
+    unsigned char       *record; // Contents of a packed queue record, which the form parts are read from.
+    unsigned char       *body; // Compressed body of a batch request.
+    struct curl_slist   *batchHeaders;
+    struct curl_slist   *requestHeaders; // Headers for a single item.
+    char                *response;
+    size_t               responseLen;
+    int                  batchMaxAdvertised; // From the response headers, or 0 if not present.
+    bool                 active;
+    bool                 batch;
+    UPLOAD_TRANSFER_ITEM_t *items;
+    int                  itemCount;
+    int                  itemSize;
+    char                 curlErrorBuf[CURL_ERROR_SIZE];
+    uint64_t             startTime;
+} UPLOAD_TRANSFER_t;
+
 struct _FILE_UPLOAD_HANDLE {
     char                *queueDirPath;
     char                *formExtension;
     char                *formPostURL;
+    int                  maxConcurrentUploads; // Read by the upload thread at the start of each upload cycle.
+    int                  batchSize; // Maximum items per request, or 1 for no batching. Also read at the start of each cycle.
+    int                  batchServerMax; // Maximum items per request the server last advertised, 0 if none, or -1 if it refused a batch. Upload thread only.
+    long                 maxSendSpeed; // Bytes per second across all uploads, or 0 for no limit. Also read at the start of each cycle.
+    // Pacing. Data may be sent at full speed while the allowance lasts. It is topped up at maxSendSpeed,
+    // to at most UPLOAD_PACING_BURST_SECS' worth. Upload thread only.
+    double               pacingAllowance;
+    double               pacingTime;
+    // The queue index: index files in the queue directory, oldest first. Built at init, then kept
+    // current via inotify where available, or otherwise by rescanning when the directory changes.
+    UPLOAD_QUEUE_ENTRY_t *queue;
+    int                  queueCount;
+    int                  queueSize;
+    pthread_mutex_t      queueLock;
+#ifdef HAVE_INOTIFY
+    int                  queueInotifyFD;
+#endif
+    time_t               queueDirMtime;
+    time_t               queueScanTime;
+    UPLOAD_JOURNAL_t    *journal; // Queued items enqueued by fileUploaderEnqueueRecord().
+    bool                 useJournal;
+    // Content hashes of recent uploads, a ring with the oldest at uploadedHashNext once full. Also
+    // protected by queueLock.
+    char               (*uploadedHashes)[UPLOAD_CONTENT_HASH_LEN_MAX + 1];
+    int                  uploadedHashCount;
+    int                  uploadedHashNext;
+    int                  uploadedHashFileLines; // The file is rewritten once it has grown well beyond the hashes kept.
+    // Retry scheduling, also protected by queueLock.
+    double               retryDelayMin;
+    double               retryDelayMax;
+    unsigned int         retrySeed;
+    int                  networkFailures; // Consecutive uploads which failed to reach the server.
+    double               offlineUntil; // No uploads are attempted before this time, or 0.
+    double               retrySignalledTime; // Retries due up to this time have already started an upload cycle.
+    pthread_t            retrySchedulerThread;
+    pthread_cond_t       retrySchedulerCond;
+    bool                 retrySchedulerQuit;
     THREAD_HANDLE_T     *uploadThread;
     char				 uploadStatus[UPLOAD_STATUS_BUFFER_LEN];
     bool                 uploadStatusHide; // Should check whether time for upload status to be hidden has arrived.
     struct timeval       uploadStatusHideAtTime; // The time at which upload status should be hidden.
     struct timeval       uploadStatusHideAfterSecs; // The number of seconds the user asked  for the status to be shown.
+    // Throughput statistics, also protected by uploadStatusLock.
+    uint64_t             statsBytesSent;
+    int                  statsItemsUploaded;
+    float                statsLastLatencySecs;
+    double               statsCycleStartTime;
+    uint64_t             statsCycleBytes;
+    int                  statsCycleItems;
+    float                statsItemsPerSec;
+    float                statsBytesPerSec;
     pthread_mutex_t      uploadStatusLock;
 };
 
@@ -75,34 +197,633 @@ static char *get_buff(char *buf, int n, FILE *fp, int skipblanks)
     return (ret);
 }
 
-static bool getNextFileInQueueWithExtension(const char *queueDir, const char *ext, char *buf, int len)
+static uint32_t recordGetUInt32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+static unsigned char *recordPutUInt32(unsigned char *p, const uint32_t u)
+{
+    p[0] = (unsigned char)u; p[1] = (unsigned char)(u >> 8); p[2] = (unsigned char)(u >> 16); p[3] = (unsigned char)(u >> 24);
+    return (p + 4);
+}
+
+static unsigned char *recordPutBytes(unsigned char *p, const void *data, const uint32_t len)
+{
+    p = recordPutUInt32(p, len);
+    if (len) memcpy(p, data, len);
+    return (p + len);
+}
+
+// Pack form fields into the body of a packed queue record (i.e. without the magic number).
+static unsigned char *recordPack(const FILE_UPLOAD_FIELD_t *fields, const int fieldCount, size_t *len_p)
+{
+    unsigned char *record, *p;
+    size_t len = 0;
+    int i;
+
+    for (i = 0; i < fieldCount; i++) {
+        const char *filename = (fields[i].filename ? fields[i].filename : "");
+        if (!fields[i].name || strlen(fields[i].name) > UPLOAD_RECORD_NAME_LEN_MAX || strlen(filename) > UPLOAD_RECORD_NAME_LEN_MAX || fields[i].dataLen > UINT32_MAX) {
+            ARLOGe("Invalid upload field name, filename or length.\n");
+            return (NULL);
+        }
+        len += 12 + strlen(fields[i].name) + strlen(filename) + fields[i].dataLen;
+    }
+    if (!(record = (unsigned char *)malloc(len))) {
+        ARLOGe("Out of memory!\n");
+        return (NULL);
+    }
+    p = record;
+    for (i = 0; i < fieldCount; i++) {
+        const char *filename = (fields[i].filename ? fields[i].filename : "");
+        p = recordPutBytes(p, fields[i].name, (uint32_t)strlen(fields[i].name));
+        p = recordPutBytes(p, filename, (uint32_t)strlen(filename));
+        p = recordPutBytes(p, fields[i].data, (uint32_t)fields[i].dataLen);
+    }
+    *len_p = len;
+    return (record);
+}
+
+// Gets the next length-prefixed byte string from a packed queue record, advancing *p_p.
+static bool recordGetBytes(const unsigned char **p_p, const unsigned char *end, const unsigned char **data_p, uint32_t *len_p)
+{
+    uint32_t len;
+
+    if (end - *p_p < 4) return (false);
+    len = recordGetUInt32(*p_p);
+    if ((size_t)(end - *p_p - 4) < len) return (false);
+    *data_p = *p_p + 4;
+    *len_p = len;
+    *p_p += 4 + len;
+    return (true);
+}
+
+static bool recordGetString(const unsigned char **p_p, const unsigned char *end, char buf[UPLOAD_RECORD_NAME_LEN_MAX + 1])
+{
+    const unsigned char *data;
+    uint32_t len;
+
+    if (!recordGetBytes(p_p, end, &data, &len) || len > UPLOAD_RECORD_NAME_LEN_MAX) return (false);
+    memcpy(buf, data, len);
+    buf[len] = '\0';
+    return (true);
+}
+
+// Find the named field in the body of a packed queue record, and copy its contents to buf as a string.
+// Returns false if there is no such field, or its contents don't fit.
+static bool recordGetField(const unsigned char *record, const size_t len, const char *fieldName, char *buf, const size_t bufLen)
+{
+    const unsigned char *p = record;
+    const unsigned char *end = record + len;
+    char name[UPLOAD_RECORD_NAME_LEN_MAX + 1];
+    char filename[UPLOAD_RECORD_NAME_LEN_MAX + 1];
+    const unsigned char *data;
+    uint32_t dataLen;
+
+    while (p < end) {
+        if (!recordGetString(&p, end, name) || !recordGetString(&p, end, filename) || !recordGetBytes(&p, end, &data, &dataLen)) return (false);
+        if (strcmp(name, fieldName) != 0) continue;
+        if (dataLen >= bufLen) return (false);
+        memcpy(buf, data, dataLen);
+        buf[dataLen] = '\0';
+        return (true);
+    }
+    return (false);
+}
+
+// Read a whole file into memory. The caller must free() the result.
+static unsigned char *readFile(const char *pathname, size_t *len_p)
+{
+    FILE *fp;
+    struct stat st;
+    unsigned char *data = NULL;
+
+    if (!(fp = fopen(pathname, "rb"))) return (NULL);
+    if (fstat(fileno(fp), &st) == 0 && (data = (unsigned char *)malloc(st.st_size ? st.st_size : 1))) {
+        if (st.st_size && fread(data, st.st_size, 1, fp) != 1) {
+            free(data);
+            data = NULL;
+        } else *len_p = (size_t)st.st_size;
+    }
+    fclose(fp);
+    return (data);
+}
+
+// Get the content hash from a queue file, if it is a packed record, copying it to buf as a string.
+// buf is set to an empty string if the file is a text index file, or the record has no content hash.
+static void recordFileGetContentHash(const char *pathname, char *buf, const size_t bufLen)
+{
+    FILE *fp;
+    char magic[UPLOAD_RECORD_MAGIC_LEN];
+    bool packed;
+    unsigned char *record;
+    size_t len;
+
+    buf[0] = '\0';
+    if (!(fp = fopen(pathname, "rb"))) return;
+    packed = (fread(magic, UPLOAD_RECORD_MAGIC_LEN, 1, fp) == 1 && memcmp(magic, UPLOAD_RECORD_MAGIC, UPLOAD_RECORD_MAGIC_LEN) == 0);
+    fclose(fp);
+    if (!packed || !(record = readFile(pathname, &len))) return;
+    if (!recordGetField(record + UPLOAD_RECORD_MAGIC_LEN, len - UPLOAD_RECORD_MAGIC_LEN, UPLOAD_CONTENT_HASH_FIELD, buf, bufLen)) buf[0] = '\0';
+    free(record);
+}
+
+static double timeNowSecs(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return ((double)tv.tv_sec + (double)tv.tv_usec*1.0e-6);
+}
+
+// Delay before the next retry after the given number of failures: exponential, capped, and with
+// jitter, so that many clients coming back online don't all retry at once. Must be called with queueLock held.
+static double retryDelay(FILE_UPLOAD_HANDLE_t *handle, const int failures)
+{
+    double delay = handle->retryDelayMin;
+    int i;
+
+    for (i = 1; i < failures && delay < handle->retryDelayMax; i++) delay *= 2.0;
+    if (delay > handle->retryDelayMax) delay = handle->retryDelayMax;
+    return (delay*(0.5 + 0.5*(double)rand_r(&(handle->retrySeed))/(double)RAND_MAX));
+}
+
+static void retryPathname(char *buf, const size_t len, const char *indexPathname)
+{
+    snprintf(buf, len, "%s." UPLOAD_RETRY_FILE_EXTENSION, indexPathname);
+}
+
+// Read the persisted retry state (if any) for a queue entry.
+static void retryLoad(UPLOAD_QUEUE_ENTRY_t *entry)
+{
+    char pathname[MAXPATHLEN];
+    char buf[256];
+    FILE *fp;
+
+    retryPathname(pathname, MAXPATHLEN, entry->pathname);
+    if (!(fp = fopen(pathname, "rb"))) return; // None.
+    while (get_buff(buf, sizeof(buf), fp, true)) {
+        char *commaPos;
+        if (!(commaPos = strchr(buf, ','))) continue;
+        *commaPos = '\0';
+        if (strcmp(buf, "attempts") == 0) entry->attempts = atoi(commaPos + 1);
+        else if (strcmp(buf, "retry_after") == 0) entry->retryTime = strtod(commaPos + 1, NULL);
+        else if (strcmp(buf, "last_error") == 0) entry->retryOnConnect = (strcmp(commaPos + 1, "network") == 0);
+    }
+    fclose(fp);
+}
+
+static void retrySave(const char *indexPathname, const int attempts, const double retryTime, const bool retryOnConnect)
+{
+    char pathname[MAXPATHLEN];
+    FILE *fp;
+
+    retryPathname(pathname, MAXPATHLEN, indexPathname);
+    if (!(fp = fopen(pathname, "wb"))) {
+        ARLOGe("Error writing upload retry file '%s'.\n", pathname);
+        ARLOGperror(NULL);
+        return;
+    }
+    fprintf(fp, "attempts,%d\nretry_after,%.0f\nlast_error,%s\n", attempts, retryTime, (retryOnConnect ? "network" : "server"));
+    fclose(fp);
+}
+
+// A content hash is used as an HTTP header value, so is restricted to letters, digits, '-' and '_'.
+static bool contentHashValid(const char *contentHash)
+{
+    size_t i, len = strlen(contentHash);
+
+    if (len < 1 || len > UPLOAD_CONTENT_HASH_LEN_MAX) return (false);
+    for (i = 0; i < len; i++) {
+        char c = contentHash[i];
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '-' || c == '_')) return (false);
+    }
+    return (true);
+}
+
+static void uploadedHashPathname(FILE_UPLOAD_HANDLE_t *handle, char *buf, const size_t len)
+{
+    snprintf(buf, len, "%s/" UPLOAD_UPLOADED_HASHES_FILENAME, handle->queueDirPath);
+}
+
+// Must be called with queueLock held.
+static bool uploadedHashFind(FILE_UPLOAD_HANDLE_t *handle, const char *contentHash)
+{
+    int i;
+    for (i = 0; i < handle->uploadedHashCount; i++) {
+        if (strcmp(handle->uploadedHashes[i], contentHash) == 0) return (true);
+    }
+    return (false);
+}
+
+// Rewrite the file of uploaded content hashes with just those remembered, oldest first. Must be called with queueLock held.
+static void uploadedHashSave(FILE_UPLOAD_HANDLE_t *handle)
+{
+    char pathname[MAXPATHLEN];
+    char tempPathname[MAXPATHLEN];
+    FILE *fp;
+    int i;
+    bool ok;
+
+    uploadedHashPathname(handle, pathname, MAXPATHLEN);
+    snprintf(tempPathname, MAXPATHLEN, "%s.tmp", pathname);
+    if (!(fp = fopen(tempPathname, "w"))) {
+        ARLOGe("Error opening uploaded content hashes file '%s'.\n", tempPathname);
+        ARLOGperror(NULL);
+        return;
+    }
+    ok = true;
+    for (i = 0; i < handle->uploadedHashCount; i++) {
+        int j = (handle->uploadedHashCount < UPLOAD_UPLOADED_HASHES_MAX ? i : (handle->uploadedHashNext + i) % UPLOAD_UPLOADED_HASHES_MAX);
+        if (fprintf(fp, "%s\n", handle->uploadedHashes[j]) < 0) ok = false;
+    }
+    if (fclose(fp) != 0) ok = false;
+    if (!ok || rename(tempPathname, pathname) < 0) {
+        ARLOGe("Error writing uploaded content hashes file '%s'.\n", pathname);
+        remove(tempPathname);
+        return;
+    }
+    handle->uploadedHashFileLines = handle->uploadedHashCount;
+}
+
+// Remember the content hash of an uploaded item, and if persist is true, append it to the file. Must be called with queueLock held.
+static void uploadedHashAdd(FILE_UPLOAD_HANDLE_t *handle, const char *contentHash, const bool persist)
+{
+    char pathname[MAXPATHLEN];
+    FILE *fp;
+
+    if (!handle->uploadedHashes || uploadedHashFind(handle, contentHash)) return;
+    snprintf(handle->uploadedHashes[handle->uploadedHashNext], UPLOAD_CONTENT_HASH_LEN_MAX + 1, "%s", contentHash);
+    handle->uploadedHashNext = (handle->uploadedHashNext + 1) % UPLOAD_UPLOADED_HASHES_MAX;
+    if (handle->uploadedHashCount < UPLOAD_UPLOADED_HASHES_MAX) handle->uploadedHashCount++;
+    if (!persist) return;
+
+    if (handle->uploadedHashFileLines >= 2*UPLOAD_UPLOADED_HASHES_MAX) {
+        uploadedHashSave(handle);
+        return;
+    }
+    uploadedHashPathname(handle, pathname, MAXPATHLEN);
+    if (!(fp = fopen(pathname, "a"))) {
+        ARLOGe("Error opening uploaded content hashes file '%s'.\n", pathname);
+        ARLOGperror(NULL);
+        return;
+    }
+    fprintf(fp, "%s\n", contentHash);
+    fclose(fp);
+    handle->uploadedHashFileLines++;
+}
+
+// Must be called with queueLock held.
+static void uploadedHashLoad(FILE_UPLOAD_HANDLE_t *handle)
+{
+    char pathname[MAXPATHLEN];
+    char buf[UPLOAD_CONTENT_HASH_LEN_MAX + 2];
+    FILE *fp;
+
+    uploadedHashPathname(handle, pathname, MAXPATHLEN);
+    if (!(fp = fopen(pathname, "r"))) return;
+    while (get_buff(buf, sizeof(buf), fp, true)) {
+        if (contentHashValid(buf)) uploadedHashAdd(handle, buf, false);
+        handle->uploadedHashFileLines++;
+    }
+    fclose(fp);
+}
+
+static bool hasExtension(const char *name, const char *ext)
+{
+    const char *dot = strrchr(name, '.');
+    return (dot && dot != name && strcasecmp(dot + 1, ext) == 0);
+}
+
+static int queueEntryCompare(const UPLOAD_QUEUE_ENTRY_t *a, const UPLOAD_QUEUE_ENTRY_t *b)
+{
+    if (a->mtime != b->mtime) return (a->mtime < b->mtime ? -1 : 1);
+    if (a->mtimeNsec != b->mtimeNsec) return (a->mtimeNsec < b->mtimeNsec ? -1 : 1);
+    if (a->pathname && b->pathname) return (strcmp(a->pathname, b->pathname));
+    if (a->pathname || b->pathname) return (a->pathname ? -1 : 1);
+    return (a->journalID < b->journalID ? -1 : (a->journalID > b->journalID ? 1 : 0));
+}
+
+// Find a queued file by pathname, or if journalID is non-zero, a queued journal item.
+static int queueFind(FILE_UPLOAD_HANDLE_t *handle, const char *pathname, const uint64_t journalID)
+{
+    int i;
+    for (i = 0; i < handle->queueCount; i++) {
+        if (journalID ? handle->queue[i].journalID == journalID : (handle->queue[i].pathname && strcmp(handle->queue[i].pathname, pathname) == 0)) return (i);
+    }
+    return (-1);
+}
+
+// Insert an entry in timestamp order. Must be called with queueLock held.
+static bool queueInsert(FILE_UPLOAD_HANDLE_t *handle, const UPLOAD_QUEUE_ENTRY_t *entry)
+{
+    int i;
+
+    if (handle->queueCount == handle->queueSize) {
+        int size = (handle->queueSize ? handle->queueSize*2 : 16);
+        UPLOAD_QUEUE_ENTRY_t *queue = (UPLOAD_QUEUE_ENTRY_t *)realloc(handle->queue, size*sizeof(UPLOAD_QUEUE_ENTRY_t));
+        if (!queue) {
+            ARLOGe("Out of memory!\n");
+            return (false);
+        }
+        handle->queue = queue;
+        handle->queueSize = size;
+    }
+
+    // Usually the newest, so search from the end.
+    for (i = handle->queueCount; i > 0 && queueEntryCompare(&handle->queue[i - 1], entry) > 0; i--);
+    memmove(&handle->queue[i + 1], &handle->queue[i], (handle->queueCount - i)*sizeof(UPLOAD_QUEUE_ENTRY_t));
+    handle->queue[i] = *entry;
+    handle->queueCount++;
+    return (true);
+}
+
+// Add a journal item to the queue. Must be called with queueLock held.
+static void queueAddJournalItem(FILE_UPLOAD_HANDLE_t *handle, const uint64_t id, const double enqueueTime, const int attempts, const double retryTime, const bool retryOnConnect, const char *contentHash)
+{
+    UPLOAD_QUEUE_ENTRY_t entry;
+
+    entry.pathname = NULL;
+    entry.journalID = id;
+    entry.mtime = (time_t)enqueueTime;
+    entry.mtimeNsec = (long)((enqueueTime - (double)entry.mtime)*1.0e9);
+    entry.inFlight = false;
+    entry.attempts = attempts;
+    entry.retryTime = retryTime;
+    entry.retryOnConnect = retryOnConnect;
+    snprintf(entry.contentHash, sizeof(entry.contentHash), "%s", (contentHash ? contentHash : ""));
+    queueInsert(handle, &entry);
+}
+
+static void journalReplayCallback(void *userdata, const uint64_t id, const double enqueueTime, const int attempts, const double retryTime, const bool retryOnConnect)
+{
+    queueAddJournalItem((FILE_UPLOAD_HANDLE_t *)userdata, id, enqueueTime, attempts, retryTime, retryOnConnect, NULL);
+}
+
+// Add an index file to the queue in timestamp order, unless already present. If contentHash is NULL, it is
+// read from the file, if a packed record, so that items queued by an earlier run are deduplicated against.
+// Must be called with queueLock held.
+static void queueAdd(FILE_UPLOAD_HANDLE_t *handle, const char *pathname, const char *contentHash)
+{
+    struct stat st;
+    UPLOAD_QUEUE_ENTRY_t entry;
+
+    if (queueFind(handle, pathname, 0) >= 0) return;
+    if (stat(pathname, &st) != 0) return; // Already gone.
+
+    entry.journalID = 0;
+    if (!(entry.pathname = strdup(pathname))) {
+        ARLOGe("Out of memory!\n");
+        return;
+    }
+    entry.mtime = st.st_mtime;
+#if defined(__APPLE__)
+    entry.mtimeNsec = st.st_mtimespec.tv_nsec;
+#else
+    entry.mtimeNsec = st.st_mtim.tv_nsec;
+#endif
+    entry.inFlight = false;
+    entry.attempts = 0;
+    entry.retryTime = 0.0;
+    entry.retryOnConnect = false;
+    if (contentHash) snprintf(entry.contentHash, sizeof(entry.contentHash), "%s", contentHash);
+    else recordFileGetContentHash(pathname, entry.contentHash, sizeof(entry.contentHash));
+    retryLoad(&entry);
+
+    if (!queueInsert(handle, &entry)) free(entry.pathname);
+}
+
+// Must be called with queueLock held.
+static void queueRemoveAt(FILE_UPLOAD_HANDLE_t *handle, const int i)
+{
+    free(handle->queue[i].pathname);
+    memmove(&handle->queue[i], &handle->queue[i + 1], (handle->queueCount - i - 1)*sizeof(UPLOAD_QUEUE_ENTRY_t));
+    handle->queueCount--;
+}
+
+// Remove an item which has been uploaded from the queue. As the upload got through, any uploads
+// waiting for a connection are now due.
+static void queueDone(FILE_UPLOAD_HANDLE_t *handle, const char *pathname, const uint64_t journalID)
+{
+    char retryPath[MAXPATHLEN];
+    int i;
+
+    if (journalID && !uploadJournalDone(handle->journal, journalID)) {
+        ARLOGe("Error recording upload of journal item %llu; it may be uploaded again.\n", (unsigned long long)journalID);
+    }
+
+    pthread_mutex_lock(&(handle->queueLock));
+    if ((i = queueFind(handle, pathname, journalID)) >= 0) queueRemoveAt(handle, i);
+    handle->networkFailures = 0;
+    handle->offlineUntil = 0.0;
+    for (i = 0; i < handle->queueCount; i++) {
+        if (!handle->queue[i].retryOnConnect) continue;
+        handle->queue[i].retryOnConnect = false;
+        handle->queue[i].retryTime = 0.0;
+    }
+    pthread_mutex_unlock(&(handle->queueLock));
+
+    if (journalID) return;
+    retryPathname(retryPath, MAXPATHLEN, pathname);
+    if (remove(retryPath) < 0 && errno != ENOENT) {
+        ARLOGe("Error removing upload retry file '%s'.\n", retryPath);
+        ARLOGperror(NULL);
+    }
+}
+
+// Rebuild the queue from the directory contents, keeping the in-flight state of entries still present.
+// Must be called with queueLock held.
+static bool queueScan(FILE_UPLOAD_HANDLE_t *handle)
 {
 	DIR *dirp ;
 	struct dirent *direntp;
+    char pathname[MAXPATHLEN];
+    UPLOAD_QUEUE_ENTRY_t *old = handle->queue;
+    int oldCount = handle->queueCount;
+    int i, j;
 
-	if (!buf || !ext) return (false);
-
-	if (!(dirp = opendir(queueDir))) {
-		ARLOGe("Error opening upload queue dir '%s'.\n", queueDir);
+	if (!(dirp = opendir(handle->queueDirPath))) {
+		ARLOGe("Error opening upload queue dir '%s'.\n", handle->queueDirPath);
         ARLOGperror(NULL);
     	return (false);
 	}
 
-	*buf = '\0';
+    handle->queue = NULL;
+    handle->queueCount = handle->queueSize = 0;
+    for (i = 0; i < oldCount; i++) {
+        if (old[i].journalID) queueInsert(handle, &old[i]);
+    }
 	while ((direntp = readdir(dirp))) {
-		char *ext0 = arUtilGetFileExtensionFromPath(direntp->d_name, true);
-		if (!ext0) continue;
-		if (strcmp(ext0, ext) == 0) {
-    		free(ext0);
-    		snprintf(buf, len, "%s/%s", queueDir, direntp->d_name);
-    		break;
-		}
-		free(ext0);
+		if (!hasExtension(direntp->d_name, handle->formExtension)) continue;
+        snprintf(pathname, MAXPATHLEN, "%s/%s", handle->queueDirPath, direntp->d_name);
+        queueAdd(handle, pathname, NULL);
 	}
-
 	closedir(dirp);
 
-	return (*buf != '\0');
+    for (i = 0; i < oldCount; i++) {
+        if (old[i].journalID) continue;
+        if ((j = queueFind(handle, old[i].pathname, 0)) >= 0) {
+            handle->queue[j].inFlight = old[i].inFlight;
+            memcpy(handle->queue[j].contentHash, old[i].contentHash, sizeof(old[i].contentHash));
+        }
+        free(old[i].pathname);
+    }
+    free(old);
+    return (true);
+}
+
+// Bring the queue up to date with changes in the queue directory.
+static void queueUpdate(FILE_UPLOAD_HANDLE_t *handle)
+{
+    struct stat st;
+
+    if (!handle->queueDirPath) return;
+
+    pthread_mutex_lock(&(handle->queueLock));
+#ifdef HAVE_INOTIFY
+    if (handle->queueInotifyFD >= 0) {
+        char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+        char pathname[MAXPATHLEN];
+        ssize_t len;
+        bool rescan = false;
+        while ((len = read(handle->queueInotifyFD, buf, sizeof(buf))) > 0) {
+            char *ptr;
+            for (ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + ((struct inotify_event *)ptr)->len) {
+                const struct inotify_event *event = (const struct inotify_event *)ptr;
+                if (event->mask & IN_Q_OVERFLOW) {
+                    rescan = true;
+                    continue;
+                }
+                if (!event->len || !hasExtension(event->name, handle->formExtension)) continue;
+                snprintf(pathname, MAXPATHLEN, "%s/%s", handle->queueDirPath, event->name);
+                if (event->mask & (IN_MOVED_TO | IN_CLOSE_WRITE)) queueAdd(handle, pathname, NULL);
+                else if (event->mask & (IN_MOVED_FROM | IN_DELETE)) {
+                    int i = queueFind(handle, pathname, 0);
+                    if (i >= 0 && !handle->queue[i].inFlight) queueRemoveAt(handle, i);
+                }
+            }
+        }
+        if (rescan) queueScan(handle);
+        pthread_mutex_unlock(&(handle->queueLock));
+        return;
+    }
+#endif
+    // No change notification, so rescan, but only if the directory has been modified since (or in the same second as) the last scan.
+    if (stat(handle->queueDirPath, &st) == 0 && (st.st_mtime != handle->queueDirMtime || st.st_mtime >= handle->queueScanTime)) {
+        handle->queueScanTime = time(NULL);
+        if (queueScan(handle)) handle->queueDirMtime = st.st_mtime;
+    }
+    pthread_mutex_unlock(&(handle->queueLock));
+}
+
+// Get the oldest queued item not already being uploaded and not waiting to be retried, and mark it
+// as being uploaded. Returns false if there is none. For a journal item, buf is set to an empty string.
+static bool queueTakeNext(FILE_UPLOAD_HANDLE_t *handle, char *buf, const size_t len, uint64_t *journalID_p)
+{
+    int i;
+    bool ret = false;
+    double now = timeNowSecs();
+
+    pthread_mutex_lock(&(handle->queueLock));
+    for (i = 0; i < handle->queueCount && now >= handle->offlineUntil; i++) {
+        if (handle->queue[i].inFlight || handle->queue[i].retryTime > now) continue;
+        handle->queue[i].inFlight = true;
+        snprintf(buf, len, "%s", (handle->queue[i].pathname ? handle->queue[i].pathname : ""));
+        *journalID_p = handle->queue[i].journalID;
+        ret = true;
+        break;
+    }
+    pthread_mutex_unlock(&(handle->queueLock));
+    return (ret);
+}
+
+// Return an item whose upload did not complete to the queue, if it still exists.
+static void queueRelease(FILE_UPLOAD_HANDLE_t *handle, const char *pathname, const uint64_t journalID)
+{
+    int i;
+
+    pthread_mutex_lock(&(handle->queueLock));
+    if ((i = queueFind(handle, pathname, journalID)) >= 0) handle->queue[i].inFlight = false;
+    pthread_mutex_unlock(&(handle->queueLock));
+}
+
+// Return an item whose upload failed to the queue, to be retried later. Persists the number of
+// attempts and the retry time. If the server could not be reached, no uploads at all are attempted until then.
+static void queueRetryLater(FILE_UPLOAD_HANDLE_t *handle, const char *pathname, const uint64_t journalID, const bool networkError)
+{
+    int i;
+    int attempts = 0;
+    double retryTime = 0.0;
+    double now = timeNowSecs();
+
+    pthread_mutex_lock(&(handle->queueLock));
+    if (networkError && now >= handle->offlineUntil) { // Concurrent failures count once.
+        handle->networkFailures++;
+        handle->offlineUntil = now + retryDelay(handle, handle->networkFailures);
+    }
+    if ((i = queueFind(handle, pathname, journalID)) >= 0) {
+        UPLOAD_QUEUE_ENTRY_t *entry = &(handle->queue[i]);
+        entry->inFlight = false;
+        entry->attempts++;
+        entry->retryOnConnect = networkError;
+        entry->retryTime = (networkError ? handle->offlineUntil : now + retryDelay(handle, entry->attempts));
+        attempts = entry->attempts;
+        retryTime = entry->retryTime;
+        if (journalID) ARLOGi("Upload of journal item %llu failed (attempt %d); will retry in %.0f seconds.\n", (unsigned long long)journalID, attempts, retryTime - now);
+        else ARLOGi("Upload of '%s' failed (attempt %d); will retry in %.0f seconds.\n", pathname, attempts, retryTime - now);
+    }
+    pthread_cond_signal(&(handle->retrySchedulerCond));
+    pthread_mutex_unlock(&(handle->queueLock));
+
+    if (i < 0) return;
+    if (journalID) uploadJournalRetry(handle->journal, journalID, attempts, retryTime, networkError);
+    else retrySave(pathname, attempts, retryTime, networkError);
+}
+
+// Starts an upload cycle whenever a retry falls due.
+static void *retryScheduler(void *arg)
+{
+    FILE_UPLOAD_HANDLE_t *handle = (FILE_UPLOAD_HANDLE_t *)arg;
+    int i;
+
+    pthread_mutex_lock(&(handle->queueLock));
+    while (!handle->retrySchedulerQuit) {
+        // Find the earliest retry not yet signalled.
+        double next = 0.0;
+        if (handle->offlineUntil > handle->retrySignalledTime) next = handle->offlineUntil;
+        for (i = 0; i < handle->queueCount; i++) {
+            double t = handle->queue[i].retryTime;
+            if (handle->queue[i].inFlight || t <= handle->retrySignalledTime) continue;
+            if (next == 0.0 || t < next) next = t;
+        }
+
+        double now = timeNowSecs();
+        if (next == 0.0) {
+            pthread_cond_wait(&(handle->retrySchedulerCond), &(handle->queueLock));
+        } else if (next > now) {
+            struct timespec ts;
+            ts.tv_sec = (time_t)next;
+            ts.tv_nsec = (long)((next - (double)ts.tv_sec)*1.0e9);
+            pthread_cond_timedwait(&(handle->retrySchedulerCond), &(handle->queueLock), &ts);
+        } else {
+            handle->retrySignalledTime = now;
+            pthread_mutex_unlock(&(handle->queueLock));
+            threadStartSignal(handle->uploadThread);
+            pthread_mutex_lock(&(handle->queueLock));
+        }
+    }
+    pthread_mutex_unlock(&(handle->queueLock));
+    return (NULL);
+}
+
+static int queueGetCount(FILE_UPLOAD_HANDLE_t *handle)
+{
+    int count;
+
+    pthread_mutex_lock(&(handle->queueLock));
+    count = handle->queueCount;
+    pthread_mutex_unlock(&(handle->queueLock));
+    return (count);
 }
 
 // ---------------------------------------------------------------------------
@@ -121,6 +842,11 @@ FILE_UPLOAD_HANDLE_t *fileUploaderInit(const char *queueDirPath, const char *for
     if (queueDirPath) handle->queueDirPath = strdup(queueDirPath);
     handle->formExtension = strdup(formExtension);
     handle->formPostURL = strdup(formPostURL);
+    handle->maxConcurrentUploads = UPLOAD_CONCURRENCY_DEFAULT;
+    handle->batchSize = 1;
+    handle->retryDelayMin = UPLOAD_RETRY_DELAY_MIN_DEFAULT;
+    handle->retryDelayMax = UPLOAD_RETRY_DELAY_MAX_DEFAULT;
+    handle->retrySeed = (unsigned int)time(NULL) ^ (unsigned int)(uintptr_t)handle;
 
     // Convert float time delta in seconds to a struct timeval.
 	time_t secs = (time_t)statusHideAfterSecs;
@@ -137,8 +863,52 @@ FILE_UPLOAD_HANDLE_t *fileUploaderInit(const char *queueDirPath, const char *for
     
     pthread_mutex_init(&(handle->uploadStatusLock), NULL);
 
-    // Spawn the file upload worker thread.
+    // Build the queue index.
+    pthread_mutex_init(&(handle->queueLock), NULL);
+#ifdef HAVE_INOTIFY
+    handle->queueInotifyFD = -1;
+#endif
+    if (handle->queueDirPath) {
+#ifdef HAVE_INOTIFY
+        // Watch before scanning, so that no file can arrive unseen in between.
+        if ((handle->queueInotifyFD = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0 ||
+            inotify_add_watch(handle->queueInotifyFD, handle->queueDirPath, IN_MOVED_TO | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_DELETE) < 0) {
+            ARLOGe("Unable to watch upload queue dir '%s'; changes will be noticed only at each upload cycle.\n", handle->queueDirPath);
+            ARLOGperror(NULL);
+            if (handle->queueInotifyFD >= 0) close(handle->queueInotifyFD);
+            handle->queueInotifyFD = -1;
+        }
+#endif
+        pthread_mutex_lock(&(handle->queueLock));
+        handle->queueScanTime = time(NULL);
+        queueScan(handle);
+        if ((handle->uploadedHashes = (char (*)[UPLOAD_CONTENT_HASH_LEN_MAX + 1])calloc(UPLOAD_UPLOADED_HASHES_MAX, sizeof(handle->uploadedHashes[0])))) uploadedHashLoad(handle);
+
+        // Replay the journal into the queue.
+        char journalPathname[MAXPATHLEN];
+        snprintf(journalPathname, MAXPATHLEN, "%s/" UPLOAD_JOURNAL_FILENAME, handle->queueDirPath);
+        if ((handle->journal = uploadJournalOpen(journalPathname, journalReplayCallback, handle))) {
+            uploadJournalCompactIfNeeded(handle->journal);
+            handle->useJournal = true;
+
+            // Recover the content hashes of the replayed items, so that duplicates of them are not queued.
+            int i;
+            for (i = 0; i < handle->queueCount; i++) {
+                unsigned char *record;
+                size_t len;
+                if (!handle->queue[i].journalID || !uploadJournalRead(handle->journal, handle->queue[i].journalID, &record, &len)) continue;
+                if (!recordGetField(record, len, UPLOAD_CONTENT_HASH_FIELD, handle->queue[i].contentHash, sizeof(handle->queue[i].contentHash))) handle->queue[i].contentHash[0] = '\0';
+                free(record);
+            }
+        }
+        pthread_mutex_unlock(&(handle->queueLock));
+    }
+    pipelineStatsSetInfo("upload_queue", (handle->useJournal ? "journal" : "files"));
+
+    // Spawn the file upload worker thread, and the thread which restarts it when retries fall due.
     handle->uploadThread = threadInit(0, handle, fileUploader);
+    pthread_cond_init(&(handle->retrySchedulerCond), NULL);
+    pthread_create(&(handle->retrySchedulerThread), NULL, retryScheduler, handle);
     
     return (handle);
 }
@@ -146,7 +916,14 @@ FILE_UPLOAD_HANDLE_t *fileUploaderInit(const char *queueDirPath, const char *for
 void fileUploaderFinal(FILE_UPLOAD_HANDLE_t **handle_p)
 {
     if (!handle_p || !*handle_p) return;
-    
+
+    pthread_mutex_lock(&((*handle_p)->queueLock));
+    (*handle_p)->retrySchedulerQuit = true;
+    pthread_cond_signal(&((*handle_p)->retrySchedulerCond));
+    pthread_mutex_unlock(&((*handle_p)->queueLock));
+    pthread_join((*handle_p)->retrySchedulerThread, NULL);
+    pthread_cond_destroy(&((*handle_p)->retrySchedulerCond));
+
     if ((*handle_p)->uploadThread) {
     	threadWaitQuit((*handle_p)->uploadThread);
     	threadFree(&((*handle_p)->uploadThread));
@@ -154,6 +931,15 @@ void fileUploaderFinal(FILE_UPLOAD_HANDLE_t **handle_p)
 
     pthread_mutex_destroy(&((*handle_p)->uploadStatusLock));
 
+#ifdef HAVE_INOTIFY
+    if ((*handle_p)->queueInotifyFD >= 0) close((*handle_p)->queueInotifyFD);
+#endif
+    while ((*handle_p)->queueCount) queueRemoveAt(*handle_p, (*handle_p)->queueCount - 1);
+    free((*handle_p)->queue);
+    uploadJournalClose(&((*handle_p)->journal));
+    free((*handle_p)->uploadedHashes);
+    pthread_mutex_destroy(&((*handle_p)->queueLock));
+
     // CURL final.
     curl_global_cleanup();
 
@@ -187,6 +973,189 @@ bool fileUploaderCreateQueueDir(const char *queueDirPath)
     return (true);
 }
 
+void fileUploaderSetMaxConcurrentUploads(FILE_UPLOAD_HANDLE_t *handle, const int maxConcurrentUploads)
+{
+    if (!handle || maxConcurrentUploads < 1) return;
+    pthread_mutex_lock(&(handle->uploadStatusLock));
+    handle->maxConcurrentUploads = maxConcurrentUploads;
+    pthread_mutex_unlock(&(handle->uploadStatusLock));
+}
+
+void fileUploaderSetBatchSize(FILE_UPLOAD_HANDLE_t *handle, const int batchSize)
+{
+    if (!handle || batchSize < 1) return;
+    pthread_mutex_lock(&(handle->uploadStatusLock));
+    handle->batchSize = batchSize;
+    pthread_mutex_unlock(&(handle->uploadStatusLock));
+}
+
+void fileUploaderSetMaxSendSpeed(FILE_UPLOAD_HANDLE_t *handle, const long bytesPerSec)
+{
+    if (!handle || bytesPerSec < 0) return;
+    pthread_mutex_lock(&(handle->uploadStatusLock));
+    handle->maxSendSpeed = bytesPerSec;
+    pthread_mutex_unlock(&(handle->uploadStatusLock));
+}
+
+void fileUploaderSetRetryDelay(FILE_UPLOAD_HANDLE_t *handle, const float minSecs, const float maxSecs)
+{
+    if (!handle || minSecs <= 0.0f || maxSecs < minSecs) return;
+    pthread_mutex_lock(&(handle->queueLock));
+    handle->retryDelayMin = minSecs;
+    handle->retryDelayMax = maxSecs;
+    pthread_mutex_unlock(&(handle->queueLock));
+}
+
+bool fileUploaderEnqueue(FILE_UPLOAD_HANDLE_t *handle, const char *indexPathname)
+{
+    if (!handle || !indexPathname || !handle->queueDirPath) return (false);
+
+    pthread_mutex_lock(&(handle->queueLock));
+    queueAdd(handle, indexPathname, NULL);
+    pthread_mutex_unlock(&(handle->queueLock));
+
+	threadStartSignal(handle->uploadThread);
+
+	return (true);
+}
+
+void fileUploaderSetUseJournal(FILE_UPLOAD_HANDLE_t *handle, const bool useJournal)
+{
+    if (!handle) return;
+    pthread_mutex_lock(&(handle->queueLock));
+    handle->useJournal = (useJournal && handle->journal);
+    pipelineStatsSetInfo("upload_queue", (handle->useJournal ? "journal" : "files"));
+    pthread_mutex_unlock(&(handle->queueLock));
+}
+
+// Append the record to the journal.
+static bool enqueueRecordJournal(FILE_UPLOAD_HANDLE_t *handle, const unsigned char *record, const size_t len, const char *contentHash)
+{
+    uint64_t id;
+    double enqueueTime;
+
+    if (!uploadJournalEnqueue(handle->journal, record, len, &id, &enqueueTime)) return (false);
+    pthread_mutex_lock(&(handle->queueLock));
+    queueAddJournalItem(handle, id, enqueueTime, 0, 0.0, false, contentHash);
+    pthread_mutex_unlock(&(handle->queueLock));
+    return (true);
+}
+
+// Sync the directory holding pathname, so that a rename into it is durable.
+static void syncParentDir(const char *pathname)
+{
+    char dir[MAXPATHLEN];
+    char *sep;
+    int fd;
+
+    snprintf(dir, MAXPATHLEN, "%s", pathname);
+    if (!(sep = strrchr(dir, '/'))) snprintf(dir, MAXPATHLEN, ".");
+    else if (sep == dir) sep[1] = '\0';
+    else *sep = '\0';
+    if ((fd = open(dir, O_RDONLY)) < 0) return;
+    fsync(fd);
+    close(fd);
+}
+
+// Write the record to its own file in the queue directory, then rename it into place. The record is synced to
+// storage before the rename, and the rename after, so that after a crash it is either wholly queued or absent.
+static bool enqueueRecordFile(FILE_UPLOAD_HANDLE_t *handle, const char *recordName, const unsigned char *record, const size_t len, const char *contentHash)
+{
+    char tempPathname[MAXPATHLEN];
+    char recordPathname[MAXPATHLEN];
+    FILE *fp;
+    bool ok;
+
+    // Write under a name without the queue file extension, so that the record isn't seen until complete.
+    snprintf(tempPathname, MAXPATHLEN, "%s/%s", handle->queueDirPath, recordName);
+    snprintf(recordPathname, MAXPATHLEN, "%s/%s.%s", handle->queueDirPath, recordName, handle->formExtension);
+    if (!(fp = fopen(tempPathname, "wb"))) {
+        ARLOGe("Error opening upload queue record '%s'.\n", tempPathname);
+        ARLOGperror(NULL);
+        return (false);
+    }
+    ok = (fwrite(UPLOAD_RECORD_MAGIC, UPLOAD_RECORD_MAGIC_LEN, 1, fp) == 1 && fwrite(record, len, 1, fp) == 1);
+    if (ok && (fflush(fp) != 0 || fsync(fileno(fp)) != 0)) ok = false;
+    if (fclose(fp) != 0) ok = false;
+    if (ok && rename(tempPathname, recordPathname) < 0) {
+        ARLOGe("Error renaming upload queue record '%s'.\n", tempPathname);
+        ARLOGperror(NULL);
+        ok = false;
+    }
+    if (!ok) {
+        ARLOGe("Error writing upload queue record '%s'.\n", tempPathname);
+        remove(tempPathname);
+        return (false);
+    }
+    syncParentDir(recordPathname);
+
+    pthread_mutex_lock(&(handle->queueLock));
+    queueAdd(handle, recordPathname, contentHash);
+    pthread_mutex_unlock(&(handle->queueLock));
+    return (true);
+}
+
+// Whether an item with the given content hash is already queued, or was recently uploaded.
+static bool queueHasContent(FILE_UPLOAD_HANDLE_t *handle, const char *contentHash)
+{
+    int i;
+    bool ret;
+
+    pthread_mutex_lock(&(handle->queueLock));
+    ret = uploadedHashFind(handle, contentHash);
+    for (i = 0; i < handle->queueCount && !ret; i++) {
+        if (strcmp(handle->queue[i].contentHash, contentHash) == 0) ret = true;
+    }
+    pthread_mutex_unlock(&(handle->queueLock));
+    return (ret);
+}
+
+bool fileUploaderEnqueueRecord(FILE_UPLOAD_HANDLE_t *handle, const char *recordName, const FILE_UPLOAD_FIELD_t *fields, const int fieldCount, const char *contentHash)
+{
+    unsigned char *record;
+    size_t len;
+    bool ok;
+
+    if (!handle || !recordName || !fields || fieldCount < 1 || !handle->queueDirPath) return (false);
+    if (contentHash && !contentHashValid(contentHash)) {
+        ARLOGe("Invalid upload content hash '%s'.\n", contentHash);
+        return (false);
+    }
+
+    uint64_t startTime = pipelineStatsTimeNow();
+    if (contentHash) {
+        if (queueHasContent(handle, contentHash)) {
+            ARLOGi("Upload with content hash %s is already queued or was recently uploaded; not queueing it again.\n", contentHash);
+            return (true);
+        }
+        // Carry the hash in the record, as an extra field.
+        FILE_UPLOAD_FIELD_t *fieldsWithHash = (FILE_UPLOAD_FIELD_t *)malloc((fieldCount + 1)*sizeof(FILE_UPLOAD_FIELD_t));
+        if (!fieldsWithHash) {
+            ARLOGe("Out of memory!\n");
+            return (false);
+        }
+        memcpy(fieldsWithHash, fields, fieldCount*sizeof(FILE_UPLOAD_FIELD_t));
+        fieldsWithHash[fieldCount].name = UPLOAD_CONTENT_HASH_FIELD;
+        fieldsWithHash[fieldCount].filename = NULL;
+        fieldsWithHash[fieldCount].data = contentHash;
+        fieldsWithHash[fieldCount].dataLen = strlen(contentHash);
+        record = recordPack(fieldsWithHash, fieldCount + 1, &len);
+        free(fieldsWithHash);
+    } else {
+        record = recordPack(fields, fieldCount, &len);
+    }
+    if (!record) return (false);
+    if (handle->useJournal) ok = enqueueRecordJournal(handle, record, len, contentHash);
+    else ok = enqueueRecordFile(handle, recordName, record, len, contentHash);
+    free(record);
+    if (!ok) return (false);
+    pipelineStatsRecord(PIPELINE_STAGE_ENQUEUE, startTime);
+
+	threadStartSignal(handle->uploadThread);
+
+	return (true);
+}
+
 bool fileUploaderTickle(FILE_UPLOAD_HANDLE_t *handle)
 {
 	if (!handle) return (false);
@@ -196,178 +1165,766 @@ bool fileUploaderTickle(FILE_UPLOAD_HANDLE_t *handle)
 	return (true);
 }
 
-static void *fileUploader(THREAD_HANDLE_T *threadHandle)
+// Reads a form part from memory (a field of a packed queue record).
+typedef struct {
+    const unsigned char *data;
+    size_t               len;
+    size_t               pos;
+} UPLOAD_PART_READER_t;
+
+static size_t uploadPartRead(char *buffer, size_t size, size_t nitems, void *arg)
+{
+    UPLOAD_PART_READER_t *reader = (UPLOAD_PART_READER_t *)arg;
+    size_t n = reader->len - reader->pos;
+
+    if (n > size*nitems) n = size*nitems;
+    memcpy(buffer, reader->data + reader->pos, n);
+    reader->pos += n;
+    return (n);
+}
+
+static int uploadPartSeek(void *arg, curl_off_t offset, int origin)
+{
+    UPLOAD_PART_READER_t *reader = (UPLOAD_PART_READER_t *)arg;
+
+    if (origin != SEEK_SET || offset < 0 || (size_t)offset > reader->len) return (CURL_SEEKFUNC_CANTSEEK);
+    reader->pos = (size_t)offset;
+    return (CURL_SEEKFUNC_OK);
+}
+
+// Adds a form part. If data is non-NULL, the part's contents are read from it, without copying, so it
+// must remain valid until the upload is finished. Otherwise, they are read from the file at filePathname.
+static bool uploadFormAddPart(curl_mime *mime, const char *name, const char *filename, const unsigned char *data, const size_t len, const char *filePathname)
+{
+    curl_mimepart *part;
+
+    if (!(part = curl_mime_addpart(mime))) return (false);
+    if (curl_mime_name(part, name) != CURLE_OK) return (false);
+    if (data) {
+        UPLOAD_PART_READER_t *reader = (UPLOAD_PART_READER_t *)malloc(sizeof(UPLOAD_PART_READER_t));
+        if (!reader) return (false);
+        reader->data = data;
+        reader->len = len;
+        reader->pos = 0;
+        if (curl_mime_data_cb(part, (curl_off_t)len, uploadPartRead, uploadPartSeek, free, reader) != CURLE_OK) {
+            free(reader);
+            return (false);
+        }
+    } else if (filePathname) {
+        if (curl_mime_filedata(part, filePathname) != CURLE_OK) return (false);
+    }
+    if (filename) {
+        if (curl_mime_filename(part, filename) != CURLE_OK) return (false);
+        if (curl_mime_type(part, "application/octet-stream") != CURLE_OK) return (false);
+    }
+    return (true);
+}
+
+// Build the form from the body of a packed queue record (i.e. after the magic number, if a file): fields,
+// each being a name, a filename (empty unless the field is to be sent as a file), and the contents.
+// Each of these is a byte string prefixed by its length as a 4-byte little-endian integer.
+static bool uploadFormFromRecord(curl_mime *mime, const unsigned char *record, const size_t len)
+{
+    const unsigned char *p = record;
+    const unsigned char *end = record + len;
+    char name[UPLOAD_RECORD_NAME_LEN_MAX + 1];
+    char filename[UPLOAD_RECORD_NAME_LEN_MAX + 1];
+    const unsigned char *data;
+    uint32_t dataLen;
+    int fieldCount = 0;
+
+    while (p < end) {
+        if (!recordGetString(&p, end, name) || !recordGetString(&p, end, filename) || !recordGetBytes(&p, end, &data, &dataLen)) return (false);
+        if (!uploadFormAddPart(mime, name, (filename[0] ? filename : NULL), data, dataLen, NULL)) return (false);
+        fieldCount++;
+    }
+    return (fieldCount > 0);
+}
+
+// Build the form from a text index file, with one "name,contents" field per line. A field named "file"
+// names a file to be sent.
+static bool uploadFormFromIndex(curl_mime *mime, FILE *fp, char *filePathname)
 {
-    FILE_UPLOAD_HANDLE_t *fileUploaderHandle;
-    char *indexUploadPathname;
-    char *filePathname;
 #define BUFSIZE 1024
-	char *buf;
-    CURL *curlHandle = NULL;
+	char buf[BUFSIZE];
+    int fieldCount = 0;
+
+    // Read lines from the file, creating form parts for each one.
+    filePathname[0] = '\0';
+    while (get_buff(buf, BUFSIZE, fp, true)) {
+
+        // Locate first comma on line, and split the string there.
+        char *commaPos;
+        if (!(commaPos = strchr(buf, ','))) continue; // No comma found! Skip line.
+        *commaPos = '\0';
+
+        if (strcmp(buf, "file") == 0) { // Handle the 'file' parameter by sending the file it names. All other params are sent as-is.
+            snprintf(filePathname, MAXPATHLEN, "%s", commaPos + 1);
+            if (!uploadFormAddPart(mime, buf, arUtilGetFileNameFromPath(commaPos + 1), NULL, 0, commaPos + 1)) return (false);
+        } else {
+            if (!uploadFormAddPart(mime, buf, NULL, (unsigned char *)commaPos + 1, strlen(commaPos + 1), NULL)) return (false);
+        }
+        fieldCount++;
+    }
+    return (fieldCount > 0);
+}
+
+// Pack the fields of a text index file into the body of a packed queue record, reading in the file
+// named by the "file" field.
+static unsigned char *recordFromIndex(FILE *fp, char *filePathname, size_t *len_p)
+{
+	char buf[BUFSIZE];
+    FILE_UPLOAD_FIELD_t *fields = NULL;
+    int fieldCount = 0;
+    unsigned char *record = NULL;
+    bool ok = true;
+    int i;
+
+    filePathname[0] = '\0';
+    while (ok && get_buff(buf, BUFSIZE, fp, true)) {
+        char *commaPos;
+        if (!(commaPos = strchr(buf, ','))) continue; // No comma found! Skip line.
+        *commaPos = '\0';
+
+        FILE_UPLOAD_FIELD_t *fields0 = (FILE_UPLOAD_FIELD_t *)realloc(fields, (fieldCount + 1)*sizeof(FILE_UPLOAD_FIELD_t));
+        if (!fields0) {
+            ok = false;
+            break;
+        }
+        fields = fields0;
+        FILE_UPLOAD_FIELD_t *field = &fields[fieldCount++];
+        field->name = strdup(buf);
+        if (strcmp(buf, "file") == 0) {
+            snprintf(filePathname, MAXPATHLEN, "%s", commaPos + 1);
+            field->filename = strdup(arUtilGetFileNameFromPath(commaPos + 1));
+            field->data = readFile(commaPos + 1, &(field->dataLen));
+            if (!field->filename) ok = false;
+        } else {
+            field->filename = NULL;
+            field->data = strdup(commaPos + 1);
+            field->dataLen = strlen(commaPos + 1);
+        }
+        if (!field->name || !field->data) ok = false;
+    }
+    if (ok && fieldCount > 0) record = recordPack(fields, fieldCount, len_p);
+
+    for (i = 0; i < fieldCount; i++) {
+        free((void *)fields[i].name);
+        free((void *)fields[i].filename);
+        free((void *)fields[i].data);
+    }
+    free(fields);
+    return (record);
+}
+
+// Get the body of a packed queue record for a queued item, packing it from the fields of an index file if need be.
+// The caller must free() the result.
+static unsigned char *uploadItemRecord(FILE_UPLOAD_HANDLE_t *fileUploaderHandle, UPLOAD_TRANSFER_ITEM_t *item, size_t *len_p)
+{
+    unsigned char *record = NULL;
+    FILE *fp;
+    char magic[UPLOAD_RECORD_MAGIC_LEN];
+
+    item->filePathname[0] = '\0';
+    if (item->journalID) {
+        if (!uploadJournalRead(fileUploaderHandle->journal, item->journalID, &record, len_p)) return (NULL);
+    } else if ((fp = fopen(item->indexPathname, "rb"))) {
+        if (fread(magic, UPLOAD_RECORD_MAGIC_LEN, 1, fp) == 1 && memcmp(magic, UPLOAD_RECORD_MAGIC, UPLOAD_RECORD_MAGIC_LEN) == 0) {
+            fclose(fp);
+            if ((record = readFile(item->indexPathname, len_p))) {
+                *len_p -= UPLOAD_RECORD_MAGIC_LEN;
+                memmove(record, record + UPLOAD_RECORD_MAGIC_LEN, *len_p);
+            }
+        } else {
+            rewind(fp);
+            record = recordFromIndex(fp, item->filePathname, len_p);
+            fclose(fp);
+        }
+    }
+    return (record);
+}
+
+static void uploadTransferFreeForm(UPLOAD_TRANSFER_t *transfer)
+{
+    curl_mime_free(transfer->mime);
+    transfer->mime = NULL;
+    free(transfer->record);
+    transfer->record = NULL;
+    free(transfer->body);
+    transfer->body = NULL;
+    curl_slist_free_all(transfer->requestHeaders);
+    transfer->requestHeaders = NULL;
+}
+
+// Keeps the response body, up to UPLOAD_RESPONSE_LEN_MAX bytes.
+static size_t uploadResponseWrite(char *buffer, size_t size, size_t nitems, void *arg)
+{
+    UPLOAD_TRANSFER_t *transfer = (UPLOAD_TRANSFER_t *)arg;
+    size_t n = size*nitems;
+    size_t keep = n;
+
+    if (transfer->responseLen + keep > UPLOAD_RESPONSE_LEN_MAX) keep = UPLOAD_RESPONSE_LEN_MAX - transfer->responseLen;
+    if (keep) {
+        char *response0 = (char *)realloc(transfer->response, transfer->responseLen + keep + 1);
+        if (!response0) return (0);
+        transfer->response = response0;
+        memcpy(transfer->response + transfer->responseLen, buffer, keep);
+        transfer->responseLen += keep;
+        transfer->response[transfer->responseLen] = '\0';
+    }
+    return (n);
+}
+
+static size_t uploadResponseHeader(char *buffer, size_t size, size_t nitems, void *arg)
+{
+    UPLOAD_TRANSFER_t *transfer = (UPLOAD_TRANSFER_t *)arg;
+    size_t n = size*nitems;
+    size_t headerLen = strlen(UPLOAD_BATCH_HEADER);
+    char value[16];
+
+    if (n > headerLen && strncasecmp(buffer, UPLOAD_BATCH_HEADER, headerLen) == 0) {
+        size_t valueLen = MIN(n - headerLen, sizeof(value) - 1);
+        memcpy(value, buffer + headerLen, valueLen);
+        value[valueLen] = '\0';
+        transfer->batchMaxAdvertised = atoi(value);
+    }
+    return (n);
+}
+
+// Take up to maxItems queued items for a transfer. Returns false if there are none.
+static bool uploadTransferTakeItems(FILE_UPLOAD_HANDLE_t *fileUploaderHandle, UPLOAD_TRANSFER_t *transfer, const int maxItems)
+{
+    if (transfer->itemSize < maxItems) {
+        UPLOAD_TRANSFER_ITEM_t *items0 = (UPLOAD_TRANSFER_ITEM_t *)realloc(transfer->items, maxItems*sizeof(UPLOAD_TRANSFER_ITEM_t));
+        if (!items0) {
+            ARLOGe("Out of memory!\n");
+            return (false);
+        }
+        transfer->items = items0;
+        transfer->itemSize = maxItems;
+    }
+    transfer->itemCount = 0;
+    while (transfer->itemCount < maxItems) {
+        UPLOAD_TRANSFER_ITEM_t *item = &(transfer->items[transfer->itemCount]);
+        if (!queueTakeNext(fileUploaderHandle, item->indexPathname, MAXPATHLEN, &(item->journalID))) break;
+        item->filePathname[0] = '\0';
+        item->contentHash[0] = '\0';
+        transfer->itemCount++;
+    }
+    return (transfer->itemCount > 0);
+}
+
+// Read the form fields of the transfer's single item from a queue file (packed record or index file) or
+// the journal.
+static bool uploadTransferBuildForm(FILE_UPLOAD_HANDLE_t *fileUploaderHandle, UPLOAD_TRANSFER_t *transfer)
+{
+    UPLOAD_TRANSFER_ITEM_t *item = &(transfer->items[0]);
+    FILE *fp;
+    char magic[UPLOAD_RECORD_MAGIC_LEN];
+    bool ok;
+
+    if (!(transfer->mime = curl_mime_init(transfer->curlHandle))) {
+        ARLOGe("Error initialising CURL form.\n");
+        return (false);
+    }
+    item->filePathname[0] = '\0';
+    if (item->journalID) {
+        // A journal item, which is the body of a packed record. The form parts are streamed from it.
+        size_t len;
+        ok = uploadJournalRead(fileUploaderHandle->journal, item->journalID, &(transfer->record), &len) && uploadFormFromRecord(transfer->mime, transfer->record, len);
+        if (ok) recordGetField(transfer->record, len, UPLOAD_CONTENT_HASH_FIELD, item->contentHash, sizeof(item->contentHash));
+    } else if (!(fp = fopen(item->indexPathname, "rb"))) {
+        ARLOGe("Error opening upload queue file '%s'.\n", item->indexPathname);
+        ok = false;
+    } else if (fread(magic, UPLOAD_RECORD_MAGIC_LEN, 1, fp) == 1 && memcmp(magic, UPLOAD_RECORD_MAGIC, UPLOAD_RECORD_MAGIC_LEN) == 0) {
+        // A packed record. Read it whole; the form parts are streamed from it.
+        struct stat st;
+        ok = false;
+        if (fstat(fileno(fp), &st) == 0 && (transfer->record = (unsigned char *)malloc(st.st_size))) {
+            rewind(fp);
+            if (fread(transfer->record, st.st_size, 1, fp) == 1) ok = uploadFormFromRecord(transfer->mime, transfer->record + UPLOAD_RECORD_MAGIC_LEN, st.st_size - UPLOAD_RECORD_MAGIC_LEN);
+            if (ok) recordGetField(transfer->record + UPLOAD_RECORD_MAGIC_LEN, st.st_size - UPLOAD_RECORD_MAGIC_LEN, UPLOAD_CONTENT_HASH_FIELD, item->contentHash, sizeof(item->contentHash));
+        }
+        fclose(fp);
+    } else {
+        rewind(fp);
+        ok = uploadFormFromIndex(transfer->mime, fp, item->filePathname);
+        fclose(fp);
+    }
+    if (!ok) {
+        if (item->journalID) ARLOGe("Error reading CURL form data from journal item %llu.\n", (unsigned long long)item->journalID);
+        else ARLOGe("Error reading CURL form data from file '%s'.\n", item->indexPathname);
+        return (false);
+    }
+
+    // Add a version to the request.
+    if (!uploadFormAddPart(transfer->mime, "version", NULL, (const unsigned char *)"1", 1, NULL)) {
+        ARLOGe("Error building CURL form.\n");
+        return (false);
+    }
+
+    // Let the server recognise a repeated upload of the same content.
+    if (item->contentHash[0]) {
+        char header[32 + UPLOAD_CONTENT_HASH_LEN_MAX];
+        snprintf(header, sizeof(header), "Idempotency-Key: %s", item->contentHash);
+        if (!(transfer->requestHeaders = curl_slist_append(NULL, header))) {
+            ARLOGe("Out of memory!\n");
+            return (false);
+        }
+    }
+
+    CURLcode curlErr = curl_easy_setopt(transfer->curlHandle, CURLOPT_MIMEPOST, transfer->mime); // Automatically sets CURLOPT_NOBODY to 0.
+    if (curlErr == CURLE_OK) curlErr = curl_easy_setopt(transfer->curlHandle, CURLOPT_HTTPHEADER, transfer->requestHeaders);
+    if (curlErr != CURLE_OK) {
+        ARLOGe("Error setting CURL form data: %s (%d)\n", curl_easy_strerror(curlErr), curlErr);
+        return (false);
+    }
+    return (true);
+}
+
+// Build the gzip-compressed body of a batch request from the transfer's items: the batch magic number,
+// the number of items, then each item as a packed record body, prefixed by its length. Items which can't
+// be read are dropped from the batch, to be retried later.
+static bool uploadTransferBuildBatch(FILE_UPLOAD_HANDLE_t *fileUploaderHandle, UPLOAD_TRANSFER_t *transfer)
+{
+    unsigned char **records;
+    size_t *recordLens;
+    unsigned char *body = NULL;
+    size_t len = UPLOAD_BATCH_MAGIC_LEN + 4;
+    int count = 0;
+    int i;
+    bool ok = false;
+
+    records = (unsigned char **)calloc(transfer->itemCount, sizeof(unsigned char *));
+    recordLens = (size_t *)calloc(transfer->itemCount, sizeof(size_t));
+    if (!records || !recordLens) {
+        ARLOGe("Out of memory!\n");
+        goto done;
+    }
+    for (i = 0; i < transfer->itemCount; i++) {
+        UPLOAD_TRANSFER_ITEM_t *item = &(transfer->items[i]);
+        if (!(records[count] = uploadItemRecord(fileUploaderHandle, item, &recordLens[count])) || recordLens[count] > UINT32_MAX) {
+            if (item->journalID) ARLOGe("Error reading upload data from journal item %llu.\n", (unsigned long long)item->journalID);
+            else ARLOGe("Error reading upload data from file '%s'.\n", item->indexPathname);
+            free(records[count]);
+            queueRetryLater(fileUploaderHandle, item->indexPathname, item->journalID, false);
+            continue;
+        }
+        recordGetField(records[count], recordLens[count], UPLOAD_CONTENT_HASH_FIELD, item->contentHash, sizeof(item->contentHash));
+        if (count != i) transfer->items[count] = *item;
+        len += 4 + recordLens[count];
+        count++;
+    }
+    transfer->itemCount = count;
+    if (!count) goto done;
+
+    if (!(body = (unsigned char *)malloc(len))) {
+        ARLOGe("Out of memory!\n");
+        goto done;
+    }
+    unsigned char *p = body;
+    memcpy(p, UPLOAD_BATCH_MAGIC, UPLOAD_BATCH_MAGIC_LEN);
+    p = recordPutUInt32(p + UPLOAD_BATCH_MAGIC_LEN, (uint32_t)count);
+    for (i = 0; i < count; i++) p = recordPutBytes(p, records[i], (uint32_t)recordLens[i]);
+
+    // Compress, with a gzip wrapper.
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        ARLOGe("Error initialising compression.\n");
+        goto done;
+    }
+    uLong bound = deflateBound(&zs, (uLong)len);
+    if ((transfer->body = (unsigned char *)malloc(bound))) {
+        zs.next_in = body;
+        zs.avail_in = (uInt)len;
+        zs.next_out = transfer->body;
+        zs.avail_out = (uInt)bound;
+        ok = (deflate(&zs, Z_FINISH) == Z_STREAM_END);
+    }
+    deflateEnd(&zs);
+    if (!ok) {
+        ARLOGe("Error compressing upload batch.\n");
+        goto done;
+    }
+    ARLOGd("Upload batch of %d items, %zu bytes (%lu compressed).\n", count, len, zs.total_out);
+
+    if (!transfer->batchHeaders) {
+        struct curl_slist *headers = curl_slist_append(NULL, "Content-Type: " UPLOAD_BATCH_CONTENT_TYPE);
+        if (headers) {
+            struct curl_slist *headers0 = curl_slist_append(headers, "Content-Encoding: gzip");
+            if (headers0) transfer->batchHeaders = headers0;
+            else curl_slist_free_all(headers);
+        }
+    }
+    CURLcode curlErr = (transfer->batchHeaders ? CURLE_OK : CURLE_OUT_OF_MEMORY);
+    if (curlErr == CURLE_OK) curlErr = curl_easy_setopt(transfer->curlHandle, CURLOPT_HTTPHEADER, transfer->batchHeaders);
+    if (curlErr == CURLE_OK) curlErr = curl_easy_setopt(transfer->curlHandle, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)zs.total_out);
+    if (curlErr == CURLE_OK) curlErr = curl_easy_setopt(transfer->curlHandle, CURLOPT_POSTFIELDS, transfer->body);
+    if (curlErr != CURLE_OK) {
+        ARLOGe("Error setting CURL post data: %s (%d)\n", curl_easy_strerror(curlErr), curlErr);
+        ok = false;
+    }
+
+done:
+    if (records) {
+        for (i = 0; i < count; i++) free(records[i]);
+    }
+    free(records);
+    free(recordLens);
+    free(body);
+    return (ok);
+}
+
+// Start the upload of the items taken for a transfer on the multi handle, as a single form, or as a batch.
+// Returns 0 if the upload was started, 4 if the form couldn't be built from the transfer's items (e.g. an
+// index names a file which has gone), or -1 if CURL couldn't be set up.
+static int uploadTransferStart(FILE_UPLOAD_HANDLE_t *fileUploaderHandle, CURLM *multiHandle, UPLOAD_TRANSFER_t *transfer, const bool batch, const curl_off_t maxSendSpeed)
+{
     CURLcode curlErr;
-	char curlErrorBuf[CURL_ERROR_SIZE];
+    CURLMcode curlMErr;
+    int i;
+
+    if (!transfer->curlHandle) {
+        transfer->curlHandle = curl_easy_init();
+        if (!transfer->curlHandle) {
+            ARLOGe("Error initialising CURL.\n");
+            return (-1);
+        }
+        curlErr = curl_easy_setopt(transfer->curlHandle, CURLOPT_ERRORBUFFER, transfer->curlErrorBuf);
+        if (curlErr != CURLE_OK) {
+            ARLOGe("Error setting CURL error buffer: %s (%d)\n", curl_easy_strerror(curlErr), curlErr);
+            return (-1);
+        }
+        curlErr = curl_easy_setopt(transfer->curlHandle, CURLOPT_URL, fileUploaderHandle->formPostURL);
+        if (curlErr != CURLE_OK) {
+            ARLOGe("Error setting CURL URL: %s (%d)\n", curl_easy_strerror(curlErr), curlErr);
+            return (-1);
+        }
+        curl_easy_setopt(transfer->curlHandle, CURLOPT_PRIVATE, transfer);
+        curl_easy_setopt(transfer->curlHandle, CURLOPT_WRITEFUNCTION, uploadResponseWrite);
+        curl_easy_setopt(transfer->curlHandle, CURLOPT_WRITEDATA, transfer);
+        curl_easy_setopt(transfer->curlHandle, CURLOPT_HEADERFUNCTION, uploadResponseHeader);
+        curl_easy_setopt(transfer->curlHandle, CURLOPT_HEADERDATA, transfer);
+#if defined(CURL_HTTP_VERSION_2TLS)
+        // Use HTTP/2 for https where the server supports it, so concurrent uploads share one connection.
+        curl_easy_setopt(transfer->curlHandle, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+        curl_easy_setopt(transfer->curlHandle, CURLOPT_PIPEWAIT, 1L);
+#endif
+
+        // The commented-out section below disables SSL peer verification. Uncommenting this will make
+        // https connections insecure, but will allow (for example) connections to a server using a
+        // self-signed SSL certificate and when you have not provided CURL with a CAfile via
+        // 'curl_easy_setopt(curlHandle, CURLOPT_CAPATH, capath);'.
+        // (default capath: /etc/ssl/certs/ca-certificates.crt)
+        //curlErr = curl_easy_setopt(transfer->curlHandle, CURLOPT_SSL_VERIFYPEER, 0L);
+        //if (curlErr != CURLE_OK) {
+        //	ARLOGe("Error setting CURL SSL options: %s (%d)\n", curl_easy_strerror(curlErr), curlErr);
+        //	fclose(fp);
+        //	return (-1);
+        //}
+    }
+
+    if (!(batch ? uploadTransferBuildBatch(fileUploaderHandle, transfer) : uploadTransferBuildForm(fileUploaderHandle, transfer))) {
+        uploadTransferFreeForm(transfer);
+        return (4);
+    }
+
+    curl_easy_setopt(transfer->curlHandle, CURLOPT_MAX_SEND_SPEED_LARGE, maxSendSpeed);
+
+    curlMErr = curl_multi_add_handle(multiHandle, transfer->curlHandle);
+    if (curlMErr != CURLM_OK) {
+        ARLOGe("Error adding CURL handle: %s (%d)\n", curl_multi_strerror(curlMErr), curlMErr);
+        uploadTransferFreeForm(transfer);
+        return (-1);
+    }
+
+    for (i = 0; i < transfer->itemCount; i++) {
+        if (transfer->items[i].journalID) uploadJournalInFlight(fileUploaderHandle->journal, transfer->items[i].journalID);
+    }
+    transfer->batch = batch;
+    transfer->curlErrorBuf[0] = '\0';
+    transfer->responseLen = 0;
+    transfer->batchMaxAdvertised = 0;
+    transfer->startTime = pipelineStatsTimeNow();
+    transfer->active = true;
+    return (0);
+}
+
+// An item was uploaded, so remember its content hash, remove it from the queue, and delete its index file
+// and the file it names.
+static void uploadItemDone(FILE_UPLOAD_HANDLE_t *fileUploaderHandle, const UPLOAD_TRANSFER_ITEM_t *item)
+{
+    if (item->contentHash[0]) {
+        pthread_mutex_lock(&(fileUploaderHandle->queueLock));
+        uploadedHashAdd(fileUploaderHandle, item->contentHash, true);
+        pthread_mutex_unlock(&(fileUploaderHandle->queueLock));
+    }
+    queueDone(fileUploaderHandle, item->indexPathname, item->journalID);
+    if (item->journalID) return;
+
+    if (remove(item->indexPathname) < 0) {
+        ARLOGe("Error removing index file '%s' after upload.\n", item->indexPathname);
+        ARLOGperror(NULL);
+    }
+    if (item->filePathname[0] && remove(item->filePathname) < 0) {
+        ARLOGe("Error removing file '%s' after upload.\n", item->filePathname);
+        ARLOGperror(NULL);
+    }
+}
+
+// Top up the allowance of data which may be sent at full speed.
+static void pacingRefill(FILE_UPLOAD_HANDLE_t *fileUploaderHandle, const long maxSendSpeed)
+{
+    double now = timeNowSecs();
+    fileUploaderHandle->pacingAllowance = MIN(fileUploaderHandle->pacingAllowance + (now - fileUploaderHandle->pacingTime)*maxSendSpeed, maxSendSpeed*UPLOAD_PACING_BURST_SECS);
+    fileUploaderHandle->pacingTime = now;
+}
+
+// Account for a finished transfer in the throughput statistics and the pacing allowance.
+static void uploadTransferAccount(FILE_UPLOAD_HANDLE_t *fileUploaderHandle, UPLOAD_TRANSFER_t *transfer, const int uploaded)
+{
+    curl_off_t bytesSent = 0;
+    curl_off_t totalTime = 0;
+
+    curl_easy_getinfo(transfer->curlHandle, CURLINFO_SIZE_UPLOAD_T, &bytesSent);
+    curl_easy_getinfo(transfer->curlHandle, CURLINFO_TOTAL_TIME_T, &totalTime);
+    fileUploaderHandle->pacingAllowance -= (double)bytesSent;
+
+    pthread_mutex_lock(&(fileUploaderHandle->uploadStatusLock));
+    fileUploaderHandle->statsBytesSent += bytesSent;
+    fileUploaderHandle->statsItemsUploaded += uploaded;
+    fileUploaderHandle->statsLastLatencySecs = (float)totalTime*1.0e-6f;
+    fileUploaderHandle->statsCycleBytes += bytesSent;
+    fileUploaderHandle->statsCycleItems += uploaded;
+    double elapsed = timeNowSecs() - fileUploaderHandle->statsCycleStartTime;
+    if (elapsed > 0.0) {
+        fileUploaderHandle->statsItemsPerSec = (float)(fileUploaderHandle->statsCycleItems/elapsed);
+        fileUploaderHandle->statsBytesPerSec = (float)(fileUploaderHandle->statsCycleBytes/elapsed);
+    }
+    pthread_mutex_unlock(&(fileUploaderHandle->uploadStatusLock));
+}
+
+// Handle a finished upload. The number of items accepted by the server is returned in *uploaded_p.
+// Returns 0 if the upload succeeded, or an error code as for the upload cycle.
+static int uploadTransferFinish(FILE_UPLOAD_HANDLE_t *fileUploaderHandle, CURLM *multiHandle, UPLOAD_TRANSFER_t *transfer, const CURLcode result, int *uploaded_p)
+{
 	long http_response;
+    int i;
+
+    *uploaded_p = 0;
+    pipelineStatsRecord(PIPELINE_STAGE_UPLOAD, transfer->startTime);
+    TRACE_INSTANT("uploadFinished");
+    curl_multi_remove_handle(multiHandle, transfer->curlHandle);
+    uploadTransferFreeForm(transfer); // Free the form resources, regardless of outcome.
+    transfer->active = false;
+
+    if (result != CURLE_OK) {
+        ARLOGe("Error performing CURL operation: %s (%d). %s.\n", curl_easy_strerror(result), result, transfer->curlErrorBuf);
+        if (result == CURLE_COULDNT_RESOLVE_HOST || result == CURLE_COULDNT_RESOLVE_PROXY || result == CURLE_COULDNT_CONNECT || result == CURLE_OPERATION_TIMEDOUT) {
+            // The server couldn't be reached, so retry once there is (probably) a connection again.
+            for (i = 0; i < transfer->itemCount; i++) queueRetryLater(fileUploaderHandle, transfer->items[i].indexPathname, transfer->items[i].journalID, true);
+            return (result == CURLE_OPERATION_TIMEDOUT ? 2 : 1);
+        }
+        // Anything else (e.g. CURLE_READ_ERROR, where a file named by an index has gone) is particular to
+        // this transfer, so retry just its items, and leave the uploader online for the rest of the queue.
+        for (i = 0; i < transfer->itemCount; i++) queueRetryLater(fileUploaderHandle, transfer->items[i].indexPathname, transfer->items[i].journalID, false);
+        return (4);
+    }
 
+    curl_easy_getinfo(transfer->curlHandle, CURLINFO_RESPONSE_CODE, &http_response);
+    if (transfer->batch && (http_response == 400 || http_response == 404 || http_response == 405 || http_response == 415 || http_response == 501)) {
+        // The server doesn't accept batches after all. Send the items again, one per request, and don't
+        // batch again for the life of the handle, whatever the server advertises.
+        if (fileUploaderHandle->batchServerMax >= 0) ARLOGi("Server refused batched upload (response %ld); uploading one file per request.\n", http_response);
+        fileUploaderHandle->batchServerMax = -1;
+        for (i = 0; i < transfer->itemCount; i++) queueRelease(fileUploaderHandle, transfer->items[i].indexPathname, transfer->items[i].journalID);
+        return (0);
+    }
+    if (http_response != 200) {
+        ARLOGe("Parameter file upload failed: server returned response %ld.\n", http_response);
+        for (i = 0; i < transfer->itemCount; i++) queueRetryLater(fileUploaderHandle, transfer->items[i].indexPathname, transfer->items[i].journalID, false);
+        return (3);
+    }
+
+    if (fileUploaderHandle->batchServerMax >= 0 && transfer->batchMaxAdvertised != fileUploaderHandle->batchServerMax) {
+        if (transfer->batchMaxAdvertised > 1) ARLOGi("Server accepts batched uploads of up to %d files.\n", transfer->batchMaxAdvertised);
+        fileUploaderHandle->batchServerMax = (transfer->batchMaxAdvertised > 1 ? transfer->batchMaxAdvertised : 0);
+    }
+
+    if (!transfer->batch) {
+        uploadItemDone(fileUploaderHandle, &(transfer->items[0]));
+        *uploaded_p = 1;
+        return (0);
+    }
+
+    // The response to a batch has one line per item, in order, "OK" if the item was accepted. Items not
+    // accepted are retried later.
+    const char *line = (transfer->responseLen ? transfer->response : "");
+    int rejected = 0;
+    for (i = 0; i < transfer->itemCount; i++) {
+        size_t lineLen = 0;
+        if (line) {
+            const char *eol = strchr(line, '\n');
+            lineLen = (eol ? (size_t)(eol - line) : strlen(line));
+            if (lineLen && line[lineLen - 1] == '\r') lineLen--;
+        }
+        if (line && lineLen == 2 && strncmp(line, "OK", 2) == 0) {
+            uploadItemDone(fileUploaderHandle, &(transfer->items[i]));
+            (*uploaded_p)++;
+        } else {
+            queueRetryLater(fileUploaderHandle, transfer->items[i].indexPathname, transfer->items[i].journalID, false);
+            rejected++;
+        }
+        if (line) line = strchr(line, '\n');
+        if (line) line++;
+    }
+    if (rejected) {
+        ARLOGe("Parameter file upload failed: server rejected %d of %d files in batch.\n", rejected, transfer->itemCount);
+        return (3);
+    }
+    return (0);
+}
+
+static void *fileUploader(THREAD_HANDLE_T *threadHandle)
+{
+    FILE_UPLOAD_HANDLE_t *fileUploaderHandle;
+    CURLM *multiHandle = NULL;
+    UPLOAD_TRANSFER_t *transfers = NULL;
+    int transferCount = 0;
+    int i;
 
     ARLOGi("Start fileUploader thread.\n");
+    TRACE_THREAD_NAME("fileUploader");
     fileUploaderHandle = (FILE_UPLOAD_HANDLE_t *)threadGetArg(threadHandle);
-    arMalloc(indexUploadPathname, char, MAXPATHLEN);
-    arMalloc(filePathname, char, MAXPATHLEN);
-    arMalloc(buf, char, BUFSIZE);
 
     while (threadStartWait(threadHandle) == 0) {
     	ARLOGd("file uploader is GO\n");
+        TRACE_BEGIN("uploadQueue");
+        queueUpdate(fileUploaderHandle);
+        int queueCount = queueGetCount(fileUploaderHandle);
     	pthread_mutex_lock(&(fileUploaderHandle->uploadStatusLock));
-    	snprintf(fileUploaderHandle->uploadStatus, UPLOAD_STATUS_BUFFER_LEN, "Looking for files to upload...");
+        // With nothing queued, leave any previous status in place.
+    	if (queueCount > 0) snprintf(fileUploaderHandle->uploadStatus, UPLOAD_STATUS_BUFFER_LEN, "Looking for files to upload...");
+        int maxConcurrentUploads = fileUploaderHandle->maxConcurrentUploads;
+        int batchSize = fileUploaderHandle->batchSize;
+        long maxSendSpeed = fileUploaderHandle->maxSendSpeed;
+        if (queueCount > 0) {
+            fileUploaderHandle->statsCycleStartTime = timeNowSecs();
+            fileUploaderHandle->statsCycleBytes = 0;
+            fileUploaderHandle->statsCycleItems = 0;
+        }
     	pthread_mutex_unlock(&(fileUploaderHandle->uploadStatusLock));
 
     	int uploadsDone = 0;
     	int errorCode = 0;
 
-    	// Look for at least one unhandled uploadQueueFileName in the queue directory.
-    	while (getNextFileInQueueWithExtension(fileUploaderHandle->queueDirPath, fileUploaderHandle->formExtension, indexUploadPathname, MAXPATHLEN)) {
-
-        	pthread_mutex_lock(&(fileUploaderHandle->uploadStatusLock));
-        	snprintf(fileUploaderHandle->uploadStatus, UPLOAD_STATUS_BUFFER_LEN, "Uploading file %d", uploadsDone + 1);
-        	pthread_mutex_unlock(&(fileUploaderHandle->uploadStatusLock));
-
-        	FILE *fp;
-    		if (!(fp = fopen(indexUploadPathname, "rb"))) {
-            	ARLOGe("Error opening upload queue file '%s'.\n", indexUploadPathname);
-            	errorCode = -1;
-    	    	break;
-    		}
-
-    	    //
-    	    // cURL upload.
-    	    //
-
-    	    if (!curlHandle) {
-    	    	curlHandle = curl_easy_init();
-        	    if (!curlHandle) {
-        	    	ARLOGe("Error initialising CURL.\n");
-            	    errorCode = -1;
-        	    	break;
-        	    }
-        	    curlErr = curl_easy_setopt(curlHandle, CURLOPT_ERRORBUFFER, curlErrorBuf);
-        	    if (curlErr != CURLE_OK) {
-        	    	ARLOGe("Error setting CURL error buffer: %s (%d)\n", curl_easy_strerror(curlErr), curlErr);
-            	    errorCode = -1;
-        	    	break;
-        	    }
-        	    
-                // First, attempt a connection to a well-known site. If this fails, assume we have no
-                // internet access at all.
-                curlErr = curl_easy_setopt(curlHandle, CURLOPT_URL, "http://www.google.com");
-                if (curlErr != CURLE_OK) {
-                    ARLOGe("Error setting CURL URL: %s (%d)\n", curl_easy_strerror(curlErr), curlErr);
-            	    errorCode = -1;
-                    break;
+        // Set up the multi handle and the pool of transfers, growing the pool if concurrency was raised.
+        if (queueCount > 0) {
+            if (!multiHandle) {
+                if (!(multiHandle = curl_multi_init())) {
+                    ARLOGe("Error initialising CURL.\n");
+                    errorCode = -1;
+                } else {
+#if defined(CURLPIPE_MULTIPLEX)
+                    curl_multi_setopt(multiHandle, CURLMOPT_PIPELINING, (long)CURLPIPE_MULTIPLEX);
+#endif
                 }
-                curlErr = curl_easy_setopt(curlHandle, CURLOPT_NOBODY, 1L); // Headers only.
-                if (curlErr != CURLE_OK) {
-                    ARLOGe("Error setting CURL URL: %s (%d)\n", curl_easy_strerror(curlErr), curlErr);
-            	    errorCode = -1;
-                    break;
+            }
+            if (multiHandle) curl_multi_setopt(multiHandle, CURLMOPT_MAX_HOST_CONNECTIONS, (long)maxConcurrentUploads);
+            if (transferCount < maxConcurrentUploads) {
+                UPLOAD_TRANSFER_t *transfers0 = (UPLOAD_TRANSFER_t *)realloc(transfers, maxConcurrentUploads*sizeof(UPLOAD_TRANSFER_t));
+                if (!transfers0) {
+                    ARLOGe("Out of memory!\n");
+                    errorCode = -1;
+                } else {
+                    transfers = transfers0;
+                    memset(&transfers[transferCount], 0, (maxConcurrentUploads - transferCount)*sizeof(UPLOAD_TRANSFER_t));
+                    transferCount = maxConcurrentUploads;
                 }
-                curlErr = curl_easy_perform(curlHandle);
-                if (curlErr != CURLE_OK) {
-                    // No need to report error, since we expect it (e.g.) when wifi and cell data are off.
-                    // Typical first error in these cases is failure to resolve the hostname.
-                    //LOGE("Error performing CURL network test: %s (%d). %s.\n", curl_easy_strerror(curlErr), curlErr, curlErrorBuf);
-                    errorCode = 1;
-                    break;
+            }
+        }
+
+        // Keep up to maxConcurrentUploads transfers in flight until the queue is drained, including files
+        // queued while uploading. Failed uploads are retried later, by the retry scheduler. If the server
+        // can't be reached, queueTakeNext() stops handing out files, and those in flight are left to finish.
+        // After an internal error, start no new transfers, but items which can't be read are just retried
+        // later. Once the server has advertised that it accepts batches, each transfer carries up to
+        // batchSize files. With a send speed limit, transfers run at full speed while the pacing
+        // allowance lasts, so that the queue drains quickly after the link has been idle, and otherwise
+        // share the limit.
+        int activeCount = 0;
+        bool queueEmpty = false;
+        if (!errorCode && queueCount > 0) {
+            TRACE_BEGIN("uploadTransfers");
+            do {
+                queueUpdate(fileUploaderHandle);
+                queueEmpty = false;
+                for (i = 0; i < maxConcurrentUploads && errorCode >= 0; i++) {
+                    if (transfers[i].active) continue;
+                    int batchItems = MIN(batchSize, fileUploaderHandle->batchServerMax);
+                    if (!uploadTransferTakeItems(fileUploaderHandle, &transfers[i], MAX(batchItems, 1))) {
+                        queueEmpty = true;
+                        break;
+                    }
+                    curl_off_t transferMaxSendSpeed = 0;
+                    if (maxSendSpeed > 0) {
+                        pacingRefill(fileUploaderHandle, maxSendSpeed);
+                        if (fileUploaderHandle->pacingAllowance <= 0.0) transferMaxSendSpeed = MAX(maxSendSpeed/maxConcurrentUploads, 1);
+                    }
+                    int err = uploadTransferStart(fileUploaderHandle, multiHandle, &transfers[i], batchItems > 1, transferMaxSendSpeed);
+                    if (err) {
+                        int j;
+                        for (j = 0; j < transfers[i].itemCount; j++) queueRetryLater(fileUploaderHandle, transfers[i].items[j].indexPathname, transfers[i].items[j].journalID, false);
+                        errorCode = err;
+                        // The items couldn't be read, so they wait for their retry, and the slot goes to the next items.
+                        if (err > 0) i--;
+                    } else activeCount++;
                 }
-    	    }
-
-    		// Network OK, so proceed with upload.
-    	    curlErr = curl_easy_setopt(curlHandle, CURLOPT_URL, fileUploaderHandle->formPostURL);
-    	    if (curlErr != CURLE_OK) {
-    	    	ARLOGe("Error setting CURL URL: %s (%d)\n", curl_easy_strerror(curlErr), curlErr);
-            	errorCode = -1;
-    	    	break;
-    	    }
-
-            // The commented-out section below disables SSL peer verification. Uncommenting this will make
-            // https connections insecure, but will allow (for example) connections to a server using a
-            // self-signed SSL certificate and when you have not provided CURL with a CAfile via
-            // 'curl_easy_setopt(curlHandle, CURLOPT_CAPATH, capath);'.
-            // (default capath: /etc/ssl/certs/ca-certificates.crt)
-    	    //curlErr = curl_easy_setopt(curlHandle, CURLOPT_SSL_VERIFYPEER, 0L);
-    	    //if (curlErr != CURLE_OK) {
-    	    //	ARLOGe("Error setting CURL SSL options: %s (%d)\n", curl_easy_strerror(curlErr), curlErr);
-            //	errorCode = -1;
-    	    //	break;
-    	    //}
-
-    	    // Build the form.
-    	    struct curl_httppost* post = NULL;
-    	    struct curl_httppost* last = NULL;
-
-    	    // Read lines from the file, creating curl parameters for each one.
-    	    *filePathname = '\0';
-    		while (get_buff(buf, BUFSIZE, fp, true)) {
-
-    			// Locate first comma on line, and split the string there.
-    			char *commaPos;
-    			if (!(commaPos = strchr(buf, ','))) continue; // No comma found! Skip line.
-    			*commaPos = '\0';
-
-    			if (strcmp(buf, "file") == 0) { // Handle the 'file' parameter by using CURLFORM_FILE. All other params use CURLFORM_COPYCONTENTS.
-    				strcpy(filePathname, commaPos + 1);
-    				curl_formadd(&post, &last, CURLFORM_COPYNAME, buf, CURLFORM_FILE, commaPos + 1, CURLFORM_FILENAME, arUtilGetFileNameFromPath(commaPos + 1), CURLFORM_CONTENTTYPE, "application/octet-stream", CURLFORM_END);
-    			} else {
-    				curl_formadd(&post, &last, CURLFORM_COPYNAME, buf, CURLFORM_COPYCONTENTS, commaPos + 1, CURLFORM_END);
-    			}
-    		}
-
-    		fclose(fp);
-
-    		// Check that we read at least 1 form parameter.
-    		if (!post) {
-    			ARLOGe("Error reading CURL form data from file '%s'.\n", indexUploadPathname);
-            	errorCode = -1;
-    			break;
-    		}
-
-    		// Add a version to the request.
-			curl_formadd(&post, &last, CURLFORM_COPYNAME, "version", CURLFORM_COPYCONTENTS, "1", CURLFORM_END);
-
-    	    curlErr = curl_easy_setopt(curlHandle, CURLOPT_HTTPPOST, post); // Automatically sets CURLOPT_NOBODY to 0.
-    		if (curlErr != CURLE_OK) {
-    			ARLOGe("Error setting CURL form data: %s (%d)\n", curl_easy_strerror(curlErr), curlErr);
-            	errorCode = -1;
-    			break;
-    		}
-
-    		// Perform the transfer. Blocks until complete.
-    	    curlErr = curl_easy_perform(curlHandle);
-    	    curl_formfree(post); // Free the form resources, regardless of outcome.
-    		if (curlErr != CURLE_OK) {
-    			ARLOGe("Error performing CURL operation: %s (%d). %s.\n", curl_easy_strerror(curlErr), curlErr, curlErrorBuf);
-    			errorCode = 2;
-    			break;
-    		}
-
-    		curl_easy_getinfo (curlHandle, CURLINFO_RESPONSE_CODE, &http_response);
-    		if (http_response != 200) {
-    			ARLOGe("Parameter file upload failed: server returned response %ld.\n", http_response);
-    			errorCode = 3;
-    			break;
-    		}
-
-    		// Uploaded OK, so delete uploaded parameters file and index.
-    		if (remove(indexUploadPathname) < 0) {
-    			ARLOGe("Error removing index file '%s' after upload.\n", indexUploadPathname);
-    			ARLOGperror(NULL);
-    		}
-    		if (remove(filePathname) < 0) {
-    			ARLOGe("Error removing file '%s' after upload.\n", filePathname);
-    			ARLOGperror(NULL);
-    		}
-
-    		uploadsDone++;
-    	} // while(getNextFileInQueueWithExtension)
+                if (!activeCount) break;
+
+                pthread_mutex_lock(&(fileUploaderHandle->uploadStatusLock));
+                snprintf(fileUploaderHandle->uploadStatus, UPLOAD_STATUS_BUFFER_LEN, "Uploading file %d of %d", uploadsDone + 1, uploadsDone + queueGetCount(fileUploaderHandle));
+                pthread_mutex_unlock(&(fileUploaderHandle->uploadStatusLock));
+
+                int running;
+                CURLMcode curlMErr = curl_multi_perform(multiHandle, &running);
+                if (curlMErr != CURLM_OK) {
+                    ARLOGe("Error performing CURL operation: %s (%d).\n", curl_multi_strerror(curlMErr), curlMErr);
+                    errorCode = -1;
+                }
+
+                CURLMsg *msg;
+                int msgsInQueue;
+                while ((msg = curl_multi_info_read(multiHandle, &msgsInQueue))) {
+                    if (msg->msg != CURLMSG_DONE) continue;
+                    UPLOAD_TRANSFER_t *transfer = NULL;
+                    curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&transfer);
+                    int uploaded;
+                    int err = uploadTransferFinish(fileUploaderHandle, multiHandle, transfer, msg->data.result, &uploaded);
+                    uploadTransferAccount(fileUploaderHandle, transfer, uploaded);
+                    activeCount--;
+                    uploadsDone += uploaded;
+                    if (err && errorCode >= 0) errorCode = err;
+                }
+
+                if (activeCount && curlMErr == CURLM_OK) curl_multi_wait(multiHandle, NULL, 0, 1000, NULL);
+            } while (errorCode >= 0 && (activeCount || !queueEmpty));
+
+            // After an internal error (e.g. curl_multi_perform() failed), transfers may still be active. Abandon them.
+            for (i = 0; i < transferCount; i++) {
+                if (!transfers[i].active) continue;
+                curl_multi_remove_handle(multiHandle, transfers[i].curlHandle);
+                uploadTransferFreeForm(&transfers[i]);
+                transfers[i].active = false;
+                int j;
+                for (j = 0; j < transfers[i].itemCount; j++) queueRelease(fileUploaderHandle, transfers[i].items[j].indexPathname, transfers[i].items[j].journalID);
+            }
+            TRACE_END("uploadTransfers");
+        }
+
+        // Drop journal records no longer needed.
+        if (uploadsDone) uploadJournalCompactIfNeeded(fileUploaderHandle->journal);
 
         pthread_mutex_lock(&(fileUploaderHandle->uploadStatusLock));
 
@@ -383,6 +1940,7 @@ static void *fileUploader(THREAD_HANDLE_T *threadHandle)
                     case 1: snprintf(fileUploaderHandle->uploadStatus, UPLOAD_STATUS_BUFFER_LEN, "No Internet access. Uploads postponed."); break;
                     case 2: snprintf(fileUploaderHandle->uploadStatus, UPLOAD_STATUS_BUFFER_LEN, "Network error while uploading. Uploads postponed."); break;
                     case 3: snprintf(fileUploaderHandle->uploadStatus, UPLOAD_STATUS_BUFFER_LEN, "Server error while uploading. Uploads postponed."); break;
+                    case 4: snprintf(fileUploaderHandle->uploadStatus, UPLOAD_STATUS_BUFFER_LEN, "Error while uploading. Failed uploads will be retried."); break;
                     default: snprintf(fileUploaderHandle->uploadStatus, UPLOAD_STATUS_BUFFER_LEN, "Internal error while uploading. Uploads postponed."); break;
                 }
             }
@@ -393,18 +1951,20 @@ static void *fileUploader(THREAD_HANDLE_T *threadHandle)
         pthread_mutex_unlock(&(fileUploaderHandle->uploadStatusLock));
 
        	ARLOGd("file uploader is DONE\n");
+        TRACE_END("uploadQueue");
         threadEndSignal(threadHandle);
     }
 
-    // Cleanup curl handle before thread exit.
-	if (curlHandle) {
-	    curl_easy_cleanup(curlHandle);
-	    curlHandle = NULL;
-	}
+    // Cleanup curl handles before thread exit.
+    for (i = 0; i < transferCount; i++) {
+        if (transfers[i].curlHandle) curl_easy_cleanup(transfers[i].curlHandle);
+        curl_slist_free_all(transfers[i].batchHeaders);
+        free(transfers[i].items);
+        free(transfers[i].response);
+    }
+    free(transfers);
+	if (multiHandle) curl_multi_cleanup(multiHandle);
 
-    free(buf);
-    free(filePathname);
-    free(indexUploadPathname);
     ARLOGi("End fileUploader thread.\n");
     return (NULL);
 }
@@ -430,3 +1990,38 @@ int fileUploaderStatusGet(FILE_UPLOAD_HANDLE_t *handle, char statusBuf[UPLOAD_ST
 
 	return (ret);
 }
+
+bool fileUploaderStatsGet(FILE_UPLOAD_HANDLE_t *handle, FILE_UPLOAD_STATS_t *stats)
+{
+    int i;
+    double now = timeNowSecs();
+    double nextRetryTime = 0.0;
+
+    if (!handle || !stats) return (false);
+    memset(stats, 0, sizeof(FILE_UPLOAD_STATS_t));
+
+    pthread_mutex_lock(&(handle->queueLock));
+    stats->queueDepth = handle->queueCount;
+    for (i = 0; i < handle->queueCount; i++) {
+        if (handle->queue[i].inFlight) stats->inFlight++;
+        else if (handle->queue[i].retryTime > now) {
+            stats->retryWaiting++;
+            if (!nextRetryTime || handle->queue[i].retryTime < nextRetryTime) nextRetryTime = handle->queue[i].retryTime;
+        }
+    }
+    stats->offline = (handle->offlineUntil > now);
+    if (stats->offline && (!nextRetryTime || handle->offlineUntil < nextRetryTime)) nextRetryTime = handle->offlineUntil;
+    if (nextRetryTime) stats->nextRetrySecs = (float)(nextRetryTime - now);
+    pthread_mutex_unlock(&(handle->queueLock));
+
+    pthread_mutex_lock(&(handle->uploadStatusLock));
+    stats->bytesSent = handle->statsBytesSent;
+    stats->itemsUploaded = handle->statsItemsUploaded;
+    stats->itemsPerSec = handle->statsItemsPerSec;
+    stats->bytesPerSec = handle->statsBytesPerSec;
+    stats->lastLatencySecs = handle->statsLastLatencySecs;
+    stats->maxSendSpeed = handle->maxSendSpeed;
+    pthread_mutex_unlock(&(handle->uploadStatusLock));
+
+    return (true);
+}
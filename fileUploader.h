@@ -38,6 +38,30 @@
 // contents are taken as the pathname to a file to be uploaded. The file will be uploaded
 // under a field named 'file', with its filename (not including any other path component)
 // supplied as the filename portion of the field.
+// Alternatively, a queue file may be a packed record, holding all the form fields and file contents,
+// which are then sent straight from memory.
+// Items queued with fileUploaderEnqueueRecord() are by default not written as files at all, but appended
+// to a single checksummed journal in the queue directory (see uploadJournal.h), which is replayed by
+// fileUploaderInit().
+// Each queue file is uploaded as a separate request, several at a time. On an HTTP 200 response, the
+// index file and the file it names are deleted. Otherwise, the upload is retried later, with the
+// number of attempts so far and the time of the next attempt kept alongside the index file, in a file
+// with ".retry" appended to its name. Connectivity is judged from the uploads themselves: while the
+// server can't be reached, no uploads are attempted until the next retry falls due.
+// Optionally, several queued items may be sent in one request (see fileUploaderSetBatchSize()), once the
+// server has advertised that it accepts batches, by including the header "X-Upload-Batch-Max: n" in a
+// response. A batch request has content type "application/x-artoolkit-upload-batch" and is gzip-compressed.
+// Its body is "ARUPBAT1", the number of items, then each item as a packed record, prefixed by its length
+// (all lengths and counts being 4-byte little-endian integers). The server responds with one line per
+// item, in order, "OK" if the item was accepted. Only accepted items are removed from the queue; the rest
+// are retried later. If the server refuses a batch request, items are again sent one per request.
+// An item queued with a content hash carries it in the field "content_hash", and when sent alone, also
+// in the header "Idempotency-Key", so that the server can recognise repeated uploads. The hashes of recent
+// uploads are kept in the file "uploaded.hashes" in the queue directory, and an item whose hash matches
+// one of these, or an item already queued, is not queued.
+// Queued index files are tracked in memory, oldest first. The index is built from the queue directory
+// by fileUploaderInit() and thereafter kept current via inotify on Linux, or elsewhere by rescanning
+// the directory when its modification time changes.
 //
 // Uses libcURL internally.
 // Don't forget to add library load calls on the Java side:
@@ -50,6 +74,8 @@
 
 #include <sys/time.h> // struct timeval, gettimeofday(), timeradd()
 #include <stdbool.h>
+#include <stddef.h> // size_t
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -57,9 +83,32 @@ extern "C" {
 
 #define UPLOAD_STATUS_BUFFER_LEN 128
 
+// A form field for fileUploaderEnqueueRecord().
+typedef struct {
+    const char *name;
+    const char *filename; // If non-NULL, the field is sent as a file, with this filename.
+    const void *data;
+    size_t      dataLen;
+} FILE_UPLOAD_FIELD_t;
+
+// Upload statistics, from fileUploaderStatsGet().
+typedef struct {
+    int         queueDepth; // Items queued, including those being uploaded.
+    int         inFlight; // Items being uploaded.
+    int         retryWaiting; // Items waiting to be retried after a failed upload.
+    float       nextRetrySecs; // Seconds until the next retry falls due, or 0 if none is waiting.
+    bool        offline; // The server could not be reached, so no uploads will be attempted for nextRetrySecs.
+    uint64_t    bytesSent; // Request bytes sent since fileUploaderInit(), including for failed uploads.
+    int         itemsUploaded; // Items uploaded since fileUploaderInit().
+    float       itemsPerSec; // Over the current or most recent upload cycle.
+    float       bytesPerSec; // Over the current or most recent upload cycle.
+    float       lastLatencySecs; // Duration of the most recently completed request.
+    long        maxSendSpeed; // Bytes per second, or 0 if unlimited.
+} FILE_UPLOAD_STATS_t;
+
 // Check for existence of queue directory, and create if not already existing.
 // Returns false if directory could not be created, true otherwise.
-// This needs to be done no later than before the first call to fileUploaderTickle().
+// This needs to be done no later than before the call to fileUploaderInit().
 bool fileUploaderCreateQueueDir(const char *queueDirPath);
     
 typedef struct _FILE_UPLOAD_HANDLE FILE_UPLOAD_HANDLE_t;
@@ -68,14 +117,54 @@ FILE_UPLOAD_HANDLE_t *fileUploaderInit(const char *queueDirPath, const char *for
 
 void fileUploaderFinal(FILE_UPLOAD_HANDLE_t **handle_p);
 
+// Set the maximum number of uploads in flight at once (default 4). Uploads share connections where
+// possible, and are multiplexed over a single connection where the server supports HTTP/2.
+// Takes effect from the next upload cycle.
+void fileUploaderSetMaxConcurrentUploads(FILE_UPLOAD_HANDLE_t *handle, const int maxConcurrentUploads);
+
+// Set the maximum number of queued items sent in one request, where the server accepts batches (default 1,
+// i.e. no batching). Takes effect from the next upload cycle.
+void fileUploaderSetBatchSize(FILE_UPLOAD_HANDLE_t *handle, const int batchSize);
+
+// Limit the rate at which uploads are sent, in bytes per second across all concurrent uploads (default
+// 0, i.e. unlimited), using libcURL's send speed limit. Pacing is adaptive: after the link has been idle,
+// up to 10 seconds' worth of data is sent at full speed, so that the queue drains promptly; thereafter,
+// uploads share the limit. Takes effect from the next upload cycle.
+void fileUploaderSetMaxSendSpeed(FILE_UPLOAD_HANDLE_t *handle, const long bytesPerSec);
+
+// Set the delay before retrying a failed upload (default 5 seconds), and the cap on the delay (default
+// 1 hour). The delay doubles with each failure, with random jitter. Uploads which failed because the
+// server could not be reached are retried as soon as any other upload succeeds.
+void fileUploaderSetRetryDelay(FILE_UPLOAD_HANDLE_t *handle, const float minSecs, const float maxSecs);
+
+// Add the given form fields to the queue, as a single packed record. The record is appended to the
+// journal, or if the journal is not in use, written to a file named "recordName" (plus the queue file
+// extension) in the queue directory, complete and synced to storage before it appears under that name.
+// If contentHash is non-NULL, it identifies the content (up to 64 letters, digits, '-' or '_'), and a
+// duplicate of an item already queued or recently uploaded is dropped, without error.
+// Returns false if the record could not be written. The time taken is recorded as PIPELINE_STAGE_ENQUEUE.
+bool fileUploaderEnqueueRecord(FILE_UPLOAD_HANDLE_t *handle, const char *recordName, const FILE_UPLOAD_FIELD_t *fields, const int fieldCount, const char *contentHash);
+
+// Choose whether fileUploaderEnqueueRecord() appends to the journal (the default) or writes a file per record.
+// Items already queued are uploaded either way.
+void fileUploaderSetUseJournal(FILE_UPLOAD_HANDLE_t *handle, const bool useJournal);
+
+// Start an upload cycle, if one is not already in progress.
 bool fileUploaderTickle(FILE_UPLOAD_HANDLE_t *handle);
 
+// Add an index file (full pathname, already in place in the queue directory) to the queue,
+// and start an upload cycle. Cheaper than fileUploaderTickle() alone, as the directory need not be examined.
+bool fileUploaderEnqueue(FILE_UPLOAD_HANDLE_t *handle, const char *indexPathname);
+
 // -1 = An error.
 // 0 = no background tasks or messages.
 // 1 = background task currently in progress.
 // 2 = background task complete, message still to be shown.
 int fileUploaderStatusGet(FILE_UPLOAD_HANDLE_t *handle, char statusBuf[UPLOAD_STATUS_BUFFER_LEN], struct timeval *currentTime_p);
 
+// Get the queue state and throughput statistics. Returns false if handle is NULL.
+bool fileUploaderStatsGet(FILE_UPLOAD_HANDLE_t *handle, FILE_UPLOAD_STATS_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
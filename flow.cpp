@@ -26,6 +26,8 @@
 #endif
 
 #include "flow.hpp"
+#include "calib_camera.h"
+#include "traceEvents.h"
 
 #include <stdio.h> // asprintf()
 #include <pthread.h>
@@ -148,6 +150,7 @@ static void flowStateSet(FLOW_STATE state)
 	pthread_mutex_lock(&gStateLock);
 	gState = state;
 	pthread_mutex_unlock(&gStateLock);
+    requestRedraw();
 }
 
 static void flowSetEventMask(const EVENT_t eventMask)
@@ -163,7 +166,9 @@ bool flowHandleEvent(const EVENT_t event)
 
 	if (!gInited) return false;
 
+    TRACE_BEGIN("wait gEventLock");
 	pthread_mutex_lock(&gEventLock);
+    TRACE_END("wait gEventLock");
 	if ((event & gEventMask) == EVENT_NONE) {
 		ret = false; // not handled (discarded).
 	} else {
@@ -180,6 +185,10 @@ static EVENT_t flowWaitForEvent(void)
 {
 	EVENT_t ret;
 
+    // Anything shown before waiting (messages, status bar) needs to reach the display.
+    requestRedraw();
+
+    TRACE_SCOPE("flowWaitForEvent");
 	pthread_mutex_lock(&gEventLock);
 	while (gEvent == EVENT_NONE && !gStop) {
 #ifdef ANDROID
@@ -211,6 +220,7 @@ static void *flowThread(void *arg)
 	// TYPE* TYPE_INSTANCE = (TYPE *)arg; // Cast the thread start arg to the correct type.
 
     ARLOGi("Start flow thread.\n");
+    TRACE_THREAD_NAME("flowThread");
 
     // Register our cleanup function, with no arg.
 	pthread_cleanup_push(flowThreadCleanup, NULL);
@@ -248,6 +258,7 @@ static void *flowThread(void *arg)
 			if (gStop) break;
 			if (event == EVENT_TOUCH) {
 
+                TRACE_INSTANT("capture");
 				if (gFlowCalib->capture()) {
 			    	captureDoneSinceBackButtonLastPressed = true;
 				}
@@ -284,10 +295,15 @@ static void *flowThread(void *arg)
 			flowSetEventMask(EVENT_NONE);
 			flowStateSet(FLOW_STATE_CALIBRATING);
 			EdenMessageShow((const unsigned char *)"Calculating camera parameters...");
+            requestRedraw();
+            TRACE_BEGIN("calib");
 			gFlowCalib->calib(&param, &err_min, &err_avg, &err_max);
+            TRACE_END("calib");
     		EdenMessageHide();
 
+            TRACE_BEGIN("flowCallback");
             if (gCallback) (*gCallback)(&param, err_min, err_avg, err_max, gCallbackUserdata);
+            TRACE_END("flowCallback");
             gFlowCalib->uncaptureAll(); // prepare for next run.
 
 			// Calibration complete. Post results as status.
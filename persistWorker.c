@@ -0,0 +1,305 @@
+/*
+ *  persistWorker.c
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+
+#include "persistWorker.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h> // open()
+#include <unistd.h> // fsync(), close()
+#include <sys/param.h> // MAXPATHLEN
+
+#include <AR6/AR/ar.h>
+
+#include "pipelineStats.h"
+#include "traceEvents.h"
+
+
+typedef struct {
+    PERSIST_JOB_FUNC_t   func;
+    void                *arg;
+} PERSIST_JOB_t;
+
+struct _PERSIST_WORKER {
+    pthread_t            thread;
+    pthread_mutex_t      lock;
+    pthread_cond_t       cond; // Signalled when a job is queued or taken, when the worker goes idle, and on stop.
+    // The job queue, a ring.
+    PERSIST_JOB_t       *jobs;
+    int                  jobsMax;
+    int                  jobsHead;
+    int                  jobsCount;
+    bool                 running; // A job is running, or its files are being synced.
+    bool                 stop;
+    // Files waiting to be synced. Worker thread only.
+    char               **syncPathnames;
+    int                  syncCount;
+    int                  syncBatchMax;
+    char                 status[PERSIST_STATUS_BUFFER_LEN];
+    bool                 statusHide; // Should check whether time for status to be hidden has arrived.
+    struct timeval       statusHideAtTime;
+    struct timeval       statusHideAfterSecs;
+};
+
+static void *persistWorker(void *arg);
+
+// ---------------------------------------------------------------------------
+
+PERSIST_WORKER_t *persistWorkerInit(const int queueMax, const int syncBatchMax, const float statusHideAfterSecs)
+{
+    PERSIST_WORKER_t *worker;
+
+    if (queueMax < 1 || syncBatchMax < 1) return (NULL);
+
+    if (!(worker = (PERSIST_WORKER_t *)calloc(1, sizeof(PERSIST_WORKER_t)))) {
+        ARLOGe("Out of memory!\n");
+        return (NULL);
+    }
+    worker->jobs = (PERSIST_JOB_t *)calloc(queueMax, sizeof(PERSIST_JOB_t));
+    worker->syncPathnames = (char **)calloc(syncBatchMax, sizeof(char *));
+    if (!worker->jobs || !worker->syncPathnames) {
+        ARLOGe("Out of memory!\n");
+        free(worker->jobs);
+        free(worker->syncPathnames);
+        free(worker);
+        return (NULL);
+    }
+    worker->jobsMax = queueMax;
+    worker->syncBatchMax = syncBatchMax;
+
+    // Convert float time delta in seconds to a struct timeval.
+    time_t secs = (time_t)statusHideAfterSecs;
+    suseconds_t usecs = (suseconds_t)((statusHideAfterSecs - (float)secs)*1000000.0f);
+    worker->statusHideAfterSecs.tv_sec = secs;
+    worker->statusHideAfterSecs.tv_usec = usecs;
+
+    pthread_mutex_init(&(worker->lock), NULL);
+    pthread_cond_init(&(worker->cond), NULL);
+    if (pthread_create(&(worker->thread), NULL, persistWorker, worker) != 0) {
+        ARLOGe("Error starting persistence worker thread.\n");
+        pthread_cond_destroy(&(worker->cond));
+        pthread_mutex_destroy(&(worker->lock));
+        free(worker->jobs);
+        free(worker->syncPathnames);
+        free(worker);
+        return (NULL);
+    }
+
+    return (worker);
+}
+
+void persistWorkerFinal(PERSIST_WORKER_t **worker_p)
+{
+    if (!worker_p || !*worker_p) return;
+
+    pthread_mutex_lock(&((*worker_p)->lock));
+    (*worker_p)->stop = true;
+    pthread_cond_broadcast(&((*worker_p)->cond));
+    pthread_mutex_unlock(&((*worker_p)->lock));
+    pthread_join((*worker_p)->thread, NULL);
+
+    pthread_cond_destroy(&((*worker_p)->cond));
+    pthread_mutex_destroy(&((*worker_p)->lock));
+    free((*worker_p)->jobs);
+    free((*worker_p)->syncPathnames);
+    free(*worker_p);
+    *worker_p = NULL;
+}
+
+bool persistWorkerSubmit(PERSIST_WORKER_t *worker, PERSIST_JOB_FUNC_t func, void *arg)
+{
+    if (!worker || !func) return (false);
+
+    pthread_mutex_lock(&(worker->lock));
+    while (worker->jobsCount == worker->jobsMax && !worker->stop) pthread_cond_wait(&(worker->cond), &(worker->lock));
+    if (worker->stop) {
+        pthread_mutex_unlock(&(worker->lock));
+        return (false);
+    }
+    PERSIST_JOB_t *job = &(worker->jobs[(worker->jobsHead + worker->jobsCount) % worker->jobsMax]);
+    job->func = func;
+    job->arg = arg;
+    worker->jobsCount++;
+    pthread_cond_broadcast(&(worker->cond));
+    pthread_mutex_unlock(&(worker->lock));
+    return (true);
+}
+
+static void syncAdd(PERSIST_WORKER_t *worker, const char *pathname)
+{
+    int i;
+
+    for (i = 0; i < worker->syncCount; i++) {
+        if (strcmp(worker->syncPathnames[i], pathname) == 0) return;
+    }
+    if (!(worker->syncPathnames[worker->syncCount] = strdup(pathname))) {
+        ARLOGe("Out of memory!\n");
+        return;
+    }
+    worker->syncCount++;
+}
+
+static bool syncPathname(const char *pathname)
+{
+    bool ok = true;
+
+    int fd = open(pathname, O_RDONLY);
+    if (fd < 0 || fsync(fd) < 0) {
+        ARLOGe("Error syncing '%s' to storage.\n", pathname);
+        ARLOGperror(NULL);
+        ok = false;
+    }
+    if (fd >= 0) close(fd);
+    return (ok);
+}
+
+// Sync the files waiting to be synced. Returns false if any could not be synced.
+static bool syncPending(PERSIST_WORKER_t *worker)
+{
+    bool ok = true;
+    int i;
+
+    TRACE_BEGIN("persistSync");
+    for (i = 0; i < worker->syncCount; i++) {
+        if (!syncPathname(worker->syncPathnames[i])) ok = false;
+        free(worker->syncPathnames[i]);
+    }
+    worker->syncCount = 0;
+    TRACE_END("persistSync");
+    return (ok);
+}
+
+static void parentDir(const char *pathname, char dir[MAXPATHLEN])
+{
+    const char *sep;
+
+    if (!(sep = strrchr(pathname, '/'))) snprintf(dir, MAXPATHLEN, ".");
+    else snprintf(dir, MAXPATHLEN, "%.*s", (int)(sep == pathname ? 1 : sep - pathname), pathname);
+}
+
+bool persistWorkerCommit(PERSIST_WORKER_t *worker, const char *tempPathname, const char *pathname)
+{
+    char dir[MAXPATHLEN];
+
+    if (!tempPathname || !pathname) return (false);
+
+    if (!syncPathname(tempPathname)) return (false);
+    if (rename(tempPathname, pathname) < 0) {
+        ARLOGe("Error renaming '%s' to '%s'.\n", tempPathname, pathname);
+        ARLOGperror(NULL);
+        return (false);
+    }
+    parentDir(pathname, dir);
+    if (!worker) return (syncPathname(dir));
+    if (worker->syncCount == worker->syncBatchMax) syncPending(worker); // Full, so sync what is waiting now.
+    syncAdd(worker, dir);
+    return (true);
+}
+
+static void *persistWorker(void *arg)
+{
+    PERSIST_WORKER_t *worker = (PERSIST_WORKER_t *)arg;
+    char message[PERSIST_STATUS_BUFFER_LEN];
+    bool failed = false; // Since the worker was last idle.
+
+    ARLOGi("Start persistWorker thread.\n");
+    TRACE_THREAD_NAME("persistWorker");
+
+    pthread_mutex_lock(&(worker->lock));
+    while (true) {
+        while (!worker->jobsCount && !worker->stop) pthread_cond_wait(&(worker->cond), &(worker->lock));
+        if (!worker->jobsCount) break; // Stopping, and all jobs done.
+
+        PERSIST_JOB_t job = worker->jobs[worker->jobsHead];
+        worker->jobsHead = (worker->jobsHead + 1) % worker->jobsMax;
+        worker->jobsCount--;
+        worker->running = true;
+        snprintf(worker->status, PERSIST_STATUS_BUFFER_LEN, "Saving...");
+        worker->statusHide = false;
+        pthread_cond_broadcast(&(worker->cond)); // There is now space in the queue.
+        pthread_mutex_unlock(&(worker->lock));
+
+        TRACE_BEGIN("persistJob");
+        uint64_t startTime = pipelineStatsTimeNow();
+        message[0] = '\0';
+        bool ok = (*job.func)(worker, job.arg, message, PERSIST_STATUS_BUFFER_LEN);
+        pipelineStatsRecord(PIPELINE_STAGE_PERSIST, startTime);
+        TRACE_END("persistJob");
+        if (!message[0]) snprintf(message, PERSIST_STATUS_BUFFER_LEN, (ok ? "Saved" : "Error while saving"));
+        if (!ok) failed = true;
+
+        // Sync in batches: when there is nothing more to do, or when enough files are waiting.
+        pthread_mutex_lock(&(worker->lock));
+        bool idle = (worker->jobsCount == 0);
+        pthread_mutex_unlock(&(worker->lock));
+        if (worker->syncCount && (idle || worker->syncCount >= worker->syncBatchMax)) {
+            if (!syncPending(worker)) {
+                snprintf(message, PERSIST_STATUS_BUFFER_LEN, "Error writing saved files to storage");
+                failed = true;
+            }
+        }
+
+        pthread_mutex_lock(&(worker->lock));
+        if (!worker->jobsCount) {
+            // Report the last job's outcome, unless an earlier one failed unreported.
+            if (failed && ok) snprintf(worker->status, PERSIST_STATUS_BUFFER_LEN, "%s (an earlier save failed)", message);
+            else snprintf(worker->status, PERSIST_STATUS_BUFFER_LEN, "%s", message);
+            struct timeval time;
+            gettimeofday(&time, NULL);
+            timeradd(&time, &(worker->statusHideAfterSecs), &(worker->statusHideAtTime));
+            worker->statusHide = true;
+            worker->running = false;
+            failed = false;
+        }
+    }
+    pthread_mutex_unlock(&(worker->lock));
+
+    ARLOGi("End persistWorker thread.\n");
+    return (NULL);
+}
+
+int persistWorkerStatusGet(PERSIST_WORKER_t *worker, char statusBuf[PERSIST_STATUS_BUFFER_LEN], struct timeval *currentTime_p)
+{
+    int ret = 0;
+
+    if (!worker) return (-1);
+
+    pthread_mutex_lock(&(worker->lock));
+    if (worker->status[0]) {
+        if (worker->statusHide && !timercmp(currentTime_p, &(worker->statusHideAtTime), <)) {
+            worker->status[0] = '\0';
+            worker->statusHide = false;
+        } else {
+            strncpy(statusBuf, worker->status, PERSIST_STATUS_BUFFER_LEN);
+            ret = ((worker->running || worker->jobsCount) ? 1 : 2);
+        }
+    }
+    pthread_mutex_unlock(&(worker->lock));
+
+    return (ret);
+}
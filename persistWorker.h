@@ -0,0 +1,82 @@
+/*
+ *  persistWorker.h
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+
+#ifndef PERSISTWORKER_H
+#define PERSISTWORKER_H
+
+//
+// Background worker for writes to storage (e.g. saving calibration results), so that the thread which
+// requests them need not wait on the disk.
+//
+// Jobs run in the order submitted, one at a time, on the worker's own thread. The queue of jobs is bounded;
+// when it is full, persistWorkerSubmit() waits for space.
+// Files committed by a job with persistWorkerCommit() are synced as they are renamed into place, but the
+// syncs of their directories, which make the renames durable, are made in one batch once the queue is
+// empty, or sooner once syncBatchMax directories are waiting.
+//
+// Progress and the outcome of each job are reported as a status message, in the same way as by
+// fileUploaderStatusGet(). Each job's run time is recorded as PIPELINE_STAGE_PERSIST.
+//
+
+#include <sys/time.h> // struct timeval, gettimeofday(), timeradd()
+#include <stdbool.h>
+#include <stddef.h> // size_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PERSIST_STATUS_BUFFER_LEN 128
+
+typedef struct _PERSIST_WORKER PERSIST_WORKER_t;
+
+// A job, run on the worker thread. The job owns arg, and must free it. It may put a message to be shown on
+// completion in message (of messageLen bytes); otherwise a default message is shown. Returns false on error.
+typedef bool (*PERSIST_JOB_FUNC_t)(PERSIST_WORKER_t *worker, void *arg, char *message, const size_t messageLen);
+
+PERSIST_WORKER_t *persistWorkerInit(const int queueMax, const int syncBatchMax, const float statusHideAfterSecs);
+
+// Runs any jobs still queued and syncs their files, then stops the worker.
+void persistWorkerFinal(PERSIST_WORKER_t **worker_p);
+
+// Queue a job. If the queue is full, waits for space. Returns false if the job could not be queued, in which
+// case arg has not been passed to the job.
+bool persistWorkerSubmit(PERSIST_WORKER_t *worker, PERSIST_JOB_FUNC_t func, void *arg);
+
+// For use by a job: replace (or create) the file at pathname with the complete file at tempPathname. The
+// temporary file is synced to storage and then renamed, so that pathname is never seen incomplete, even after
+// a crash. The rename is made durable with the next batch. Returns false on error, leaving tempPathname in place.
+bool persistWorkerCommit(PERSIST_WORKER_t *worker, const char *tempPathname, const char *pathname);
+
+// -1 = An error.
+// 0 = no background tasks or messages.
+// 1 = background task currently in progress.
+// 2 = background task complete, message still to be shown.
+int persistWorkerStatusGet(PERSIST_WORKER_t *worker, char statusBuf[PERSIST_STATUS_BUFFER_LEN], struct timeval *currentTime_p);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // !PERSISTWORKER_H
@@ -0,0 +1,322 @@
+/*
+ *  pipelineStats.cpp
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "pipelineStats.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/resource.h> // getrusage()
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+#include <AR6/AR/ar.h>
+
+// Histogram layout. Values below 16 us get a bucket each. Above that, each power of two is split into
+// 8 linear sub-buckets, up to 2^40 us.
+#define HIST_LINEAR_BUCKETS 16
+#define HIST_SUB_BUCKETS 8
+#define HIST_SUB_BUCKET_BITS 3
+#define HIST_EXPONENT_MIN 4
+#define HIST_EXPONENT_MAX 40
+#define HIST_BUCKET_COUNT (HIST_LINEAR_BUCKETS + (HIST_EXPONENT_MAX - HIST_EXPONENT_MIN + 1)*HIST_SUB_BUCKETS)
+
+// Each field is written only by the thread which owns the shard, so updates are plain loads and stores, and
+// are atomic only so that they may be read while being written.
+typedef struct {
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> total; // microseconds.
+    std::atomic<uint64_t> min;   // microseconds, plus 1. 0 means no value yet.
+    std::atomic<uint64_t> max;   // microseconds.
+    std::atomic<uint64_t> buckets[HIST_BUCKET_COUNT];
+} PipelineStageStats;
+
+// The statistics recorded by one thread. Shards are never freed; when a thread exits, its shard (and the
+// statistics in it) passes to the next thread to start recording.
+typedef struct {
+    PipelineStageStats stages[PIPELINE_STAGE_COUNT];
+    bool inUse; // Guarded by gShardsLock.
+} PipelineStatsShard;
+
+static pthread_mutex_t gShardsLock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<PipelineStatsShard *> gShards;
+
+// Releases the calling thread's shard when the thread exits.
+class PipelineStatsShardRef {
+public:
+    PipelineStatsShard *shard = nullptr;
+    ~PipelineStatsShardRef() {
+        if (!shard) return;
+        pthread_mutex_lock(&gShardsLock);
+        shard->inUse = false;
+        pthread_mutex_unlock(&gShardsLock);
+    }
+};
+static thread_local PipelineStatsShardRef tShard;
+
+// Process CPU time (user plus system) in microseconds, and context switches.
+static void cpuUsageNow(uint64_t *cpuUs_p, uint64_t *switches_p)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) != 0) {
+        *cpuUs_p = *switches_p = 0;
+        return;
+    }
+    *cpuUs_p = (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec)*1000000ull + (uint64_t)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+    *switches_p = (uint64_t)(ru.ru_nvcsw + ru.ru_nivcsw);
+}
+
+static uint64_t gStartTime = pipelineStatsTimeNow();
+static uint64_t gStartCPU = 0;
+static uint64_t gStartSwitches = 0;
+
+static pthread_mutex_t gInfoLock = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::string, std::string> gInfo;
+
+static const char *stageNames[PIPELINE_STAGE_COUNT] = {
+    "capture",
+    "copy",
+    "detect_chessboard",
+    "detect_circles_grid",
+    "detect_asymmetric_circles_grid",
+    "subpixel",
+    "texture_upload",
+    "draw",
+    "swap",
+    "solve",
+    "upload",
+    "enqueue",
+    "persist"
+};
+
+static int bucketForValue(uint64_t us)
+{
+    if (us < HIST_LINEAR_BUCKETS) return ((int)us);
+    int exponent = 63 - __builtin_clzll(us);
+    if (exponent > HIST_EXPONENT_MAX) return (HIST_BUCKET_COUNT - 1);
+    int sub = (int)(us >> (exponent - HIST_SUB_BUCKET_BITS)) - HIST_SUB_BUCKETS;
+    return (HIST_LINEAR_BUCKETS + (exponent - HIST_EXPONENT_MIN)*HIST_SUB_BUCKETS + sub);
+}
+
+static uint64_t bucketLowerBound(int bucket)
+{
+    if (bucket < HIST_LINEAR_BUCKETS) return ((uint64_t)bucket);
+    int exponent = HIST_EXPONENT_MIN + (bucket - HIST_LINEAR_BUCKETS)/HIST_SUB_BUCKETS;
+    int sub = (bucket - HIST_LINEAR_BUCKETS) % HIST_SUB_BUCKETS;
+    return ((uint64_t)(HIST_SUB_BUCKETS + sub) << (exponent - HIST_SUB_BUCKET_BITS));
+}
+
+static uint64_t bucketWidth(int bucket)
+{
+    if (bucket < HIST_LINEAR_BUCKETS) return (1);
+    int exponent = HIST_EXPONENT_MIN + (bucket - HIST_LINEAR_BUCKETS)/HIST_SUB_BUCKETS;
+    return ((uint64_t)1 << (exponent - HIST_SUB_BUCKET_BITS));
+}
+
+uint64_t pipelineStatsTimeNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec*1000000000ull + (uint64_t)ts.tv_nsec);
+}
+
+static PipelineStatsShard *shardGet(void)
+{
+    if (tShard.shard) return (tShard.shard);
+
+    pthread_mutex_lock(&gShardsLock);
+    for (std::vector<PipelineStatsShard *>::const_iterator it = gShards.begin(); it != gShards.end(); it++) {
+        if (!(*it)->inUse) {
+            tShard.shard = *it;
+            break;
+        }
+    }
+    if (!tShard.shard) {
+        tShard.shard = new PipelineStatsShard(); // Value-initialised, i.e. zeroed.
+        gShards.push_back(tShard.shard);
+    }
+    tShard.shard->inUse = true;
+    pthread_mutex_unlock(&gShardsLock);
+    return (tShard.shard);
+}
+
+static inline void add(std::atomic<uint64_t>& a, const uint64_t v)
+{
+    a.store(a.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+}
+
+void pipelineStatsRecord(const PIPELINE_STAGE stage, const uint64_t startTime)
+{
+    if ((int)stage < 0 || stage >= PIPELINE_STAGE_COUNT) return;
+
+    uint64_t now = pipelineStatsTimeNow();
+    uint64_t us = (now > startTime ? (now - startTime)/1000ull : 0);
+    PipelineStageStats *s = &(shardGet()->stages[stage]);
+
+    add(s->count, 1);
+    add(s->total, us);
+    add(s->buckets[bucketForValue(us)], 1);
+    if (us > s->max.load(std::memory_order_relaxed)) s->max.store(us, std::memory_order_relaxed);
+    uint64_t min = s->min.load(std::memory_order_relaxed);
+    if (min == 0 || us + 1 < min) s->min.store(us + 1, std::memory_order_relaxed);
+}
+
+void pipelineStatsSetInfo(const char *key, const char *value)
+{
+    if (!key) return;
+    pthread_mutex_lock(&gInfoLock);
+    if (value) gInfo[key] = value;
+    else gInfo.erase(key);
+    pthread_mutex_unlock(&gInfoLock);
+}
+
+void pipelineStatsReset(void)
+{
+    int i, j;
+
+    // A run being recorded by another thread at the same time may be partly kept.
+    pthread_mutex_lock(&gShardsLock);
+    for (std::vector<PipelineStatsShard *>::const_iterator it = gShards.begin(); it != gShards.end(); it++) {
+        for (i = 0; i < PIPELINE_STAGE_COUNT; i++) {
+            PipelineStageStats *s = &((*it)->stages[i]);
+            s->count = 0;
+            s->total = 0;
+            s->min = 0;
+            s->max = 0;
+            for (j = 0; j < HIST_BUCKET_COUNT; j++) s->buckets[j] = 0;
+        }
+    }
+    pthread_mutex_unlock(&gShardsLock);
+    gStartTime = pipelineStatsTimeNow();
+    cpuUsageNow(&gStartCPU, &gStartSwitches);
+}
+
+static void writeJSONString(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') fprintf(fp, "\\%c", c);
+        else if (c < 0x20) fprintf(fp, "\\u%04x", c);
+        else fputc(c, fp);
+    }
+    fputc('"', fp);
+}
+
+// Value at the given quantile, estimated as the midpoint of the bucket in which it falls.
+static uint64_t quantile(const uint64_t counts[HIST_BUCKET_COUNT], const uint64_t count, const uint64_t max, const double q)
+{
+    uint64_t target = (uint64_t)(q*(double)count + 0.5);
+    uint64_t cumulative = 0;
+    int i;
+
+    if (target < 1) target = 1;
+    for (i = 0; i < HIST_BUCKET_COUNT; i++) {
+        cumulative += counts[i];
+        if (cumulative >= target) {
+            uint64_t v = bucketLowerBound(i) + bucketWidth(i)/2;
+            return (v > max ? max : v);
+        }
+    }
+    return (max);
+}
+
+bool pipelineStatsWrite(const char *path)
+{
+    FILE *fp;
+    int i, j;
+    uint64_t counts[HIST_BUCKET_COUNT];
+
+    if (!path) return false;
+    if (!(fp = fopen(path, "w"))) {
+        ARLOGe("Error opening pipeline statistics file '%s'.\n", path);
+        ARLOGperror(NULL);
+        return false;
+    }
+
+    // CPU used by the whole process over the same period, as a percentage of one core.
+    double elapsed = (double)(pipelineStatsTimeNow() - gStartTime)*1.0e-9;
+    uint64_t cpuUs, switches;
+    cpuUsageNow(&cpuUs, &switches);
+    double cpu = (double)(cpuUs - gStartCPU)*1.0e-6;
+    fprintf(fp, "{\n  \"elapsed_s\": %.3f,\n  \"cpu_s\": %.3f,\n  \"cpu_percent\": %.2f,\n  \"context_switches\": %llu,\n  \"info\": {",
+            elapsed, cpu, (elapsed > 0.0 ? 100.0*cpu/elapsed : 0.0), (unsigned long long)(switches - gStartSwitches));
+    pthread_mutex_lock(&gInfoLock);
+    for (std::map<std::string, std::string>::const_iterator it = gInfo.begin(); it != gInfo.end(); it++) {
+        fprintf(fp, "%s\n    ", (it == gInfo.begin() ? "" : ","));
+        writeJSONString(fp, it->first.c_str());
+        fprintf(fp, ": ");
+        writeJSONString(fp, it->second.c_str());
+    }
+    pthread_mutex_unlock(&gInfoLock);
+    fprintf(fp, "\n  },\n  \"stages\": {");
+
+    pthread_mutex_lock(&gShardsLock);
+    for (i = 0; i < PIPELINE_STAGE_COUNT; i++) {
+        // Take a snapshot, merging all threads' shards. Individual fields may be very slightly inconsistent if
+        // recording is in progress.
+        uint64_t count = 0, total = 0, min = 0, max = 0;
+        for (j = 0; j < HIST_BUCKET_COUNT; j++) counts[j] = 0;
+        for (std::vector<PipelineStatsShard *>::const_iterator it = gShards.begin(); it != gShards.end(); it++) {
+            const PipelineStageStats *s = &((*it)->stages[i]);
+            count += s->count.load(std::memory_order_relaxed);
+            total += s->total.load(std::memory_order_relaxed);
+            uint64_t shardMin = s->min.load(std::memory_order_relaxed);
+            if (shardMin && (!min || shardMin < min)) min = shardMin;
+            uint64_t shardMax = s->max.load(std::memory_order_relaxed);
+            if (shardMax > max) max = shardMax;
+            for (j = 0; j < HIST_BUCKET_COUNT; j++) counts[j] += s->buckets[j].load(std::memory_order_relaxed);
+        }
+        min = (min ? min - 1 : 0);
+
+        fprintf(fp, "%s\n    \"%s\": {\"count\": %llu", (i == 0 ? "" : ","), stageNames[i], (unsigned long long)count);
+        if (count > 0) {
+            fprintf(fp, ", \"total_us\": %llu, \"mean_us\": %.1f, \"min_us\": %llu, \"max_us\": %llu, \"p50_us\": %llu, \"p90_us\": %llu, \"p99_us\": %llu, \"p999_us\": %llu",
+                    (unsigned long long)total, (double)total/(double)count, (unsigned long long)min, (unsigned long long)max,
+                    (unsigned long long)quantile(counts, count, max, 0.5), (unsigned long long)quantile(counts, count, max, 0.9),
+                    (unsigned long long)quantile(counts, count, max, 0.99), (unsigned long long)quantile(counts, count, max, 0.999));
+            // Non-empty buckets only, as [lower bound in us, count] pairs.
+            fprintf(fp, ", \"histogram\": [");
+            bool first = true;
+            for (j = 0; j < HIST_BUCKET_COUNT; j++) {
+                if (!counts[j]) continue;
+                fprintf(fp, "%s[%llu, %llu]", (first ? "" : ", "), (unsigned long long)bucketLowerBound(j), (unsigned long long)counts[j]);
+                first = false;
+            }
+            fprintf(fp, "]");
+        }
+        fprintf(fp, "}");
+    }
+    pthread_mutex_unlock(&gShardsLock);
+    fprintf(fp, "\n  }\n}\n");
+
+    if (fclose(fp) != 0) {
+        ARLOGe("Error writing pipeline statistics file '%s'.\n", path);
+        return false;
+    }
+    ARLOGi("Wrote pipeline statistics to '%s'.\n", path);
+    return true;
+}
@@ -0,0 +1,84 @@
+/*
+ *  pipelineStats.h
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+
+#ifndef PIPELINESTATS_H
+#define PIPELINESTATS_H
+
+//
+// Always-on timing of the stages of the capture, detection, display, solve and upload pipeline.
+//
+// Each stage keeps a count, total, min and max, plus a log-linear (HDR-style) latency histogram with
+// 8 sub-buckets per power of two of microseconds, i.e. about 12% relative precision from 1 us to over an hour.
+// Recording may be done from any thread, and is lock-free: each thread records into its own shard of counters,
+// which it alone writes, so threads never contend for the same cache lines. Shards are merged when written.
+//
+// The statistics are written as JSON by pipelineStatsWrite(), along with the CPU time and context switches of the
+// whole process over the same period, so that changes to idle and running cost can be compared.
+//
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    PIPELINE_STAGE_CAPTURE = 0,
+    PIPELINE_STAGE_COPY,
+    PIPELINE_STAGE_DETECT_CHESSBOARD,
+    PIPELINE_STAGE_DETECT_CIRCLES_GRID,
+    PIPELINE_STAGE_DETECT_ASYMMETRIC_CIRCLES_GRID,
+    PIPELINE_STAGE_SUBPIXEL,
+    PIPELINE_STAGE_TEXTURE_UPLOAD,
+    PIPELINE_STAGE_DRAW,
+    PIPELINE_STAGE_SWAP,
+    PIPELINE_STAGE_SOLVE,
+    PIPELINE_STAGE_UPLOAD,
+    PIPELINE_STAGE_ENQUEUE,
+    PIPELINE_STAGE_PERSIST,
+    PIPELINE_STAGE_COUNT
+} PIPELINE_STAGE;
+
+// Current monotonic time in nanoseconds, for passing to pipelineStatsRecord().
+uint64_t pipelineStatsTimeNow(void);
+
+// Record one run of a stage, which began at startTime (as returned by pipelineStatsTimeNow()) and ended now.
+void pipelineStatsRecord(const PIPELINE_STAGE stage, const uint64_t startTime);
+
+// Set a descriptive key-value pair (e.g. camera device ID) to be included in the output. Setting an existing key
+// replaces its value; a NULL value removes it.
+void pipelineStatsSetInfo(const char *key, const char *value);
+
+// Write all statistics gathered so far to the file at path, as JSON. Returns false on error.
+bool pipelineStatsWrite(const char *path);
+
+// Reset all statistics.
+void pipelineStatsReset(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // !PIPELINESTATS_H
@@ -39,6 +39,7 @@
 #include "flow.hpp"
 #include <AR6/ARUtil/file_utils.h>
 #include "calib_camera.h"
+#include "traceEvents.h"
 
 #define PREFS_FILENAME "prefs"
 
@@ -178,6 +179,9 @@ void *showPreferencesThread(void *arg)
         return (NULL);
     }
     
+    TRACE_THREAD_NAME("showPreferencesThread");
+    TRACE_SCOPE("showPreferences");
+    
     flowHandleEvent(EVENT_MODAL);
     
     while (state != PREFS_END) {
@@ -0,0 +1,193 @@
+/*
+ *  traceEvents.cpp
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "traceEvents.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h> // getpid()
+#include <pthread.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <AR6/AR/ar.h>
+
+// One slot in the ring buffer. A writer claims a slot, then publishes it by storing its sequence number
+// (index + 1) last. A reader accepts a slot only if the sequence number is as expected before and after reading,
+// so slots being overwritten concurrently are skipped rather than torn.
+typedef struct {
+    std::atomic<uint64_t> seq;
+    std::atomic<uint64_t> ts; // nanoseconds since traceStart().
+    std::atomic<const char *> name;
+    std::atomic<int> tid;
+    std::atomic<char> phase;
+} TraceEvent;
+
+volatile int gTraceEnabled = 0;
+
+static TraceEvent *gEvents = NULL;
+static uint64_t gMask = 0;
+static std::atomic<uint64_t> gHead(0);
+static uint64_t gStartTime = 0;
+
+static std::atomic<int> gThreadCount(0);
+static thread_local int tThreadID = 0;
+static pthread_mutex_t gThreadNamesLock = PTHREAD_MUTEX_INITIALIZER;
+static std::map<int, std::string> gThreadNames;
+
+static uint64_t timeNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec*1000000000ull + (uint64_t)ts.tv_nsec);
+}
+
+static int threadID(void)
+{
+    if (!tThreadID) tThreadID = ++gThreadCount;
+    return (tThreadID);
+}
+
+bool traceStart(const size_t capacity)
+{
+    uint64_t size = 1;
+
+    if (gEvents) return (true);
+    while (size < capacity) size <<= 1;
+    gEvents = new (std::nothrow) TraceEvent[size];
+    if (!gEvents) {
+        ARLOGe("Out of memory allocating trace buffer.\n");
+        return (false);
+    }
+    for (uint64_t i = 0; i < size; i++) gEvents[i].seq = 0;
+    gMask = size - 1;
+    gStartTime = timeNow();
+    gTraceEnabled = 1;
+    ARLOGi("Tracing enabled, %llu events.\n", (unsigned long long)size);
+    return (true);
+}
+
+static void traceEvent(const char *name, const char phase)
+{
+    if (!gEvents) return;
+
+    uint64_t index = gHead.fetch_add(1, std::memory_order_relaxed);
+    TraceEvent *e = &gEvents[index & gMask];
+    e->seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    e->ts.store(timeNow() - gStartTime, std::memory_order_relaxed);
+    e->name.store(name, std::memory_order_relaxed);
+    e->tid.store(threadID(), std::memory_order_relaxed);
+    e->phase.store(phase, std::memory_order_relaxed);
+    e->seq.store(index + 1, std::memory_order_release);
+}
+
+void traceBegin(const char *name)
+{
+    traceEvent(name, 'B');
+}
+
+void traceEnd(const char *name)
+{
+    traceEvent(name, 'E');
+}
+
+void traceInstant(const char *name)
+{
+    traceEvent(name, 'i');
+}
+
+void traceSetThreadName(const char *name)
+{
+    if (!name) return;
+    int tid = threadID();
+    pthread_mutex_lock(&gThreadNamesLock);
+    gThreadNames[tid] = name;
+    pthread_mutex_unlock(&gThreadNamesLock);
+}
+
+static void writeJSONString(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') fprintf(fp, "\\%c", c);
+        else if (c < 0x20) fprintf(fp, "\\u%04x", c);
+        else fputc(c, fp);
+    }
+    fputc('"', fp);
+}
+
+bool traceWrite(const char *path)
+{
+    FILE *fp;
+    bool first = true;
+    int pid = (int)getpid();
+
+    if (!gEvents || !path) return (false);
+    if (!(fp = fopen(path, "w"))) {
+        ARLOGe("Error opening trace file '%s'.\n", path);
+        ARLOGperror(NULL);
+        return (false);
+    }
+
+    fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+
+    pthread_mutex_lock(&gThreadNamesLock);
+    for (std::map<int, std::string>::const_iterator it = gThreadNames.begin(); it != gThreadNames.end(); it++) {
+        fprintf(fp, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": ", (first ? "" : ","), pid, it->first);
+        writeJSONString(fp, it->second.c_str());
+        fprintf(fp, "}}");
+        first = false;
+    }
+    pthread_mutex_unlock(&gThreadNamesLock);
+
+    uint64_t head = gHead.load(std::memory_order_acquire);
+    uint64_t index = (head > gMask + 1 ? head - (gMask + 1) : 0);
+    for (; index < head; index++) {
+        TraceEvent *e = &gEvents[index & gMask];
+        uint64_t seq = e->seq.load(std::memory_order_acquire);
+        if (seq != index + 1) continue; // Not yet published, or already overwritten.
+        uint64_t ts = e->ts.load(std::memory_order_relaxed);
+        const char *name = e->name.load(std::memory_order_relaxed);
+        int tid = e->tid.load(std::memory_order_relaxed);
+        char phase = e->phase.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (e->seq.load(std::memory_order_relaxed) != seq) continue; // Overwritten while reading.
+
+        fprintf(fp, "%s\n{\"name\": ", (first ? "" : ","));
+        writeJSONString(fp, name ? name : "");
+        fprintf(fp, ", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": %d, \"tid\": %d%s}", phase, (double)ts*1.0e-3, pid, tid, (phase == 'i' ? ", \"s\": \"t\"" : ""));
+        first = false;
+    }
+    fprintf(fp, "\n]}\n");
+
+    if (fclose(fp) != 0) {
+        ARLOGe("Error writing trace file '%s'.\n", path);
+        return (false);
+    }
+    ARLOGi("Wrote trace to '%s'.\n", path);
+    return (true);
+}
@@ -0,0 +1,88 @@
+/*
+ *  traceEvents.h
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+
+#ifndef TRACEEVENTS_H
+#define TRACEEVENTS_H
+
+//
+// Optional tracing of the app's threads, in Chrome trace-event format (load the output in chrome://tracing
+// or Perfetto).
+//
+// Begin/end markers are written into a fixed-size ring buffer; once full, the oldest events are overwritten.
+// Writing an event is lock-free. Tracing is off unless traceStart() has been called, and when off each marker
+// macro costs only a test of gTraceEnabled.
+//
+// Event names must be string literals (or otherwise outlive the trace), as only the pointer is stored.
+//
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Non-zero while tracing. Set only by traceStart().
+extern volatile int gTraceEnabled;
+
+// Allocate a ring buffer holding at least the given number of events, and start tracing. Should be called once,
+// before other threads are started. The buffer lives until exit.
+bool traceStart(const size_t capacity);
+
+// Write the events currently in the ring buffer to the file at path, as Chrome trace-event JSON.
+// Tracing continues. Returns false on error.
+bool traceWrite(const char *path);
+
+// Name the calling thread in the trace output.
+void traceSetThreadName(const char *name);
+
+void traceBegin(const char *name);
+void traceEnd(const char *name);
+void traceInstant(const char *name);
+
+#define TRACE_THREAD_NAME(name) do { if (gTraceEnabled) traceSetThreadName(name); } while (0)
+#define TRACE_BEGIN(name) do { if (gTraceEnabled) traceBegin(name); } while (0)
+#define TRACE_END(name) do { if (gTraceEnabled) traceEnd(name); } while (0)
+#define TRACE_INSTANT(name) do { if (gTraceEnabled) traceInstant(name); } while (0)
+
+#ifdef __cplusplus
+}
+
+// Marks the enclosing scope.
+class TraceScope {
+public:
+    TraceScope(const char *name) : m_name(gTraceEnabled ? name : nullptr) { if (m_name) traceBegin(m_name); }
+    ~TraceScope() { if (m_name) traceEnd(m_name); }
+private:
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+    const char *m_name;
+};
+#define TRACE_SCOPE_CONCAT_(a, b) a##b
+#define TRACE_SCOPE_CONCAT(a, b) TRACE_SCOPE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_SCOPE_CONCAT(traceScope, __LINE__)(name)
+
+#endif // __cplusplus
+#endif // !TRACEEVENTS_H
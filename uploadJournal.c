@@ -0,0 +1,581 @@
+/*
+ *  uploadJournal.c
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "uploadJournal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/param.h> // MAXPATHLEN
+#include <pthread.h>
+#include <zlib.h> // crc32()
+
+#include <AR6/AR/ar.h>
+
+//
+// File format. All integers are little-endian.
+//
+// The file begins with UPLOAD_JOURNAL_MAGIC. Each record which follows is:
+//    uint32 length of type and payload
+//    uint32 CRC-32 of type and payload
+//    uint8  type
+//    payload
+// Payloads, by type:
+//    ENQUEUE:   uint64 ID, uint64 time enqueued (microseconds since the epoch), item data.
+//    IN_FLIGHT: uint64 ID.
+//    RETRY:     uint64 ID, uint32 attempts, uint64 retry time (microseconds since the epoch), uint8 retry on connect.
+//    DONE:      uint64 ID.
+//
+#define UPLOAD_JOURNAL_MAGIC "ARUPJNL1"
+#define UPLOAD_JOURNAL_MAGIC_LEN 8
+#define UPLOAD_JOURNAL_RECORD_HEADER_LEN 9
+#define UPLOAD_JOURNAL_COMPACT_MIN_SIZE 16384 // Don't bother compacting a journal smaller than this, unless it holds no items.
+
+typedef enum {
+    UPLOAD_JOURNAL_RECORD_ENQUEUE = 1,
+    UPLOAD_JOURNAL_RECORD_IN_FLIGHT = 2,
+    UPLOAD_JOURNAL_RECORD_RETRY = 3,
+    UPLOAD_JOURNAL_RECORD_DONE = 4
+} UPLOAD_JOURNAL_RECORD_TYPE;
+
+#define UPLOAD_JOURNAL_ENQUEUE_LEN (UPLOAD_JOURNAL_RECORD_HEADER_LEN + 16) // Plus item data.
+#define UPLOAD_JOURNAL_RETRY_LEN (UPLOAD_JOURNAL_RECORD_HEADER_LEN + 21)
+
+typedef struct {
+    uint64_t             id;
+    uint64_t             enqueueTime; // Microseconds since the epoch.
+    off_t                dataOffset; // Position of the item data in the journal file.
+    uint32_t             dataLen;
+    int                  attempts;
+    uint64_t             retryTime; // Microseconds since the epoch, or 0.
+    bool                 retryOnConnect;
+    bool                 hasRetry;
+} UPLOAD_JOURNAL_ITEM_t;
+
+struct _UPLOAD_JOURNAL {
+    char                *pathname;
+    int                  fd;
+    off_t                size;
+    uint64_t             nextID;
+    UPLOAD_JOURNAL_ITEM_t *items; // In the order enqueued.
+    int                  itemCount;
+    int                  itemSize;
+    pthread_mutex_t      lock;
+};
+
+// ---------------------------------------------------------------------------
+
+static uint64_t timeNowMicros(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return ((uint64_t)tv.tv_sec*1000000ull + (uint64_t)tv.tv_usec);
+}
+
+static void putUInt32(unsigned char *p, const uint32_t v)
+{
+    p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8); p[2] = (unsigned char)(v >> 16); p[3] = (unsigned char)(v >> 24);
+}
+
+static void putUInt64(unsigned char *p, const uint64_t v)
+{
+    putUInt32(p, (uint32_t)v);
+    putUInt32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint32_t getUInt32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+static uint64_t getUInt64(const unsigned char *p)
+{
+    return ((uint64_t)getUInt32(p) | ((uint64_t)getUInt32(p + 4) << 32));
+}
+
+static bool syncFD(const int fd)
+{
+#ifdef __linux__
+    return (fdatasync(fd) == 0);
+#else
+    return (fsync(fd) == 0);
+#endif
+}
+
+// Sync the directory holding pathname, so that a rename into it is durable.
+static void syncParentDir(const char *pathname)
+{
+    char dir[MAXPATHLEN];
+    char *sep;
+    int fd;
+
+    snprintf(dir, MAXPATHLEN, "%s", pathname);
+    if (!(sep = strrchr(dir, '/'))) snprintf(dir, MAXPATHLEN, ".");
+    else if (sep == dir) sep[1] = '\0';
+    else *sep = '\0';
+    if ((fd = open(dir, O_RDONLY)) < 0) return;
+    fsync(fd);
+    close(fd);
+}
+
+static bool writeAll(const int fd, const unsigned char *buf, size_t len)
+{
+    while (len) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return (false);
+        }
+        buf += n;
+        len -= n;
+    }
+    return (true);
+}
+
+// Fill in the header of a record whose type and payload are already in place after it.
+static void recordSeal(unsigned char *record, const UPLOAD_JOURNAL_RECORD_TYPE type, const size_t payloadLen)
+{
+    record[8] = (unsigned char)type;
+    putUInt32(record, (uint32_t)(payloadLen + 1));
+    putUInt32(record + 4, (uint32_t)crc32(crc32(0L, Z_NULL, 0), record + 8, (uInt)(payloadLen + 1)));
+}
+
+// Append a complete record. On failure, the journal is cut back to its previous length, so that a
+// partial record can't hide later ones from replay. Must be called with lock held.
+static bool journalAppend(UPLOAD_JOURNAL_t *journal, const unsigned char *record, const size_t len, const bool sync)
+{
+    if (!writeAll(journal->fd, record, len) || (sync && !syncFD(journal->fd))) {
+        ARLOGe("Error writing upload journal '%s'.\n", journal->pathname);
+        ARLOGperror(NULL);
+        if (ftruncate(journal->fd, journal->size) < 0) ARLOGperror(NULL);
+        return (false);
+    }
+    journal->size += len;
+    return (true);
+}
+
+static int journalFind(UPLOAD_JOURNAL_t *journal, const uint64_t id)
+{
+    int lo = 0, hi = journal->itemCount - 1;
+
+    // Items are in ID order.
+    while (lo <= hi) {
+        int mid = (lo + hi)/2;
+        if (journal->items[mid].id == id) return (mid);
+        if (journal->items[mid].id < id) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return (-1);
+}
+
+static bool journalAddItem(UPLOAD_JOURNAL_t *journal, const uint64_t id, const uint64_t enqueueTime, const off_t dataOffset, const uint32_t dataLen)
+{
+    UPLOAD_JOURNAL_ITEM_t *item;
+
+    if (journal->itemCount == journal->itemSize) {
+        int size = (journal->itemSize ? journal->itemSize*2 : 16);
+        UPLOAD_JOURNAL_ITEM_t *items = (UPLOAD_JOURNAL_ITEM_t *)realloc(journal->items, size*sizeof(UPLOAD_JOURNAL_ITEM_t));
+        if (!items) {
+            ARLOGe("Out of memory!\n");
+            return (false);
+        }
+        journal->items = items;
+        journal->itemSize = size;
+    }
+    item = &(journal->items[journal->itemCount++]);
+    memset(item, 0, sizeof(UPLOAD_JOURNAL_ITEM_t));
+    item->id = id;
+    item->enqueueTime = enqueueTime;
+    item->dataOffset = dataOffset;
+    item->dataLen = dataLen;
+    return (true);
+}
+
+static void journalRemoveItem(UPLOAD_JOURNAL_t *journal, const int i)
+{
+    memmove(&journal->items[i], &journal->items[i + 1], (journal->itemCount - i - 1)*sizeof(UPLOAD_JOURNAL_ITEM_t));
+    journal->itemCount--;
+}
+
+// Replay the journal file contents into the item list. Returns the length of the valid part of the file.
+static off_t journalReplay(UPLOAD_JOURNAL_t *journal, const unsigned char *buf, const off_t len)
+{
+    off_t pos = UPLOAD_JOURNAL_MAGIC_LEN;
+    int i;
+
+    while (len - pos >= UPLOAD_JOURNAL_RECORD_HEADER_LEN) {
+        uint32_t recordLen = getUInt32(buf + pos);
+        uint32_t crc = getUInt32(buf + pos + 4);
+        if (recordLen < 1 || (off_t)recordLen > len - pos - 8) break; // Torn.
+        if ((uint32_t)crc32(crc32(0L, Z_NULL, 0), buf + pos + 8, recordLen) != crc) break; // Corrupt.
+
+        const unsigned char *payload = buf + pos + UPLOAD_JOURNAL_RECORD_HEADER_LEN;
+        uint32_t payloadLen = recordLen - 1;
+        uint64_t id = (payloadLen >= 8 ? getUInt64(payload) : 0);
+        switch (buf[pos + 8]) {
+            case UPLOAD_JOURNAL_RECORD_ENQUEUE:
+                if (payloadLen < 16) break;
+                if (id >= journal->nextID) journal->nextID = id + 1;
+                journalAddItem(journal, id, getUInt64(payload + 8), pos + UPLOAD_JOURNAL_ENQUEUE_LEN, payloadLen - 16);
+                break;
+            case UPLOAD_JOURNAL_RECORD_IN_FLIGHT:
+                if (payloadLen >= 8 && (i = journalFind(journal, id)) >= 0) journal->items[i].attempts++; // Superseded by a RETRY record if the attempt finished.
+                break;
+            case UPLOAD_JOURNAL_RECORD_RETRY:
+                if (payloadLen >= 21 && (i = journalFind(journal, id)) >= 0) {
+                    journal->items[i].attempts = (int)getUInt32(payload + 8);
+                    journal->items[i].retryTime = getUInt64(payload + 12);
+                    journal->items[i].retryOnConnect = (payload[20] != 0);
+                    journal->items[i].hasRetry = true;
+                }
+                break;
+            case UPLOAD_JOURNAL_RECORD_DONE:
+                if (payloadLen >= 8 && (i = journalFind(journal, id)) >= 0) journalRemoveItem(journal, i);
+                break;
+            default:
+                break;
+        }
+        pos += 8 + recordLen;
+    }
+    return (pos);
+}
+
+UPLOAD_JOURNAL_t *uploadJournalOpen(const char *pathname, UPLOAD_JOURNAL_REPLAY_CALLBACK replay, void *userdata)
+{
+    UPLOAD_JOURNAL_t *journal;
+    struct stat st;
+    unsigned char *buf = NULL;
+    int i;
+
+    if (!pathname) return (NULL);
+
+    if (!(journal = (UPLOAD_JOURNAL_t *)calloc(1, sizeof(UPLOAD_JOURNAL_t)))) {
+        ARLOGe("Out of memory!\n");
+        return (NULL);
+    }
+    journal->pathname = strdup(pathname);
+    journal->nextID = 1;
+    pthread_mutex_init(&(journal->lock), NULL);
+
+    if ((journal->fd = open(pathname, O_RDWR | O_CREAT | O_APPEND, 0644)) < 0 || fstat(journal->fd, &st) < 0) {
+        ARLOGe("Error opening upload journal '%s'.\n", pathname);
+        ARLOGperror(NULL);
+        goto bail;
+    }
+
+    if (st.st_size >= UPLOAD_JOURNAL_MAGIC_LEN) {
+        if (!(buf = (unsigned char *)malloc(st.st_size))) {
+            ARLOGe("Out of memory!\n");
+            goto bail;
+        }
+        if (pread(journal->fd, buf, st.st_size, 0) != st.st_size) {
+            ARLOGe("Error reading upload journal '%s'.\n", pathname);
+            ARLOGperror(NULL);
+            goto bail;
+        }
+        if (memcmp(buf, UPLOAD_JOURNAL_MAGIC, UPLOAD_JOURNAL_MAGIC_LEN) != 0) {
+            ARLOGe("Upload journal '%s' is not in a recognised format.\n", pathname);
+            goto bail;
+        }
+        journal->size = journalReplay(journal, buf, st.st_size);
+        free(buf);
+        buf = NULL;
+        if (journal->size < st.st_size) {
+            ARLOGe("Discarding %lld bytes of incomplete or corrupt records at end of upload journal '%s'.\n", (long long)(st.st_size - journal->size), pathname);
+            if (ftruncate(journal->fd, journal->size) < 0) {
+                ARLOGperror(NULL);
+                goto bail;
+            }
+        }
+    } else {
+        // New (or torn before the header was complete).
+        if (ftruncate(journal->fd, 0) < 0 || !writeAll(journal->fd, (const unsigned char *)UPLOAD_JOURNAL_MAGIC, UPLOAD_JOURNAL_MAGIC_LEN) || !syncFD(journal->fd)) {
+            ARLOGe("Error writing upload journal '%s'.\n", pathname);
+            ARLOGperror(NULL);
+            goto bail;
+        }
+        syncParentDir(pathname);
+        journal->size = UPLOAD_JOURNAL_MAGIC_LEN;
+    }
+
+    ARLOGi("Upload journal '%s': %d item%s queued.\n", pathname, journal->itemCount, (journal->itemCount == 1 ? "" : "s"));
+    if (replay) {
+        for (i = 0; i < journal->itemCount; i++) {
+            const UPLOAD_JOURNAL_ITEM_t *item = &(journal->items[i]);
+            (*replay)(userdata, item->id, (double)item->enqueueTime*1.0e-6, item->attempts, (double)item->retryTime*1.0e-6, item->retryOnConnect);
+        }
+    }
+    return (journal);
+
+bail:
+    free(buf);
+    uploadJournalClose(&journal);
+    return (NULL);
+}
+
+void uploadJournalClose(UPLOAD_JOURNAL_t **journal_p)
+{
+    if (!journal_p || !*journal_p) return;
+
+    if ((*journal_p)->fd >= 0) close((*journal_p)->fd);
+    pthread_mutex_destroy(&((*journal_p)->lock));
+    free((*journal_p)->items);
+    free((*journal_p)->pathname);
+    free(*journal_p);
+    *journal_p = NULL;
+}
+
+bool uploadJournalEnqueue(UPLOAD_JOURNAL_t *journal, const void *data, const size_t len, uint64_t *id_p, double *enqueueTime_p)
+{
+    unsigned char *record;
+    uint64_t id, enqueueTime;
+    bool ok;
+
+    if (!journal || !data || len > UINT32_MAX - 17) return (false);
+
+    if (!(record = (unsigned char *)malloc(UPLOAD_JOURNAL_ENQUEUE_LEN + len))) {
+        ARLOGe("Out of memory!\n");
+        return (false);
+    }
+    enqueueTime = timeNowMicros();
+    memcpy(record + UPLOAD_JOURNAL_ENQUEUE_LEN, data, len);
+
+    pthread_mutex_lock(&(journal->lock));
+    id = journal->nextID;
+    putUInt64(record + UPLOAD_JOURNAL_RECORD_HEADER_LEN, id);
+    putUInt64(record + UPLOAD_JOURNAL_RECORD_HEADER_LEN + 8, enqueueTime);
+    recordSeal(record, UPLOAD_JOURNAL_RECORD_ENQUEUE, 16 + len);
+    off_t offset = journal->size;
+    if ((ok = journalAppend(journal, record, UPLOAD_JOURNAL_ENQUEUE_LEN + len, true))) {
+        journal->nextID++;
+        ok = journalAddItem(journal, id, enqueueTime, offset + UPLOAD_JOURNAL_ENQUEUE_LEN, (uint32_t)len);
+    }
+    pthread_mutex_unlock(&(journal->lock));
+    free(record);
+
+    if (ok) {
+        if (id_p) *id_p = id;
+        if (enqueueTime_p) *enqueueTime_p = (double)enqueueTime*1.0e-6;
+    }
+    return (ok);
+}
+
+bool uploadJournalRead(UPLOAD_JOURNAL_t *journal, const uint64_t id, unsigned char **data_p, size_t *len_p)
+{
+    unsigned char *data = NULL;
+    int i;
+    bool ok = false;
+
+    if (!journal || !data_p || !len_p) return (false);
+
+    pthread_mutex_lock(&(journal->lock));
+    if ((i = journalFind(journal, id)) < 0) {
+        ARLOGe("Upload journal item %llu not found.\n", (unsigned long long)id);
+    } else if (!(data = (unsigned char *)malloc(journal->items[i].dataLen ? journal->items[i].dataLen : 1))) {
+        ARLOGe("Out of memory!\n");
+    } else if (pread(journal->fd, data, journal->items[i].dataLen, journal->items[i].dataOffset) != (ssize_t)journal->items[i].dataLen) {
+        ARLOGe("Error reading upload journal '%s'.\n", journal->pathname);
+        ARLOGperror(NULL);
+    } else {
+        *data_p = data;
+        *len_p = journal->items[i].dataLen;
+        ok = true;
+    }
+    pthread_mutex_unlock(&(journal->lock));
+
+    if (!ok) free(data);
+    return (ok);
+}
+
+static bool journalAppendIDRecord(UPLOAD_JOURNAL_t *journal, const UPLOAD_JOURNAL_RECORD_TYPE type, const uint64_t id, const bool sync)
+{
+    unsigned char record[UPLOAD_JOURNAL_RECORD_HEADER_LEN + 8];
+
+    putUInt64(record + UPLOAD_JOURNAL_RECORD_HEADER_LEN, id);
+    recordSeal(record, type, 8);
+    return (journalAppend(journal, record, sizeof(record), sync));
+}
+
+bool uploadJournalInFlight(UPLOAD_JOURNAL_t *journal, const uint64_t id)
+{
+    bool ok;
+
+    if (!journal) return (false);
+    pthread_mutex_lock(&(journal->lock));
+    ok = journalAppendIDRecord(journal, UPLOAD_JOURNAL_RECORD_IN_FLIGHT, id, false);
+    pthread_mutex_unlock(&(journal->lock));
+    return (ok);
+}
+
+static bool journalAppendRetry(UPLOAD_JOURNAL_t *journal, const UPLOAD_JOURNAL_ITEM_t *item)
+{
+    unsigned char record[UPLOAD_JOURNAL_RETRY_LEN];
+
+    putUInt64(record + UPLOAD_JOURNAL_RECORD_HEADER_LEN, item->id);
+    putUInt32(record + UPLOAD_JOURNAL_RECORD_HEADER_LEN + 8, (uint32_t)item->attempts);
+    putUInt64(record + UPLOAD_JOURNAL_RECORD_HEADER_LEN + 12, item->retryTime);
+    record[UPLOAD_JOURNAL_RECORD_HEADER_LEN + 20] = (item->retryOnConnect ? 1 : 0);
+    recordSeal(record, UPLOAD_JOURNAL_RECORD_RETRY, 21);
+    return (journalAppend(journal, record, sizeof(record), false));
+}
+
+bool uploadJournalRetry(UPLOAD_JOURNAL_t *journal, const uint64_t id, const int attempts, const double retryTime, const bool retryOnConnect)
+{
+    int i;
+    bool ok = false;
+
+    if (!journal) return (false);
+    pthread_mutex_lock(&(journal->lock));
+    if ((i = journalFind(journal, id)) >= 0) {
+        UPLOAD_JOURNAL_ITEM_t *item = &(journal->items[i]);
+        item->attempts = attempts;
+        item->retryTime = (retryTime > 0.0 ? (uint64_t)(retryTime*1.0e6) : 0);
+        item->retryOnConnect = retryOnConnect;
+        item->hasRetry = true;
+        ok = journalAppendRetry(journal, item);
+    }
+    pthread_mutex_unlock(&(journal->lock));
+    return (ok);
+}
+
+bool uploadJournalDone(UPLOAD_JOURNAL_t *journal, const uint64_t id)
+{
+    int i;
+    bool ok = false;
+
+    if (!journal) return (false);
+    pthread_mutex_lock(&(journal->lock));
+    if ((i = journalFind(journal, id)) >= 0) {
+        if ((ok = journalAppendIDRecord(journal, UPLOAD_JOURNAL_RECORD_DONE, id, true))) journalRemoveItem(journal, i);
+    }
+    pthread_mutex_unlock(&(journal->lock));
+    return (ok);
+}
+
+// Rewrite the journal with just the records needed for the remaining items. Must be called with lock held.
+static bool journalCompact(UPLOAD_JOURNAL_t *journal)
+{
+    char tempPathname[MAXPATHLEN];
+    unsigned char *record = NULL;
+    size_t recordSize = 0;
+    off_t size = UPLOAD_JOURNAL_MAGIC_LEN;
+    off_t *offsets = NULL;
+    int fd;
+    int i;
+
+    snprintf(tempPathname, MAXPATHLEN, "%s.tmp", journal->pathname);
+    if ((fd = open(tempPathname, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644)) < 0) {
+        ARLOGe("Error creating '%s'.\n", tempPathname);
+        ARLOGperror(NULL);
+        return (false);
+    }
+    if (journal->itemCount && !(offsets = (off_t *)malloc(journal->itemCount*sizeof(off_t)))) {
+        ARLOGe("Out of memory!\n");
+        goto bail;
+    }
+    if (!writeAll(fd, (const unsigned char *)UPLOAD_JOURNAL_MAGIC, UPLOAD_JOURNAL_MAGIC_LEN)) goto bailWrite;
+    for (i = 0; i < journal->itemCount; i++) {
+        UPLOAD_JOURNAL_ITEM_t *item = &(journal->items[i]);
+        size_t len = UPLOAD_JOURNAL_ENQUEUE_LEN + item->dataLen;
+        if (len > recordSize) {
+            unsigned char *r = (unsigned char *)realloc(record, len);
+            if (!r) {
+                ARLOGe("Out of memory!\n");
+                goto bail;
+            }
+            record = r;
+            recordSize = len;
+        }
+        // Copy the original enqueue record, which is unchanged.
+        if (pread(journal->fd, record, len, item->dataOffset - UPLOAD_JOURNAL_ENQUEUE_LEN) != (ssize_t)len) {
+            ARLOGe("Error reading upload journal '%s'.\n", journal->pathname);
+            ARLOGperror(NULL);
+            goto bail;
+        }
+        if (!writeAll(fd, record, len)) goto bailWrite;
+        offsets[i] = size + UPLOAD_JOURNAL_ENQUEUE_LEN;
+        size += len;
+        if (item->hasRetry || item->attempts) {
+            unsigned char retry[UPLOAD_JOURNAL_RETRY_LEN];
+            putUInt64(retry + UPLOAD_JOURNAL_RECORD_HEADER_LEN, item->id);
+            putUInt32(retry + UPLOAD_JOURNAL_RECORD_HEADER_LEN + 8, (uint32_t)item->attempts);
+            putUInt64(retry + UPLOAD_JOURNAL_RECORD_HEADER_LEN + 12, item->retryTime);
+            retry[UPLOAD_JOURNAL_RECORD_HEADER_LEN + 20] = (item->retryOnConnect ? 1 : 0);
+            recordSeal(retry, UPLOAD_JOURNAL_RECORD_RETRY, 21);
+            if (!writeAll(fd, retry, sizeof(retry))) goto bailWrite;
+            size += sizeof(retry);
+        }
+    }
+    if (fsync(fd) < 0) goto bailWrite;
+    if (rename(tempPathname, journal->pathname) < 0) {
+        ARLOGe("Error replacing upload journal '%s'.\n", journal->pathname);
+        ARLOGperror(NULL);
+        goto bail;
+    }
+    syncParentDir(journal->pathname);
+
+    ARLOGd("Compacted upload journal from %lld to %lld bytes.\n", (long long)journal->size, (long long)size);
+    close(journal->fd);
+    journal->fd = fd;
+    journal->size = size;
+    for (i = 0; i < journal->itemCount; i++) journal->items[i].dataOffset = offsets[i];
+    free(offsets);
+    free(record);
+    return (true);
+
+bailWrite:
+    ARLOGe("Error writing '%s'.\n", tempPathname);
+    ARLOGperror(NULL);
+bail:
+    close(fd);
+    remove(tempPathname);
+    free(offsets);
+    free(record);
+    return (false);
+}
+
+bool uploadJournalCompactIfNeeded(UPLOAD_JOURNAL_t *journal)
+{
+    off_t liveSize = UPLOAD_JOURNAL_MAGIC_LEN;
+    bool ok = true;
+    int i;
+
+    if (!journal) return (false);
+
+    pthread_mutex_lock(&(journal->lock));
+    for (i = 0; i < journal->itemCount; i++) {
+        liveSize += UPLOAD_JOURNAL_ENQUEUE_LEN + journal->items[i].dataLen;
+        if (journal->items[i].hasRetry || journal->items[i].attempts) liveSize += UPLOAD_JOURNAL_RETRY_LEN;
+    }
+    if ((journal->itemCount == 0 && journal->size > liveSize) || (journal->size > UPLOAD_JOURNAL_COMPACT_MIN_SIZE && journal->size - liveSize > liveSize)) {
+        ok = journalCompact(journal);
+    }
+    pthread_mutex_unlock(&(journal->lock));
+    return (ok);
+}
@@ -0,0 +1,83 @@
+/*
+ *  uploadJournal.h
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+
+#ifndef UPLOADJOURNAL_H
+#define UPLOADJOURNAL_H
+
+//
+// Append-only journal of queued uploads, held in a single file.
+//
+// Each record is checksummed (CRC-32) and is one of: enqueue (an item's data), in-flight (an upload of
+// the item has started), retry (an upload failed; attempts so far and when to try again) and done (the
+// item was uploaded). Enqueue and done records are synced to storage before returning.
+//
+// On opening, the journal is replayed to find the items not yet done. A torn or corrupt record (e.g. from
+// power loss during a write) ends the replay, and it and anything after it are discarded. An item which
+// was in flight when the journal was last closed counts as one failed attempt.
+//
+// Compaction rewrites the journal with only the records needed for the remaining items, to a temporary
+// file which then replaces the journal.
+//
+// All functions are thread-safe.
+//
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h> // size_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _UPLOAD_JOURNAL UPLOAD_JOURNAL_t;
+
+// Called by uploadJournalOpen() for each item not yet done, in the order enqueued.
+// Times are in seconds since the epoch. retryTime is 0 if the item may be uploaded now.
+typedef void (*UPLOAD_JOURNAL_REPLAY_CALLBACK)(void *userdata, const uint64_t id, const double enqueueTime, const int attempts, const double retryTime, const bool retryOnConnect);
+
+// Open (creating if necessary) and replay the journal at pathname. Returns NULL in case of error.
+UPLOAD_JOURNAL_t *uploadJournalOpen(const char *pathname, UPLOAD_JOURNAL_REPLAY_CALLBACK replay, void *userdata);
+
+void uploadJournalClose(UPLOAD_JOURNAL_t **journal_p);
+
+// Append an item. On success, its ID and the time it was enqueued are returned in *id_p and *enqueueTime_p.
+bool uploadJournalEnqueue(UPLOAD_JOURNAL_t *journal, const void *data, const size_t len, uint64_t *id_p, double *enqueueTime_p);
+
+// Get a copy of an item's data, which the caller must free().
+bool uploadJournalRead(UPLOAD_JOURNAL_t *journal, const uint64_t id, unsigned char **data_p, size_t *len_p);
+
+bool uploadJournalInFlight(UPLOAD_JOURNAL_t *journal, const uint64_t id);
+
+bool uploadJournalRetry(UPLOAD_JOURNAL_t *journal, const uint64_t id, const int attempts, const double retryTime, const bool retryOnConnect);
+
+bool uploadJournalDone(UPLOAD_JOURNAL_t *journal, const uint64_t id);
+
+// Compact the journal, if more of it is taken up by records no longer needed than by those still needed.
+bool uploadJournalCompactIfNeeded(UPLOAD_JOURNAL_t *journal);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // !UPLOADJOURNAL_H